@@ -4,6 +4,14 @@
  * @details
  * Opns the socket and connects to the server specified by the address. If use_vsock is passed as zero then the server address is
  * used as a normal IP address.
+ * By default frames go over a stream (tcp), but they can instead each go as a message of their own (seqpacket for vsock
+ * or udp otherwise), or, between two processes on one host, over a stream through shared memory (shm), falling back to
+ * tcp if that doesn't connect. A udp socket connects whether or not anything is listening, so with messages the client
+ * only keeps to them once the server answers its hello (see /ref src/wire.h), and falls back to tcp if it doesn't.
+ * Receives can go through an io_uring instead (io=uring, which also has inject write bursts through one).
+ * Also measures zero-copy sends against copying sends, to find how big a send has to be for zero-copy to pay off,
+ * shm against tcp loopback between two processes, and receiving from several clients through an io_uring against
+ * waiting on them with epoll.
  *
  * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
  */
@@ -11,36 +19,116 @@
 #include "ci_client_server.h"
 #include "ci_queues.h"
 #include "ci_workers.h"
+#include "ci_main.h"
 #include "lisa.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <netinet/tcp.h>
 //#include "radiotap.h"
 #include "utilities.h"
 
-int ci_start_client(char * server_addr, int port, lisa *lp, int use_vsock) {
+static enum transport_t {stream, messages, shm} transport = stream;
+static const char * transport_names[] = {"stream", "messages", "shm"};
+
+#define HELLO_WAIT_S 2     /* longest a client over messages waits for the server to answer its hello */
+
+static bool use_uring = false;
+
+bool ci_set_io(const char * name) {
+    if (!strcmp(name, "poll")) use_uring = false;
+    else if (!strcmp(name, "uring")) use_uring = true;
+    else {
+        printf("io should be poll or uring: %s\n", name);
+        return false;
+    }
+    ciqs_set_io(use_uring ? ciqs_io_uring : ciqs_io_poll);
+    return true;
+}
+
+// receives through an io_uring if that was asked for, carrying on as before if it can't
+static void set_io(lisa *lp) {
+    if (use_uring && !lisa_set_uring(lp, 1)) printf("not receiving through io_uring (%s)\n", lp->debugmsg);
+}
+
+bool ci_set_transport(const char * name) {
+    if (!strcmp(name, "stream")) transport = stream;
+    else if (!strcmp(name, "messages")) transport = messages;
+    else if (!strcmp(name, "shm")) transport = shm;
+    else {
+        printf("transport should be stream, messages or shm: %s\n", name);
+        return false;
+    }
+    return true;
+}
+
+// opens lp as a stream, with messages as seqpacket (vsock) or udp (otherwise), or with shm as shared memory
+static void open_transport(lisa *lp, int use_vsock, enum transport_t t) {
     lisa_open(lp);
-    q2print("using vsock: %d\n", use_vsock);
-    if (use_vsock) lisa_set_to_vsock(lp);
-    lisa_setup_tcp(lp);
+    if (use_vsock && t != shm) lisa_set_to_vsock(lp);
+    if (t == stream) lisa_setup_tcp(lp);
+    else if (t == shm) lisa_setup_shm(lp);
+    else if (use_vsock) lisa_setup_seqpacket(lp);
+    else lisa_setup_udp(lp);
     lisa_set_wait_time(lp, 2);
+}
+
+// goes back to tcp when messages or shm don't work, e.g., with an older kernel or a server that only takes streams
+static void fall_back_to_stream(lisa *lp, int use_vsock) {
+    printf("%s didn't work (%s), using tcp\n", transport_names[transport], lp->debugmsg);
+    if (lp->fd > 0) close(lp->fd);   /* the socket the transport was tried on, if it was made */
+    open_transport(lp, use_vsock, stream);
+}
+
+static int not_connected(lisa *lp) {
+    q2print("Did not connect to server\n");
+    q2print("%s\n", lp->debugmsg);
+    return CI_SOCKET_ERROR;
+}
+
+int ci_start_client(char * server_addr, int port, lisa *lp, int use_vsock) {
+    bool connected;
+    q2print("using vsock: %d\n", use_vsock);
+    open_transport(lp, use_vsock, transport);
     q2print("client connecting...\n");
     lisa_connect(lp, server_addr, port);
+    if (transport != stream && lp->state != LISA_CONNECTED) {
+        fall_back_to_stream(lp, use_vsock);
+        lisa_connect(lp, server_addr, port);
+    }
     q2print("lp fd: %d\n", lp->fd);
-    if (lp->state != LISA_CONNECTED) {
-        q2print("Did not connect to server\n");
-        q2print("%s\n", lp->debugmsg);
-        return CI_SOCKET_ERROR;
+    if (lp->state != LISA_CONNECTED) return not_connected(lp);
+    set_io(lp);
+    ciqs_say_hello();
+    if (!lisa_is_stream(lp) && !ciqs_heard_hello(HELLO_WAIT_S)) {
+        ci_pause_client();      /* so that neither uses the socket while it is replaced */
+        snprintf(lp->debugmsg, sizeof(lp->debugmsg), "no answer to hello in %d s", HELLO_WAIT_S);
+        fall_back_to_stream(lp, use_vsock);
+        ciqs_send_on_stream();
+        lisa_connect(lp, server_addr, port);
+        connected = (lp->state == LISA_CONNECTED);    /* before receive gets to it again */
+        if (connected) set_io(lp);
+        ci_resume_client();
+        if (!connected) return not_connected(lp);
+        ciqs_say_hello();
     }
     q2print("client ready\n");
     return CI_NO_ERROR;
 }
 
 int ci_start_server(int port, lisa *lp, int use_vsock) {
-    lisa_open(lp);
-    if (use_vsock) lisa_set_to_vsock(lp);
-    lisa_setup_tcp(lp);
+    open_transport(lp, use_vsock, transport);
+    if (lp->state != LISA_CREATED) fall_back_to_stream(lp, use_vsock);
     lp->port = port;
-    lisa_set_wait_time(lp, 2);
+    set_io(lp);
     q2print("server ready\n");
     return CI_NO_ERROR;
 }
@@ -76,4 +164,433 @@ void ci_stop_server() {
     ciqs_stop(altreceiveq);
 }
 
+/*
+ * zero-copy benchmark
+ */
+
+#define BENCH_PORT (SERVER_PORT + 1)
+#define BENCH_BYTES (256 * 1024 * 1024)   /* sent for each send size and mode */
+#define BENCH_MIN_SEND 1024
+#define BENCH_MAX_SEND (256 * 1024)
+#define BENCH_TIMEOUT_S 30                /* longest a run waits for the kernel and the receiver once it has sent */
+
+static lisa bench_server;
+static atomic_uint_fast64_t bench_received;
+static atomic_bool bench_stop;
+static atomic_bool bench_receiving;      /* cleared when the receiver stops */
+
+static void * bench_receive(void * d) {
+    char * buffer = malloc(BENCH_MAX_SEND);
+    int rc;
+    while (buffer && !atomic_load(&bench_stop)) {
+        rc = lisa_recv(&bench_server, buffer, BENCH_MAX_SEND);
+        if (rc > 0) atomic_fetch_add(&bench_received, (uint64_t) rc);
+        else if (bench_server.client_state == LISA_CLOSED || bench_server.client_state == LISA_ERROR) break;
+    }
+    free(buffer);
+    atomic_store(&bench_receiving, false);
+    return NULL;
+}
+
+static double seconds(struct timespec * start, struct timespec * end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// sends BENCH_BYTES in sends of size bytes, waiting for room whenever the socket is full, returns false on error
+static bool bench_send(lisa * lp, char * data, uint32_t size) {
+    struct iovec iov;
+    struct pollfd pfd;
+    uint64_t sent;
+    int rc;
+    pfd.fd = lisa_get_send_fd(lp);
+    for (sent = 0; sent < BENCH_BYTES; ) {
+        iov.iov_base = data + sent % size;
+        iov.iov_len = size - sent % size;
+        rc = lisa_sendv(lp, &iov, 1);
+        if (rc < 0) return false;
+        if (rc > 0) {
+            sent += rc;
+            continue;
+        }
+        // the socket is full, so read any zero-copy notices while waiting for room (they would wake poll anyway)
+        lisa_zerocopy_pending(lp);
+        pfd.events = lisa_get_send_events(lp);
+        poll(&pfd, 1, 1000);
+    }
+    return true;
+}
+
+static bool bench_past(struct timespec * deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return seconds(deadline, &now) > 0;
+}
+
+// sends BENCH_BYTES in sends of size bytes and waits until they have all been received (and, for zero-copy, the kernel
+// is done with them), returns MB/s and sets *cpu to the sender's cpu seconds per GB, or returns 0 if it can't
+static double bench_run(lisa * lp, char * data, uint32_t size, int zerocopy, double * cpu) {
+    struct timespec start, end, cpu_start, cpu_end, deadline;
+    struct pollfd pfd;
+    uint64_t target;
+    lisa_set_zerocopy(lp, zerocopy ? 1 : 0);
+    target = atomic_load(&bench_received) + BENCH_BYTES;
+    pfd.fd = lisa_get_send_fd(lp);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    if (!bench_send(lp, data, size)) {
+        printf("error sending: %s\n", lp->debugmsg);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += BENCH_TIMEOUT_S;
+    while (lisa_zerocopy_pending(lp)) {
+        if (bench_past(&deadline)) {
+            printf("the kernel was not done with the zero-copy sends after %d s\n", BENCH_TIMEOUT_S);
+            return 0;
+        }
+        pfd.events = 0;
+        poll(&pfd, 1, 1000);
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    while (atomic_load(&bench_received) < target) {
+        if (!atomic_load(&bench_receiving) || bench_past(&deadline)) {
+            printf("received %lu of %d bytes sent\n", (unsigned long) (atomic_load(&bench_received) + BENCH_BYTES - target), BENCH_BYTES);
+            return 0;
+        }
+        usleep(100);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *cpu = seconds(&cpu_start, &cpu_end) * (1024.0 * 1024 * 1024 / BENCH_BYTES);
+    return BENCH_BYTES / (1024.0 * 1024) / seconds(&start, &end);
+}
 
+// measures copying and zero-copy sends of sizes from BENCH_MIN_SEND to BENCH_MAX_SEND over tcp loopback (or, with
+// use_vsock, over vsock loopback, which needs the vsock_loopback module) and prints where zero-copy starts to pay off
+void ci_zerocopy_benchmark(int use_vsock) {
+    lisa client;
+    pthread_t receiver;
+    double copy_rate, zc_rate, copy_cpu, zc_cpu;
+    uint32_t size, crossover;
+    char * data;
+    unsigned int copied;
+    lisa_open(&bench_server);
+    lisa_open(&client);
+    pthread_mutex_init(&(bench_server.lock), NULL);
+    pthread_mutex_init(&(bench_server.send_lock), NULL);
+    pthread_mutex_init(&(bench_server.recv_lock), NULL);
+    pthread_mutex_init(&(client.lock), NULL);
+    pthread_mutex_init(&(client.send_lock), NULL);
+    pthread_mutex_init(&(client.recv_lock), NULL);
+    if (use_vsock) {
+        lisa_set_to_vsock(&bench_server);
+        lisa_set_to_vsock(&client);
+    }
+    lisa_setup_tcp(&bench_server);
+    lisa_set_wait_time(&bench_server, 1);
+    lisa_listen(&bench_server, BENCH_PORT);
+    lisa_setup_tcp(&client);
+    lisa_connect(&client, use_vsock ? "1" : "127.0.0.1", BENCH_PORT);
+    lisa_accept(&bench_server, BENCH_PORT);
+    if (client.state != LISA_CONNECTED || bench_server.state != LISA_ACCEPTED) {
+        printf("could not connect over %s loopback: %s %s\n", use_vsock ? "vsock" : "tcp", client.debugmsg, bench_server.debugmsg);
+        return;
+    }
+    if (!lisa_set_zerocopy(&client, 1)) {
+        printf("zero-copy sends are not supported here: %s\n", client.debugmsg);
+        return;
+    }
+    data = malloc(BENCH_MAX_SEND);
+    if (!data) return;
+    memset(data, 0x5a, BENCH_MAX_SEND);
+    atomic_store(&bench_received, 0);
+    atomic_store(&bench_stop, false);
+    atomic_store(&bench_receiving, true);
+    pthread_create(&receiver, NULL, bench_receive, NULL);
+    printf("%s loopback, %d MB per run\n", use_vsock ? "vsock" : "tcp", BENCH_BYTES / (1024 * 1024));
+    printf("%10s %12s %12s %14s %14s %8s\n", "send size", "copy MB/s", "zc MB/s", "copy cpu s/GB", "zc cpu s/GB", "copied");
+    crossover = 0;
+    for (size = BENCH_MIN_SEND; size <= BENCH_MAX_SEND; size *= 2) {
+        copy_rate = bench_run(&client, data, size, 0, &copy_cpu);
+        copied = client.zerocopy_copied;
+        zc_rate = bench_run(&client, data, size, 1, &zc_cpu);
+        copied = client.zerocopy_copied - copied;
+        if (!copy_rate || !zc_rate) {
+            crossover = 0;
+            break;
+        }
+        printf("%10u %12.0f %12.0f %14.3f %14.3f %8s\n", size, copy_rate, zc_rate, copy_cpu, zc_cpu, copied ? "yes" : "no");
+        if (zc_cpu < copy_cpu && zc_rate >= copy_rate) {
+            if (!crossover) crossover = size;
+        }
+        else crossover = 0;
+    }
+    if (crossover) printf("zero-copy pays off from sends of about %u bytes (e.g., \"capture_send zerocopy=%u\")\n", crossover, crossover);
+    else printf("zero-copy did not pay off for any send size here\n");
+    printf("(\"copied\" means the kernel had to copy the zero-copy sends after all, as it does for tcp over loopback)\n");
+    atomic_store(&bench_stop, true);
+    pthread_join(receiver, NULL);
+    lisa_close(&client);
+    lisa_close(&bench_server);
+    free(data);
+}
+
+/*
+ * shm against tcp loopback benchmark
+ */
+
+#define BENCH_SIZES 9     /* BENCH_MIN_SEND to BENCH_MAX_SEND */
+
+// the receiving process: takes BENCH_BYTES at a time, each time saying so with a byte back, until the sender closes
+static void bench_receive_process(lisa * server) {
+    char * buffer = malloc(BENCH_MAX_SEND);
+    uint64_t received = 0;
+    int rc;
+    lisa_accept(server, BENCH_PORT);
+    while (buffer && server->state == LISA_ACCEPTED) {
+        rc = lisa_recv(server, buffer, BENCH_MAX_SEND);
+        if (rc > 0) {
+            received += rc;
+            if (received >= BENCH_BYTES) {
+                received -= BENCH_BYTES;
+                lisa_send(server, "k", 1);
+            }
+        }
+        else if (server->client_state == LISA_CLOSED || server->client_state == LISA_ERROR) break;
+    }
+    lisa_close(server);
+    _exit(0);    /* leaves what the sender's process had buffered to it */
+}
+
+// sends BENCH_BYTES in sends of size bytes and waits for the receiver to say it has them all, returns MB/s and sets
+// *cpu to the sender's cpu seconds per GB
+static double transport_run(lisa * lp, char * data, uint32_t size, double * cpu) {
+    struct timespec start, end, cpu_start, cpu_end;
+    char ack;
+    int rc;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    if (!bench_send(lp, data, size)) return 0;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    do rc = lisa_recv(lp, &ack, 1);
+    while (rc == 0 && lp->state == LISA_TIMEOUT);
+    if (rc <= 0) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *cpu = seconds(&cpu_start, &cpu_end) * (1024.0 * 1024 * 1024 / BENCH_BYTES);
+    return BENCH_BYTES / (1024.0 * 1024) / seconds(&start, &end);
+}
+
+// runs each send size over t to a receiver in a process of its own, putting MB/s and cpu s/GB in rates and cpus,
+// returns false if it couldn't connect
+static bool transport_bench(enum transport_t t, char * data, double * rates, double * cpus) {
+    lisa server, client;
+    pid_t receiver;
+    uint32_t size;
+    int i;
+    open_transport(&server, 0, t);
+    pthread_mutex_init(&(server.lock), NULL);
+    pthread_mutex_init(&(server.send_lock), NULL);
+    pthread_mutex_init(&(server.recv_lock), NULL);
+    lisa_set_wait_time(&server, 1);
+    lisa_listen(&server, BENCH_PORT);
+    if (server.state < LISA_CREATED) {
+        printf("could not listen over %s: %s\n", transport_names[t], server.debugmsg);
+        return false;
+    }
+    fflush(stdout);
+    receiver = fork();
+    if (receiver < 0) return false;
+    if (receiver == 0) bench_receive_process(&server);
+    close(server.fd);
+    open_transport(&client, 0, t);
+    pthread_mutex_init(&(client.lock), NULL);
+    pthread_mutex_init(&(client.send_lock), NULL);
+    pthread_mutex_init(&(client.recv_lock), NULL);
+    lisa_connect(&client, "127.0.0.1", BENCH_PORT);
+    if (client.state != LISA_CONNECTED) {
+        printf("could not connect over %s: %s\n", transport_names[t], client.debugmsg);
+        kill(receiver, SIGTERM);
+        waitpid(receiver, NULL, 0);
+        return false;
+    }
+    for (i = 0, size = BENCH_MIN_SEND; i < BENCH_SIZES; i++, size *= 2) rates[i] = transport_run(&client, data, size, &(cpus[i]));
+    lisa_close(&client);
+    waitpid(receiver, NULL, 0);
+    return true;
+}
+
+// measures sends of sizes from BENCH_MIN_SEND to BENCH_MAX_SEND to another process over tcp loopback and over shm
+void ci_shm_benchmark() {
+    double tcp_rates[BENCH_SIZES], shm_rates[BENCH_SIZES], tcp_cpus[BENCH_SIZES], shm_cpus[BENCH_SIZES];
+    uint32_t size;
+    char * data;
+    int i;
+    data = malloc(BENCH_MAX_SEND);
+    if (!data) return;
+    memset(data, 0x5a, BENCH_MAX_SEND);
+    if (!transport_bench(stream, data, tcp_rates, tcp_cpus) || !transport_bench(shm, data, shm_rates, shm_cpus)) {
+        free(data);
+        return;
+    }
+    printf("tcp loopback against shm, to another process, %d MB per run\n", BENCH_BYTES / (1024 * 1024));
+    printf("%10s %12s %12s %14s %14s\n", "send size", "tcp MB/s", "shm MB/s", "tcp cpu s/GB", "shm cpu s/GB");
+    for (i = 0, size = BENCH_MIN_SEND; i < BENCH_SIZES; i++, size *= 2) {
+        printf("%10u %12.0f %12.0f %14.3f %14.3f\n", size, tcp_rates[i], shm_rates[i], tcp_cpus[i], shm_cpus[i]);
+    }
+    printf("(cpu is the sender's; shm only makes system calls when a side waits for the other)\n");
+    free(data);
+}
+
+/*
+ * io_uring against epoll benchmark
+ */
+
+#define URING_BENCH_RECORD 64           /* bytes sent at a time by each client, starting with when it was sent */
+#define URING_BENCH_INTERVAL 100000     /* ns between a client's records */
+#define URING_BENCH_RECORDS 10000       /* per client, so a run lasts about a second */
+#define URING_BENCH_MAX_CLIENTS 10
+
+static uint64_t monotonic_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// a client process: connects, waits for the go, then sends a record every URING_BENCH_INTERVAL, and stays connected
+// until the server closes (so the server never sees clients leave partway)
+// it first lets go of the server's ring and socket that it has a copy of, since while the ring is open in any process
+// its receives keep the server's sockets open (and the server's close wouldn't end the run)
+static void uring_bench_client(lisa * server, unsigned short port) {
+    char record[URING_BENCH_RECORD];
+    struct timespec next;
+    lisa client;
+    uint64_t now;
+    int one = 1;
+    lisa_set_uring(server, 0);
+    close(server->fd);
+    open_transport(&client, 0, stream);
+    pthread_mutex_init(&(client.lock), NULL);
+    pthread_mutex_init(&(client.send_lock), NULL);
+    pthread_mutex_init(&(client.recv_lock), NULL);
+    lisa_connect(&client, "127.0.0.1", port);
+    if (client.state != LISA_CONNECTED) _exit(1);
+    setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   /* each record goes out as it is sent */
+    do lisa_recv(&client, record, 1);
+    while (client.state == LISA_TIMEOUT);
+    memset(record, 0x5a, sizeof(record));
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int i=0; i<URING_BENCH_RECORDS; i++) {
+        now = monotonic_ns();
+        memcpy(record, &now, sizeof(now));
+        lisa_send(&client, record, sizeof(record));
+        next.tv_nsec += URING_BENCH_INTERVAL;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    do lisa_recv(&client, record, sizeof(record));
+    while (client.state == LISA_TIMEOUT || client.state == LISA_GOT_DATA);
+    _exit(0);
+}
+
+static int compare_lags(const void * a, const void * b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// receives from clients client processes on port (each run has its own, since the last is left in TIME_WAIT), through
+// an io_uring if uring is set (returning false if it can't) or else with epoll, and puts the frames (records)
+// received, system calls per frame, and p50 and p99 lag in us in results
+static bool uring_bench_run(int clients, bool uring, unsigned short port, double * results) {
+    static char buffer[BENCH_MAX_SEND];
+    char partial[URING_BENCH_MAX_CLIENTS][URING_BENCH_RECORD];
+    int have[URING_BENCH_MAX_CLIENTS];
+    pid_t pids[URING_BENCH_MAX_CLIENTS];
+    uint64_t * lags;
+    uint64_t sent, frames, expected, syscalls;
+    lisa server;
+    int i, c, k, rc, take, idle;
+    open_transport(&server, 0, stream);
+    pthread_mutex_init(&(server.lock), NULL);
+    pthread_mutex_init(&(server.send_lock), NULL);
+    pthread_mutex_init(&(server.recv_lock), NULL);
+    lisa_set_wait_time(&server, 1);
+    lisa_listen(&server, port);
+    if (server.state < LISA_CREATED || (uring && !lisa_set_uring(&server, 1))) {
+        printf("could not %s: %s\n", uring ? "receive through io_uring" : "listen", server.debugmsg);
+        lisa_close(&server);
+        return false;
+    }
+    fflush(stdout);
+    for (c=0; c<clients; c++) {   /* one at a time, since lisa_listen only has a backlog of 1 */
+        pids[c] = fork();
+        if (pids[c] == 0) uring_bench_client(&server, port);
+        have[c] = 0;
+        if (pids[c] < 0 || !lisa_accept(&server, port) || server.num_clients != c + 1) break;
+    }
+    expected = (uint64_t) clients * URING_BENCH_RECORDS;
+    lags = malloc(expected * sizeof(uint64_t));
+    frames = 0;
+    syscalls = server.syscalls;
+    for (k=0; c == clients && lags && k<clients; k++) {   /* the go (lisa_cast leaves out the current client) */
+        server.client_fd = server.client_fds[k];
+        lisa_send(&server, "g", 1);
+    }
+    for (idle=0; c == clients && lags && frames < expected && idle < 3; ) {
+        rc = lisa_recv(&server, buffer, sizeof(buffer));
+        if (rc <= 0) {
+            idle += (server.client_state == LISA_TIMEOUT);
+            if (server.client_state != LISA_TIMEOUT) break;
+            continue;
+        }
+        idle = 0;
+        for (k=0; k<clients && server.client_fds[k] != server.client_fd; k++);
+        for (i=0; k<clients && i<rc; i+=take) {
+            take = URING_BENCH_RECORD - have[k];
+            if (take > rc - i) take = rc - i;
+            memcpy(partial[k] + have[k], buffer + i, take);
+            have[k] += take;
+            if (have[k] < URING_BENCH_RECORD) continue;
+            have[k] = 0;
+            memcpy(&sent, partial[k], sizeof(sent));
+            if (frames < expected) lags[frames++] = monotonic_ns() - sent;
+        }
+    }
+    syscalls = server.syscalls - syscalls;
+    lisa_close(&server);
+    for (k=0; k<=c && k<clients; k++) if (pids[k] > 0) waitpid(pids[k], NULL, 0);
+    if (!frames) {
+        printf("received nothing from %d clients\n", clients);
+        free(lags);
+        return false;
+    }
+    qsort(lags, frames, sizeof(uint64_t), compare_lags);
+    results[0] = (double) frames;
+    results[1] = (double) syscalls / frames;
+    results[2] = lags[frames / 2] / 1000.0;
+    results[3] = lags[frames * 99 / 100] / 1000.0;
+    free(lags);
+    return true;
+}
+
+// measures receiving 64 byte records paced from 2, 5, and 10 client processes over tcp loopback, waiting on the clients
+// with epoll against taking them from an io_uring, in system calls per record and lag from send to receive
+void ci_uring_benchmark() {
+    static const int clients[] = {2, 5, URING_BENCH_MAX_CLIENTS};
+    double results[4];
+    unsigned short port = BENCH_PORT;
+    printf("%d clients at most, each sending a %d byte record every %d us for about %.1f s over tcp loopback\n",
+           URING_BENCH_MAX_CLIENTS, URING_BENCH_RECORD, URING_BENCH_INTERVAL / 1000,
+           URING_BENCH_RECORDS * (URING_BENCH_INTERVAL / 1e9));
+    printf("%8s %8s %10s %14s %10s %10s\n", "clients", "path", "frames", "syscalls/frame", "p50 us", "p99 us");
+    for (int i=0; i<3; i++) {
+        if (uring_bench_run(clients[i], false, port++, results)) {
+            printf("%8d %8s %10.0f %14.3f %10.1f %10.1f\n", clients[i], "epoll", results[0], results[1], results[2], results[3]);
+        }
+        if (uring_bench_run(clients[i], true, port++, results)) {
+            printf("%8d %8s %10.0f %14.3f %10.1f %10.1f\n", clients[i], "uring", results[0], results[1], results[2], results[3]);
+        }
+    }
+    printf("(system calls are the server's, receiving; lag is from the client's send to the server taking the record)\n");
+}
@@ -19,11 +19,23 @@
  * but you could run clients & server in same VM using localhost (which is why client/server is used instead of multicast).
  */
 
+#include <stdbool.h>
 #include "lisa.h"
 
 #define CI_NO_ERROR 0
 #define CI_SOCKET_ERROR -1
 
+// stream: frames go over tcp (the default), messages: each frame goes as a message of its own, over seqpacket for
+// vsock or udp otherwise, shm: frames go through shared memory to a server on the same host (the server address and
+// vsock are ignored, the port says which server); messages and shm fall back to tcp if they don't connect (set before
+// starting the client or server)
+bool ci_set_transport(const char * name);
+
+// poll: receives wait on the sockets (the default), uring: receives take what arrives through an io_uring, and inject
+// writes bursts of frames through one (see lisa_set_uring and ciqs_set_io), each falling back to poll if it can't
+// (set before starting the queues and the client or server)
+bool ci_set_io(const char * name);
+
 int ci_start_client(char * server_addr, int port, lisa *lp, int use_vsock);
 
 int ci_start_server(int port, lisa *lp, int use_vsock);
@@ -38,5 +50,14 @@ void ci_pause_server();
 void ci_resume_server();
 void ci_stop_server();
 
+/* measures zero-copy against copying sends of a range of sizes over tcp (or vsock) loopback and prints the results */
+void ci_zerocopy_benchmark(int use_vsock);
+
+/* measures shm against tcp loopback, to a receiver in another process, for a range of send sizes and prints the results */
+void ci_shm_benchmark();
+
+/* measures receiving from 2, 5, and 10 clients through an io_uring against epoll, and prints the results */
+void ci_uring_benchmark();
+
 
 #endif // CLIENT_SERVER_H
@@ -4,6 +4,19 @@
  * @details
  * Accepts several options but the only "production" option is c. The other options are for unit testing different parts of the application.
  * Passing the single character c starts all the queues and workers for a client.
+ * Passing z instead measures zero-copy sends against copying sends over tcp loopback (or, with a second parameter v,
+ * vsock loopback), to find a zerocopy setting for capture_send, and passing m measures the shm transport against tcp
+ * loopback between two processes.
+ * An optional second parameter r runs all the queues on one reactor thread instead of a thread per queue.
+ * An optional third parameter is the latency budget in microseconds, i.e., how long the queues keep polling for more
+ * work before blocking (default 0).
+ * Any further parameters are settings for the queues, each either a file of settings or one quoted setting line such as
+ * "send cpus=2 policy=fifo priority=10" or "capture_send size=262144 overflow=drop-oldest" (see ciqs_configure).
+ * The setting "transport=messages" sends each frame as a message of its own instead of over a tcp stream (going back to
+ * tcp if the server doesn't connect or doesn't answer the client's hello), and
+ * "transport=shm" sends the stream through shared memory to a server on the same host (see ci_set_transport).
+ * The setting "io=uring" receives through an io_uring and has inject write bursts of frames through one (see ci_set_io),
+ * and passing u measures receiving through an io_uring against epoll with several clients.
  */
 
 #define QUEUES_TEST
@@ -11,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -20,6 +34,7 @@
 #include "ci_client_server.h"
 #include "ci_workers.h"
 #include "ci_nl.h"
+#include "looper.h"
 #include "utilities.h"
 #include "item.h"
 
@@ -117,6 +132,29 @@ static void start_server(int use_nl) {
 }
 
 
+static void set_latency_budget(int argc, char **argv) {
+    useconds_t budget;
+    if (argc < 4) return;
+    budget = (useconds_t) atoi(argv[3]);
+    for (enum ciqs_queue q = CIQS_FIRST_QUEUE; q<CIQS_LAST_QUEUE; q++) ciqs_set_latency_budget(q, budget);
+    printf("latency budget: %u us\n", (unsigned) budget);
+}
+
+// applies one setting, either the transport or one for the queues
+static bool configure(const char * line) {
+    if (!strncmp(line, "transport=", 10)) return ci_set_transport(line + 10);
+    if (!strncmp(line, "io=", 3)) return ci_set_io(line + 3);
+    return ciqs_configure(line);
+}
+
+// applies any settings on the command line, before the queues are initialized
+static void configure_queues(int argc, char **argv) {
+    for (int i=4; i<argc; i++) {
+        if (strchr(argv[i], '=')) configure(argv[i]);
+        else looper_read_config(argv[i], configure);
+    }
+}
+
 /*
  * main
  */
@@ -125,32 +163,67 @@ int main(int argc, char **argv) {
 
     if (argc < 2) {
       printf("invoke with either 'c' or 's' as a command line parameter (client or server)\n");
+      printf("optionally followed by 'r' to run all queues on one thread (reactor) or 't' for a thread per queue (default)\n");
+      printf("and then optionally by a latency budget in microseconds to poll before blocking (default 0)\n");
+      printf("and then optionally by settings files or quoted lines such as \"send cpus=2 policy=fifo priority=10\"\n");
+      printf("or \"capture_send size=262144 overflow=drop-oldest\" (overflow: block, drop-newest, drop-oldest, drop-beacons)\n");
+      printf("and \"schedule=weighted weights=8,4,1\" (schedule: strict, weighted; weights: priority,data,beacon lanes)\n");
+      printf("and \"capture_send zerocopy=16384\" (sends of at least this many bytes don't copy the frames)\n");
+      printf("and \"transport=messages\" (each frame its own seqpacket or udp message, falling back to tcp) or \"transport=stream\"\n");
+      printf("or \"transport=shm\" (through shared memory to a server on the same host, falling back to tcp)\n");
+      printf("and \"wire version=2 source=3 compress=1\" (highest header version offered, this radio/VM, compress v2 frames)\n");
+      printf("and \"io=uring\" (receive and inject through io_uring, falling back to poll) or \"io=poll\"\n");
+      printf("or invoke with 'z' to measure zero-copy sends against copying them over tcp loopback, or 'z v' over vsock\n");
+      printf("or invoke with 'm' to measure the shm transport against tcp loopback between two processes\n");
+      printf("or invoke with 'u' to measure receiving through io_uring against epoll from 2, 5, and 10 clients\n");
       return -1;
     }
+    if (argc > 2 && argv[2][0] == 'r') {
+      printf("using reactor runtime\n");
+      ciqs_set_runtime(ciqs_reactor);
+    }
+    configure_queues(argc, argv);
     start_printing_worker();
 	switch (argv[1][0]) {
 
 	    case 'n': mode = nl_test;
                   ciqs_init_queues();
                   ciqs_start(nlcaptureq, NULL);
+                  set_latency_budget(argc, argv);
+                  ciqs_print_threads();
 	              signal (SIGINT,sig_handler);
                   while (1) { sleep(1); }
                   break;
 
 	    case 'o': mode = client_server;
                   start_client(1);
+                  set_latency_budget(argc, argv);
+                  ciqs_print_threads();
 	              signal (SIGINT,sig_handler);
                   while (1) { sleep(1); }
                   break;
 
 	    case 'c': mode = client_server;
                   start_client(0);
+                  set_latency_budget(argc, argv);
+                  ciqs_print_threads();
 	              signal (SIGINT,sig_handler);
                   while (1) { sleep(1); }
                   break;
 
+	    case 'z': ci_zerocopy_benchmark(argc > 2 && argv[2][0] == 'v');
+                  return 0;
+
+	    case 'm': ci_shm_benchmark();
+                  return 0;
+
+	    case 'u': ci_uring_benchmark();
+                  return 0;
+
 	    case 's': mode = client_server;
                   start_server(0);
+                  set_latency_budget(argc, argv);
+                  ciqs_print_threads();
 	              signal (SIGINT,sig_handler);
                   while (1) { sleep(1); }
                   break;
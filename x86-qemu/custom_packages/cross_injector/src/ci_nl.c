@@ -23,17 +23,14 @@
 #include "queue.h"
 #include "radiotap.h"
 #include "utilities.h"
-#include "aq_type.h"
+#include "rq_type.h"
+#include <string.h>
+#include <time.h>
 
 #define NUM_RADIOS 2
 
-static aq_type * nl_capture_send_q;     /* capture is the producer, send is the consumer */
-static aq_type * nl_receive_inject_q;   /* receive is the producer, inject is the consumer */
-
-typedef struct nl_item_s {
-    int size;
-    uint8_t buffer[BUFFER_SIZE];
-} nl_item_t;
+static rq_type * nl_capture_send_q;     /* capture is the producer, send is the consumer */
+static rq_type * nl_receive_inject_q;   /* receive is the producer, inject is the consumer */
 
 struct mac_address {
 	unsigned char addr[6];
@@ -53,14 +50,17 @@ int cinl_received() {
 /* put on captured frames queue  */
 
 static void capture_frame(uint8_t *data, unsigned int data_len, unsigned int freq) {
-    nl_item_t * item = (nl_item_t *) aq_get_tail(nl_capture_send_q);
+    struct timespec now;
+    rq_record_t * item = rq_reserve(nl_capture_send_q, RT_CHANNEL_HEADER_SIZE + data_len);
     if (!item) {
-        printf("nl_capture queue is full, can't capture right now\n");
+        printf("nl_capture queue is full (or the frame is too big), can't capture right now\n");
         return;
     }
+    if (clock_gettime(CLOCK_REALTIME, &now)<0) bignum_sec_assigns(&(item->bignum_timestamp), true, 0, 0);
+    else bignum_sec_assigns(&(item->bignum_timestamp), true, now.tv_sec, now.tv_nsec);
     rt_set_channel_header(item->buffer, freq);
-    /* TODO */
-    aq_put_tail(nl_capture_send_q);
+    if (data) memcpy(item->buffer + RT_CHANNEL_HEADER_SIZE, data, data_len);
+    rq_commit(nl_capture_send_q, RT_CHANNEL_HEADER_SIZE + (data ? data_len : 0));
     received++;
 }
 /* put on captured frames queue and send back to hwsim to transmit */
@@ -86,7 +86,7 @@ static void process_hwsim_cmd(struct nlattr **attrs) {
     data = NULL;
     tx_rates = NULL;
     flags = 0;
-    cookie = freq = 0;
+    cookie = freq = data_len = 0;
     if (attrs[HWSIM_ATTR_ADDR_TRANSMITTER]) src = (struct mac_address*) nla_data(attrs[HWSIM_ATTR_ADDR_TRANSMITTER]);
     else printf("no transmitter\n");
     if (attrs[HWSIM_ATTR_FRAME]) {data_len = nla_len(attrs[HWSIM_ATTR_FRAME]); data = (uint8_t *)nla_data(attrs[HWSIM_ATTR_FRAME]);}
@@ -146,11 +146,11 @@ int cinl_init(struct queue_t *nlcaptureq)
     struct nl_cache    *nlcache;
     struct genl_family *gnlfamily;
 
-    if (!aq_new(&nl_capture_send_q, sizeof(nl_item_t), NUM_ITEMS)) {
+    if (!rq_new(&nl_capture_send_q, NL_RING_SIZE)) {
         printf("error allocating nl_capture_send_q\n");
         return -1;
     };
-    if (!aq_new(&nl_receive_inject_q, sizeof(nl_item_t), NUM_ITEMS)) {
+    if (!rq_new(&nl_receive_inject_q, NL_RING_SIZE)) {
         printf("error allocating nl_receive_inject_q\n");
         return -1;
     };
@@ -207,8 +207,15 @@ int cinl_init(struct queue_t *nlcaptureq)
 
 }
 
-void cinl_run() {
+int cinl_run() {
+    int before = received;
     nl_recvmsgs_default(nlsock);
+    return received - before;
+}
+
+int cinl_get_fd() {
+    if (!nlsock) return -1;
+    return nl_socket_get_fd(nlsock);
 }
 
 #define SIZE_OF_ACK RT_CHANNEL_HEADER_SIZE + 10
@@ -13,14 +13,17 @@
 #define HWSIM_FAMILY_NAME "MAC80211_HWSIM"
 #define HWSIM_NL_VERSION 1
 
-#define BUFFER_SIZE 2500
-#define NUM_ITEMS 10
+#define NL_RING_SIZE (64 * 1024)   /* bytes of frames queued between netlink capture and send */
 
 #include "queue.h"
 
 int cinl_init(struct queue_t * nlcaptureq);
 
-void cinl_run();
+// processes what is waiting on the netlink socket, returns how many frames were captured
+int cinl_run();
+
+// the netlink socket fd to wait on for cinl_run to have something to do (-1 if not initialized)
+int cinl_get_fd();
 
 int cinl_received();
 
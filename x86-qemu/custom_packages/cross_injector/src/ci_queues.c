@@ -3,21 +3,57 @@
  * @brief implements the sending, receiving, capturing, and injecting queues.
  * @details
  * Each queue is implemented as a looper (/ref src/looper.h) along with its own queue data.
+ * Frames are passed between loopers in rings of variable length records (/ref src/rq_type.h), so small frames take
+ * little room, and capture and receive write each frame straight into its record.
+ * A client sends a whole burst of frames at a time, gathering each frame's header and its record straight from the
+ * ring into one send, and picks up where it left off when the socket only takes part of it. Sends that are big enough
+ * can even hand the kernel the records themselves rather than a copy (zero-copy), which then holds on to the batch until
+ * the kernel says it is done with it.
+ * Receive does the mirror image, reading as much as is there in one go and then splitting it into frames.
+ * The header before each frame is either version of /ref src/wire.h: v1 until the other side says hello offering v2,
+ * which a client does each time it connects (see ciqs_say_hello) and a server does to answer just the client that said
+ * it. A server sends the lowest version any of its clients offered, so a client that never said hello only gets v1. Receive counts the frames of each
+ * source and the sequence numbers they skipped, and drops frames from this side's own source, which a relay echoed.
+ * With v2, send can also compress each frame against the frames it sent before (/ref src/lz.h), starting over every
+ * KEY_INTERVAL frames and whenever a receiver joins, and receive expands them with a history for each source.
+ * Over a socket that keeps messages apart (seqpacket or udp, see ci_set_transport), each frame is instead sent as a
+ * message of its own, a burst of them in one call, and received a burst at a time, so there is nothing to split.
+ * How big each ring is and what happens when a frame doesn't fit (the overflow policy) can be set before initializing
+ * the queues: the producer can wait for room (block), drop the new frame (drop-newest), have the consumer drop the
+ * oldest frames (drop-oldest), or drop beacons first, new ones right away and queued ones as the consumer gets to them
+ * (drop-beacons). A waiting producer blocks on a doorbell that the consumer rings as it makes room.
+ * Each ring is split into lanes by frame class (management and EAPOL, data, beacons), each lane a ring of its own, so
+ * that a flood of data frames can't hold up an authentication or a handshake. Send and inject pick which lane to take
+ * each frame from, either strictly by priority or round robin by weight.
+ * Rather than sleeping in between runs, each looper blocks until it has something to do: send and inject wait on the
+ * doorbell of their input queue (/ref src/doorbell.h), receive waits on its socket, and capture waits on the pcap fd.
+ * The loopers either each run on a thread of their own or all together on one reactor thread (/ref src/reactor.h),
+ * depending on the runtime set before starting the queues.
+ * The threads can be given cpus, scheduling, and names from thread settings given before initializing the queues.
+ * With the uring io, inject writes each burst through an io_uring (/ref src/uring.h) in one system call rather than
+ * handing pcap one frame at a time.
  * used as a normal IP address.
  *
  * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
  */
 
+#define _GNU_SOURCE   /* for struct mmsghdr */
 #include "ci_queues.h"
-#include "aq_type.h"
+#include "rq_type.h"
+#include "doorbell.h"
 #include "ci_main.h"
 #include "item.h"
 #include "looper.h"
+#include "reactor.h"
 #include "utilities.h"
 #include "ci_nl.h"
 #include "radiotap.h"
+#include "wire.h"
+#include "lz.h"
 #include "debug.h"
 #include "bignum_sec_profiling.h"
+#include "uring.h"
+#include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
@@ -25,6 +61,8 @@
 #include <sys/ioctl.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <errno.h>
 
 
 /***********************************************************************
@@ -36,6 +74,14 @@ static int packets_sent=0;
 static int packets_captured=0;
 static int packets_injected=0;
 static int packets_nlinjected=0;
+static int packets_too_big=0;
+static int packets_echoed=0;
+static int send_calls=0;
+
+static void print_looper_stats();
+static void print_overflow_stats();
+static void print_zerocopy_stats();
+static void print_wire_stats();
 
 void ciqs_print_stats() {
     bignum_sec_t avg;
@@ -43,10 +89,14 @@ void ciqs_print_stats() {
     bignum_sec_t min;
     printf("\n");
     printf("packets_captured: %d\n", packets_captured);
-    printf("packets_sent:     %d\n", packets_sent);
+    printf("packets_sent:     %d (in %d scatter-gather sends)\n", packets_sent, send_calls);
+    print_zerocopy_stats();
     printf("packets_received: %d\n", packets_received);
     printf("packets_injected: %d\n", packets_injected);
     printf("packets_nlinjected: %d\n", packets_nlinjected);
+    printf("packets_too_big:  %d\n", packets_too_big);
+    printf("packets_echoed:   %d (sent by this source and relayed back)\n", packets_echoed);
+    print_wire_stats();
     profiling_get_lag_time_avg(&avg, packets_injected);
     profiling_get_lag_time_max(&max);
     profiling_get_lag_time_min(&min);
@@ -56,6 +106,8 @@ void ciqs_print_stats() {
     else printf("max lag time: -%010ld.%09ld \n", max.sec, max.nsec);
     if (min.positive) printf("min lag time: +%010ld.%09ld \n", min.sec, min.nsec);
     else printf("min lag time: -%010ld.%09ld \n", min.sec, min.nsec);
+    print_overflow_stats();
+    print_looper_stats();
 }
 
 /***********************************************************************
@@ -64,38 +116,141 @@ void ciqs_print_stats() {
 
 static char pcap_errbuf[PCAP_ERRBUF_SIZE]; /* Size defined in pcap.h */
 
-static aq_type * capture_send_q;     /* capture is the producer, send is the consumer */
-static aq_type * receive_inject_q;   /* receive is the producer, inject is the consumer */
+#define RECEIVE_BUFFER_SIZE (64 * 1024)   /* most bytes received at a time, frames bigger than this (less a header) are dropped */
+#define MESSAGE_SLOT_SIZE (WIRE_MAX_HEADER_SIZE + MAX_FRAME_SIZE)   /* room for each message received */
+#define RECEIVE_MESSAGES 16               /* most messages received at a time */
+#define PACKED_SIZE LZ_BOUND(LZ_MAX_FRAME)  /* room for a frame compressed */
+#define KEY_INTERVAL 64                   /* most frames compressed before the history starts over (a key frame) */
 
-typedef struct q_item_s {
-    uint32_t size;
-    bignum_sec_t bignum_timestamp;
-    uint8_t  buffer[BUFFER_SIZE];
-} q_item_t;
+// frames between a producer and a consumer, in a lane (rq_type) per frame class that all ring the same doorbells, along
+// with what happens when a frame doesn't fit in its lane, how the consumer picks the lane to take from, and how often
+struct ring_t {
+    const char * name;
+    uint32_t size;                     /* of each lane, in bytes */
+    enum ciqs_overflow policy;
+    enum ciqs_schedule schedule;
+    uint16_t weights[CIQS_NUM_LANES];  /* for the weighted schedule, most frames taken from a lane in one turn */
+    uint32_t zerocopy;                 /* for capture_send, sends of at least this many bytes don't copy the frames (0 = off) */
+    rq_type * lanes[CIQS_NUM_LANES];
+    struct doorbell_t bell;            /* rung by the producer to wake the consumer */
+    struct doorbell_t room_bell;       /* rung by the consumer as it makes room, for a waiting producer */
+    bool waiting;                      /* the producer is waiting for room */
+    int turn;                          /* the lane whose turn it is (for the weighted schedule, used by the consumer) */
+    uint16_t turn_left;                /* how many more frames it can have this turn */
+    unsigned long frames[CIQS_NUM_LANES];  /* frames taken from each lane (counted by the consumer) */
+    unsigned long waits;               /* times the producer had to wait (counted by the producer) */
+    unsigned long dropped_newest;      /* new frames the producer dropped (counted by the producer) */
+    unsigned long dropped_oldest;      /* queued frames the consumer dropped to make room (counted by the consumer) */
+    unsigned long dropped_beacons;     /* queued beacons the consumer dropped to make room (counted by the consumer) */
+};
+
+static struct ring_t capture_send = {"capture_send", RING_SIZE, ciqs_block, ciqs_weighted, {8, 4, 1}};       /* capture is the producer, send is the consumer */
+static struct ring_t receive_inject = {"receive_inject", RING_SIZE, ciqs_block, ciqs_weighted, {8, 4, 1}};   /* receive is the producer, inject is the consumer */
+static const char * overflow_names[] = {"block", "drop-newest", "drop-oldest", "drop-beacons"};
+static const char * schedule_names[] = {"strict", "weighted"};
+static const char * lane_names[CIQS_NUM_LANES] = {"priority", "data", "beacon"};
+
+// a client of a server that said hello
+struct wire_client_t {
+    SOCKET fd;
+    uint8_t version;                /* the highest both offered */
+    bool answer_wanted;             /* send should answer its hello */
+};
+
+// the header versions offered and in use (see /ref src/wire.h) and what was received from each source
+static struct wire_t {
+    uint8_t max_version;            /* the highest this side offers, set before the queues start */
+    uint16_t source;                /* this radio/VM, 0 if not set (then no frames are taken for echoes) */
+    _Atomic uint8_t version;        /* what send uses: the server's offer, or for a server the lowest of its clients' */
+    _Atomic bool hello_wanted;      /* a client's send should say hello (it connected, see ciqs_say_hello) */
+    _Atomic bool hello_heard;       /* the server answered the client's hello (see ciqs_heard_hello) */
+    _Atomic bool answer_wanted;     /* a server's send should answer the clients that said hello */
+    pthread_mutex_t clients_lock;   /* for clients, which receive adds to and send reads */
+    struct wire_client_t clients[MAX_CLIENTS];   /* for a server, the clients that said hello */
+    int num_clients;
+    uint16_t sequence;              /* of the next frame sent (used by send only) */
+    struct wire_sources_t sources;  /* frames received from each source (used by receive only) */
+    bool compress;                  /* v2 frames are compressed (see /ref src/lz.h), which needs a source */
+    _Atomic bool key_wanted;        /* send should start its history over (a receiver joined or missed a frame) */
+    int since_key;                  /* frames compressed since it last did (used by send only) */
+    struct lz_t lz;                 /* the frames sent, to compress against (used by send only) */
+    struct lz_sources_t expanders;  /* the frames received from each source, to expand against (used by receive only) */
+} wire = {WIRE_V2, 0, WIRE_V1, false, false, false, PTHREAD_MUTEX_INITIALIZER, .key_wanted = true};
 
 struct sending_data_t {
     lisa *lp;
-    uint8_t len[4];
-    uint8_t timestamp[16];
-    uint32_t len_processed;
+    uint8_t header[WIRE_MAX_HEADER_SIZE];   /* of the item in process */
+    int header_size;
+    uint8_t * data;                         /* what is sent of the item in process, its record or that compressed */
+    uint32_t size;
+    uint32_t len_processed;                 /* bytes of header sent */
     uint32_t pkt_processed;
     int in_process;
-    q_item_t * item;
+    int lane;                /* of the item in process */
+    rq_record_t * item;
+    /* for a client, a batch of items sent together (see send_batch) */
+    int batch_n;                                        /* items in the batch */
+    int batch_done;                                     /* items completely sent (or shed) */
+    int batch_released;                                 /* items given back to their lanes (see release_batch) */
+    int batch_lanes[BURST_SIZE];                        /* lane of each item */
+    uint32_t batch_ends[BURST_SIZE];                    /* bytes of the batch up to the end of each item */
+    uint32_t batch_sent;                                /* bytes of the batch sent so far */
+    uint8_t batch_headers[BURST_SIZE][WIRE_MAX_HEADER_SIZE];
+    struct iovec iov[2 * BURST_SIZE];                   /* a header and a record for each item */
+    int iov_first;                                      /* first iov not completely sent */
+    int iov_n;
+    struct mmsghdr msgs[BURST_SIZE];                    /* or, over seqpacket or udp, a message of each header and record */
+    int msg_first;                                      /* first message not sent */
+    int msg_n;
+    bool zerocopy_set;                                  /* the zerocopy setting of capture_send was given to lisa */
+    uint8_t hello[WIRE_MAX_HEADER_SIZE];                /* a hello being said (see say_hello) */
+    int hello_size;
+    int hello_sent;
+    uint8_t * packed;                                   /* if compressing, a slot of PACKED_SIZE bytes for each item */
+};
+
+/* the bytes received over a stream from one socket, since a frame cut off by one receive goes on in the next one from
+ * the same socket, while a server's next receive can be from another client */
+struct receive_stream_t {
+    SOCKET fd;               /* the socket received from, or -1 while the stream is free */
+    uint8_t *buffer;         /* RECEIVE_BUFFER_SIZE bytes as received, which can hold many frames (see parse_frames) */
+    uint32_t start;          /* the bytes not yet parsed are from start up to end */
+    uint32_t end;
+    uint32_t discard_left;   /* bytes not yet received of a frame that is too big, which are dropped as they arrive */
 };
 
 struct receiving_data_t {
     lisa *lp;
-    uint8_t len[4];
-    uint8_t timestamp[16];
-    uint32_t bytes_received;
-    uint32_t bytes_to_receive;
-    int len_received;
-    q_item_t * item;
+    struct receive_stream_t streams[MAX_CLIENTS];    /* for a server, one for each client, for a client just one */
+    struct receive_stream_t *stream;    /* the one being parsed (if its frame is waiting, it goes first) */
+    uint8_t *spare;          /* RECEIVE_BUFFER_SIZE bytes received into, which then go to the stream they are from */
+    SOCKET from;             /* the socket the frames being taken came from, whose hello it is */
+    bool waiting;            /* the frame at start is waiting for room in its lane */
+    enum ciqs_lane lane;     /* of the frame that is waiting */
+    uint32_t wait_size;
+    /* over seqpacket or udp, each frame arrives whole as a message of its own (see receive_messages) */
+    uint8_t *slots;          /* RECEIVE_MESSAGES slots of MESSAGE_SLOT_SIZE bytes, a message received into each */
+    struct iovec slot_iov[RECEIVE_MESSAGES];
+    struct mmsghdr messages[RECEIVE_MESSAGES];
+    int message_next;        /* the messages not yet taken are from message_next up to message_n */
+    int message_n;
+    uint8_t *expanded_from;  /* the compressed frame last expanded (if it is waiting for room it isn't expanded again) */
+    const uint8_t *expanded; /* and what it expanded to */
+    int expanded_size;
 };
 
 struct pcap_data_t {
     pcap_t **pcap_handle_ptr;
     char * dev;
+    int drained;        /* for capture, whether the last pcap_next_ex found nothing (only then is waiting on the fd reliable) */
+    int fd;             /* for capture, to wait on, and for inject through uring, to write to */
+    struct pcap_pkthdr *pending_header;      /* for capture, a frame waiting for room in its capture_send lane */
+    const u_char *pending_data;              /* (pcap keeps it until pcap_next_ex is called again) */
+    bignum_sec_t pending_timestamp;
+    enum ciqs_lane pending_lane;
+    struct uring_t uring;                    /* for inject with the uring io (see init_inject_uring) */
+    bool inject_uring;                       /* whether inject goes through it */
+    bool inject_fixed;                       /* and writes from the registered lanes */
 };
 
 union ciqs_data_t {
@@ -109,6 +264,12 @@ static struct ciqs_t {
     union ciqs_data_t data;
 } ciqs[CIQS_NUM_QUEUES];
 
+static enum ciqs_runtime runtime = ciqs_threads;
+static enum ciqs_io io = ciqs_io_poll;
+static struct reactor_t reactor;     /* only used for the reactor runtime */
+static struct looper_attr_t thread_attrs[CIQS_NUM_QUEUES];
+static struct looper_attr_t reactor_attr;
+
 /***********************************************************************
  * queue functions
  ***********************************************************************/
@@ -118,6 +279,204 @@ static struct ciqs_t {
 static enum ciqs_queue queues_running[NUM_QUEUES];
 static int last_queue;
 
+static const char * queue_names[CIQS_NUM_QUEUES] = {"send", "altsend", "receive", "altreceive",
+                                                    "capture", "nlcapture", "injection", "nlinjection"};
+
+static void print_one_looper_stats(const char * name, struct looper_t * l) {
+    printf("%-12s spins: %lu sleeps: %lu wakeups: %lu (latency budget %u us)\n", name, l->spins, l->sleeps, l->wakeups, (unsigned) l->latency_budget);
+}
+
+static void set_thread_attr(struct looper_t * l, struct looper_attr_t * attr, const char * name) {
+    l->attr = *attr;
+    if (!l->attr.name[0]) snprintf(l->attr.name, LOOPER_NAME_LEN, "ci_%s", name);
+}
+
+bool ciqs_set_thread_attr(const char * line) {
+    int n;
+    for (n=0; line[n] && line[n] != ' ' && line[n] != '\t'; n++);
+    if (n == 7 && !strncmp(line, "reactor", n)) return looper_parse_attr(&reactor_attr, line + n);
+    for (enum ciqs_queue q = CIQS_FIRST_QUEUE; q<CIQS_LAST_QUEUE; q++) {
+        if ((int) strlen(queue_names[q]) == n && !strncmp(line, queue_names[q], n)) return looper_parse_attr(&(thread_attrs[q]), line + n);
+    }
+    printf("unknown queue in thread settings: %.*s\n", n, line);
+    return false;
+}
+
+// e.g., "8,4,1" for the priority, data, and beacon lanes
+static bool set_weights(struct ring_t * r, const char * spec) {
+    uint16_t weights[CIQS_NUM_LANES];
+    const char * value = spec;
+    char * end;
+    unsigned long weight;
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        weight = strtoul(value, &end, 0);
+        if (end == value || weight < 1 || weight > UINT16_MAX || *end != ((l < CIQS_NUM_LANES-1) ? ',' : '\0')) {
+            printf("queue weights should be %d numbers from 1 to %u separated by commas: %s\n", CIQS_NUM_LANES, UINT16_MAX, spec);
+            return false;
+        }
+        weights[l] = (uint16_t) weight;
+        value = end + 1;
+    }
+    memcpy(r->weights, weights, sizeof(weights));
+    return true;
+}
+
+// bytes per lane, with room for a record of the largest frame (the lane is rounded up to a power of two)
+static bool set_size(struct ring_t * r, const char * value) {
+    char * end;
+    unsigned long size = strtoul(value, &end, 0);
+    if (end == value || *end || size < RQ_MIN_SIZE || size > RQ_MAX_SIZE || rq_max_record_for(size) < MAX_FRAME_SIZE) {
+        printf("queue size should be from %u to %u bytes, with room for a frame of %d bytes: %s\n",
+               RQ_MIN_SIZE, RQ_MAX_SIZE, MAX_FRAME_SIZE, value);
+        return false;
+    }
+    r->size = (uint32_t) size;
+    return true;
+}
+
+// sends of at least this many bytes don't copy the frames, 0 for none (a send is never more than a lane)
+static bool set_zerocopy(struct ring_t * r, const char * value) {
+    char * end;
+    unsigned long threshold = strtoul(value, &end, 0);
+    if (end == value || *end || threshold > RQ_MAX_SIZE) {
+        printf("queue zerocopy should be from 0 (off) to %u bytes: %s\n", RQ_MAX_SIZE, value);
+        return false;
+    }
+    r->zerocopy = (uint32_t) threshold;
+    return true;
+}
+
+// e.g., "capture_send size=262144 overflow=drop-oldest schedule=weighted weights=8,4,1"
+static bool set_ring(struct ring_t * r, const char * spec) {
+    char settings[256];
+    char *setting, *value, *saveptr;
+    int i;
+    snprintf(settings, sizeof(settings), "%s", spec);
+    for (setting = strtok_r(settings, " \t", &saveptr); setting; setting = strtok_r(NULL, " \t", &saveptr)) {
+        value = strchr(setting, '=');
+        if (!value) {
+            printf("queue setting should be name=value: %s\n", setting);
+            return false;
+        }
+        *value++ = '\0';
+        if (!strcmp(setting, "size")) {
+            if (!set_size(r, value)) return false;
+        }
+        else if (!strcmp(setting, "overflow")) {
+            for (i=0; i<(int) (sizeof(overflow_names)/sizeof(overflow_names[0])) && strcmp(value, overflow_names[i]); i++);
+            if (i == (int) (sizeof(overflow_names)/sizeof(overflow_names[0]))) {
+                printf("queue overflow should be block, drop-newest, drop-oldest, or drop-beacons: %s\n", value);
+                return false;
+            }
+            r->policy = (enum ciqs_overflow) i;
+        }
+        else if (!strcmp(setting, "schedule")) {
+            for (i=0; i<(int) (sizeof(schedule_names)/sizeof(schedule_names[0])) && strcmp(value, schedule_names[i]); i++);
+            if (i == (int) (sizeof(schedule_names)/sizeof(schedule_names[0]))) {
+                printf("queue schedule should be strict or weighted: %s\n", value);
+                return false;
+            }
+            r->schedule = (enum ciqs_schedule) i;
+        }
+        else if (!strcmp(setting, "weights")) {
+            if (!set_weights(r, value)) return false;
+        }
+        else if (!strcmp(setting, "zerocopy")) {
+            if (!set_zerocopy(r, value)) return false;
+        }
+        else {
+            printf("unknown queue setting: %s\n", setting);
+            return false;
+        }
+    }
+    return true;
+}
+
+// e.g., "wire version=2 source=3 compress=1"
+static bool set_wire(const char * spec) {
+    char settings[256];
+    char *setting, *value, *saveptr, *end;
+    unsigned long number;
+    snprintf(settings, sizeof(settings), "%s", spec);
+    for (setting = strtok_r(settings, " \t", &saveptr); setting; setting = strtok_r(NULL, " \t", &saveptr)) {
+        value = strchr(setting, '=');
+        if (!value) {
+            printf("wire setting should be name=value: %s\n", setting);
+            return false;
+        }
+        *value++ = '\0';
+        number = strtoul(value, &end, 0);
+        if (end == value || *end || *value == '-') {
+            printf("wire %s should be a number: %s\n", setting, value);
+            return false;
+        }
+        if (!strcmp(setting, "version")) {
+            if (number < WIRE_V1 || number > WIRE_V2) {
+                printf("wire version should be 1 or 2: %s\n", value);
+                return false;
+            }
+            wire.max_version = (uint8_t) number;
+        }
+        else if (!strcmp(setting, "source")) {
+            if (number > UINT16_MAX) {
+                printf("wire source should be from 1 to %u (0 for none): %s\n", UINT16_MAX, value);
+                return false;
+            }
+            wire.source = (uint16_t) number;
+        }
+        else if (!strcmp(setting, "compress")) {
+            if (number > 1) {
+                printf("wire compress should be 1 or 0: %s\n", value);
+                return false;
+            }
+            wire.compress = (number != 0);
+        }
+        else {
+            printf("unknown wire setting: %s\n", setting);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ciqs_configure(const char * line) {
+    int n;
+    for (n=0; line[n] && line[n] != ' ' && line[n] != '\t'; n++);
+    if (n == 4 && !strncmp(line, "wire", n)) return set_wire(line + n);
+    if (n == 12 && !strncmp(line, capture_send.name, n)) return set_ring(&capture_send, line + n);
+    if (n == 14 && !strncmp(line, receive_inject.name, n)) return set_ring(&receive_inject, line + n);
+    return ciqs_set_thread_attr(line);
+}
+
+bool ciqs_load_config(const char * path) {
+    return looper_read_config(path, ciqs_configure);
+}
+
+void ciqs_print_threads() {
+    printf("threads:\n");
+    for (int i=0; i<last_queue; i++) looper_print_attr(queue_names[queues_running[i]], &(ciqs[queues_running[i]].looper));
+    if (runtime == ciqs_reactor) looper_print_attr("reactor", &(reactor.looper));
+}
+
+static void print_one_overflow_stats(struct ring_t * r) {
+    if (!r->lanes[0]) return;
+    printf("%-14s %u bytes per lane, %s, %s: waits: %lu dropped newest: %lu oldest: %lu beacons: %lu\n", r->name, r->lanes[0]->size,
+           overflow_names[r->policy], schedule_names[r->schedule], r->waits, r->dropped_newest, r->dropped_oldest, r->dropped_beacons);
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        printf("  %-9s frames: %lu (%u bytes in use), weight %u\n", lane_names[l], r->frames[l], rq_bytes_used(r->lanes[l]), r->weights[l]);
+    }
+}
+
+static void print_overflow_stats() {
+    print_one_overflow_stats(&capture_send);
+    print_one_overflow_stats(&receive_inject);
+}
+
+static void print_looper_stats() {
+    for (int i=0; i<last_queue; i++) print_one_looper_stats(queue_names[queues_running[i]], &(ciqs[queues_running[i]].looper));
+    if (runtime == ciqs_reactor) print_one_looper_stats("reactor", &(reactor.looper));
+}
+
 static void add_running_queue(enum ciqs_queue q) {
     queues_running[last_queue++] = q;
 }
@@ -139,17 +498,18 @@ void ciqs_stop_all() {
     for (int i=0; i<NUM_QUEUES; i++) if (queues_running[i] != naq) ciqs_stop(queues_running[i]);
 }
 
-static void repeat_sending_function(void *d);
-static void repeat_receiving_function(void *d);
-static void repeat_capturing_function(void *d);
-static void repeat_injecting_function(void *d);
-static void repeat_nlcapturing_function(void *d);
-static void repeat_nlinjecting_function(void *d);
+// each returns how much work it did (e.g., packets moved), so the looper knows whether to keep polling
+static int repeat_sending_function(void *d);
+static int repeat_receiving_function(void *d);
+static int repeat_capturing_function(void *d);
+static int repeat_injecting_function(void *d);
+static int repeat_nlcapturing_function(void *d);
+static int repeat_nlinjecting_function(void *d);
 
-static void (* looper_functions[CIQS_NUM_QUEUES]) (void *d) = {repeat_sending_function, repeat_sending_function,
-                                                               repeat_receiving_function, repeat_receiving_function,
-                                                               repeat_capturing_function, repeat_nlcapturing_function,
-                                                               repeat_injecting_function, repeat_nlinjecting_function};
+static int (* looper_functions[CIQS_NUM_QUEUES]) (void *d) = {repeat_sending_function, repeat_sending_function,
+                                                              repeat_receiving_function, repeat_receiving_function,
+                                                              repeat_capturing_function, repeat_nlcapturing_function,
+                                                              repeat_injecting_function, repeat_nlinjecting_function};
 
 static void init_sending_function(void *d);
 static void init_receiving_function(void *d);
@@ -163,69 +523,134 @@ static void (*init_functions[CIQS_NUM_QUEUES]) (void *d) = {init_sending_functio
                                                             init_capturing_function, init_nlcapturing_function,
                                                             init_injecting_function, init_nlinjecting_function};
 
-static void common_final_function(void *d);
+static enum looper_wait_t before_wait_sending_function(void *d);
+static enum looper_wait_t before_wait_receiving_function(void *d);
+static enum looper_wait_t before_wait_capturing_function(void *d);
+static enum looper_wait_t before_wait_injecting_function(void *d);
 
-void ciqs_init_queues() {
-    if (!aq_new(&capture_send_q, sizeof(q_item_t), QUEUE_SIZE)) {
-        printf("error allocating capture->send queue\n");
-        return;
-    }
-    if (!aq_new(&receive_inject_q, sizeof(q_item_t), QUEUE_SIZE)) {
-        printf("error allocating receive->inject queue\n");
-        return;
+static enum looper_wait_t (*before_wait_functions[CIQS_NUM_QUEUES]) (void *d) = {before_wait_sending_function, before_wait_sending_function,
+                                                                               before_wait_receiving_function, before_wait_receiving_function,
+                                                                               before_wait_capturing_function, NULL,
+                                                                               before_wait_injecting_function, NULL};
+
+static void final_receiving_function(void *d);
+
+// only receiving has anything to free when its looper stops
+static void (*final_functions[CIQS_NUM_QUEUES]) (void *d) = {NULL, NULL,
+                                                             final_receiving_function, final_receiving_function,
+                                                             NULL, NULL,
+                                                             NULL, NULL};
+
+void ciqs_set_runtime(enum ciqs_runtime rt) {
+    runtime = rt;
+}
+
+void ciqs_set_io(enum ciqs_io i) {
+    io = i;
+}
+
+// allocates the lanes of a ring, all ringing the ring's doorbells
+static bool init_ring(struct ring_t * r) {
+    bool bell, room_bell;
+    bell = doorbell_init(&(r->bell));
+    room_bell = doorbell_init(&(r->room_bell));
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        if (!rq_new(&(r->lanes[l]), r->size)) {
+            printf("error allocating %s %s lane\n", r->name, lane_names[l]);
+            return false;
+        }
+        if (bell) rq_set_doorbell(r->lanes[l], &(r->bell));
+        if (room_bell) rq_set_room_doorbell(r->lanes[l], &(r->room_bell));
     }
+    r->turn = ciqs_lane_priority;
+    r->turn_left = r->weights[ciqs_lane_priority];
+    return true;
+}
+
+void ciqs_init_queues() {
+    if (!init_ring(&capture_send) || !init_ring(&receive_inject)) return;
     for (enum ciqs_queue q = CIQS_FIRST_QUEUE; q<CIQS_LAST_QUEUE; q++) {
             looper_init(&(ciqs[q].looper));
             ciqs[q].looper.function_to_run_first = init_functions[q];
-            ciqs[q].looper.function_to_repeat = looper_functions[q];
-            ciqs[q].looper.function_to_run_last = common_final_function;
+            ciqs[q].looper.function_to_poll = looper_functions[q];
+            ciqs[q].looper.function_to_run_last = final_functions[q];
+            ciqs[q].looper.function_before_wait = before_wait_functions[q];
             ciqs[q].looper.data = (void *) &(ciqs[q]);
+            set_thread_attr(&(ciqs[q].looper), &(thread_attrs[q]), queue_names[q]);
     }
     for (int i=0; i<NUM_QUEUES; i++) queues_running[i] = naq;
     last_queue = 0;
+    if (runtime == ciqs_reactor && !reactor_init(&reactor)) {
+        printf("error initializing reactor, using a thread per queue\n");
+        runtime = ciqs_threads;
+    }
+    if (runtime == ciqs_reactor) set_thread_attr(&(reactor.looper), &reactor_attr, "reactor");
+}
+
+void ciqs_set_latency_budget(enum ciqs_queue q, useconds_t budget) {
+    looper_change_latency_budget(&(ciqs[q].looper), budget);
+    // on the reactor all queues share one thread, so the thread polls for the largest budget
+    if (runtime == ciqs_reactor && budget > reactor.looper.latency_budget) looper_change_latency_budget(&(reactor.looper), budget);
+}
+
+static void start_looper(enum ciqs_queue q) {
+    if (runtime == ciqs_reactor) reactor_add(&reactor, &(ciqs[q].looper));
+    else looper_start(&(ciqs[q].looper));
 }
 
 void ciqs_start(enum ciqs_queue q, void * dataptr) {
     switch (q) {
         case sendq:
             ciqs[sendq].data.send_data.lp = (lisa *) dataptr;
-            looper_start(&(ciqs[sendq].looper));
+            start_looper(sendq);
             break;
         case altsendq:
             ciqs[altsendq].data.send_data.lp = (lisa *) dataptr;
-            looper_start(&(ciqs[altsendq].looper));
+            start_looper(altsendq);
             break;
         case receiveq:
             ciqs[receiveq].data.receive_data.lp = (lisa *) dataptr;
-            looper_start(&(ciqs[receiveq].looper));
+            start_looper(receiveq);
             break;
         case altreceiveq:
             ciqs[altreceiveq].data.receive_data.lp = (lisa *) dataptr;
-            looper_start(&(ciqs[altreceiveq].looper));
+            start_looper(altreceiveq);
             break;
         case captureq:
             ciqs[captureq].data.pcap_data.pcap_handle_ptr = (pcap_t **) dataptr;
             looper_nowait(&(ciqs[captureq].looper));
-            looper_start(&(ciqs[captureq].looper));
+            start_looper(captureq);
             break;
         case injectionq:
             ciqs[injectionq].data.pcap_data.pcap_handle_ptr = (pcap_t **) dataptr;
-            looper_start(&(ciqs[injectionq].looper));
+            start_looper(injectionq);
             break;
         case nlcaptureq:
-            looper_start(&(ciqs[nlcaptureq].looper));
+            start_looper(nlcaptureq);
             break;
         case nlinjectionq:
-            looper_start(&(ciqs[nlinjectionq].looper));
+            start_looper(nlinjectionq);
             break;
         case naq: break;
     }
     add_running_queue(q);
 }
 
-void ciqs_stop (enum ciqs_queue q)  { looper_stop(&(ciqs[q].looper)); del_running_queue(q); }
-void ciqs_pause(enum ciqs_queue q)  { looper_pause(&(ciqs[q].looper)); }
-void ciqs_resume(enum ciqs_queue q) { looper_resume(&(ciqs[q].looper)); }
+void ciqs_stop(enum ciqs_queue q) {
+    if (runtime == ciqs_reactor) reactor_remove(&reactor, &(ciqs[q].looper));
+    else looper_stop(&(ciqs[q].looper));
+    del_running_queue(q);
+}
+
+void ciqs_pause(enum ciqs_queue q) {
+    if (runtime == ciqs_reactor) reactor_pause(&reactor, &(ciqs[q].looper));
+    else looper_pause(&(ciqs[q].looper));
+}
+
+void ciqs_resume(enum ciqs_queue q) {
+    if (runtime == ciqs_reactor) reactor_resume(&reactor, &(ciqs[q].looper));
+    else looper_resume(&(ciqs[q].looper));
+}
 
 
 /**************************************************************************************************************************
@@ -235,47 +660,171 @@ void ciqs_resume(enum ciqs_queue q) { looper_resume(&(ciqs[q].looper)); }
  **************************************************************************************************************************/
 
  /***************
-  * sending
+  * overflow
   ***************/
 
-void common_final_function(void * d) {
+// waits on just fd for events (if it isn't already)
+static void wait_on_fd(struct looper_t * l, int fd, short events) {
+    if (l->num_wait_fds == 1 && l->wait_fds[1].fd == fd && l->wait_fds[1].events == events) return;
+    looper_clear_wait_fds(l);
+    if (fd >= 0) looper_add_wait_fd(l, fd, events);
+}
 
+// the lane for a frame (which starts with the radiotap header), anything that can't be told apart goes with data
+static enum ciqs_lane frame_lane(uint8_t * frame, uint32_t size) {
+    uint8_t type_subtype = get_type_subtype(frame, size);
+    if (type_subtype == BEACON) return ciqs_lane_beacon;
+    if (type_subtype < DATA || is_eapol(frame, size)) return ciqs_lane_priority;
+    return ciqs_lane_data;
+}
+
+// producer: a frame of size bytes doesn't fit in its lane, returns true if it is to be dropped, otherwise the producer
+// keeps it and waits for room
+static bool overflow(struct ring_t * r, enum ciqs_lane lane, uint32_t size) {
+    switch (r->policy) {
+        case ciqs_drop_newest:
+            r->dropped_newest++;
+            return true;
+        case ciqs_drop_beacons:
+            if (lane == ciqs_lane_beacon) {
+                r->dropped_newest++;
+                return true;
+            }
+            rq_want_room(r->lanes[lane], size);
+            break;
+        case ciqs_drop_oldest:
+            rq_want_room(r->lanes[lane], size);
+            break;
+        case ciqs_block:
+            break;
+    }
+    if (!r->waiting) r->waits++;
+    r->waiting = true;
+    return false;
+}
+
+// producer: got room for a frame in its lane, so it no longer needs the consumer to make room
+static void got_room(struct ring_t * r, enum ciqs_lane lane) {
+    if (!r->waiting) return;
+    r->waiting = false;
+    rq_want_room(r->lanes[lane], 0);
+}
+
+// producer: blocks until there is room for a frame of size bytes in its lane
+static enum looper_wait_t wait_for_room(struct ciqs_t * c, struct ring_t * r, enum ciqs_lane lane, uint32_t size) {
+    if (!r->lanes[lane]->room_doorbell) return looper_wait_sleep;
+    if (!c->looper.spinning) doorbell_arm(&(r->room_bell));     /* a spin doesn't block, so needn't be rung */
+    if (rq_reserve(r->lanes[lane], size)) return looper_wait_none;
+    wait_on_fd(&(c->looper), doorbell_fd(&(r->room_bell)), POLLIN);
+    return looper_wait_block;
+}
+
+// consumer: if the producer is waiting for room and the policy is drop-oldest, drops the oldest frames of the lane it is
+// waiting on to make it, except from the lane keep (if not -1), whose head is in use
+static void make_room(struct ring_t * r, int keep) {
+    if (r->policy != ciqs_drop_oldest) return;
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        if (l != keep) r->dropped_oldest += rq_drop_head_for_room(r->lanes[l]);
+    }
+}
+
+// consumer: whether to drop a queued frame instead of using it, i.e., a beacon while the producer is waiting for room
+static bool shed(struct ring_t * r, int lane, rq_record_t * item) {
+    int l;
+    if (r->policy != ciqs_drop_beacons || lane != ciqs_lane_beacon) return false;
+    for (l=0; l<CIQS_NUM_LANES && !rq_room_wanted(r->lanes[l]); l++);
+    if (l == CIQS_NUM_LANES) return false;
+    r->dropped_beacons++;
+    return true;
 }
 
  /***************
-  * sending
+  * lanes
   ***************/
 
-// sets the length of the packet from send q worker to receive q worker in the other VM, big endian
-static void set_length(uint8_t len[4], uint32_t size) {
-    len[3] = (uint8_t) size & 0x000000FF;
-    size >>= 8;
-    len[2] = (uint8_t) size & 0x000000FF;
-    size >>= 8;
-    len[1] = (uint8_t) size & 0x000000FF;
-    size >>= 8;
-    len[0] = (uint8_t) size & 0x000000FF;
+// the frames the consumer has from each lane of a ring, and how many of each it has used
+struct burst_t {
+    rq_record_t * items[CIQS_NUM_LANES][BURST_SIZE];
+    uint16_t n[CIQS_NUM_LANES];
+    uint16_t used[CIQS_NUM_LANES];
+};
+
+// consumer: whether any lane has frames
+static bool has_frames(struct ring_t * r) {
+    for (int l=0; l<CIQS_NUM_LANES; l++) if (rq_get_head(r->lanes[l])) return true;
+    return false;
 }
 
-static void set_timestamp (uint8_t timestamp[16], q_item_t * item){
-    /* marshal seconds and then nseconds both in BE format */
-    int i;
-    uint8_t byte;
-    uint64_t byte8;
-    byte8 = item->bignum_timestamp.sec;
-    for (i=0; i < 8; i++) {
-        byte = byte8 & (uint64_t) 0xFF;
-        timestamp[7-i] = byte;
-        byte8 = byte8 >> 8;
+// consumer: gets up to a burst of frames from each lane
+static void get_burst(struct ring_t * r, struct burst_t * b) {
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        b->n[l] = rq_get_head_n(r->lanes[l], b->items[l], BURST_SIZE);
+        b->used[l] = 0;
+    }
+}
+
+// consumer: picks the lane to use the next frame of the burst from, -1 if there are no frames left
+// the lanes are only looked at once per burst, so with the strict schedule a priority frame waits for at most a burst
+static int next_lane(struct ring_t * r, struct burst_t * b) {
+    int l;
+    if (r->schedule == ciqs_strict) {
+        for (l=0; l<CIQS_NUM_LANES; l++) if (b->used[l] < b->n[l]) return l;
+        return -1;
+    }
+    // weighted: the lane whose turn it is keeps it until it runs out of frames or has had its weight in frames
+    for (int i=0; i<=CIQS_NUM_LANES; i++) {
+        l = r->turn;
+        if (r->turn_left && b->used[l] < b->n[l]) {
+            r->turn_left--;
+            return l;
+        }
+        r->turn = (l + 1) % CIQS_NUM_LANES;
+        r->turn_left = r->weights[r->turn];
     }
-    byte8 = item->bignum_timestamp.nsec;
-    for (i=0; i < 8; i++) {
-        byte = byte8 & (uint64_t) 0xFF;
-        timestamp[15-i] = byte;
-        byte8 = byte8 >> 8;
+    return -1;
+}
+
+// consumer: releases the frames of the burst that were used
+static void used_burst(struct ring_t * r, struct burst_t * b) {
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        if (!b->used[l]) continue;
+        rq_used_head_n(r->lanes[l], b->used[l]);
+        r->frames[l] += b->used[l];
     }
 }
 
+ /***************
+  * sending
+  ***************/
+
+// writes the header of item, in the version the other side takes, and returns its size, with what is sent after it
+// in *data and *size: the record, or with v2 and a packed slot to compress into (see init_sending_function), that
+// compressed (starting the history over if it should)
+static int put_frame_header(uint8_t header[WIRE_MAX_HEADER_SIZE], rq_record_t * item, uint8_t * packed, uint8_t ** data,
+                            uint32_t * size) {
+    struct wire_header_t h;
+    h.version = atomic_load_explicit(&(wire.version), memory_order_relaxed);
+    h.flags = 0;
+    h.timestamp = (uint64_t) item->bignum_timestamp.sec * 1000000000ULL + (uint64_t) item->bignum_timestamp.nsec;
+    h.sequence = wire.sequence++;
+    h.source = wire.source;
+    *data = item->buffer;
+    *size = item->size;
+    if (packed && h.version >= WIRE_V2 && item->size <= LZ_MAX_FRAME) {
+        if (atomic_exchange(&(wire.key_wanted), false) || ++wire.since_key >= KEY_INTERVAL) {
+            lz_reset(&(wire.lz));
+            wire.since_key = 0;
+            h.flags |= WIRE_FLAG_KEY;
+        }
+        h.flags |= WIRE_FLAG_COMPRESSED;
+        *size = lz_compress(&(wire.lz), item->buffer, item->size, packed);
+        *data = packed;
+    }
+    else if (packed) atomic_store(&(wire.key_wanted), true);    /* a frame sent as it is isn't in the receivers' histories */
+    h.length = *size;
+    return wire_put_header(header, &h);
+}
+
 static void init_sending_function(void *d) {
     struct ciqs_t * q = (struct ciqs_t *) d;
     struct sending_data_t * sd = (struct sending_data_t *) &(q->data);
@@ -283,252 +832,940 @@ static void init_sending_function(void *d) {
     sd->len_processed = 0;
     sd->pkt_processed = 0;
     sd->in_process = 0;
+    sd->batch_n = sd->batch_done = sd->batch_released = 0;
+    sd->zerocopy_set = false;
+    sd->hello_size = sd->hello_sent = 0;
+    if (wire.compress && !sd->packed) {
+        if (!wire.source) printf("not compressing frames: wire compress needs a source\n");
+        else if (!(sd->packed = malloc(BURST_SIZE * PACKED_SIZE)) || (!wire.lz.history && !lz_init(&(wire.lz), true))) {
+            printf("error allocating for compression, not compressing frames\n");
+            free(sd->packed);
+            sd->packed = NULL;
+        }
+    }
+    looper_clear_wait_fds(&(q->looper));
+    if (capture_send.lanes[0]->doorbell) looper_add_wait_fd(&(q->looper), doorbell_fd(&(capture_send.bell)), POLLIN);
 }
 
- static void repeat_sending_function(void *d) {
-    bool q2_condition;
+static enum looper_wait_t before_wait_sending_function(void *d) {
     struct ciqs_t * ciqs_ptr = (struct ciqs_t *) d;
     struct sending_data_t *sd = (struct sending_data_t *) &(ciqs_ptr->data.send_data);
+    if (sd->lp->state < LISA_CONNECTED) return looper_wait_sleep;
+    if (sd->in_process) return looper_wait_none;      /* lisa_send waits for the socket itself */
+    if (sd->batch_done < sd->batch_n || sd->hello_sent < sd->hello_size) {   /* the socket is full, so wait for room in it */
+        wait_on_fd(&(ciqs_ptr->looper), lisa_get_send_fd(sd->lp), lisa_get_send_events(sd->lp));
+        return looper_wait_block;
+    }
+    if (sd->batch_released < sd->batch_done) {        /* the kernel isn't done with a zero-copy send, so wait for it */
+        if (!lisa_zerocopy_pending(sd->lp)) return looper_wait_none;
+        wait_on_fd(&(ciqs_ptr->looper), lisa_get_send_fd(sd->lp), 0);   /* its notice makes the socket poll with POLLERR */
+        return looper_wait_block;
+    }
+    if (!capture_send.lanes[0]->doorbell) return looper_wait_sleep;
+    wait_on_fd(&(ciqs_ptr->looper), doorbell_fd(&(capture_send.bell)), POLLIN);
+    if (!ciqs_ptr->looper.spinning) doorbell_arm(&(capture_send.bell));
+    if (has_frames(&capture_send) || atomic_load(&(wire.hello_wanted)) || atomic_load(&(wire.answer_wanted))) return looper_wait_none;
+    return looper_wait_block;
+}
+
+// sends as much of the item in process as possible, returns true once all of it has been sent
+static bool send_item(struct sending_data_t *sd) {
+    bool q2_condition;
+    q2_set_condition(q2_condition, (!DEBUG || (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || !is_beacon(sd->item->buffer, sd->item->size)))));
     if (!sd->in_process) {
-        if (sd->lp->state >= LISA_CONNECTED) sd->item = (q_item_t *) aq_get_head(capture_send_q);
-        if (sd->item) {
+        #ifdef FORCE_POWERSAVE_OFF
+        force_powersave_flag_off(sd->item->buffer, sd->item->size);
+        #endif
+        sd->in_process = 1;
+        sd->header_size = put_frame_header(sd->header, sd->item, sd->packed, &(sd->data), &(sd->size));
+        q2log(q2_condition, "got item to send");
+        q2log_wftype(q2_condition, sd->item->buffer, sd->item->size, "to send");
+    }
+    // as long as have not sent the header, just send it
+    if (sd->len_processed < (uint32_t) sd->header_size) {
+        sd->len_processed += lisa_cast(sd->lp, (char *) sd->header + sd->len_processed, sd->header_size - sd->len_processed);
+        q2log(q2_condition, "send header processed: %d, lp:%p", sd->len_processed, (void *) sd->lp);
+        q2log_hex(q2_condition, sd->header, sd->header_size);
+    }
+    // once sent the header, then send the rest of the one packet to send
+    if (sd->len_processed == (uint32_t) sd->header_size) {
+        sd->pkt_processed += lisa_cast(sd->lp, (char *) sd->data + sd->pkt_processed, sd->size - sd->pkt_processed);
+        assert(sd->pkt_processed <= sd->size);
+        if (sd->pkt_processed == sd->size) {
+            q2log(q2_condition, "sent %d, (%d)", sd->item->size, packets_sent++);
+            q2log_wftype(q2_condition, sd->item->buffer, sd->item->size, "sent");
+            packets_sent++;
+            sd->in_process = 0;
+            sd->len_processed = 0;
+            sd->pkt_processed = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// puts up to a burst of items from the capture lanes in a new batch, marshalling the header of each and gathering the
+// headers and records (in place in the lanes, unless compressed) into iov, and each header and record into a message
+// of its own
+static void fill_batch(struct sending_data_t *sd) {
+    bool q2_condition;
+    struct burst_t burst;
+    rq_record_t * item;
+    uint8_t * header;
+    uint8_t * data;
+    uint32_t bytes, size;
+    int lane, header_size;
+    make_room(&capture_send, -1);
+    get_burst(&capture_send, &burst);
+    sd->batch_n = sd->batch_done = sd->batch_released = 0;
+    sd->batch_sent = bytes = 0;
+    sd->iov_first = sd->iov_n = 0;
+    sd->msg_first = sd->msg_n = 0;
+    while (sd->batch_n < BURST_SIZE && (lane = next_lane(&capture_send, &burst)) >= 0) {
+        item = burst.items[lane][burst.used[lane]++];
+        sd->batch_lanes[sd->batch_n] = lane;
+        if (!shed(&capture_send, lane, item)) {
             #ifdef FORCE_POWERSAVE_OFF
-            force_powersave_flag_off(sd->item->buffer, sd->item->size);
+            force_powersave_flag_off(item->buffer, item->size);
             #endif
-            sd->in_process = 1;
-            q2_set_condition(q2_condition, (!DEBUG || (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || !is_beacon(sd->item->buffer, sd->item->size)))));
-            q2log(q2_condition, "got item to send");
-            q2log_wftype(q2_condition, sd->item->buffer, sd->item->size, "to send");
-        }
-    }
-    if (sd->in_process) {
-        // as long as have not sent the number of bytes, set the length and just send it
-        if (sd->len_processed < 4) {
-            set_length(sd->len, sd->item->size);
-            sd->len_processed += lisa_cast(sd->lp, (char *) sd->len + sd->len_processed, 4 - sd->len_processed);
-            q2log(q2_condition, "send len processed: %d, lp:%p", sd->len_processed, (void *) sd->lp);
-        }
-        if ( (4 <= sd->len_processed)  && (sd->len_processed < 20) )  {
-            set_timestamp(sd->timestamp, sd->item);
-            sd->len_processed += lisa_cast(sd->lp, (char *) sd->timestamp + (sd->len_processed - 4), 20  - sd->len_processed);
-            q2log(q2_condition, "send timestamp processed:");
-            q2log_hex(q2_condition, sd->timestamp, 16);
-        }
-        // once sent the length bytes, then send the rest of the one packet to send
-        if (sd->len_processed == 20) {
-            sd->pkt_processed += lisa_cast(sd->lp, (char *) sd->item->buffer + sd->pkt_processed, sd->item->size - sd->pkt_processed);
-            assert(sd->pkt_processed <= sd->item->size);
-            if (sd->pkt_processed == sd->item->size) {
-                q2log(q2_condition, "sent %d, (%d)", sd->item->size, packets_sent++);
-                q2log_wftype(q2_condition, sd->item->buffer, sd->item->size, "sent");
-                packets_sent++;
-                aq_used_head(capture_send_q);
-                sd->in_process = 0;
-                sd->len_processed = 0;
-                sd->pkt_processed = 0;
-            }
+            q2_set_condition(q2_condition, (!DEBUG || (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || lane != ciqs_lane_beacon))));
+            q2log_wftype(q2_condition, item->buffer, item->size, "to send");
+            header = sd->batch_headers[sd->batch_n];
+            header_size = put_frame_header(header, item, sd->packed ? sd->packed + sd->batch_n * PACKED_SIZE : NULL, &data, &size);
+            sd->iov[sd->iov_n].iov_base = header;
+            sd->iov[sd->iov_n++].iov_len = header_size;
+            sd->iov[sd->iov_n].iov_base = data;
+            sd->iov[sd->iov_n++].iov_len = size;
+            memset(&(sd->msgs[sd->msg_n]), 0, sizeof(sd->msgs[0]));
+            sd->msgs[sd->msg_n].msg_hdr.msg_iov = sd->iov + sd->iov_n - 2;
+            sd->msgs[sd->msg_n++].msg_hdr.msg_iovlen = 2;
+            bytes += header_size + size;
         }
+        sd->batch_ends[sd->batch_n++] = bytes;    /* a shed item ends where the one before it does */
+    }
+}
+
+// gives the items that have been sent back to their lanes, returns how many
+// if the kernel may still be reading from the batch (a zero-copy send of it isn't done), the whole batch, headers and
+// all, stays put until it is done; each lane's items went into the batch in order, so the ones sent are at its head
+static int release_batch(struct sending_data_t *sd) {
+    uint16_t used[CIQS_NUM_LANES] = {0};
+    int n;
+    if (sd->batch_released == sd->batch_done || lisa_zerocopy_pending(sd->lp)) return 0;
+    for (n = sd->batch_released; n < sd->batch_done; n++) used[sd->batch_lanes[n]]++;
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        if (!used[l]) continue;
+        rq_used_head_n(capture_send.lanes[l], used[l]);
+        capture_send.frames[l] += used[l];
     }
+    n = sd->batch_done - sd->batch_released;
+    sd->batch_released = sd->batch_done;
+    return n;
+}
+
+// sends as much of the rest of the batch as a stream socket will take in one call, returns the bytes sent
+static int send_stream(struct sending_data_t *sd) {
+    int rc, left;
+    if (sd->iov_first == sd->iov_n) return 0;
+    rc = lisa_sendv(sd->lp, sd->iov + sd->iov_first, sd->iov_n - sd->iov_first);
+    send_calls++;
+    // skips what was sent, so the next call picks up partway through an iov if that's where this one stopped
+    for (left = rc; left > 0; ) {
+        if ((size_t) left >= sd->iov[sd->iov_first].iov_len) left -= sd->iov[sd->iov_first++].iov_len;
+        else {
+            sd->iov[sd->iov_first].iov_base = (uint8_t *) sd->iov[sd->iov_first].iov_base + left;
+            sd->iov[sd->iov_first].iov_len -= left;
+            left = 0;
+        }
+    }
+    return rc;
+}
+
+// sends as many of the rest of the messages of the batch as a seqpacket or udp socket will take in one call, each
+// whole, returns the bytes sent
+static int send_messages(struct sending_data_t *sd) {
+    int rc, bytes;
+    if (sd->msg_first == sd->msg_n) return 0;
+    rc = lisa_sendmv(sd->lp, sd->msgs + sd->msg_first, sd->msg_n - sd->msg_first);
+    send_calls++;
+    for (bytes = 0; rc > 0; rc--, sd->msg_first++) bytes += sd->msgs[sd->msg_first].msg_hdr.msg_iov[0].iov_len + sd->msgs[sd->msg_first].msg_hdr.msg_iov[1].iov_len;
+    return (rc < 0) ? rc : bytes;
+}
+
+// says hello (see /ref src/wire.h) if it should, in between batches so that it can't land in the middle of a frame
+// (even offering only v1 over messages, where the answer is all that says the server is there at all)
+// returns true while some of it is still to be sent (the socket is full)
+static bool say_hello(struct sending_data_t *sd) {
+    struct iovec iov;
+    struct mmsghdr msg;
+    int rc;
+    if (sd->hello_sent == sd->hello_size) {
+        if (!atomic_exchange(&(wire.hello_wanted), false)) return false;
+        if (wire.max_version < WIRE_V2 && lisa_is_stream(sd->lp)) return false;
+        sd->hello_size = wire_put_hello(sd->hello, wire.max_version, wire.source);
+        sd->hello_sent = 0;
+    }
+    iov.iov_base = sd->hello + sd->hello_sent;
+    iov.iov_len = sd->hello_size - sd->hello_sent;
+    if (lisa_is_stream(sd->lp)) rc = lisa_sendv(sd->lp, &iov, 1);
+    else {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_hdr.msg_iov = &iov;
+        msg.msg_hdr.msg_iovlen = 1;
+        rc = lisa_sendmv(sd->lp, &msg, 1);
+        if (rc > 0) rc = iov.iov_len;
+    }
+    if (rc < 0) sd->hello_sent = sd->hello_size;    /* the lisa state says it failed */
+    else sd->hello_sent += rc;
+    return sd->hello_sent < sd->hello_size;
+}
+
+// sends as much of the batch as the socket will take in one call, starting a new batch if the last one is done with,
+// and releases the items that have been completely sent, returns how many were
+static int send_batch(struct sending_data_t *sd) {
+    uint32_t prev_end;
+    int rc, done;
+    if (!sd->zerocopy_set) {
+        sd->zerocopy_set = true;
+        if (capture_send.zerocopy && !lisa_set_zerocopy(sd->lp, capture_send.zerocopy)) printf("not using zero-copy sends: %s\n", sd->lp->debugmsg);
+    }
+    if (sd->batch_released == sd->batch_n) {
+        if (say_hello(sd)) return 0;
+        fill_batch(sd);
+    }
+    if (!sd->batch_n) return 0;
+    rc = lisa_is_stream(sd->lp) ? send_stream(sd) : send_messages(sd);
+    if (rc <= 0) return release_batch(sd);      /* all sent, the socket is full, or it failed (which the lisa state says) */
+    sd->batch_sent += rc;
+    prev_end = sd->batch_done ? sd->batch_ends[sd->batch_done - 1] : 0;
+    for (done = sd->batch_done; done < sd->batch_n && sd->batch_ends[done] <= sd->batch_sent; done++) {
+        if (sd->batch_ends[done] > prev_end) packets_sent++;
+        prev_end = sd->batch_ends[done];
+    }
+    rc = done - sd->batch_done;
+    sd->batch_done = done;
+    q2log((Q2PRINT_PROCESSING == 2) && rc, "sent %d items, %u of %u bytes of batch", rc, sd->batch_sent, sd->batch_ends[sd->batch_n - 1]);
+    return release_batch(sd) + rc;
+}
+
+static void print_zerocopy_stats() {
+    lisa * lp = ciqs[sendq].data.send_data.lp;
+    if (!lp || !lp->zerocopy) return;
+    printf("zero-copy sends:  %u of at least %u bytes (%u copied by the kernel after all, %u not done)\n", lp->zerocopy_sent,
+           lp->zerocopy, lp->zerocopy_copied, lp->zerocopy_sent - lp->zerocopy_done);
+}
+
+static void print_wire_stats() {
+    printf("wire: sending v%u (offering up to v%u) as source %u, frames received by source:\n",
+           atomic_load(&(wire.version)), wire.max_version, wire.source);
+    wire_print_sources(&(wire.sources));
+    if (wire.lz.history) lz_print_stats("compressed", &(wire.lz.stats));
+    if (wire.expanders.n || wire.expanders.others) {
+        printf("wire: frames expanded by source:\n");
+        lz_print_sources(&(wire.expanders));
+    }
+}
+
+static int cast_items(struct sending_data_t *sd);
+static int cast_messages(struct sending_data_t *sd);
+
+// a client sends batches, while a server casts each piece of each item to all its clients as before (or over seqpacket
+// or udp, each batch of items as messages)
+static int repeat_sending_function(void *d) {
+    struct ciqs_t * ciqs_ptr = (struct ciqs_t *) d;
+    struct sending_data_t *sd = (struct sending_data_t *) &(ciqs_ptr->data.send_data);
+    if (sd->lp->state < LISA_CONNECTED) return 0;
+    if (sd->lp->clsvr == LISA_CLIENT) return send_batch(sd);
+    if (!lisa_is_stream(sd->lp)) return cast_messages(sd);
+    return cast_items(sd);
+}
+
+// answers each client that said hello with a hello (see /ref src/wire.h) to just that client (whatever the highest
+// version this offers, since a client over messages waits for it), forgets the clients that are gone, and sends from
+// now on the lowest version any client offered (v1 if one never said hello)
+static void answer_hellos(struct sending_data_t *sd) {
+    SOCKET fds[MAX_CLIENTS], answers[MAX_CLIENTS];
+    uint8_t version = wire.max_version;
+    int n, num_answers = 0, c, i;
+    atomic_store(&(wire.answer_wanted), false);
+    pthread_mutex_lock(&(wire.clients_lock));
+    n = lisa_get_clients(sd->lp, fds, MAX_CLIENTS);    /* under the lock, so a client that just said hello is in it */
+    for (c = 0; c < wire.num_clients; ) {
+        for (i = 0; i < n && fds[i] != wire.clients[c].fd; i++);
+        if (i == n) wire.clients[c] = wire.clients[--wire.num_clients];
+        else c++;
+    }
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < wire.num_clients && wire.clients[c].fd != fds[i]; c++);
+        if (c == wire.num_clients) version = WIRE_V1;
+        else {
+            if (wire.clients[c].version < version) version = wire.clients[c].version;
+            if (wire.clients[c].answer_wanted) answers[num_answers++] = fds[i];
+            wire.clients[c].answer_wanted = false;
+        }
+    }
+    pthread_mutex_unlock(&(wire.clients_lock));
+    atomic_store(&(wire.version), n ? version : WIRE_V1);
+    if (!num_answers) return;
+    sd->hello_size = wire_put_hello(sd->hello, wire.max_version, wire.source);
+    for (i = 0; i < num_answers; i++) lisa_send_client(sd->lp, answers[i], (char *) sd->hello, sd->hello_size);
+    sd->hello_sent = sd->hello_size;
+}
+
+// casts a batch of items to all clients, each item a message of its own, returns how many items
+static int cast_messages(struct sending_data_t *sd) {
+    answer_hellos(sd);
+    fill_batch(sd);
+    if (!sd->batch_n) return 0;
+    if (sd->msg_n) {
+        lisa_castmv(sd->lp, sd->msgs, sd->msg_n);
+        send_calls++;
+        packets_sent += sd->msg_n;
+    }
+    sd->batch_done = sd->batch_n;
+    return release_batch(sd);
+}
+
+// casts up to a burst of items from the capture lanes, stopping early if an item could only be partly sent
+static int cast_items(struct sending_data_t *sd) {
+    struct burst_t burst;
+    int lane, work;
+    if (!sd->in_process) answer_hellos(sd);
+    make_room(&capture_send, sd->in_process ? sd->lane : -1);
+    get_burst(&capture_send, &burst);
+    for (work=0; work<BURST_SIZE; work++) {
+        // an item that was partly sent has to be finished before any other, whatever the schedule
+        lane = sd->in_process ? sd->lane : next_lane(&capture_send, &burst);
+        if (lane < 0 || burst.used[lane] == burst.n[lane]) break;
+        sd->item = burst.items[lane][burst.used[lane]];
+        if (!sd->in_process && shed(&capture_send, lane, sd->item)) {
+            burst.used[lane]++;
+            continue;
+        }
+        sd->lane = lane;
+        if (!send_item(sd)) break;
+        burst.used[lane]++;
+    }
+    used_burst(&capture_send, &burst);
+    return work;
 }
 
  /***************
   * receiving
   ***************/
 
-static uint32_t get_length(uint8_t len[4]) {
-    uint32_t size;
-    size = (uint32_t) len[0];
-    size <<= 8;
-    size += (uint32_t) len[1];
-    size <<= 8;
-    size += (uint32_t) len[2];
-    size <<= 8;
-    size += (uint32_t) len[3];
-    return size;
-}
-
-static void get_timestamp (uint8_t timestamp[16], q_item_t * item){
-    /* demarshal seconds and then nseconds both in BE format */
-    int i;
-    uint8_t byte;
-    uint64_t byte8;
-    byte8 = 0;
-    for (i=0; i< 8; i++) {
-        byte = timestamp[i];
-        byte8 += byte;
-        if (i<7) byte8 = byte8 << 8;
-    }
-    item->bignum_timestamp.sec = byte8;
-    byte8 = 0;
-    for (i=8; i< 16; i++) {
-        byte = timestamp[i];
-        byte8 += byte;
-        if (i<15) byte8 = byte8 << 8;
-    }
-    item->bignum_timestamp.nsec = byte8;
-    item->bignum_timestamp.positive = true;
+// the other side offers (at most) the version of its hello; a server keeps what each client offered, for send to
+// answer that client with its own hello (and start its history over, since the client has none of it)
+static void heard_hello(struct receiving_data_t *rd, const struct wire_header_t * h) {
+    uint8_t version = (h->version < wire.max_version) ? h->version : wire.max_version;
+    SOCKET fd;
+    int c;
+    q2log(Q2PRINT_PROCESSING, "hello from source %u offering v%u, sending v%u", h->source, h->version, version);
+    if (version < WIRE_V1) return;
+    if (rd->lp->clsvr != LISA_SERVER) {
+        atomic_store(&(wire.version), version);
+        atomic_store(&(wire.hello_heard), true);
+        return;
+    }
+    fd = rd->from;
+    pthread_mutex_lock(&(wire.clients_lock));
+    for (c = 0; c < wire.num_clients && wire.clients[c].fd != fd; c++);
+    if (c == wire.num_clients && c < MAX_CLIENTS) wire.clients[wire.num_clients++].fd = fd;
+    if (c < wire.num_clients) {
+        wire.clients[c].version = version;
+        wire.clients[c].answer_wanted = true;
+    }
+    pthread_mutex_unlock(&(wire.clients_lock));
+    atomic_store(&(wire.key_wanted), true);
+    atomic_store(&(wire.answer_wanted), true);
+    doorbell_ring(&(capture_send.bell));
 }
 
+void ciqs_say_hello() {
+    atomic_store(&(wire.version), WIRE_V1);        /* until the server answers, it may only take v1 */
+    atomic_store(&(wire.hello_heard), false);
+    atomic_store(&(wire.key_wanted), true);
+    atomic_store(&(wire.hello_wanted), true);
+    doorbell_ring(&(capture_send.bell));
+}
+
+void ciqs_send_on_stream() {
+    struct sending_data_t *sd = &(ciqs[sendq].data.send_data);
+    sd->iov_first = 2 * sd->msg_first;      /* each message of the batch is a header and a record, in order */
+    sd->msg_first = sd->msg_n;
+    sd->hello_sent = sd->hello_size;        /* said again once connected */
+    sd->zerocopy_set = false;
+}
+
+bool ciqs_heard_hello(int seconds) {
+    for (int waited = 0; !atomic_load(&(wire.hello_heard)); waited++) {
+        if (waited >= seconds * 100) return false;
+        usleep(10000);
+    }
+    return true;
+}
+
+// hellos are taken here and frames that this side sent (and a relay sent back) are dropped, returns true for the rest
+static bool is_frame(struct receiving_data_t *rd, const struct wire_header_t * h) {
+    if (h->flags & WIRE_FLAG_HELLO) {
+        heard_hello(rd, h);
+        return false;
+    }
+    if (wire.source && h->version >= WIRE_V2 && h->source == wire.source) {
+        packets_echoed++;
+        return false;
+    }
+    return true;
+}
 
 static void init_receiving_function(void *d) {
     struct ciqs_t * ciqs = (struct ciqs_t *) d;
     struct receiving_data_t *rd = (struct receiving_data_t *) &(ciqs->data);
-    rd->bytes_received = rd->bytes_to_receive = 0;
-    rd->len_received = 0;
-    rd->item = NULL;
+    if (!rd->spare) rd->spare = malloc(RECEIVE_BUFFER_SIZE);
+    if (!rd->spare) printf("error allocating receive buffer\n");
+    if (!rd->slots) rd->slots = malloc(RECEIVE_MESSAGES * MESSAGE_SLOT_SIZE);
+    if (!rd->slots) printf("error allocating receive slots\n");
+    for (int i=0; rd->slots && i<RECEIVE_MESSAGES; i++) {
+        rd->slot_iov[i].iov_base = rd->slots + i * MESSAGE_SLOT_SIZE;
+        rd->slot_iov[i].iov_len = MESSAGE_SLOT_SIZE;
+        memset(&(rd->messages[i]), 0, sizeof(rd->messages[i]));
+        rd->messages[i].msg_hdr.msg_iov = &(rd->slot_iov[i]);
+        rd->messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    rd->message_next = rd->message_n = 0;
+    rd->expanded_from = NULL;
+    for (int i=0; i<MAX_CLIENTS; i++) {
+        rd->streams[i].fd = -1;
+        rd->streams[i].start = rd->streams[i].end = 0;
+        rd->streams[i].discard_left = 0;
+    }
+    rd->stream = NULL;
+    rd->from = -1;
+    rd->waiting = false;
 }
 
- static void repeat_receiving_function(void *d) {
-    bool q2_condition;
+static void final_receiving_function(void *d) {
+    struct ciqs_t * ciqs = (struct ciqs_t *) d;
+    struct receiving_data_t *rd = (struct receiving_data_t *) &(ciqs->data);
+    free(rd->spare);
+    rd->spare = NULL;
+    for (int i=0; i<MAX_CLIENTS; i++) {
+        free(rd->streams[i].buffer);
+        rd->streams[i].buffer = NULL;
+    }
+    free(rd->slots);
+    rd->slots = NULL;
+}
+
+static enum looper_wait_t before_wait_receiving_function(void *d) {
     struct ciqs_t * ciqs_ptr = (struct ciqs_t *) d;
     struct receiving_data_t *rd = (struct receiving_data_t *) &(ciqs_ptr->data.receive_data);
-    if  (rd->lp->state >= LISA_CONNECTED) {
-        if (rd->len_received < 4) {
-            rd->len_received += lisa_recv(rd->lp, (char *) rd->len + rd->len_received, 4 - rd->len_received);
-            q2log((Q2PRINT_PROCESSING ==2) && rd->len_received, "len_received: %d, lp:%p", rd->len_received, (void *) rd->lp);
-        }
-        if (rd->len_received == 4) {
-            rd->bytes_to_receive = get_length(rd->len);
-        }
-        if ( (4 <= rd->len_received) && (rd->len_received < 20) )  {
-            rd->len_received += lisa_recv(rd->lp, (char *) rd->timestamp + (rd->len_received - 4), 20 - rd->len_received);
-            q2log((Q2PRINT_PROCESSING ==2) && rd->len_received, "len_received: %d, lp:%p", rd->len_received, (void *) rd->lp);
-        }
-        if (rd->len_received == 20) {
-            rd->item = (q_item_t *) aq_get_tail(receive_inject_q);
-            if (!(rd->item)) {
-                printf("*** no space left in receive_inject_q, can't receive right now ...\n");
-                return;
-            }
-            get_timestamp(rd->timestamp, rd->item);
-        }
-        if (rd->len_received >= 20) {
-            if (!(rd->item)) return;
-            q2log((Q2PRINT_PROCESSING == 2), "bytes to receive: %d, lp:%p", rd->bytes_to_receive, (void *) rd->lp);
-            assert(rd->bytes_to_receive <= BUFFER_SIZE);
-            rd->item->size = rd->bytes_to_receive;
-            rd->bytes_received += lisa_recv(rd->lp, (char *) rd->item->buffer + rd->bytes_received, rd->bytes_to_receive - rd->bytes_received);
-            assert(rd->bytes_received <= rd->bytes_to_receive);
-            if (rd->bytes_received == rd->bytes_to_receive) {
-                aq_put_tail(receive_inject_q);
-                packets_received++;
-                q2_set_condition(q2_condition, (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || !is_beacon(rd->item->buffer, rd->item->size))));
-                q2log(q2_condition, "received %d (%d)", rd->bytes_received, packets_received);
-                q2log_wftype(q2_condition, rd->item->buffer, rd->item->size, "received");
-                rd->len_received = 0;
-                rd->len_received = rd->bytes_received = rd->bytes_to_receive = 0;
-                rd->item = NULL;
-            }
+    SOCKET fds[LOOPER_MAX_WAIT_FDS];
+    int n;
+    if (rd->waiting) return wait_for_room(ciqs_ptr, &receive_inject, rd->lane, rd->wait_size);
+    n = lisa_get_recv_fds(rd->lp, fds, LOOPER_MAX_WAIT_FDS);
+    if (!n) return looper_wait_sleep;
+    looper_clear_wait_fds(&(ciqs_ptr->looper));
+    for (int i=0; i<n; i++) looper_add_wait_fd(&(ciqs_ptr->looper), fds[i], POLLIN);
+    return looper_wait_block;
+}
+
+// the bytes of frame after the header h, expanded if they were compressed (only once, even if the frame then waits for
+// room, since that adds it to the history), returns their size, or -1 if they couldn't be expanded
+static int frame_data(struct receiving_data_t *rd, uint8_t * frame, const struct wire_header_t * h, const uint8_t ** data) {
+    if (!(h->flags & WIRE_FLAG_COMPRESSED)) {
+        *data = frame + h->size;
+        return h->length;
+    }
+    if (rd->expanded_from != frame) {
+        rd->expanded_from = frame;
+        rd->expanded_size = lz_expand_from(&(wire.expanders), h->source, h->sequence, h->flags & WIRE_FLAG_KEY,
+                                           frame + h->size, h->length, &(rd->expanded));
+    }
+    *data = rd->expanded;
+    return rd->expanded_size;
+}
+
+// puts a frame as it was sent (the header h, then the frame, maybe compressed) in its lane, returns 1 if it did, 0 if
+// it was dropped, or -1 if it has to wait for room
+static int take_frame(struct receiving_data_t *rd, uint8_t * frame, const struct wire_header_t * h, bool added[CIQS_NUM_LANES]) {
+    bool q2_condition;
+    rq_record_t * item;
+    enum ciqs_lane lane;
+    const uint8_t * data;
+    int rc;
+    uint32_t size;
+    rc = frame_data(rd, frame, h, &data);
+    if (rc < 0 || (uint32_t) rc > rq_max_record(receive_inject.lanes[0])) {
+        if (rc >= 0) packets_too_big++;
+        rd->expanded_from = NULL;
+        wire_count(&(wire.sources), h);
+        return 0;
+    }
+    size = (uint32_t) rc;
+    lane = frame_lane((uint8_t *) data, size);
+    item = rq_reserve(receive_inject.lanes[lane], size);
+    if (!item) {
+        if (!overflow(&receive_inject, lane, size)) {
+            rd->waiting = true;
+            rd->lane = lane;
+            rd->wait_size = size;
+            return -1;
+        }
+        rd->expanded_from = NULL;
+        wire_count(&(wire.sources), h);
+        return 0;
+    }
+    got_room(&receive_inject, lane);
+    rd->expanded_from = NULL;
+    wire_count(&(wire.sources), h);
+    item->bignum_timestamp.sec = h->timestamp / 1000000000ULL;
+    item->bignum_timestamp.nsec = h->timestamp % 1000000000ULL;
+    item->bignum_timestamp.positive = true;
+    memcpy(item->buffer, data, size);
+    rq_add(receive_inject.lanes[lane], size);
+    added[lane] = true;
+    packets_received++;
+    q2_set_condition(q2_condition, (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || lane != ciqs_lane_beacon)));
+    q2log(q2_condition, "received %d (%d)", size, packets_received);
+    q2log_wftype(q2_condition, item->buffer, size, "received");
+    return 1;
+}
+
+// the socket lisa last received from: for a server the client, for a client its own
+static SOCKET received_from(lisa *lp) {
+    return (lp->clsvr == LISA_SERVER) ? lp->recv_fd : lp->fd;
+}
+
+// the stream of fd, taking a free one (and letting go of those of clients that are gone, as sending does with
+// wire.clients) if it has none yet, returns NULL if there is none free
+static struct receive_stream_t * receive_stream(struct receiving_data_t *rd, SOCKET fd) {
+    struct receive_stream_t *s, *taken = NULL;
+    SOCKET fds[MAX_CLIENTS];
+    int i, n;
+    for (s = rd->streams; s < rd->streams + MAX_CLIENTS; s++) if (s->fd == fd) return s;
+    n = lisa_get_clients(rd->lp, fds, MAX_CLIENTS);
+    for (s = rd->streams; s < rd->streams + MAX_CLIENTS; s++) {
+        for (i = 0; i < n && fds[i] != s->fd; i++);
+        if (i == n) {
+            s->fd = -1;
+            if (!taken) taken = s;
+        }
+    }
+    if (!taken) return NULL;
+    if (!taken->buffer) taken->buffer = malloc(RECEIVE_BUFFER_SIZE);
+    if (!taken->buffer) return NULL;
+    taken->fd = fd;
+    taken->start = taken->end = 0;
+    taken->discard_left = 0;
+    return taken;
+}
+
+// puts the complete frames in the buffer of the stream in their lanes, stopping at one that isn't all there yet or has to wait for
+// room, and then hands them all to inject at once
+// returns how many frames it took
+static int parse_frames(struct receiving_data_t *rd) {
+    bool added[CIQS_NUM_LANES] = {false};
+    struct wire_header_t h;
+    uint8_t * frame;
+    uint32_t skip;
+    struct receive_stream_t *s = rd->stream;
+    int rc, header_size, n = 0;
+    rd->waiting = false;
+    rd->from = s->fd;
+    while (s->start < s->end) {
+        if (s->discard_left) {
+            skip = (s->end - s->start < s->discard_left) ? s->end - s->start : s->discard_left;
+            s->start += skip;
+            s->discard_left -= skip;
+            continue;
+        }
+        frame = s->buffer + s->start;
+        header_size = wire_get_header(frame, s->end - s->start, &h);
+        if (header_size == 0) break;
+        if (header_size < 0) {     /* there's no telling where the next frame starts, so drop all there is */
+            printf("*** received bytes that don't start with a frame header, dropping %u bytes\n", s->end - s->start);
+            s->start = s->end;
+            break;
+        }
+        if (h.length > rq_max_record(receive_inject.lanes[0]) || h.length > RECEIVE_BUFFER_SIZE - WIRE_MAX_HEADER_SIZE) {
+            printf("*** received frame of %u bytes is too big, dropping it\n", h.length);
+            packets_too_big++;
+            s->start += header_size;
+            s->discard_left = h.length;
+            continue;
+        }
+        if (s->end - s->start < header_size + h.length) break;
+        if (is_frame(rd, &h)) {
+            rc = take_frame(rd, frame, &h, added);
+            if (rc < 0) break;
+            n += rc;
+        }
+        s->start += header_size + h.length;
+    }
+    for (int l=0; l<CIQS_NUM_LANES; l++) if (added[l]) rq_publish(receive_inject.lanes[l]);
+    if (s->start == s->end) s->start = s->end = 0;
+    return n;
+}
+
+// puts the frames of the messages received in their lanes, each message one frame as it was sent, stopping at one that
+// has to wait for room, and then hands them all to inject at once
+// returns how many frames it took
+static int take_messages(struct receiving_data_t *rd) {
+    bool added[CIQS_NUM_LANES] = {false};
+    struct mmsghdr * message;
+    struct wire_header_t h;
+    uint8_t * frame;
+    int rc, header_size, n = 0;
+    rd->waiting = false;
+    for (; rd->message_next < rd->message_n; rd->message_next++) {
+        message = &(rd->messages[rd->message_next]);
+        frame = message->msg_hdr.msg_iov->iov_base;
+        header_size = wire_get_header(frame, message->msg_len, &h);
+        if (header_size <= 0 || (message->msg_hdr.msg_flags & MSG_TRUNC) || header_size + h.length != message->msg_len
+            || h.length > rq_max_record(receive_inject.lanes[0])) {
+            printf("*** received message of %u bytes is not a frame that fits, dropping it\n", message->msg_len);
+            packets_too_big++;
+            continue;
         }
+        if (!is_frame(rd, &h)) continue;
+        rc = take_frame(rd, frame, &h, added);
+        if (rc < 0) break;
+        n += rc;
+    }
+    for (int l=0; l<CIQS_NUM_LANES; l++) if (added[l]) rq_publish(receive_inject.lanes[l]);
+    return n;
+}
+
+// receives a burst of messages, each into a slot of its own, and takes the frames out of them
+static int receive_messages(struct receiving_data_t *rd) {
+    int rc, work;
+    if (!rd->slots) return 0;
+    // the messages left over from the last burst, the first of which was waiting for room, go first
+    work = (rd->message_next < rd->message_n) ? take_messages(rd) : 0;
+    if (rd->waiting) return work;
+    if (runtime == ciqs_reactor) rc = lisa_recvmv_nowait(rd->lp, rd->messages, RECEIVE_MESSAGES);
+    else rc = lisa_recvmv(rd->lp, rd->messages, RECEIVE_MESSAGES);
+    if (rc <= 0) return work;
+    q2log((Q2PRINT_PROCESSING == 2), "received %d messages, lp:%p", rc, (void *) rd->lp);
+    rd->message_next = 0;
+    rd->message_n = rc;
+    rd->from = received_from(rd->lp);
+    return work + 1 + take_messages(rd);
+}
+
+// receives as much as there is room for after what is left of any stream, adds it to the stream it is from and takes
+// the frames out of that
+static int repeat_receiving_function(void *d) {
+    struct ciqs_t * ciqs_ptr = (struct ciqs_t *) d;
+    struct receiving_data_t *rd = (struct receiving_data_t *) &(ciqs_ptr->data.receive_data);
+    struct receive_stream_t *s;
+    uint32_t most_left = 0;
+    uint8_t *buffer;
+    int rc, work;
+    if (rd->lp->state < LISA_CONNECTED || !rd->spare) return 0;
+    if (!lisa_is_stream(rd->lp)) return receive_messages(rd);
+    // a frame that was waiting for room goes first
+    work = rd->waiting ? parse_frames(rd) : 0;
+    if (rd->waiting) return work;
+    // what is left of a stream is at most the frame it starts, which fits in the buffer, so this always takes something
+    for (s = rd->streams; s < rd->streams + MAX_CLIENTS; s++) if (s->end - s->start > most_left) most_left = s->end - s->start;
+    // on the reactor thread lisa_recv must not wait for data, since that would hold up every other queue
+    if (runtime == ciqs_reactor) rc = lisa_recv_nowait(rd->lp, (char *) rd->spare, RECEIVE_BUFFER_SIZE - most_left);
+    else rc = lisa_recv(rd->lp, (char *) rd->spare, RECEIVE_BUFFER_SIZE - most_left);
+    if (rc <= 0) return work;
+    q2log((Q2PRINT_PROCESSING == 2), "received %d bytes, lp:%p", rc, (void *) rd->lp);
+    s = receive_stream(rd, received_from(rd->lp));
+    if (!s) {
+        printf("*** received from more clients than there are streams for, dropping %d bytes\n", rc);
+        return work + 1;
+    }
+    if (s->start == s->end) {     /* nothing is left of the stream, so what was received becomes its buffer */
+        buffer = s->buffer;
+        s->buffer = rd->spare;
+        rd->spare = buffer;
+        s->start = 0;
+        s->end = rc;
+    }
+    else {
+        memmove(s->buffer, s->buffer + s->start, s->end - s->start);
+        s->end -= s->start;
+        s->start = 0;
+        memcpy(s->buffer + s->end, rd->spare, rc);
+        s->end += rc;
     }
+    rd->stream = s;
+    return work + 1 + parse_frames(rd);
 }
 
 /**************************************
     capture
  **************************************/
 
+// opens in immediate mode so that packets are handed over (and the fd becomes ready) as soon as they arrive
+static pcap_t * open_pcap() {
+    pcap_t * pcap_handle;
+    pcap_handle = pcap_create(PCAP_DEVICE, pcap_errbuf);
+    if (!pcap_handle) return NULL;
+    pcap_set_snaplen(pcap_handle, MAX_FRAME_SIZE);
+    pcap_set_promisc(pcap_handle, 1);
+    pcap_set_timeout(pcap_handle, 600);
+    pcap_set_immediate_mode(pcap_handle, 1);
+    if (pcap_activate(pcap_handle) < 0) {
+        printf("error activating pcap: %s\n", pcap_geterr(pcap_handle));
+        pcap_close(pcap_handle);
+        return NULL;
+    }
+    return pcap_handle;
+}
+
  static void init_capturing_function(void *d) {
     struct ciqs_t * ciqs = (struct ciqs_t *) d;
     pcap_t ** ptr2_pcap_handle = ciqs->data.pcap_data.pcap_handle_ptr;
+    int fd;
     if (!*ptr2_pcap_handle) {
         q2log(Q2PRINT_CAPTURED, "opening pcap\n");
-        *ptr2_pcap_handle = pcap_open_live(PCAP_DEVICE, BUFFER_SIZE, 1, 600, pcap_errbuf);
+        *ptr2_pcap_handle = open_pcap();
         if (!*ptr2_pcap_handle) {
             printf("error opening pcap for capture\n");
         }
         else pcap_setnonblock(*ptr2_pcap_handle, 1, pcap_errbuf);
     }
+    ciqs->data.pcap_data.drained = 0;
+    ciqs->data.pcap_data.pending_data = NULL;
+    fd = (*ptr2_pcap_handle) ? pcap_get_selectable_fd(*ptr2_pcap_handle) : -1;
+    ciqs->data.pcap_data.fd = fd;
+    looper_clear_wait_fds(&(ciqs->looper));
+    if (fd >= 0) looper_add_wait_fd(&(ciqs->looper), fd, POLLIN);
 }
 
- static void repeat_capturing_function(void *d) {
+// captures up to a burst of packets, putting each in the capture queue or, if it doesn't fit, doing what the overflow
+// policy says: keeping it to put in once there is room or dropping it
+ static int repeat_capturing_function(void *d) {
     bool q2_condition;
     struct timespec now;
     struct ciqs_t * ciqs = (struct ciqs_t *) d;
-    pcap_t ** ptr2_pcap_handle = (pcap_t **) ciqs->data.pcap_data.pcap_handle_ptr;
-    q_item_t * new_item;
-    struct pcap_pkthdr *pkt_header;
-    const u_char *pkt_data;
-    int rc;
+    struct pcap_data_t * pd = &(ciqs->data.pcap_data);
+    pcap_t ** ptr2_pcap_handle = (pcap_t **) pd->pcap_handle_ptr;
+    rq_record_t * new_item;
+    uint32_t size;
+    int rc, work;
+    work = 0;
     if (*ptr2_pcap_handle) {
-        new_item = (q_item_t *) aq_get_tail(capture_send_q);
-        if (!new_item) {
-            printf("error, capture_send_q is full, can't process capture now\n");
-        }
-        else {
-            rc = pcap_next_ex(*ptr2_pcap_handle, &pkt_header,  &pkt_data);
-            if (rc>0) {
-                if (clock_gettime(CLOCK_REALTIME, &now)<0) bignum_sec_assigns(&(new_item->bignum_timestamp), true, 0, 0);
-                else bignum_sec_assigns(&(new_item->bignum_timestamp), true, now.tv_sec, now.tv_nsec);
+        for (int i=0; i<BURST_SIZE; i++) {
+            if (!pd->pending_data) {
+                rc = pcap_next_ex(*ptr2_pcap_handle, &(pd->pending_header), &(pd->pending_data));
+                pd->drained = (rc <= 0);
+                if (rc<=0) {
+                    pd->pending_data = NULL;
+                    return work;
+                }
+                if (clock_gettime(CLOCK_REALTIME, &now)<0) bignum_sec_assigns(&(pd->pending_timestamp), true, 0, 0);
+                else bignum_sec_assigns(&(pd->pending_timestamp), true, now.tv_sec, now.tv_nsec);
                 packets_captured++;
                 #ifdef SKIP_ACKS
-                if (is_ack((uint8_t *) pkt_data, pkt_header->caplen)) return;
+                if (is_ack((uint8_t *) pd->pending_data, pd->pending_header->caplen)) {
+                    pd->pending_data = NULL;
+                    continue;
+                }
                 #endif
-                new_item->size = (pkt_header->caplen < BUFFER_SIZE) ? pkt_header->caplen : BUFFER_SIZE;
-                memcpy(new_item->buffer, pkt_data, new_item->size);
-                aq_put_tail(capture_send_q);
-                q2_set_condition(q2_condition, (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || is_beacon((uint8_t *) pkt_data, pkt_header->caplen))));
-                q2log(q2_condition, "captured %d (%d)", pkt_header->caplen, packets_captured);
-                q2log_wftype(q2_condition, (uint8_t *) pkt_data, pkt_header->caplen, "captured");
+                pd->pending_lane = frame_lane((uint8_t *) pd->pending_data, pd->pending_header->caplen);
+            }
+            size = (pd->pending_header->caplen < MAX_FRAME_SIZE) ? pd->pending_header->caplen : MAX_FRAME_SIZE;
+            new_item = rq_reserve(capture_send.lanes[pd->pending_lane], size);
+            if (!new_item) {
+                if (size > rq_max_record(capture_send.lanes[pd->pending_lane])) packets_too_big++;
+                else if (!overflow(&capture_send, pd->pending_lane, size)) return work;
+                pd->pending_data = NULL;
+                work++;
+                continue;
             }
+            got_room(&capture_send, pd->pending_lane);
+            bignum_sec_assign(&(new_item->bignum_timestamp), &(pd->pending_timestamp));
+            memcpy(new_item->buffer, pd->pending_data, size);
+            rq_commit(capture_send.lanes[pd->pending_lane], size);
+            work++;
+            q2_set_condition(q2_condition, (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || is_beacon((uint8_t *) pd->pending_data, pd->pending_header->caplen))));
+            q2log(q2_condition, "captured %d (%d)", pd->pending_header->caplen, packets_captured);
+            q2log_wftype(q2_condition, (uint8_t *) pd->pending_data, pd->pending_header->caplen, "captured");
+            pd->pending_data = NULL;
         }
     }
     else printf("error: no pcap handle!\n");
+    return work;
  }
 
+static enum looper_wait_t before_wait_capturing_function(void *d) {
+    struct ciqs_t * ciqs = (struct ciqs_t *) d;
+    struct pcap_data_t * pd = &(ciqs->data.pcap_data);
+    pcap_t ** ptr2_pcap_handle = (pcap_t **) pd->pcap_handle_ptr;
+    uint32_t size;
+    if (!*ptr2_pcap_handle) return looper_wait_sleep;
+    if (pd->pending_data) {     /* waiting for send to make room */
+        size = (pd->pending_header->caplen < MAX_FRAME_SIZE) ? pd->pending_header->caplen : MAX_FRAME_SIZE;
+        return wait_for_room(ciqs, &capture_send, pd->pending_lane, size);
+    }
+    wait_on_fd(&(ciqs->looper), pd->fd, POLLIN);
+    if (!pd->drained) return looper_wait_none;   /* pcap may still have packets buffered */
+    return looper_wait_block;
+}
+
 
 /**********************************************************
     injection
  **********************************************************/
 
+// with the uring io, inject writes each burst to the pcap socket (which is all pcap_inject does for each frame) in one
+// submission, straight from the receive_inject lanes, which are registered with the ring so that the kernel maps them
+// once rather than for every write (if they can't be, e.g., for the memlock limit, it writes from them unregistered)
+static void init_inject_uring(struct pcap_data_t * pd, pcap_t * pcap_handle) {
+    struct iovec lanes[CIQS_NUM_LANES];
+    if (pd->inject_uring) return;
+    pd->fd = pcap_get_selectable_fd(pcap_handle);
+    if (pd->fd < 0 || !uring_init(&(pd->uring), BURST_SIZE)) {
+        printf("not injecting through io_uring (%s), using pcap_inject\n", pd->fd < 0 ? "no pcap fd" : strerror(errno));
+        return;
+    }
+    for (int l=0; l<CIQS_NUM_LANES; l++) {
+        lanes[l].iov_base = receive_inject.lanes[l]->data;
+        lanes[l].iov_len = receive_inject.lanes[l]->size;
+    }
+    pd->inject_fixed = uring_register_buffers(&(pd->uring), lanes, CIQS_NUM_LANES);
+    if (!pd->inject_fixed) printf("not registering the receive_inject lanes with io_uring: %s\n", strerror(errno));
+    pd->inject_uring = true;
+}
+
 static void init_injecting_function(void *d) {
     struct ciqs_t * ciqs = (struct ciqs_t *) d;
     pcap_t ** ptr2_pcap_handle = (pcap_t **) ciqs->data.pcap_data.pcap_handle_ptr;
     if (!*ptr2_pcap_handle) {
-        *ptr2_pcap_handle = pcap_open_live(PCAP_DEVICE, BUFFER_SIZE, 1, 600, pcap_errbuf);
+        *ptr2_pcap_handle = open_pcap();
         if (!*ptr2_pcap_handle) {
             printf("error opening pcap for injection\n");
         }
     }
+    if (io == ciqs_io_uring && *ptr2_pcap_handle) init_inject_uring(&(ciqs->data.pcap_data), *ptr2_pcap_handle);
+    looper_clear_wait_fds(&(ciqs->looper));
+    if (receive_inject.lanes[0]->doorbell) looper_add_wait_fd(&(ciqs->looper), doorbell_fd(&(receive_inject.bell)), POLLIN);
 }
 
-static void repeat_injecting_function(void *d) {
+static void inject_item(pcap_t * pcap_handle, rq_record_t * item) {
     bool q2_condition;
-    struct ciqs_t * ciqs = (struct ciqs_t *) d;
-    pcap_t ** ptr2_pcap_handle = (pcap_t **) ciqs->data.pcap_data.pcap_handle_ptr;
-    if (!ptr2_pcap_handle) {
-        printf("error: no open pcap handle for injection\n");
-        return;
-    }
     int rc;
-    q_item_t *item;
-    item = (q_item_t *) aq_get_head(receive_inject_q);
-    if (item) {
-        q2_set_condition(q2_condition, (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || !is_beacon(item->buffer, item->size))));
-        q2log(q2_condition, "injecting packet %d", packets_injected);
-        q2log_wftype(q2_condition, item->buffer, item->size, "injecting");
-        rc = pcap_inject(*ptr2_pcap_handle, item->buffer, item->size);
-        q2log(q2_condition, "injected packet %d", packets_injected);
-        if (rc == PCAP_ERROR) printf("error injecting: %s\n", pcap_geterr(*ptr2_pcap_handle));
+    q2_set_condition(q2_condition, (Q2PRINT_PROCESSING && (Q2PRINT_BEACONS || !is_beacon(item->buffer, item->size))));
+    q2log(q2_condition, "injecting packet %d", packets_injected);
+    q2log_wftype(q2_condition, item->buffer, item->size, "injecting");
+    rc = pcap_inject(pcap_handle, item->buffer, item->size);
+    q2log(q2_condition, "injected packet %d", packets_injected);
+    if (rc == PCAP_ERROR) printf("error injecting: %s\n", pcap_geterr(pcap_handle));
+    else {
+        packets_injected++;
+        q2log(q2_condition, "injected %d (%d)", rc, packets_injected);
+        q2log_wftype(Q2PRINT_INJECTED, item->buffer, item->size, "injected");
+        profiling_update_lag_time(&(item->bignum_timestamp));
+    }
+}
+
+// writes the n items of a burst (from lanes) to the pcap socket through the ring, hard linked so that they go out in
+// order even if one fails, in one system call that also waits for all of them (before used_burst lets them go)
+// if the submit fails, the items the kernel didn't take are taken back, and it still waits for those it did take,
+// since they read from the records
+static void inject_burst(struct pcap_data_t * pd, rq_record_t ** items, uint8_t * lanes, int n) {
+    struct io_uring_sqe * sqe;
+    struct io_uring_cqe * cqe;
+    rq_record_t * item;
+    int i, done, failed = 0;
+    for (i=0; i<n; i++) {
+        sqe = uring_get_sqe(&(pd->uring));   /* the ring has room for a burst, and each burst is done before the next */
+        sqe->opcode = pd->inject_fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = pd->fd;
+        sqe->addr = (uint64_t) (uintptr_t) items[i]->buffer;
+        sqe->len = items[i]->size;
+        sqe->buf_index = lanes[i];
+        if (i < n - 1) sqe->flags = IOSQE_IO_HARDLINK;
+        sqe->user_data = (uint64_t) i;
+    }
+    for (done=0; done<n; ) {
+        cqe = uring_peek(&(pd->uring));
+        if (!cqe) {
+            if (uring_submit(&(pd->uring), n - done) < 0) {
+                if (!failed++) printf("error injecting: %s\n", strerror(errno));
+                n -= uring_unsubmit(&(pd->uring));
+            }
+            continue;
+        }
+        if (cqe->user_data >= (uint64_t) n) {      /* not of this burst */
+            uring_seen(&(pd->uring));
+            continue;
+        }
+        item = items[cqe->user_data];
+        if (cqe->res < 0) printf("error injecting: %s\n", strerror(-cqe->res));
         else {
             packets_injected++;
-            q2log(q2_condition, "injected %d (%d)", rc, packets_injected);
             q2log_wftype(Q2PRINT_INJECTED, item->buffer, item->size, "injected");
             profiling_update_lag_time(&(item->bignum_timestamp));
         }
-        aq_used_head(receive_inject_q);
+        uring_seen(&(pd->uring));
+        done++;
+    }
+}
+
+// injects up to a burst of items from the receive lanes, in the order the schedule picks
+static int repeat_injecting_function(void *d) {
+    struct ciqs_t * ciqs = (struct ciqs_t *) d;
+    struct pcap_data_t * pd = &(ciqs->data.pcap_data);
+    pcap_t ** ptr2_pcap_handle = (pcap_t **) pd->pcap_handle_ptr;
+    if (!ptr2_pcap_handle) {
+        printf("error: no open pcap handle for injection\n");
+        return 0;
+    }
+    struct burst_t burst;
+    rq_record_t * item;
+    rq_record_t * items[BURST_SIZE];
+    uint8_t lanes[BURST_SIZE];
+    int lane, work, n;
+    make_room(&receive_inject, -1);
+    get_burst(&receive_inject, &burst);
+    for (work=0, n=0; work<BURST_SIZE; work++) {
+        lane = next_lane(&receive_inject, &burst);
+        if (lane < 0) break;
+        item = burst.items[lane][burst.used[lane]++];
+        if (shed(&receive_inject, lane, item)) continue;
+        if (!pd->inject_uring) inject_item(*ptr2_pcap_handle, item);
+        else {
+            items[n] = item;
+            lanes[n++] = (uint8_t) lane;
+        }
     }
+    if (n) inject_burst(pd, items, lanes, n);
+    used_burst(&receive_inject, &burst);
+    return work;
  }
 
+static enum looper_wait_t before_wait_injecting_function(void *d) {
+    struct ciqs_t * ciqs = (struct ciqs_t *) d;
+    if (!receive_inject.lanes[0]->doorbell) return looper_wait_sleep;
+    if (!ciqs->looper.spinning) doorbell_arm(&(receive_inject.bell));
+    if (has_frames(&receive_inject)) return looper_wait_none;
+    return looper_wait_block;
+}
+
 /**************************************
     capture via netlink
  **************************************/
 
  static void init_nlcapturing_function(void *d) {
+    struct ciqs_t * ciqs = (struct ciqs_t *) d;
+    int fd;
     printf("nl started\n");
+    // the netlink socket is nonblocking, so wait on it instead of polling
+    looper_clear_wait_fds(&(ciqs->looper));
+    fd = cinl_get_fd();
+    if (fd >= 0) looper_add_wait_fd(&(ciqs->looper), fd, POLLIN);
 }
 
- static void repeat_nlcapturing_function(void *d) {
-    cinl_run();
+ static int repeat_nlcapturing_function(void *d) {
+    return cinl_run();
  }
 
  /**************************************
@@ -539,8 +1776,8 @@ static void repeat_injecting_function(void *d) {
     return;
 }
 
- static void repeat_nlinjecting_function(void *d) {
-    return;
+ static int repeat_nlinjecting_function(void *d) {
+    return 0;
  }
 
 
@@ -35,9 +35,11 @@
 #define QUEUES_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "item.h"
 #include "lisa.h"
 #include <pcap.h>
+#include <unistd.h>
 
 #define Q_SOCKET_ERROR -1
 #define Q_PCAP_ERROR -2
@@ -45,8 +47,9 @@
 
 #define PCAP_DEVICE "hwsim0"
 
-#define BUFFER_SIZE 2500
-#define QUEUE_SIZE 10
+#define MAX_FRAME_SIZE 12288        /* largest frame captured or received, a VHT A-MSDU can be up to 11454 bytes */
+#define RING_SIZE (128 * 1024)      /* default bytes between capture and send and between receive and inject */
+#define BURST_SIZE 32               /* most items the send and inject queues move per wakeup */
 
 enum ciqs_queue {sendq, altsendq, receiveq, altreceiveq, captureq, nlcaptureq, injectionq, nlinjectionq, naq};
 
@@ -54,8 +57,52 @@ enum ciqs_queue {sendq, altsendq, receiveq, altreceiveq, captureq, nlcaptureq, i
 #define CIQS_LAST_QUEUE  nlinjectionq+1
 #define CIQS_NUM_QUEUES  CIQS_LAST_QUEUE
 
+// threads: each queue runs on a thread of its own (the default)
+// reactor: all queues run on one thread that waits on all their fds together
+enum ciqs_runtime {ciqs_threads, ciqs_reactor};
+
+void ciqs_set_runtime(enum ciqs_runtime rt); /* call before ciqs_init_queues to change from the default */
+
+// poll: inject hands pcap one frame at a time (the default)
+// uring: inject writes each burst of frames to the pcap socket through an io_uring, in one system call, straight from
+// the receive_inject lanes (falling back to poll if it can't)
+enum ciqs_io {ciqs_io_poll, ciqs_io_uring};
+
+void ciqs_set_io(enum ciqs_io io); /* call before starting the injection queue to change from the default */
 void ciqs_init_queues(); /* call before doing anything with queues */
 
+// what happens when a frame doesn't fit in the ring between capture and send or between receive and inject
+// block: the producer waits for room, drop_newest: the new frame is dropped, drop_oldest: the oldest queued frames are
+// dropped to make room, drop_beacons: new beacons are dropped and queued beacons are dropped until there is room
+enum ciqs_overflow {ciqs_block, ciqs_drop_newest, ciqs_drop_oldest, ciqs_drop_beacons};
+
+// each ring is split into lanes by frame class, so that a flood of one class can't hold up another, highest priority
+// first: priority (management other than beacons, control, and EAPOL), data, and beacon
+enum ciqs_lane {ciqs_lane_priority, ciqs_lane_data, ciqs_lane_beacon, CIQS_NUM_LANES};
+
+// how send and inject pick the lane of the next frame
+// strict: always the highest priority lane with frames, weighted: round robin, taking up to a lane's weight in frames each turn
+enum ciqs_schedule {ciqs_strict, ciqs_weighted};
+
+// thread settings for one queue (or the reactor), e.g., "send cpus=2 policy=fifo priority=10 name=ci_send" (see
+// looper_parse_attr in /ref src/looper.h), call before ciqs_init_queues, returns false if the line is not understood
+bool ciqs_set_thread_attr(const char * line);
+// either thread settings as above or ring settings for capture_send or receive_inject,
+// e.g., "capture_send size=262144 overflow=drop-oldest schedule=weighted weights=8,4,1" (size is per lane, overflow is
+// block, drop-newest, drop-oldest, or drop-beacons, schedule is strict or weighted, weights are priority,data,beacon)
+// and, for capture_send, zerocopy=16384 to have a client's sends of at least that many bytes use MSG_ZEROCOPY (see
+// lisa_set_zerocopy; ci z measures where that starts to pay off)
+// or the wire settings, e.g., "wire version=2 source=3 compress=1" (the highest header version offered, this radio/VM
+// as the source of the frames sent, and whether v2 frames are compressed, which needs a source; see /ref src/wire.h)
+bool ciqs_configure(const char * line);
+// reads settings from a file, one line per queue or ring as above (# starts a comment)
+bool ciqs_load_config(const char * path);
+// reports which cpus, scheduling, etc. the running queue threads ended up with
+void ciqs_print_threads();
+
+// after the queue does no work, keep polling it for up to budget microseconds before blocking (0, the default, doesn't)
+void ciqs_set_latency_budget(enum ciqs_queue q, useconds_t budget);
+
 // for send, altsend, receive, altreceive, dataptr is a pointer to a lisa
 // for capture and injection, dataptr is a pointer to a pcap_handle
 void ciqs_start(enum ciqs_queue q, void * dataptr);
@@ -72,4 +119,15 @@ int ciqs_size_ts(enum ciqs_queue q);
 
 void ciqs_print_stats();
 
+// a client calls this each time it connects (or reconnects), for send to say hello (see /ref src/wire.h) before any
+// more frames, and to send v1 until the server answers
+void ciqs_say_hello();
+
+// while send is paused, after its socket was replaced by a stream, has it send the rest of the batch it was sending as
+// messages over the stream (batch_sent already counts the messages sent, so it picks up at the first one that wasn't)
+void ciqs_send_on_stream();
+
+// waits up to seconds for the server to answer the hello said since the client last connected, returns whether it did
+bool ciqs_heard_hello(int seconds);
+
 #endif
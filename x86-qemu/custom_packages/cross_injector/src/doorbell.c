@@ -0,0 +1,53 @@
+/*!
+ * @file src/doorbell.c
+ * @brief A doorbell lets a producer wake a consumer thread that is blocked waiting for work.
+ * @details
+ * The seq_cst fences in arm and ring are what make the "arm then check" and "publish then ring" sequences safe:
+ * either the consumer's last check sees the work or the producer sees the doorbell armed and writes the eventfd.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#include "doorbell.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+
+bool doorbell_init(struct doorbell_t * db) {
+    db->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    atomic_init(&(db->armed), 0);
+    if (db->fd < 0) {
+        printf("error creating doorbell eventfd\n");
+        return false;
+    }
+    return true;
+}
+
+void doorbell_arm(struct doorbell_t * db) {
+    uint64_t count;
+    // only a ring can have cleared armed, so only then can there be a count left in the eventfd to clear
+    if (!atomic_load_explicit(&(db->armed), memory_order_relaxed)) {
+        if (read(db->fd, &count, sizeof(count)) < 0) { /* nothing was written, which is fine */ }
+        atomic_store_explicit(&(db->armed), 1, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void doorbell_ring(struct doorbell_t * db) {
+    uint64_t one = 1;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&(db->armed), memory_order_relaxed)) return;
+    if (atomic_exchange_explicit(&(db->armed), 0, memory_order_relaxed)) {
+        if (write(db->fd, &one, sizeof(one)) < 0) printf("error ringing doorbell\n");
+    }
+}
+
+int doorbell_fd(struct doorbell_t * db) {
+    return db->fd;
+}
+
+void doorbell_free(struct doorbell_t * db) {
+    if (db->fd >= 0) close(db->fd);
+    db->fd = -1;
+}
@@ -0,0 +1,40 @@
+/*!
+ * @file src/doorbell.h
+ * @brief A doorbell lets a producer wake a consumer thread that is blocked waiting for work.
+ * @details
+ * The doorbell is an eventfd that the consumer can poll on (e.g., as one of the wait fds of a looper, /ref src/looper.h).
+ * To avoid a system call for every item produced, the producer only writes the eventfd when the consumer has armed
+ * the doorbell, i.e., when it is about to block. The consumer must arm first and then check for work one more time
+ * before blocking, and the producer must publish its work before ringing; then one of them always sees the other:
+ *       consumer: doorbell_arm(), check queue, if empty block on doorbell_fd()
+ *       producer: put item in queue, doorbell_ring()
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#ifndef DOORBELL_H
+#define DOORBELL_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+struct doorbell_t {
+    int fd;                 /* eventfd that becomes readable when the doorbell is rung */
+    _Atomic int armed;      /* set by the consumer before blocking, cleared by the first ring after that */
+};
+
+// creates the eventfd, returns false on error
+bool doorbell_init(struct doorbell_t * db);
+
+// called by the consumer just before it checks for work one last time and blocks
+void doorbell_arm(struct doorbell_t * db);
+
+// called by the producer after publishing work, only makes a system call if the consumer is (about to be) blocked
+void doorbell_ring(struct doorbell_t * db);
+
+// the fd to poll for POLLIN
+int doorbell_fd(struct doorbell_t * db);
+
+void doorbell_free(struct doorbell_t * db);
+
+#endif // DOORBELL_H
@@ -10,8 +10,11 @@
 
 #define ERRORS 1
 #define TIMEOUTS 1
+#define _GNU_SOURCE   /* for sendmmsg and recvmmsg */
 
 #include "lisa.h"
+#include "shm_ring.h"
+#include "uring.h"
 #include <strings.h>
 #include <memory.h>
 #include <unistd.h>
@@ -25,6 +28,17 @@
 #else
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <linux/errqueue.h>
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
 #endif
 
 static int lisa_initialized = 0;
@@ -100,8 +114,14 @@ void lisa_set_error(lisa * l, char * fun) {
 #define CHECK_RC_ERROR_UNLOCK(fun,retval) if (rc < 0) { SET_ERROR(fun); l->state = LISA_ERROR; pthread_mutex_unlock(&(l->lock)); return retval;}
 #endif
 
-#define CHECK_ERROR(x) if (!l || l->state < 0) return x;
-#define CHECK_ERROR_UNLOCK(x) if (!l || l->state < 0) { pthread_mutex_unlock(&(l->lock)); return x; }
+/* the send and receive halves each change the state under only their own lock (see note 9 in lisa.h), so the state is
+ * read and set with atomics wherever one of them may be going at the same time */
+#define STATE(s) __atomic_load_n(&(s), __ATOMIC_ACQUIRE)
+#define SET_STATE(s,v) __atomic_store_n(&(s), (v), __ATOMIC_RELEASE)
+
+#define CHECK_ERROR(x) if (!l || STATE(l->state) < 0) return x;
+#define CHECK_ERROR_UNLOCK(x) if (!l || STATE(l->state) < 0) { pthread_mutex_unlock(&(l->lock)); return x; }
+#define CHECK_ERROR_RELEASE(m,x) if (!l || STATE(l->state) < 0) { pthread_mutex_unlock(m); return x; }
 
 static int isnumber (char *c, int max) {
     int count = 0;
@@ -113,6 +133,294 @@ static int isnumber (char *c, int max) {
     return 1;
 }
 
+/* LLLLLLLLLLLLLLLLLLLLLLLL
+ * WAITING
+ * LLLLLLLLLLLLLLLLLLLLLLLL
+ */
+
+/* how long poll or epoll_wait should wait for tp (NULL = forever) */
+static int lisa_wait_ms(struct timeval * tp) {
+  if (!tp) return -1;
+  return (int) (tp->tv_sec * 1000 + tp->tv_usec / 1000);
+}
+
+/* waits for events on one fd, returns 1 if it is ready, 0 on timeout, or -1 on error */
+static int lisa_poll(SOCKET fd, short events, struct timeval * tp) {
+  struct pollfd pfd;
+  int rc;
+  pfd.fd = fd;
+  pfd.events = events;
+  pfd.revents = 0;
+  do rc = poll(&pfd, 1, lisa_wait_ms(tp));
+  while (rc < 0 && errno == EINTR);
+  return rc;
+}
+
+/* a change to the connection (its sockets, clients, or links) holds both halves, so that neither is using what
+ * changes; they are always taken in this order, after the lock when that is held too */
+static void lisa_hold_halves(lisa *l) {
+  pthread_mutex_lock(&(l->recv_lock));
+  pthread_mutex_lock(&(l->send_lock));
+}
+
+static void lisa_release_halves(lisa *l) {
+  pthread_mutex_unlock(&(l->send_lock));
+  pthread_mutex_unlock(&(l->recv_lock));
+}
+
+/* sets the state a send ended in, unless the connection closed (or went wrong, or was never made) meanwhile, which the
+ * receive half or a change to the connection may have found while the send was going: a send doesn't undo that */
+static void lisa_set_sent_state(int * state, int sent) {
+  int old = __atomic_load_n(state, __ATOMIC_ACQUIRE);
+  while (old >= LISA_CONNECTED && old != LISA_CLOSED && old != sent &&
+         !__atomic_compare_exchange_n(state, &old, sent, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+/* the shm link of fd (the socket of a client, or one of the clients of a server), or NULL if it isn't shm */
+static struct shm_link_t * lisa_link(lisa *l, SOCKET fd) {
+  if (l->type != LISA_SHM) return NULL;
+  if (l->clsvr == LISA_CLIENT) return l->shm_links[0];
+  for (int i=0; i<l->num_clients; i++) if (l->client_fds[i] == fd) return l->shm_links[i];
+  return NULL;
+}
+
+/* receiving through an io_uring: each socket has one multishot receive, which keeps going (taking a buffer for each
+ * piece it gets) until it runs out of buffers or the socket closes, marked with an id of the socket so that results
+ * still to come for a socket that was closed (or had the same fd before) are told apart and ignored */
+#define LISA_URING_ENTRIES 64
+#define LISA_URING_BUFFERS 64         /* a power of 2 */
+#define LISA_URING_BUFFER_SIZE 16384
+#define LISA_URING_GROUP 1
+
+struct lisa_uring_t {
+  struct uring_t ring;
+  struct {
+    SOCKET fd;
+    unsigned long long id;
+    char armed;                      /* its receive is going */
+    char done;                       /* it closed (or failed), so its receive isn't started again */
+  } sockets[MAX_CLIENTS];
+  int num_sockets;
+  unsigned long long next_id;        /* id 0 is never a socket's */
+  unsigned int taken;                /* bytes of the oldest result already received (it is seen once all of it is) */
+};
+
+/* starts the receive of socket i (if the submission ring is full, it is started with the next) */
+static void lisa_uring_arm(struct lisa_uring_t * lu, int i) {
+  struct io_uring_sqe * sqe;
+  sqe = uring_get_sqe(&(lu->ring));
+  if (!sqe) return;
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = lu->sockets[i].fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = LISA_URING_GROUP;
+  sqe->user_data = lu->sockets[i].id;
+  lu->sockets[i].armed = 1;
+}
+
+/* the socket with id, or -1 if it has been removed */
+static int lisa_uring_socket(struct lisa_uring_t * lu, unsigned long long id) {
+  for (int i=0; i<lu->num_sockets; i++) if (lu->sockets[i].id == id) return i;
+  return -1;
+}
+
+/* starts receiving from fd (a client's socket, or a client of a server) */
+static void lisa_uring_add(lisa *l, SOCKET fd) {
+  struct lisa_uring_t * lu = l->uring;
+  int i;
+  if (!lu || lu->num_sockets == MAX_CLIENTS) return;
+  i = lu->num_sockets++;
+  lu->sockets[i].fd = fd;
+  lu->sockets[i].id = ++(lu->next_id);
+  lu->sockets[i].done = 0;
+  lisa_uring_arm(lu, i);
+  uring_submit(&(lu->ring), 0);
+  l->syscalls++;
+}
+
+/* stops receiving from fd before it is closed, cancelling its receive (whose last result is then ignored) */
+static void lisa_uring_remove(lisa *l, SOCKET fd) {
+  struct lisa_uring_t * lu = l->uring;
+  struct io_uring_sqe * sqe;
+  int i;
+  if (!lu) return;
+  i = 0;
+  while (i < lu->num_sockets && lu->sockets[i].fd != fd) i++;
+  if (i == lu->num_sockets) return;
+  if (lu->sockets[i].armed && (sqe = uring_get_sqe(&(lu->ring)))) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = lu->sockets[i].id;
+    sqe->user_data = 0;
+    uring_submit(&(lu->ring), 0);
+    l->syscalls++;
+  }
+  lu->sockets[i] = lu->sockets[--(lu->num_sockets)];
+}
+
+/* takes up to msglength bytes of what the receives have got, all from the socket of the oldest result, which it puts in
+ * *fd, and starts again the receives that stopped (e.g., for want of buffers); returns how many bytes, 0 if that
+ * socket closed, or -1 with errno set (EAGAIN if nothing has been received yet); called with the receive lock */
+static int lisa_uring_take(lisa *l, char *msg, unsigned int msglength, SOCKET *fd) {
+  struct lisa_uring_t * lu = l->uring;
+  struct io_uring_cqe * cqe;
+  unsigned int n, size;
+  uint32_t flags;
+  int i, res, rc, error, restart;
+  n = 0;
+  rc = -1;
+  error = EAGAIN;
+  while (n < msglength && (cqe = uring_peek(&(lu->ring)))) {
+    i = lisa_uring_socket(lu, cqe->user_data);
+    res = cqe->res;
+    flags = cqe->flags;
+    if (i >= 0 && n && (lu->sockets[i].fd != *fd || res <= 0)) break;  /* for the next receive */
+    if (i >= 0 && !(flags & IORING_CQE_F_MORE)) lu->sockets[i].armed = 0;
+    if (i < 0 || res <= 0) {
+      if (flags & IORING_CQE_F_BUFFER) uring_recycle(&(lu->ring), flags);
+      uring_seen(&(lu->ring));
+      lu->taken = 0;
+      if (i < 0 || res == -ENOBUFS) continue;  /* removed, or out of buffers until these are given back */
+      *fd = lu->sockets[i].fd;
+      lu->sockets[i].done = 1;
+      rc = (res == 0) ? 0 : -1;
+      error = -res;
+      break;
+    }
+    *fd = lu->sockets[i].fd;
+    size = (unsigned int) res - lu->taken;
+    if (size > msglength - n) size = msglength - n;
+    memcpy(msg + n, uring_buffer(&(lu->ring), flags) + lu->taken, size);
+    n += size;
+    lu->taken += size;
+    if (lu->taken == (unsigned int) res) {
+      uring_recycle(&(lu->ring), flags);
+      uring_seen(&(lu->ring));
+      lu->taken = 0;
+    }
+  }
+  restart = 0;
+  for (i=0; i<lu->num_sockets; i++) {
+    if (lu->sockets[i].armed || lu->sockets[i].done) continue;
+    lisa_uring_arm(lu, i);
+    restart = 1;
+  }
+  if (restart) {
+    uring_submit(&(lu->ring), 0);
+    l->syscalls++;
+  }
+  if (n) return (int) n;
+  errno = error;
+  return rc;
+}
+
+/* whether the kernel can do multishot receives (6.0), which it only says once one is started, so this starts one on a
+ * socketpair, sends it a byte, and sees that the receive got it and keeps going */
+static int lisa_uring_works(struct lisa_uring_t * lu) {
+  struct io_uring_cqe * cqe;
+  struct io_uring_sqe * sqe;
+  SOCKET sv[2];
+  int works;
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return 0;
+  works = 0;
+  lu->sockets[0].fd = sv[0];
+  lu->sockets[0].id = ++(lu->next_id);
+  lisa_uring_arm(lu, 0);
+  if (send(sv[1], "x", 1, 0) == 1 && uring_submit(&(lu->ring), 1) >= 0 && (cqe = uring_peek(&(lu->ring)))) {
+    works = (cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE));
+    if (cqe->flags & IORING_CQE_F_BUFFER) uring_recycle(&(lu->ring), cqe->flags);
+    uring_seen(&(lu->ring));
+  }
+  /* cancels the receive if it is still going and waits for it to finish (the result of the cancel and its own) */
+  if (works && (sqe = uring_get_sqe(&(lu->ring)))) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = lu->sockets[0].id;
+    uring_submit(&(lu->ring), 2);
+  }
+  while ((cqe = uring_peek(&(lu->ring)))) {
+    if (cqe->flags & IORING_CQE_F_BUFFER) uring_recycle(&(lu->ring), cqe->flags);
+    uring_seen(&(lu->ring));
+  }
+  lu->sockets[0].armed = 0;
+  close(sv[0]);
+  close(sv[1]);
+  return works;
+}
+
+/* stops receiving through the io_uring, if there is one (tearing it down cancels the receives) */
+static void lisa_uring_drop(lisa *l) {
+  if (!l->uring) return;
+  uring_exit(&(l->uring->ring));
+  free(l->uring);
+  l->uring = NULL;
+}
+
+/* a server keeps its clients in an epoll set, rather than putting all of them in an fd_set for every receive
+ * (for shm, the link's eventfd is what says there is something to receive, but the event names the client's socket),
+ * and starts receiving from them through its io_uring if it has one */
+static void lisa_watch_client(lisa *l, SOCKET fd) {
+  struct epoll_event ev;
+  struct shm_link_t * link;
+  if (l->epfd < 0) l->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (l->epfd < 0) return;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev);
+  link = lisa_link(l, fd);
+  if (link) epoll_ctl(l->epfd, EPOLL_CTL_ADD, shm_link_data_fd(link), &ev);
+  lisa_uring_add(l, fd);
+}
+
+static void lisa_unwatch_client(lisa *l, SOCKET fd) {
+  struct shm_link_t * link;
+  int i, j;
+  link = lisa_link(l, fd);
+  if (l->epfd >= 0) epoll_ctl(l->epfd, EPOLL_CTL_DEL, fd, NULL);
+  if (l->epfd >= 0 && link) epoll_ctl(l->epfd, EPOLL_CTL_DEL, shm_link_data_fd(link), NULL);
+  lisa_uring_remove(l, fd);
+  for (i=l->next_ready, j=l->next_ready; i<l->num_ready; i++) {
+    if (l->ready_fds[i] != fd) l->ready_fds[j++] = l->ready_fds[i];
+  }
+  l->num_ready = j;
+}
+
+/* waits for clients with something to receive and puts (up to MAX_CLIENTS of) them in fds
+ * returns how many, 0 on timeout, or -1 on error
+ * called without the lock, so that clients can still be accepted meanwhile */
+static int lisa_wait_clients(SOCKET epfd, SOCKET * fds, struct timeval * tp) {
+  struct epoll_event events[MAX_CLIENTS];
+  int n;
+  if (epfd < 0) return 0;  /* no client yet */
+  do n = epoll_wait(epfd, events, MAX_CLIENTS, lisa_wait_ms(tp));
+  while (n < 0 && errno == EINTR);
+  for (int i=0; i<n; i++) fds[i] = events[i].data.fd;
+  return n;
+}
+
+/* closes the shm link of client i (for a client, 0), if it has one */
+static void lisa_drop_link(lisa *l, int i) {
+  if (!l->shm_links[i]) return;
+  shm_link_close(l->shm_links[i]);
+  free(l->shm_links[i]);
+  l->shm_links[i] = NULL;
+}
+
+/* shm is set up over a unix socket named for the port (in the abstract namespace, so there is no file to clean up) */
+static socklen_t lisa_shm_address(struct sockaddr_un * addr, unsigned short port) {
+  int n;
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "lisa-shm-%u", port);
+  return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+/* the next client the last wait found ready, or 0 if it has received from all of them (and should wait again) */
+static SOCKET lisa_next_ready(lisa *l) {
+  if (l->next_ready >= l->num_ready) return 0;
+  return l->ready_fds[l->next_ready++];
+}
+
 /**
  * start
  *
@@ -166,8 +474,19 @@ void lisa_open(lisa* l) {
   l->wait_time.tv_sec = 30;
   l->wait_time.tv_usec = 0;
   l->num_clients=0;
+  l->recv_fd = -1;
+  l->epfd = -1;
+  l->num_ready = 0;
+  l->next_ready = 0;
+  l->zerocopy = 0;
+  l->zerocopy_sent = 0;
+  l->zerocopy_done = 0;
+  l->zerocopy_copied = 0;
   l->clsvr = LISA_UNKNOWN;
   l->vsock = 0;
+  for (int i=0; i<MAX_CLIENTS; i++) l->shm_links[i] = NULL;
+  l->uring = NULL;
+  l->syscalls = 0;
   COPY_MSG("lisa_open", "OK");
 }
 
@@ -250,6 +569,59 @@ void lisa_setup_udp(lisa *l) {
   COPY_MSG("lisa_setup_udp", "OK");
 }
 
+#ifndef WIN32
+/**
+ * Setup the lisa for SEQPACKET, which connects like TCP but keeps each message apart like UDP (vsock only).
+ */
+#ifdef DEBUG
+void LISA_SETUP_SEQPACKET(lisa *l, char * file, char * line) {
+#else
+void lisa_setup_seqpacket(lisa *l) {
+#endif
+  CHECK_ERROR();
+  if (!lisa_initialized) lisa_start();
+  if (!l->vsock) {
+      COPY_MSG("lisa_setup_seqpacket", "seqpacket is only for vsock");
+      l->state = LISA_ERROR;
+      return;
+  }
+  l->fd  = socket(AF_VSOCK, SOCK_SEQPACKET, 0);
+  CHECK_FD_ERROR("lisa_setup_seqpacket", )
+  memset(&(l->local_vaddr),  0, sizeof(l->local_vaddr));
+  memset(&(l->remote_vaddr), 0, sizeof(l->remote_vaddr));
+  l->local_vaddr.svm_family  = AF_VSOCK;
+  l->remote_vaddr.svm_family = AF_VSOCK;
+  l->type = LISA_SEQPACKET;
+  l->flags = 0;
+  l->state = LISA_CREATED;
+  l->client_state = LISA_UNINITIALIZED;
+  lisa_set_nonblocking(l);
+  COPY_MSG("lisa_setup_seqpacket", "OK");
+}
+
+/**
+ * Setup the lisa for SHM, a stream through shared memory with another process on this host, which is set up over a
+ * unix socket (see lisa_connect and lisa_accept).
+ */
+#ifdef DEBUG
+void LISA_SETUP_SHM(lisa *l, char * file, char * line) {
+#else
+void lisa_setup_shm(lisa *l) {
+#endif
+  CHECK_ERROR();
+  if (!lisa_initialized) lisa_start();
+  l->fd  = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_FD_ERROR("lisa_setup_shm", )
+  l->vsock = 0;  /* shm is only ever on this host */
+  l->type = LISA_SHM;
+  l->flags = 0;
+  l->state = LISA_CREATED;
+  l->client_state = LISA_UNINITIALIZED;
+  lisa_set_nonblocking(l);
+  COPY_MSG("lisa_setup_shm", "OK");
+}
+#endif
+
 /**
  * Set the remote address to the destination addr and port, connect,
  * and then get the local address of the connection.
@@ -264,15 +636,16 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
   int rc;
   struct timeval timeout;
   struct timeval * tp;
+  int err;
   SOCKET         this_fd;
-  fd_set         this_fdset;
 #ifdef WIN32
   int size;
 #else
   unsigned int size;
+  struct sockaddr_un uaddr;
 #endif
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -286,7 +659,11 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
 #ifdef WIN32
   if (addr) l->remote_addr.sin_addr.s_addr = inet_addr(addr);
 #else
-  if (l->vsock) {
+  if (l->type == LISA_SHM) {  /* the server is on this host, so only the port matters */
+    size = lisa_shm_address(&uaddr, port);
+    rc = connect(l->fd, (struct sockaddr *) &uaddr, size);
+  }
+  else if (l->vsock) {
     /* convert addr from text number to binary */
     if (!isnumber(addr, 10)) {SET_ERROR("lisa connect failed"); l->state = LISA_ERROR; return;}
     l->remote_vaddr.svm_cid = atol(addr);
@@ -320,13 +697,10 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
   }
   pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  FD_ZERO(&this_fdset);
-  FD_SET(this_fd, &this_fdset);
-  rc = select(this_fd+1, NULL, &this_fdset, NULL, tp);
-  if (select(this_fd+1, NULL, &this_fdset, NULL, tp) <= 0) {
+  if (lisa_poll(this_fd, POLLOUT, tp) <= 0) {
     COPY_MSG("lisa_connect", "timeout waiting for connect");
     pthread_mutex_lock(&(l->lock));
 	l->state = LISA_ERROR;
@@ -334,12 +708,31 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
     return;
   }
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
-  if (!FD_ISSET(this_fd, &this_fdset)) COPY_MSG("lisa_connect", "fd not set");
-  if (l->vsock) {
+  /* the socket is writable whether or not the connection worked, so see which it was */
+  size = sizeof(err);
+  if (getsockopt(this_fd, SOL_SOCKET, SO_ERROR, &err, &size) < 0 || err) {
+    COPY_MSG("lisa_connect", err ? strerror(err) : "error getting connect result");
+    l->state = LISA_ERROR;
+    pthread_mutex_unlock(&(l->lock));
+    return;
+  }
+  if (l->type == LISA_SHM) {  /* the connection is only used to hand the server the link */
+    l->shm_links[0] = malloc(sizeof(struct shm_link_t));
+    if (!l->shm_links[0] || !shm_link_create(l->shm_links[0], this_fd)) {
+      free(l->shm_links[0]);
+      l->shm_links[0] = NULL;
+      COPY_MSG("lisa_connect", "error setting up shared memory");
+      l->state = LISA_ERROR;
+      pthread_mutex_unlock(&(l->lock));
+      return;
+    }
+    rc = 0;
+  }
+  else if (l->vsock) {
     size = sizeof(l->local_vaddr);
     rc = getsockname(this_fd, (struct sockaddr *) &(l->local_vaddr), &size);
   }
@@ -350,7 +743,8 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
   if (rc<0) {
     printf("error getsockname: %s\n", strerror(errno));
   }
-  l->state = LISA_CONNECTED;
+  /* the halves only look at the socket and link once they see this */
+  SET_STATE(l->state, LISA_CONNECTED);
   COPY_MSG("lisa_connect", "OK");
   pthread_mutex_unlock(&(l->lock));
 }
@@ -404,6 +798,8 @@ void LISA_LISTEN(lisa *l, unsigned short port, char * file, char * line) {
 void lisa_listen(lisa *l, unsigned short port) {
 #endif
   int rc;
+  int one = 1;
+  struct sockaddr_un uaddr;
   CHECK_ERROR();
   l->clsvr = LISA_SERVER;
   if (l->state < LISA_CREATED) {
@@ -412,7 +808,11 @@ void lisa_listen(lisa *l, unsigned short port) {
   }
   CHECK_ERROR();
   if (l->state < LISA_BOUND) {
-    if (l->vsock) {
+    if (l->type == LISA_SHM) {
+        rc = bind(l->fd, (struct sockaddr *) &uaddr, lisa_shm_address(&uaddr, port));
+        CHECK_RC_ERROR("lisa_listen", );
+    }
+    else if (l->vsock) {
         l->local_vaddr.svm_cid = VMADDR_CID_ANY;
         l->local_vaddr.svm_port = port;  /* vsock always in host byte order */
         //printf("port: %d\n", l->local_vaddr.svm_port);
@@ -423,20 +823,78 @@ void lisa_listen(lisa *l, unsigned short port) {
     else {
         l->local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
         l->local_addr.sin_port = htons(port);
+        /* a udp server's clients each get a socket bound to the same port (see lisa_accept_udp) */
+        if (l->type == LISA_UDP) setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
         rc = bind(l->fd, (struct sockaddr *) &(l->local_addr), sizeof(l->local_addr));
         CHECK_RC_ERROR("lisa_listen", );
     }
     l->state = LISA_BOUND;
   }
+  if (l->type == LISA_UDP) {
+    COPY_MSG("lisa_listen", "OK");
+    return;
+  }
   rc = listen(l->fd, 1);
   //printf("listen rc: %d\n", rc);
   CHECK_RC_ERROR("lisa_listen", )
   COPY_MSG("lisa_listen", "OK");
 }
 
+#ifndef WIN32
+/* udp has no connections to accept, so the first datagram from a new client stands in for one: the listening socket,
+ * with that datagram still on it, is connected to the client and becomes its socket, and a new socket bound to the
+ * same port takes over listening (the kernel gives a connected socket the datagrams from its peer)
+ * returns the client's socket or -1 */
+static SOCKET lisa_accept_udp(lisa *l) {
+  struct sockaddr_in from;
+  socklen_t size;
+  SOCKET client, fd;
+  int one = 1;
+  size = sizeof(from);
+  if (recvfrom(l->fd, NULL, 0, MSG_PEEK | MSG_DONTWAIT, (struct sockaddr *) &from, &size) < 0) return -1;
+  if (connect(l->fd, (struct sockaddr *) &from, size) < 0) return -1;
+  client = l->fd;
+  fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd >= 0) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *) &(l->local_addr), sizeof(l->local_addr)) < 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd < 0) {  /* keeps listening on the client's socket, which at least still works for the one client */
+    connect(l->fd, (struct sockaddr *) &(struct sockaddr_in) {.sin_family = AF_UNSPEC}, sizeof(struct sockaddr_in));
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  l->fd = fd;
+  l->remote_addr = from;
+  return client;
+}
+
+/* accepts a client's connection and then the link it sends over it (waiting up to tp for that), which it puts in *linkp
+ * for the client about to be added; returns the client's socket or -1 */
+static SOCKET lisa_accept_shm(lisa *l, struct timeval * tp, struct shm_link_t ** linkp) {
+  struct shm_link_t * link;
+  SOCKET client;
+  client = accept(l->fd, NULL, NULL);
+  if (client < 0) return -1;
+  link = malloc(sizeof(struct shm_link_t));
+  if (!link || !shm_link_accept(link, client, lisa_wait_ms(tp))) {
+    free(link);
+    close(client);
+    return -1;
+  }
+  *linkp = link;
+  return client;
+}
+#endif
+
 /**
  * In addition to calling the regular accept function, this also calls
  * listen automatically if needed.
+ * For udp, the first datagram from a client is what is accepted (and then received from the client's socket).
+ * For shm, the client's connection is accepted and then the link it sends over it.
  */
 #ifdef DEBUG
 int LISA_ACCEPT(lisa *l, unsigned short port, char * file, char * line) {
@@ -444,7 +902,8 @@ int LISA_ACCEPT(lisa *l, unsigned short port, char * file, char * line) {
 int lisa_accept(lisa *l, unsigned short port) {
 #endif
   SOCKET  this_fd;
-  fd_set  this_fdset;
+  SOCKET  new_fd;
+  struct shm_link_t * link;
   int rc;
 #ifdef WIN32
   int size;
@@ -454,7 +913,7 @@ int lisa_accept(lisa *l, unsigned short port) {
   struct timeval timeout;
   struct timeval * tp;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -490,15 +949,13 @@ int lisa_accept(lisa *l, unsigned short port) {
       }
       pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-      FD_ZERO(&this_fdset);
-      FD_SET(this_fd, &this_fdset);
-      rc = select(this_fd+1, &this_fdset, NULL, NULL, tp);
+      rc = lisa_poll(this_fd, POLLIN, tp);
 
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
       pthread_mutex_lock(&(l->lock));
@@ -512,38 +969,33 @@ int lisa_accept(lisa *l, unsigned short port) {
                  COPY_MSG("lisa_accept", "Error accepting");
                  rc = 0;
                  break;
-        default: l->state = LISA_ACCEPTED;
-                 if (!FD_ISSET(this_fd, &this_fdset)) {
-                   COPY_MSG("lisa_accept", "accepted but fd not set");
-                   l->client_state = LISA_ERROR;
-                   pthread_mutex_unlock(&(l->lock));
-                   return 0;
-                 }
+        default: SET_STATE(l->state, LISA_ACCEPTED);
+                 link = NULL;
                  if (l->vsock) {
                      size = sizeof(l->remote_vaddr);
-                     rc = accept(l->fd, (struct sockaddr *) &(l->remote_vaddr), &size);
-                     if (rc <= 0) {
-                       COPY_MSG("lisa_accept", strerror(errno));
-                     }
-                     else {
-                       l->client_fd = rc;
-                       //printf("added client: %d\n", l->client_fd);
-                       l->state = LISA_ACCEPTED;
-                       l->client_state = LISA_CONNECTED;
-                       l->client_fds[l->num_clients] = l->client_fd;
-                       l->num_clients++;
-                       //printf("added client: %d (%d)\n", l->client_fd, l->num_clients);
-                     }
+                     new_fd = accept(l->fd, (struct sockaddr *) &(l->remote_vaddr), &size);
+                     if (new_fd <= 0) COPY_MSG("lisa_accept", strerror(errno));
+                     rc = new_fd;
                  }
                  else {
                      size = sizeof(l->remote_addr);
-                     l->client_fd = accept(l->fd, (struct sockaddr *) &(l->remote_addr), &size);
-                     if (l->client_fd <= 0) COPY_MSG("lisa_accept", "Error accepting connection");
-                     l->client_state = LISA_CONNECTED;
-                     l->client_fds[l->num_clients] = l->client_fd;
-                     l->num_clients++;
+                     if (l->type == LISA_UDP) new_fd = lisa_accept_udp(l);
+                     else if (l->type == LISA_SHM) new_fd = lisa_accept_shm(l, tp, &link);
+                     else new_fd = accept(l->fd, (struct sockaddr *) &(l->remote_addr), &size);
+                     if (new_fd <= 0) COPY_MSG("lisa_accept", "Error accepting connection");
                      rc = 1;
                  }
+                 if (new_fd > 0) {
+                     lisa_hold_halves(l);
+                     __atomic_store_n(&(l->client_fd), new_fd, __ATOMIC_RELAXED);
+                     SET_STATE(l->client_state, LISA_CONNECTED);
+                     l->client_fds[l->num_clients] = new_fd;
+                     l->shm_links[l->num_clients] = link;
+                     l->num_clients++;
+                     lisa_watch_client(l, new_fd);
+                     lisa_release_halves(l);
+                     //printf("added client: %d (%d)\n", new_fd, l->num_clients);
+                 }
       }
   /*
   }
@@ -561,9 +1013,9 @@ int lisa_accept(lisa *l, unsigned short port) {
  * when the remote address was set by a previous recv_from.
  */
 #ifdef DEBUG
-int LISA_SEND(lisa *l, char *msg, unsigned int msglength, char * file, char * line) {
+static int lisa_send_on(lisa *l, SOCKET to, char *msg, unsigned int msglength, char * file, char * line) {
 #else
-int lisa_send(lisa *l, char *msg, unsigned int msglength) {
+static int lisa_send_on(lisa *l, SOCKET to, char *msg, unsigned int msglength) {
 #endif
   int rc;
   unsigned int bytes_sent;
@@ -571,66 +1023,84 @@ int lisa_send(lisa *l, char *msg, unsigned int msglength) {
   struct timeval * tp;
   SOCKET this_fd;
   SOCKET this_socket;
-  fd_set this_fdset;
+  SOCKET wait_fd;
+  short  wait_events;
   char   this_type;
+  int    this_connected;
   int    this_flags;
   int    this_state;
+  struct shm_link_t * this_link;
+  struct iovec iov;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-SEND
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  pthread_mutex_lock(&(l->lock));
+  pthread_mutex_lock(&(l->send_lock));
   this_fd = l->fd;
   this_flags = l->flags;
-  if (l->state != LISA_ACCEPTED) this_state = l->state;
-  else this_state = l->client_state;
-  CHECK_ERROR_UNLOCK(-1);
-  if (l->state < LISA_CONNECTED) {
-        pthread_mutex_unlock(&(l->lock));
+  if (STATE(l->state) != LISA_ACCEPTED) this_state = STATE(l->state);
+  else this_state = STATE(l->client_state);
+  CHECK_ERROR_RELEASE(&(l->send_lock), -1);
+  if (STATE(l->state) < LISA_CONNECTED) {
+        pthread_mutex_unlock(&(l->send_lock));
         return LISA_ERROR;
   }
   if (l->clsvr == LISA_CLIENT) this_socket = this_fd;
-  else this_socket = l->client_fd;  //note that this defaults to the most recently set fd from recv (but could be overwritten as in cast)
+  else if (to >= 0) this_socket = to;
+  else this_socket = __atomic_load_n(&(l->client_fd), __ATOMIC_RELAXED);  //note that this defaults to the most recently set fd from recv
   this_type = l->type;
+  /* udp only needs to say where each datagram goes if it didn't connect (or accept) */
+  this_connected = (this_type != LISA_UDP || l->clsvr != LISA_UNKNOWN);
+  this_link = lisa_link(l, this_socket);
+  /* shm has room again when the other side rings the link's eventfd */
+  wait_fd = this_link ? shm_link_room_fd(this_link) : this_socket;
+  wait_events = this_link ? POLLIN : POLLOUT;
   if (l->wait_time.tv_sec == 0) tp = NULL;
   else {
      timeout.tv_sec = l->wait_time.tv_sec;
      timeout.tv_usec = l->wait_time.tv_usec;
      tp = &(timeout);
   }
-  pthread_mutex_unlock(&(l->lock));
+  pthread_mutex_unlock(&(l->send_lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * SEND (waiting only while the socket is full)
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  if (this_type == LISA_TCP) {
+  if (this_connected) {  /* a message (seqpacket or udp) is always sent whole, so this only goes around for tcp */
 	bytes_sent = 0;
-    FD_ZERO(&this_fdset);
-    FD_SET(this_socket, &this_fdset);
 	  while (bytes_sent < msglength && this_state != LISA_ERROR) {
-	    rc = select(this_socket+1, NULL, &this_fdset, NULL, tp);
-	    if (rc <= 0) {
-            pthread_mutex_lock(&(l->lock));
+	    if (this_link) {
+            iov.iov_base = &(msg[bytes_sent]);
+            iov.iov_len = msglength-bytes_sent;
+            rc = shm_link_write(this_link, &iov, 1);
+            if (rc == 0) {  /* the ring is full */
+                rc = -1;
+                errno = EAGAIN;
+            }
+	    }
+	    else rc = send(this_socket, &(msg[bytes_sent]), msglength-bytes_sent, this_flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+	    if (rc >= 0) {
+            bytes_sent += rc;
+            this_state = LISA_SENT_DATA;
+	    }
+	    else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          if (lisa_poll(wait_fd, wait_events, tp) <= 0) {
+            pthread_mutex_lock(&(l->send_lock));
             COPY_MSG("lisa_send", "timeout sending");
 		    this_state = LISA_TIMEOUT;
-            pthread_mutex_unlock(&(l->lock));
+            pthread_mutex_unlock(&(l->send_lock));
+          }
 	    }
-	    else {
-          if (!FD_ISSET(this_socket, &this_fdset)) {
-            pthread_mutex_lock(&(l->lock));
-	        COPY_MSG("lisa_send", "unexpected fd not set");
+	    else if (errno != EINTR) {
+            pthread_mutex_lock(&(l->send_lock));
+	        COPY_MSG("lisa_send", "send failed");
 		    this_state = LISA_ERROR;
-            pthread_mutex_unlock(&(l->lock));
-  	      }
-		  else { /* all ok */
-            bytes_sent += send(this_socket, &(msg[bytes_sent]), msglength-bytes_sent, this_flags);
-            this_state = LISA_SENT_DATA;
-          }
+            pthread_mutex_unlock(&(l->send_lock));
 	    }
     } //while
     rc = bytes_sent;
   }
-  else {  //not TCP
+  else {  //udp without a connection (the remote address is set under the lock, as by recv_from)
     pthread_mutex_lock(&(l->lock));
     if (l->vsock) {
         rc = sendto(this_socket, msg, msglength, this_flags,
@@ -645,49 +1115,351 @@ int lisa_send(lisa *l, char *msg, unsigned int msglength) {
   }
   if (rc < 0) this_state = LISA_ERROR;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-SEND
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  pthread_mutex_lock(&(l->lock));
-  if (l->state != LISA_ACCEPTED) l->state = this_state;
-  else l->client_state = this_state;
+  pthread_mutex_lock(&(l->send_lock));
+  if (STATE(l->state) != LISA_ACCEPTED) lisa_set_sent_state(&(l->state), this_state);
+  else lisa_set_sent_state(&(l->client_state), this_state);
   COPY_MSG("lisa_send", "OK");
-  pthread_mutex_unlock(&(l->lock));
+  pthread_mutex_unlock(&(l->send_lock));
   return rc;
 }
 
+#ifdef DEBUG
+int LISA_SEND(lisa *l, char *msg, unsigned int msglength, char * file, char * line) {
+  return lisa_send_on(l, -1, msg, msglength, file, line);
+}
+#else
+int lisa_send(lisa *l, char *msg, unsigned int msglength) {
+  return lisa_send_on(l, -1, msg, msglength);
+}
+#endif
+
+/**
+ * Like lisa_send, but for a server sends to client fd rather than to the client last received from.
+ */
+#ifdef DEBUG
+int LISA_SEND_CLIENT(lisa *l, SOCKET fd, char *msg, unsigned int msglength, char * file, char * line) {
+  return lisa_send_on(l, fd, msg, msglength, file, line);
+}
+#else
+int lisa_send_client(lisa *l, SOCKET fd, char *msg, unsigned int msglength) {
+  return lisa_send_on(l, fd, msg, msglength);
+}
+#endif
+
+#ifndef WIN32
 /**
- * Sends same msg to all clients (generally only useful for server; for client is identical to send)
+ * Gathers iovcnt buffers into one sendmsg that doesn't wait for the socket, so it may send only part of them.
+ * Unlike lisa_send there is no wait, since the caller waits (on lisa_get_send_fd) only if the socket is full.
+ */
+#ifdef DEBUG
+int LISA_SENDV(lisa *l, struct iovec *iov, int iovcnt, char * file, char * line) {
+#else
+int lisa_sendv(lisa *l, struct iovec *iov, int iovcnt) {
+#endif
+  struct msghdr msg;
+  SOCKET this_socket;
+  struct shm_link_t * this_link;
+  int this_flags;
+  size_t bytes;
+  ssize_t rc;
+  pthread_mutex_lock(&(l->send_lock));
+  CHECK_ERROR_RELEASE(&(l->send_lock), LISA_ERROR);
+  if (STATE(l->state) < LISA_CONNECTED || !lisa_is_stream(l)) {
+    pthread_mutex_unlock(&(l->send_lock));
+    return LISA_ERROR;
+  }
+  if (l->clsvr == LISA_CLIENT) this_socket = l->fd;
+  else this_socket = __atomic_load_n(&(l->client_fd), __ATOMIC_RELAXED);
+  this_flags = l->flags;
+  if (l->zerocopy) {
+    bytes = 0;
+    for (int i=0; i<iovcnt; i++) bytes += iov[i].iov_len;
+    if (bytes >= l->zerocopy) this_flags |= MSG_ZEROCOPY;
+  }
+  this_link = lisa_link(l, this_socket);
+  pthread_mutex_unlock(&(l->send_lock));
+  if (this_link) rc = shm_link_write(this_link, iov, iovcnt);
+  else {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    rc = sendmsg(this_socket, &msg, this_flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+  if (rc >= 0) {
+    /* the kernel numbers the zero-copy sends that sent something, to say which ones it is done with */
+    if (rc > 0 && (this_flags & MSG_ZEROCOPY)) {
+      pthread_mutex_lock(&(l->send_lock));
+      l->zerocopy_sent++;
+      pthread_mutex_unlock(&(l->send_lock));
+    }
+    return (int) rc;
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+  pthread_mutex_lock(&(l->send_lock));
+  SET_ERROR("lisa_sendv");
+  if (STATE(l->state) != LISA_ACCEPTED) lisa_set_sent_state(&(l->state), LISA_ERROR);
+  else lisa_set_sent_state(&(l->client_state), LISA_ERROR);
+  pthread_mutex_unlock(&(l->send_lock));
+  return LISA_ERROR;
+}
+
+/**
+ * Gets the fd lisa_sendv sends on, so a caller can wait for room in the socket, or -1 if not connected.
+ */
+SOCKET lisa_get_send_fd(lisa *l) {
+  SOCKET fd;
+  struct shm_link_t * link;
+  pthread_mutex_lock(&(l->send_lock));
+  if (STATE(l->state) < LISA_CONNECTED) fd = -1;
+  else if (l->clsvr == LISA_CLIENT) fd = l->fd;
+  else fd = __atomic_load_n(&(l->client_fd), __ATOMIC_RELAXED);
+  link = (fd < 0) ? NULL : lisa_link(l, fd);
+  if (link) fd = shm_link_room_fd(link);
+  pthread_mutex_unlock(&(l->send_lock));
+  return fd;
+}
+
+/**
+ * The events to poll lisa_get_send_fd for: an eventfd (shm) is only ever readable, while a socket has room when it is writable.
+ */
+short lisa_get_send_events(lisa *l) {
+  return (l->type == LISA_SHM) ? POLLIN : POLLOUT;
+}
+
+int lisa_is_stream(lisa *l) {
+  return (l->type == LISA_TCP || l->type == LISA_SHM);
+}
+
+/**
+ * Sends as many of vlen messages as the socket will take right now in one sendmmsg, each message whole (seqpacket or udp).
+ * Like lisa_sendv there is no wait, since the caller waits (on lisa_get_send_fd) only if the socket is full.
+ */
+#ifdef DEBUG
+int LISA_SENDMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line) {
+#else
+int lisa_sendmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen) {
+#endif
+  SOCKET this_socket;
+  int this_flags;
+  int rc;
+  pthread_mutex_lock(&(l->send_lock));
+  CHECK_ERROR_RELEASE(&(l->send_lock), LISA_ERROR);
+  if (STATE(l->state) < LISA_CONNECTED || lisa_is_stream(l)) {
+    pthread_mutex_unlock(&(l->send_lock));
+    return LISA_ERROR;
+  }
+  if (l->clsvr == LISA_CLIENT) this_socket = l->fd;
+  else this_socket = __atomic_load_n(&(l->client_fd), __ATOMIC_RELAXED);
+  this_flags = l->flags;
+  pthread_mutex_unlock(&(l->send_lock));
+  rc = sendmmsg(this_socket, msgs, vlen, this_flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (rc >= 0) return rc;
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+  pthread_mutex_lock(&(l->send_lock));
+  SET_ERROR("lisa_sendmv");
+  if (STATE(l->state) != LISA_ACCEPTED) lisa_set_sent_state(&(l->state), LISA_ERROR);
+  else lisa_set_sent_state(&(l->client_state), LISA_ERROR);
+  pthread_mutex_unlock(&(l->send_lock));
+  return LISA_ERROR;
+}
+
+/* sends all vlen messages on fd, waiting up to tp each time the socket is full, returns how many were sent */
+static unsigned int lisa_sendmv_all(SOCKET fd, int flags, struct mmsghdr *msgs, unsigned int vlen, struct timeval * tp) {
+  unsigned int sent;
+  int rc;
+  for (sent = 0; sent < vlen; ) {
+    rc = sendmmsg(fd, msgs + sent, vlen - sent, flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (rc > 0) sent += rc;
+    else if (rc < 0 && errno == EINTR) continue;
+    else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (lisa_poll(fd, POLLOUT, tp) <= 0) break;
+    }
+    else break;
+  }
+  return sent;
+}
+
+/**
+ * Sends all vlen messages to all clients (other than the one last received from, as for lisa_cast), waiting for room
+ * like lisa_send. A client just sends them to the server.
+ */
+#ifdef DEBUG
+int LISA_CASTMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line) {
+#else
+int lisa_castmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen) {
+#endif
+  SOCKET fds[MAX_CLIENTS];
+  struct timeval timeout;
+  struct timeval * tp;
+  int this_flags;
+  int n;
+  pthread_mutex_lock(&(l->send_lock));
+  CHECK_ERROR_RELEASE(&(l->send_lock), LISA_ERROR);
+  if (STATE(l->state) < LISA_CONNECTED || lisa_is_stream(l)) {
+    pthread_mutex_unlock(&(l->send_lock));
+    return LISA_ERROR;
+  }
+  n = 0;
+  if (l->clsvr == LISA_CLIENT) fds[n++] = l->fd;
+  else {
+    for (int i=0; i<l->num_clients; i++) if (l->client_fds[i] != __atomic_load_n(&(l->client_fd), __ATOMIC_RELAXED)) fds[n++] = l->client_fds[i];
+  }
+  this_flags = l->flags;
+  if (l->wait_time.tv_sec == 0) tp = NULL;
+  else {
+    timeout.tv_sec = l->wait_time.tv_sec;
+    timeout.tv_usec = l->wait_time.tv_usec;
+    tp = &(timeout);
+  }
+  pthread_mutex_unlock(&(l->send_lock));
+  for (int i=0; i<n; i++) {
+    if (lisa_sendmv_all(fds[i], this_flags, msgs, vlen, tp) < vlen) {
+      pthread_mutex_lock(&(l->send_lock));
+      COPY_MSG("lisa_castmv", "timeout or error sending to a client");
+      pthread_mutex_unlock(&(l->send_lock));
+    }
+  }
+  return vlen;
+}
+
+/**
+ * Turns on SO_ZEROCOPY so that lisa_sendv can use MSG_ZEROCOPY for sends of at least threshold bytes.
+ * Below some size pinning the pages and the extra notification cost more than the copy saves.
+ */
+#ifdef DEBUG
+int LISA_SET_ZEROCOPY(lisa *l, unsigned int threshold, char * file, char * line) {
+#else
+int lisa_set_zerocopy(lisa *l, unsigned int threshold) {
+#endif
+  int one = 1;
+  pthread_mutex_lock(&(l->send_lock));
+  CHECK_ERROR_RELEASE(&(l->send_lock), 0);
+  l->zerocopy = 0;
+  if (threshold && l->type == LISA_TCP) {
+    if (setsockopt(l->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) SET_ERROR("lisa_set_zerocopy");
+    else {
+      l->zerocopy = threshold;
+      COPY_MSG("lisa_set_zerocopy", "OK");
+    }
+  }
+  else if (threshold) COPY_MSG("lisa_set_zerocopy", "only for tcp");
+  pthread_mutex_unlock(&(l->send_lock));
+  return (l->zerocopy != 0);
+}
+
+/**
+ * Reads what the kernel has said about zero-copy sends (without waiting) and returns how many it isn't done with.
+ * Each notification covers a range of sends, in the order they were made.
+ */
+unsigned int lisa_zerocopy_pending(lisa *l) {
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  struct sock_extended_err *serr;
+  unsigned int pending;
+  SOCKET this_socket;
+  pthread_mutex_lock(&(l->send_lock));
+  if (l->zerocopy_done == l->zerocopy_sent) {
+    pthread_mutex_unlock(&(l->send_lock));
+    return 0;
+  }
+  this_socket = (l->clsvr == LISA_CLIENT) ? l->fd : __atomic_load_n(&(l->client_fd), __ATOMIC_RELAXED);
+  for (;;) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(this_socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+    for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      serr = (struct sock_extended_err *) CMSG_DATA(cm);
+      if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) continue;
+      /* ee_info to ee_data is the range of sends done */
+      l->zerocopy_done += serr->ee_data - serr->ee_info + 1;
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) l->zerocopy_copied += serr->ee_data - serr->ee_info + 1;
+    }
+  }
+  pending = l->zerocopy_sent - l->zerocopy_done;
+  pthread_mutex_unlock(&(l->send_lock));
+  return pending;
+}
+
+/**
+ * Starts receiving through an io_uring: one multishot receive for each socket, each taking buffers from a ring of them
+ * that are given back once lisa_recv has copied them out. Any of that the kernel can't do, it falls back from.
+ * Turning it off drops anything received but not yet taken, so is for when nothing more is to be received.
+ */
+#ifdef DEBUG
+int LISA_SET_URING(lisa *l, int on, char * file, char * line) {
+#else
+int lisa_set_uring(lisa *l, int on) {
+#endif
+  struct lisa_uring_t * lu;
+  pthread_mutex_lock(&(l->recv_lock));
+  CHECK_ERROR_RELEASE(&(l->recv_lock), 0);
+  if (!on || l->uring || l->type != LISA_TCP) {
+    if (!on) lisa_uring_drop(l);
+    else if (!l->uring) COPY_MSG("lisa_set_uring", "only for tcp");
+    pthread_mutex_unlock(&(l->recv_lock));
+    return (l->uring != NULL);
+  }
+  lu = calloc(1, sizeof(*lu));
+  if (!lu) COPY_MSG("lisa_set_uring", "out of memory");
+  else if (!uring_init(&(lu->ring), LISA_URING_ENTRIES)) {
+    COPY_MSG("lisa_set_uring", "no io_uring here");
+    free(lu);
+    lu = NULL;
+  }
+  else if (!uring_provide_buffers(&(lu->ring), LISA_URING_GROUP, LISA_URING_BUFFERS, LISA_URING_BUFFER_SIZE)) {
+    COPY_MSG("lisa_set_uring", "no provided buffers (before 5.19)");
+  }
+  else if (!lisa_uring_works(lu)) COPY_MSG("lisa_set_uring", "no multishot receives (before 6.0)");
+  else {
+    l->uring = lu;
+    if (l->clsvr == LISA_CLIENT && STATE(l->state) >= LISA_CONNECTED) lisa_uring_add(l, l->fd);
+    for (int i=0; l->clsvr == LISA_SERVER && i<l->num_clients; i++) lisa_uring_add(l, l->client_fds[i]);
+    COPY_MSG("lisa_set_uring", "OK");
+  }
+  if (lu && !l->uring) {
+    uring_exit(&(lu->ring));
+    free(lu);
+  }
+  pthread_mutex_unlock(&(l->recv_lock));
+  return (l->uring != NULL);
+}
+#endif
+
+/**
+ * Sends same msg to all clients (generally only useful for server; for client is identical to send), other than the one
+ * last received from. The clients are taken under the send half, as by lisa_castmv, and each is sent to without
+ * changing which client lisa_send goes to.
  */
 #ifdef DEBUG
 int LISA_CAST(lisa *l, char *msg, unsigned int msglength, char * file, char * line) {
 #else
 int lisa_cast(lisa *l, char *msg, unsigned int msglength) {
 #endif
-  //printf("in cast\n");
-  int last_client;
-  pthread_mutex_lock(&(l->lock));
+  SOCKET fds[MAX_CLIENTS];
+  SOCKET last_client;
+  int n;
   if (l->clsvr == LISA_CLIENT) {
-        pthread_mutex_unlock(&(l->lock));
         lisa_send(l,msg,msglength);
         return msglength;
   }
-  else {
-    last_client = l->client_fd;
-    for (int i=0; i<l->num_clients; i++) {
-     //fprintf(stderr, "%d ", i);
-      if (l->client_fds[i] != last_client) {
-        printf("sending %d to: %d\n", msglength, l->client_fds[i]);
-        l->client_fd = l->client_fds[i];
-        pthread_mutex_unlock(&(l->lock));
-        lisa_send(l, msg, msglength);
-        pthread_mutex_lock(&(l->lock));
-        //printf("sent\n");
-      }
-    }
-    pthread_mutex_unlock(&(l->lock));
-    return msglength;
+  n = 0;
+  pthread_mutex_lock(&(l->send_lock));
+  last_client = __atomic_load_n(&(l->client_fd), __ATOMIC_RELAXED);
+  for (int i=0; i<l->num_clients; i++) if (l->client_fds[i] != last_client) fds[n++] = l->client_fds[i];
+  pthread_mutex_unlock(&(l->send_lock));
+  for (int i=0; i<n; i++) {
+#ifdef DEBUG
+    lisa_send_on(l, fds[i], msg, msglength, file, line);
+#else
+    lisa_send_on(l, fds[i], msg, msglength);
+#endif
   }
+  return msglength;
 }
 
 
@@ -758,86 +1530,157 @@ int lisa_send_to(lisa *l, char *msg, unsigned int msglength, char *addr, unsigne
   return rc;
 }
 
+/* receives whatever there is right now: up to vlen messages into msgs if there are msgs, otherwise up to msglength bytes
+ * into msg (from the link, for shm); on a connection (anything but udp), an empty message means the other side closed,
+ * which recvmmsg reports as a run of them, so only the messages before it count, and 0 means closed either way */
+static int lisa_recv_now(SOCKET fd, struct shm_link_t *link, char *msg, unsigned int msglength, struct mmsghdr *msgs, unsigned int vlen, int connection) {
+  int rc, i;
+  if (link && !msgs) return (int) shm_link_read(link, msg, msglength);
+  if (!msgs) return recv(fd, msg, msglength, MSG_DONTWAIT);
+  rc = recvmmsg(fd, msgs, vlen, MSG_DONTWAIT, NULL);
+  if (rc <= 0 || !connection) return rc;
+  for (i=0; i<rc && msgs[i].msg_len; i++);
+  return i;
+}
+
 /**
- * Basically the same as recv or recv_from except that it handles errors.
- * Note that in the case of UDP, conceptually the socket is connected because
- * the remote address was set by a previous send_to;
- * and errors are captured in the state field, not the return code (which is never negative)
+ * Receives into msg like lisa_recv_within, but takes it from what the receives of the io_uring have got, and if they
+ * have got nothing yet (and wait is set) waits on the ring, for tp, rather than on the sockets.
+ * Called with the receive lock, which it unlocks.
  */
 #ifdef DEBUG
-int LISA_RECV(lisa *l, char *msg, unsigned int msglength, char * file, char * line) {
+static int lisa_recv_uring(lisa *l, char *msg, unsigned int msglength, int wait, struct timeval * tp, char * file, char * line) {
 #else
-int lisa_recv(lisa *l, char *msg, unsigned int msglength) {
+static int lisa_recv_uring(lisa *l, char *msg, unsigned int msglength, int wait, struct timeval * tp) {
 #endif
-  int rc, this_state;
-  struct timeval timeout;
-  struct timeval * tp;
-  SOCKET max_fd, this_fd;
-  fd_set this_fdset;
-#ifdef WIN32
-  int size;
+  int rc, ready, this_state;
+  SOCKET this_fd, ring_fd;
+  this_fd = 0;
+  ready = 1;
+  rc = lisa_uring_take(l, msg, msglength, &this_fd);
+  if (rc < 0 && errno == EAGAIN && wait) {
+    ring_fd = uring_fd(&(l->uring->ring));
+    pthread_mutex_unlock(&(l->recv_lock));
+    ready = lisa_poll(ring_fd, POLLIN, tp);
+    pthread_mutex_lock(&(l->recv_lock));
+    l->syscalls++;
+    if (ready > 0 && l->uring) rc = lisa_uring_take(l, msg, msglength, &this_fd);
+    else if (ready > 0) errno = EAGAIN;   /* it stopped receiving through the ring meanwhile */
+  }
+  if (ready < 0) {
+    printf("error waiting to receive: %s\n", strerror(errno));
+    COPY_MSG("lisa_recv", "error waiting to receive");
+    this_state = LISA_ERROR;
+    rc = -1;
+  }
+  else if (rc < 0 && errno == EAGAIN) {  /* nothing yet, or only what was left of sockets since closed */
+    COPY_MSG("lisa_recv", "timeout receiving");
+    this_state = LISA_TIMEOUT;
+    rc = 0;
+  }
+  else if (rc < 0) {
+    printf("%s\n", strerror(errno));
+    COPY_MSG("lisa_recv", "receive failed");
+    this_state = LISA_ERROR;
+  }
+  else if (rc == 0) this_state = LISA_CLOSED;
+  else this_state = LISA_GOT_DATA;
+  if (l->clsvr != LISA_CLIENT && this_fd) {
+    __atomic_store_n(&(l->client_fd), this_fd, __ATOMIC_RELAXED);
+    l->recv_fd = this_fd;
+  }
+  if (l->clsvr == LISA_CLIENT) SET_STATE(l->state, this_state);
+  else SET_STATE(l->client_state, this_state);
+  COPY_MSG("lisa_recv", "OK");
+  pthread_mutex_unlock(&(l->recv_lock));
+  return rc;
+}
+
+/**
+ * Receives into msg (or msgs), waiting up to the wait time if wait is set and there is nothing to receive yet.
+ * Rather than waiting first, a client tries its socket and only waits if there is nothing on it, and a server receives
+ * from each of the clients the last wait found ready in turn and only waits again once it has been through all of them.
+ */
+#ifdef DEBUG
+static int lisa_recv_within(lisa *l, char *msg, unsigned int msglength, struct mmsghdr *msgs, unsigned int vlen, int wait, char * file, char * line) {
 #else
-  unsigned int size;
+static int lisa_recv_within(lisa *l, char *msg, unsigned int msglength, struct mmsghdr *msgs, unsigned int vlen, int wait) {
 #endif
+  int rc, this_state, received, ready, spurious, connection, calls;
+  struct timeval timeout;
+  struct timeval * tp;
+  SOCKET this_fd, epfd;
+  SOCKET ready_fds[MAX_CLIENTS];
+  struct shm_link_t * this_link;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  pthread_mutex_lock(&(l->lock));
-  CHECK_ERROR_UNLOCK(-1);
-  this_fd = l->fd;
-  this_state = l->state;
-  if (l->state < LISA_CONNECTED || l->clsvr == LISA_UNKNOWN) {
+  pthread_mutex_lock(&(l->recv_lock));
+  CHECK_ERROR_RELEASE(&(l->recv_lock), -1);
+  this_state = STATE(l->state);
+  if (this_state < LISA_CONNECTED || l->clsvr == LISA_UNKNOWN) {
     COPY_MSG("lisa_recv", "not connected");
-    pthread_mutex_unlock(&(l->lock));
+    pthread_mutex_unlock(&(l->recv_lock));
     return 0;
   }
-  if (l->wait_time.tv_sec == 0) tp = NULL;
+  if (!wait) {
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 0;
+    tp = &(timeout);
+  }
+  else if (l->wait_time.tv_sec == 0) tp = NULL;
   else {
     timeout.tv_sec = l->wait_time.tv_sec;
     timeout.tv_usec = l->wait_time.tv_usec;
 	tp = &(timeout);
   }
-  FD_ZERO(&this_fdset);
-  if (l->clsvr == LISA_CLIENT) {
-    FD_SET(this_fd, &this_fdset);
-    max_fd=this_fd+1;
-  }
-  else {
-    max_fd=0;
-    for (int i=0; i<l->num_clients; i++) {
-        this_fd=l->client_fds[i];
-        //printf("selecting on: %d\n", this_fd);
-        FD_SET(this_fd, &this_fdset);
-        if (max_fd<this_fd) max_fd=this_fd;
-    }
-    max_fd++;
+#ifdef DEBUG
+  if (l->uring && !msgs) return lisa_recv_uring(l, msg, msglength, wait, tp, file, line);
+#else
+  if (l->uring && !msgs) return lisa_recv_uring(l, msg, msglength, wait, tp);
+#endif
+  if (l->clsvr == LISA_CLIENT) this_fd = l->fd;
+  else this_fd = lisa_next_ready(l);
+  this_link = lisa_link(l, this_fd);
+  epfd = l->epfd;
+  connection = (l->type != LISA_UDP);
+  pthread_mutex_unlock(&(l->recv_lock));
+  /* LLLLLLLLLLLLLLLLLLLLLLLL
+   * TRY
+   * LLLLLLLLLLLLLLLLLLLLLLLL
+   */
+  rc = 0;
+  received = 0;
+  calls = 0;
+  if (this_fd) {
+    rc = lisa_recv_now(this_fd, this_link, msg, msglength, msgs, vlen, connection);
+    received = (rc >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK));
+    if (!this_link) calls++;
   }
-  pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT (only if there was nothing to receive)
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  //fprintf(stderr, "[");
-  //printf("fd: %d\n", this_fd);
-  rc = select(max_fd, &this_fdset, NULL, NULL, tp);
-  //fprintf(stderr, "]");
+  ready = received;
+  if (!received) {
+    if (l->clsvr != LISA_CLIENT) ready = lisa_wait_clients(epfd, ready_fds, tp);
+    else if (wait) ready = lisa_poll(this_link ? shm_link_data_fd(this_link) : this_fd, POLLIN, tp);
+    if (l->clsvr != LISA_CLIENT ? epfd >= 0 : wait) calls++;
+  }
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  //fprintf(stderr, "{");
-  pthread_mutex_lock(&(l->lock));
-  //fprintf(stderr, "}");
-  if (rc <= 0) {
-    if (rc<0) {
-        printf("error in select\n");
-        COPY_MSG("lisa_recv", "error in select");
+  pthread_mutex_lock(&(l->recv_lock));
+  if (ready <= 0) {
+    if (ready<0) {
+        printf("error waiting to receive: %s\n", strerror(errno));
+        COPY_MSG("lisa_recv", "error waiting to receive");
         this_state = LISA_ERROR;
         rc = -1;
     }
     else {
-        //printf("timeout\n");
         COPY_MSG("lisa_recv", "timeout receiving");
         this_state = LISA_TIMEOUT;
         rc = 0;
@@ -845,60 +1688,103 @@ int lisa_recv(lisa *l, char *msg, unsigned int msglength) {
   }
   else {
     /* this_fd := fd for sending data, depending on if we are a client or a server */
-    if (l->clsvr == LISA_CLIENT) {
-        this_fd=l->fd;
+    if (!received && l->clsvr != LISA_CLIENT) {
+        memcpy(l->ready_fds, ready_fds, ready * sizeof(SOCKET));
+        l->num_ready = ready;
+        l->next_ready = 0;
+        this_fd = lisa_next_ready(l);
+        this_link = lisa_link(l, this_fd);
     }
-    else { //we must be a server
-        l->client_fd=0;
-        for (int i=0; i<l->num_clients; i++) {
-            if (FD_ISSET(l->client_fds[i], &this_fdset)) {
-                l->client_fd = l->client_fds[i];
-                break;
-            }
-        }
-        if (!l->client_fd) {
-            COPY_MSG("lisa_recv", "Unexpected FD not set receiving");
-        }
-        else {
-            this_fd=l->client_fd;
-        }
+    if (l->clsvr != LISA_CLIENT) {
+        __atomic_store_n(&(l->client_fd), this_fd, __ATOMIC_RELAXED);
+        l->recv_fd = this_fd;
     }
-    /* now that we have the socket for receiving data, do the receive and set the current state, depending on if tcp or udp */
-    //fprintf(stderr, "%d", this_fd);
-    if (this_fd) {
-        if (l->type == LISA_TCP)  {
-            //fprintf(stderr, "(");
-            rc = recv(this_fd, msg, msglength, 0);
-            //fprintf(stderr, ")");
-            //printf("rc: %d, this_fd: %d\n", rc, this_fd);
-            if (rc <= 0) {
-                if (rc < 0) {
-                    printf("%s\n", strerror(errno));
-                    COPY_MSG("lisa_recv", "receive failed");
-                    this_state = LISA_ERROR;
-                }
-                else this_state = LISA_CLOSED;  /* if select passes but no data then socket is at EOF */
-            }
-            else {
-                this_state = LISA_GOT_DATA;
-                //todo: handle tv flag (and add flags param)
-            }
-
-        }
-        else { //UDP
-            size = sizeof(l->remote_addr);
-            rc = recvfrom(this_fd, msg, msglength, l->flags, (struct sockaddr*) &l->remote_addr, &size);
-            this_state = LISA_GOT_DATA;
-        }
+    /* now that we have the socket for receiving data, do the receive and set the current state */
+    spurious = 0;
+    if (!received) {
+        rc = lisa_recv_now(this_fd, this_link, msg, msglength, msgs, vlen, connection);
+        spurious = (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        if (!this_link) calls++;
+    }
+    if (spurious) {  /* the wait said there was something, but it had already been received */
+        COPY_MSG("lisa_recv", "timeout receiving");
+        this_state = LISA_TIMEOUT;
+        rc = 0;
+    }
+    else if (rc < 0) {
+        printf("%s\n", strerror(errno));
+        COPY_MSG("lisa_recv", "receive failed");
+        this_state = LISA_ERROR;
+    }
+    else if (rc == 0 && connection) this_state = LISA_CLOSED;  /* if the socket is ready but has no data then it is at EOF */
+    else {
+        this_state = LISA_GOT_DATA;
+        //todo: handle tv flag (and add flags param)
     }
   } //not timeout receiving
-  if (l->clsvr == LISA_CLIENT) l->state = this_state;
-  else l->client_state = this_state;
+  if (l->clsvr == LISA_CLIENT) SET_STATE(l->state, this_state);
+  else SET_STATE(l->client_state, this_state);
+  l->syscalls += calls;
   COPY_MSG("lisa_recv", "OK");
-  pthread_mutex_unlock(&(l->lock));
+  pthread_mutex_unlock(&(l->recv_lock));
   return rc;
 }
 
+/**
+ * Basically the same as recv or recv_from except that it handles errors.
+ * Note that in the case of UDP, conceptually the socket is connected because
+ * the remote address was set by a previous send_to;
+ * and errors are captured in the state field, not the return code (which is never negative)
+ */
+#ifdef DEBUG
+int LISA_RECV(lisa *l, char *msg, unsigned int msglength, char * file, char * line) {
+  return lisa_recv_within(l, msg, msglength, NULL, 0, 1, file, line);
+}
+#else
+int lisa_recv(lisa *l, char *msg, unsigned int msglength) {
+  return lisa_recv_within(l, msg, msglength, NULL, 0, 1);
+}
+#endif
+
+/**
+ * Same as lisa_recv except that it doesn't wait if there is nothing to receive.
+ */
+#ifdef DEBUG
+int LISA_RECV_NOWAIT(lisa *l, char *msg, unsigned int msglength, char * file, char * line) {
+  return lisa_recv_within(l, msg, msglength, NULL, 0, 0, file, line);
+}
+#else
+int lisa_recv_nowait(lisa *l, char *msg, unsigned int msglength) {
+  return lisa_recv_within(l, msg, msglength, NULL, 0, 0);
+}
+#endif
+
+/**
+ * Same as lisa_recv but receives up to vlen whole messages at once (seqpacket or udp), returning how many.
+ */
+#ifdef DEBUG
+int LISA_RECVMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line) {
+  return lisa_recv_within(l, NULL, 0, msgs, vlen, 1, file, line);
+}
+#else
+int lisa_recvmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen) {
+  return lisa_recv_within(l, NULL, 0, msgs, vlen, 1);
+}
+#endif
+
+/**
+ * Same as lisa_recvmv except that it doesn't wait if there is nothing to receive.
+ */
+#ifdef DEBUG
+int LISA_RECVMV_NOWAIT(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line) {
+  return lisa_recv_within(l, NULL, 0, msgs, vlen, 0, file, line);
+}
+#else
+int lisa_recvmv_nowait(lisa *l, struct mmsghdr *msgs, unsigned int vlen) {
+  return lisa_recv_within(l, NULL, 0, msgs, vlen, 0);
+}
+#endif
+
 /**
  * Basically the same as recv_from except that it automatically binds
  * if needed, sets up the local address and handles errors. The remote
@@ -918,9 +1804,8 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
   struct timeval * tp;
   int this_fd;
   int rc;
-  fd_set this_fdset;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -942,7 +1827,6 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
     CHECK_RC_ERROR_UNLOCK("lisa_recv_from", rc)
     l->state = LISA_BOUND;
   }
-  FD_SET(this_fd, &this_fdset);
   if (l->wait_time.tv_sec == 0) tp = NULL;
   else {
     timeout.tv_sec = l->wait_time.tv_sec;
@@ -951,12 +1835,12 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
   }
   pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  rc = select(this_fd+1, &this_fdset, NULL, NULL, tp);
+  rc = lisa_poll(this_fd, POLLIN, tp);
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -965,7 +1849,6 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
     pthread_mutex_unlock(&(l->lock));
     return 0;
   }
-  if (!FD_ISSET(this_fd, &this_fdset)) COPY_MSG("lisa_recv_from", "fd not set");
   if (l->vsock) {
     size = sizeof(l->local_vaddr);
     rc = recvfrom(this_fd, msg, msglength, l->flags,
@@ -995,19 +1878,30 @@ void lisa_close(lisa *l) {
   struct linger linger = {1,5};
 #endif
   CHECK_ERROR();
-  if (l->state < LISA_CONNECTED) return;
+  if (STATE(l->state) < LISA_CONNECTED) return;
+  pthread_mutex_lock(&(l->lock));
+  lisa_hold_halves(l);
 #ifdef WIN32
   /* setsockopt(l->fd, SOL_SOCKET, SO_LINGER, (char *) &linger, sizeof(linger)); */
   closesocket(l->fd);
 #else
   setsockopt(l->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  lisa_uring_drop(l);
   for (int i=0; i<l->num_clients; i++) {
+    lisa_drop_link(l, i);
     close(l->client_fds[i]);
   }
+  if (l->clsvr == LISA_CLIENT) lisa_drop_link(l, 0);
   close(l->fd);
+  if (l->epfd >= 0) close(l->epfd);
+  l->epfd = -1;
+  l->num_ready = 0;
+  l->next_ready = 0;
 #endif
-  l->state = LISA_UNINITIALIZED;
+  SET_STATE(l->state, LISA_UNINITIALIZED);
   COPY_MSG("lisa_close", "OK");
+  lisa_release_halves(l);
+  pthread_mutex_unlock(&(l->lock));
 }
 
 /**
@@ -1018,24 +1912,35 @@ void LISA_CLOSE_CLIENT(lisa *l, char * file, char * line) {
 #else
 void lisa_close_client(lisa *l) {
 #endif
-  int i, j, found;
+  int i, j;
   struct linger linger = {1,5};
   CHECK_ERROR();
-  if (l->client_state < LISA_CONNECTED) return;
+  if (STATE(l->client_state) < LISA_CONNECTED) return;
+  pthread_mutex_lock(&(l->lock));
+  lisa_hold_halves(l);
+  for (i=0; i<l->num_clients && l->client_fds[i] != l->client_fd; i++);
 #ifdef WIN32
   setsockopt(l->client_fd, SOL_SOCKET, SO_LINGER, (char *) &linger, sizeof(linger));
   closesocket(l->client_fd);
 #else
+  lisa_unwatch_client(l, l->client_fd);
+  if (i < l->num_clients) lisa_drop_link(l, i);
   setsockopt(l->client_fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
   close(l->client_fd);
 #endif
-  found = 0;
-  for (i=0; i<l->num_clients && !found; i++) found = (l->client_fds[i] == l->client_fd);
-  for (j=i+1; j<l->num_clients; j++) l->client_fds[j-1] = l->client_fds[j];
-  l->num_clients--;
-  l->client_state = LISA_UNINITIALIZED;
-  l->state = LISA_LISTENING;
+  if (i < l->num_clients) {
+    for (j=i+1; j<l->num_clients; j++) {
+      l->client_fds[j-1] = l->client_fds[j];
+      l->shm_links[j-1] = l->shm_links[j];
+    }
+    l->shm_links[l->num_clients - 1] = NULL;
+    l->num_clients--;
+  }
+  SET_STATE(l->client_state, LISA_UNINITIALIZED);
+  SET_STATE(l->state, LISA_LISTENING);
   COPY_MSG("lisa_close_client", "OK");
+  lisa_release_halves(l);
+  pthread_mutex_unlock(&(l->lock));
 }
 
 
@@ -1147,4 +2052,47 @@ void lisa_set_wait_time(lisa *l, int t) {
   l->wait_time.tv_sec = t;
 }
 
+/**
+ * Gets the clients of a server (for a client, nothing), so a caller can tell them apart or send to each.
+ * Returns how many (up to max_fds).
+ */
+int lisa_get_clients(lisa *l, SOCKET *fds, int max_fds) {
+  int n = 0;
+  pthread_mutex_lock(&(l->send_lock));
+  if (STATE(l->state) >= LISA_CONNECTED && l->clsvr == LISA_SERVER) {
+    for (int i=0; i<l->num_clients && n<max_fds; i++) fds[n++] = l->client_fds[i];
+  }
+  pthread_mutex_unlock(&(l->send_lock));
+  return n;
+}
+
+/**
+ * Gets the fds that lisa_recv would wait on, so a caller can wait for data without being in lisa_recv.
+ * Returns how many (up to max_fds), or zero if not connected (or the other side closed, since then the fds would always be ready).
+ */
+int lisa_get_recv_fds(lisa *l, SOCKET *fds, int max_fds) {
+  int n, open;
+  n = 0;
+  pthread_mutex_lock(&(l->recv_lock));
+  if (STATE(l->state) >= LISA_CONNECTED) {
+    if (l->uring) {
+      if (l->clsvr == LISA_CLIENT) open = (STATE(l->state) != LISA_CLOSED);
+      else open = (STATE(l->client_state) != LISA_CLOSED && l->num_clients);
+      if (max_fds > 0 && open) fds[n++] = uring_fd(&(l->uring->ring));
+    }
+    else if (l->clsvr == LISA_CLIENT) {
+      if (max_fds > 0 && STATE(l->state) != LISA_CLOSED) fds[n++] = l->fd;
+      if (n && n < max_fds && l->shm_links[0]) fds[n++] = shm_link_data_fd(l->shm_links[0]);
+    }
+    else if (l->clsvr == LISA_SERVER && STATE(l->client_state) != LISA_CLOSED) {
+      for (int i=0; i<l->num_clients && n<max_fds; i++) {
+        fds[n++] = l->client_fds[i];
+        if (n < max_fds && l->shm_links[i]) fds[n++] = shm_link_data_fd(l->shm_links[i]);
+      }
+    }
+  }
+  pthread_mutex_unlock(&(l->recv_lock));
+  return n;
+}
+
 
@@ -55,13 +55,31 @@
  * 2. The non-blocking server does call setup_udp because the subsequent call to make it nonblocking can work
  *    for either tcp or udp sockets so it doesn't know which one to initialize it for, and therefore we need to
  *    explicitly set it to udp.
- * 3. Reads are guarded with a select statment with a default timeout of one second. If you want to change the
- *    timeout, set tube->wait_time.tv_sec to the number of seconds you wan to wait (or tube->wait_time_tv_usec);
+ * 3. Reads are tried right away and only wait (in poll, or for a server in an epoll set of its clients) if there is
+ *    nothing to read yet, by default for up to 30 seconds. If you want to change the timeout, set
+ *    tube->wait_time.tv_sec to the number of seconds you wan to wait (or tube->wait_time_tv_usec);
  * 4. By default, sockets are nonblocking ("by default" means if you call connect without calling setup_tcp).
  * 5. Servers can have up to MAX_CLIENTS connected at a time. Sends will go to whichever client the last recv
  *    came from. The expectation is that servers will be in a loop receiving and then optionally responding to
  *    the client that most recently sent something. So, for example, trying to receive from three different clients
  *    and then responding to all 3 will result in all 3 responses going to the last client who sent something.
+ * 6. Besides tcp, a client can connect and a server can listen and accept with seqpacket (vsock only) or udp, so
+ *    that each message sent is received whole, on its own. A udp server accepts a client when its first datagram
+ *    comes in. Sendmv, castmv, and recvmv send and receive a batch of such messages in one call.
+ * 7. Between two processes on the same host, a client and server can set up shm instead, a stream like tcp that goes
+ *    through rings in shared memory (see shm_ring.h), set up over a unix socket named for the port. Since the other
+ *    side rings an eventfd rather than the socket, a caller waiting to send polls lisa_get_send_fd for
+ *    lisa_get_send_events rather than for POLLOUT.
+ * 8. A tcp client or server can receive through an io_uring instead (lisa_set_uring), where each socket has one
+ *    receive that keeps going, so that receiving takes no system call while data keeps arriving, and a server waits on
+ *    the one fd of the ring rather than an epoll set. It falls back to plain receives if the kernel can't do that.
+ * 9. Sending and receiving are separately locked halves (send_lock, recv_lock), so one thread can send on a connection
+ *    while another receives on it, neither waiting for the other; lock is only for changing the connection (connect,
+ *    listen, accept, close, udp addresses), which also holds both halves while it changes what they use, always taking
+ *    lock, then recv_lock, then send_lock (a half is never held while taking lock). The state is changed atomically,
+ *    and a send ending doesn't undo a close (or error) the receive found meanwhile. A server's sends still go to the
+ *    client last received from (note 5), which the receive half sets as it receives (casting to the others or sending
+ *    to one of them with lisa_send_client leaves it alone), and debugmsg is whatever either half last put there.
  *
  * fine-print: Copyright (c) 2007-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under LGPLv2 (see LICENSE2.txt in root directory).
  */
@@ -90,6 +108,9 @@
 #include <linux/vm_sockets.h>
 #endif
 
+struct shm_link_t;
+struct lisa_uring_t;
+
 /** \brief
  * This will use either strerror or WSAGetLastError depending on the platform.
  * (for Windows, there are hard coded strings for errors that pertain to sockets)
@@ -113,23 +134,37 @@ struct lisa_def {
   struct sockaddr_in   remote_addr;  /* remote protocol, address, port */
   struct sockaddr_vm   local_vaddr;  /* local protocol, address, port */
   struct sockaddr_vm   remote_vaddr; /* remote protocol, address, port */
-  stdtimeval           wait_time;    /* how long to wait on reads (using select) */
+  stdtimeval           wait_time;    /* how long to wait on reads (using poll) */
   SOCKET               fd;           /* the socket, or for a server the listening socket */
   SOCKET               client_fd;    /* for a server this is the most recent accept */
+  SOCKET               recv_fd;      /* for a server, the client the last receive was from (client_fd moves on to accepts) */
   SOCKET               client_fds[MAX_CLIENTS];   /* for a server this is what accept returns for each client connecting */
   int                  num_clients;  /* number of clients with a connection */
+  SOCKET               epfd;         /* for a server, epoll set of the clients (created by the first accept) */
+  SOCKET               ready_fds[MAX_CLIENTS];    /* for a server, the clients the last wait found ready */
+  int                  num_ready;    /* number of ready_fds */
+  int                  next_ready;   /* next of ready_fds to receive from; the server only waits again after the last */
+  unsigned int         zerocopy;     /* lisa_sendv doesn't copy sends of at least this many bytes (0 = it always copies) */
+  unsigned int         zerocopy_sent;    /* zero-copy sends made */
+  unsigned int         zerocopy_done;    /* zero-copy sends the kernel is done with */
+  unsigned int         zerocopy_copied;  /* zero-copy sends the kernel copied after all (e.g., over loopback) */
   int                  state;        /* used to short circuit if tube is in a bad state */
   int                  client_state; /* for a server, the state of the connection with a client */
   int                  flags;        /* used to customize tube behavior */
   int                  timeout;      /* for things like opening a connection */
   int                  port;         /* port to use */
-  char                 type;         /* tcp, udp */
+  char                 type;         /* tcp, udp, seqpacket, shm */
   char                 clsvr;        /* client or server */
   char                 vsock;        /* inet or vsock connection type: default inet (i.e., vsock=0) */
   char                 blocking;     /* 0 = nonblocking */
   //fd_set               fdset;        /* for select on reads */
   char                 debugmsg[DEBUGMSGLEN]; /* the last error or last status */
-  pthread_mutex_t      lock;
+  struct shm_link_t *  shm_links[MAX_CLIENTS];  /* for shm, the link of each of client_fds (a client's is shm_links[0]) */
+  struct lisa_uring_t * uring;       /* for tcp, the io_uring receives come through, if it has one (see lisa_set_uring) */
+  unsigned long        syscalls;     /* system calls made receiving (to compare ways of receiving) */
+  pthread_mutex_t      lock;         /* for changing the connection (see note 9) */
+  pthread_mutex_t      send_lock;    /* for the send half */
+  pthread_mutex_t      recv_lock;    /* for the receive half */
 
 };
 typedef struct lisa_def lisa;
@@ -203,6 +238,31 @@ void LISA_SETUP_UDP(lisa *l, char * file, char * line);
 void lisa_setup_udp(lisa *l);
 #endif
 
+#ifndef WIN32
+/** \brief
+ * initialize a tube to be a seqpacket socket (vsock only), which connects like tcp but keeps messages apart like udp
+ * Unlike tcp and udp, you do have to call this, before connect or listen.
+ */
+#ifdef DEBUG
+#define lisa_setup_seqpacket(l) LISA_SETUP_SEQPACKET(l, BREADCRUMB)
+void LISA_SETUP_SEQPACKET(lisa *l, char * file, char * line);
+#else
+void lisa_setup_seqpacket(lisa *l);
+#endif
+
+/** \brief
+ * initialize a tube to be a stream through shared memory with another process on this host (see note 7), which takes
+ * the same calls as tcp (but not zero-copy sends); as with seqpacket, you have to call this before connect or listen.
+ * The address to connect to is ignored, only the port says which server.
+ */
+#ifdef DEBUG
+#define lisa_setup_shm(l) LISA_SETUP_SHM(l, BREADCRUMB)
+void LISA_SETUP_SHM(lisa *l, char * file, char * line);
+#else
+void lisa_setup_shm(lisa *l);
+#endif
+#endif
+
 /** \brief
  * called in a client to connect to a host
  */
@@ -259,6 +319,16 @@ int  LISA_SEND(lisa *l, char *msg, unsigned int msglength, char * file, char * l
 int  lisa_send(lisa *l, char *msg, unsigned int msglength);
 #endif
 
+/** \brief
+ * used in a server to send completely to one client (fd, one of lisa_get_clients) rather than the current one
+ */
+#ifdef DEBUG
+#define lisa_send_client(l, fd, msg, msglength) LISA_SEND_CLIENT(l, fd, msg, msglength, BREADCRUMB)
+int  LISA_SEND_CLIENT(lisa *l, SOCKET fd, char *msg, unsigned int msglength, char * file, char * line);
+#else
+int  lisa_send_client(lisa *l, SOCKET fd, char *msg, unsigned int msglength);
+#endif
+
 /** \brief
  * send completely to all clients
  * send completely to all clients
@@ -270,6 +340,92 @@ int  LISA_CAST(lisa *l, char *msg, unsigned int msglength, char * file, char * l
 int  lisa_cast(lisa *l, char *msg, unsigned int msglength);
 #endif
 
+#ifndef WIN32
+#include <sys/uio.h>
+/** \brief
+ * tcp or shm only: sends what the socket will take right now of iovcnt buffers, all in one call (like writev), to the server
+ * or (for a server) the current client; returns the bytes sent, which may end partway through a buffer, or 0 if the
+ * socket is full (wait on lisa_get_send_fd for room), or LISA_ERROR
+ */
+#ifdef DEBUG
+#define lisa_sendv(l, iov, iovcnt) LISA_SENDV(l, iov, iovcnt, BREADCRUMB)
+int  LISA_SENDV(lisa *l, struct iovec *iov, int iovcnt, char * file, char * line);
+#else
+int  lisa_sendv(lisa *l, struct iovec *iov, int iovcnt);
+#endif
+
+/** \brief
+ * gets the fd that lisa_sendv sends on, or -1 if not connected
+ */
+SOCKET lisa_get_send_fd(lisa *l);
+
+/** \brief
+ * the poll events that say there is room to send on lisa_get_send_fd: POLLOUT, except for shm, where it is POLLIN
+ */
+short lisa_get_send_events(lisa *l);
+
+/** \brief
+ * 1 if what is sent is a stream of bytes (tcp or shm), 0 if it is messages (seqpacket or udp)
+ */
+int lisa_is_stream(lisa *l);
+
+/** \brief
+ * tcp only: has lisa_sendv hand the kernel the caller's buffers instead of copying them (MSG_ZEROCOPY) whenever it
+ * sends at least threshold bytes in one call (0 turns this off), in which case the buffers must stay as they are until
+ * lisa_zerocopy_pending says the kernel is done with them; returns 1 if zero-copy is on, 0 if not (e.g., if the kernel
+ * doesn't support it for this socket)
+ */
+#ifdef DEBUG
+#define lisa_set_zerocopy(l, threshold) LISA_SET_ZEROCOPY(l, threshold, BREADCRUMB)
+int  LISA_SET_ZEROCOPY(lisa *l, unsigned int threshold, char * file, char * line);
+#else
+int  lisa_set_zerocopy(lisa *l, unsigned int threshold);
+#endif
+
+/** \brief
+ * tcp only: has lisa_recv (not lisa_recvmv) take what arrives from an io_uring (see note 8) if on, or go back to
+ * receiving from the sockets if not; a client calls it once connected, a server at any time; returns 1 if it receives
+ * through an io_uring, 0 if not (e.g., if the kernel is older than 6.0 or io_uring is turned off), in which case
+ * receives carry on as before
+ */
+#ifdef DEBUG
+#define lisa_set_uring(l, on) LISA_SET_URING(l, on, BREADCRUMB)
+int  LISA_SET_URING(lisa *l, int on, char * file, char * line);
+#else
+int  lisa_set_uring(lisa *l, int on);
+#endif
+
+/** \brief
+ * how many zero-copy sends the kernel isn't done with yet; it says when it is on the socket's error queue, which makes
+ * the fd poll with POLLERR, so a caller with sends pending can wait for that on lisa_get_send_fd (with no events)
+ */
+unsigned int lisa_zerocopy_pending(lisa *l);
+
+struct mmsghdr;
+
+/** \brief
+ * seqpacket or udp only: sends as many of vlen messages as the socket will take right now, all in one call (like
+ * sendmmsg), to the server or (for a server) the current client; each message is sent whole or not at all; returns how
+ * many were sent, 0 if the socket is full (wait on lisa_get_send_fd for room), or LISA_ERROR
+ */
+#ifdef DEBUG
+#define lisa_sendmv(l, msgs, vlen) LISA_SENDMV(l, msgs, vlen, BREADCRUMB)
+int  LISA_SENDMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line);
+#else
+int  lisa_sendmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen);
+#endif
+
+/** \brief
+ * seqpacket or udp only: sends all vlen messages to all clients like lisa_cast (for a client, to the server)
+ */
+#ifdef DEBUG
+#define lisa_castmv(l, msgs, vlen) LISA_CASTMV(l, msgs, vlen, BREADCRUMB)
+int  LISA_CASTMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line);
+#else
+int  lisa_castmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen);
+#endif
+#endif
+
 /** \brief
  * used to set the port to send from (uses bind).
  * If you don't care what specific port you are sending data from,
@@ -307,6 +463,39 @@ int  LISA_RECV(lisa *l, char *msg, unsigned int msglength, char * file, char * l
 int  lisa_recv(lisa *l, char *msg, unsigned int msglength);
 #endif
 
+/** \brief
+ * like lisa_recv but never waits: returns 0 (with state LISA_TIMEOUT) if there is nothing to receive right now
+ */
+#ifdef DEBUG
+#define lisa_recv_nowait(l, msg, msglength) LISA_RECV_NOWAIT(l, msg, msglength, BREADCRUMB)
+int  LISA_RECV_NOWAIT(lisa *l, char *msg, unsigned int msglength, char * file, char * line);
+#else
+int  lisa_recv_nowait(lisa *l, char *msg, unsigned int msglength);
+#endif
+
+#ifndef WIN32
+/** \brief
+ * seqpacket or udp: like lisa_recv, but receives up to vlen messages at once (like recvmmsg), each whole in its own
+ * buffer, with msg_len set to its size (a message too big for its buffer has MSG_TRUNC in msg_flags); returns how many
+ */
+#ifdef DEBUG
+#define lisa_recvmv(l, msgs, vlen) LISA_RECVMV(l, msgs, vlen, BREADCRUMB)
+int  LISA_RECVMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line);
+#else
+int  lisa_recvmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen);
+#endif
+
+/** \brief
+ * like lisa_recvmv but never waits, as for lisa_recv_nowait
+ */
+#ifdef DEBUG
+#define lisa_recvmv_nowait(l, msgs, vlen) LISA_RECVMV_NOWAIT(l, msgs, vlen, BREADCRUMB)
+int  LISA_RECVMV_NOWAIT(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line);
+#else
+int  lisa_recvmv_nowait(lisa *l, struct mmsghdr *msgs, unsigned int vlen);
+#endif
+#endif
+
 /** \brief
  * The UDP version to receive data (port to receive data on is specified here).
  */
@@ -393,6 +582,18 @@ int lisa_read_response(lisa *l, char *s, int size);
 
 void lisa_set_wait_time(lisa *l, int t);
 
+/** \brief
+ * gets the fds lisa_recv would wait on (the socket for a client, the accepted clients for a server, and for shm the
+ * eventfd of each link too, or just the fd of the io_uring if it receives through one) so that a caller can block
+ * until there is something to receive; returns how many
+ */
+int lisa_get_recv_fds(lisa *l, SOCKET *fds, int max_fds);
+
+/** \brief
+ * gets the clients of a server (for a client, none), e.g., to send to each with lisa_send_client; returns how many
+ */
+int lisa_get_clients(lisa *l, SOCKET *fds, int max_fds);
+
 void lisa_set_to_vsock(lisa *l);
 
 /* These are used internally, but you can reference them too, if you like. */
@@ -400,6 +601,8 @@ void lisa_set_to_vsock(lisa *l);
 /* Socket Type */
 #define LISA_TCP 1
 #define LISA_UDP 2
+#define LISA_SEQPACKET 3
+#define LISA_SHM 4
 
 /* State */
 #define LISA_ERROR         -1
@@ -3,6 +3,7 @@
  * @brief A looper is a thread that runs on its own, simply repeating a function over and over.
  * @details
  * The main action is looper_function which is the thread setup up to run the user supplied function over and over.
+ * In between runs it either sleeps or, if it has wait fds, blocks in looper_wait until one of them is ready.
  *
  * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
  */
@@ -10,29 +11,129 @@
 #include "looper.h"
 #include <unistd.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 
 void looper_update_state(struct looper_t * l, enum looper_state_t *desired_state, enum looper_state_t actual_state);
 
+static void looper_sleep(struct looper_t * l) {
+    #ifdef USE_YIELDS
+    pthread_yield();
+    #else
+    usleep(l->usleep_time);
+    #endif
+}
+
+static inline void looper_cpu_relax() {
+    #if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+    #elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+    #endif
+}
+
+static long looper_usec_since(struct timespec * then) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) * 1000000L + (now.tv_nsec - then->tv_nsec) / 1000L;
+}
+
+// waits up to wait_timeout ms (-1 = until a wait fd is ready), or only looks at the wait fds if spinning, unless
+// function_before_wait says otherwise (it runs without the lock so that it can change the wait fds and wait_timeout,
+// which is read after it)
+// returns whether the function should run next, which is always unless it was spinning and there was nothing to do
+static int looper_wait(struct looper_t * l, bool spinning) {
+    struct pollfd fds[LOOPER_MAX_WAIT_FDS + 1];
+    enum looper_wait_t wait;
+    int num_fds, rc, timeout;
+    uint64_t count;
+    l->spinning = spinning;
+    wait = (l->function_before_wait) ? l->function_before_wait(l->data) : looper_wait_block;
+    pthread_mutex_lock(&(l->lock));
+    timeout = spinning ? 0 : l->wait_timeout;
+    num_fds = l->num_wait_fds + 1;
+    memcpy(fds, l->wait_fds, num_fds * sizeof(struct pollfd));
+    pthread_mutex_unlock(&(l->lock));
+    if (wait == looper_wait_none) return 1;
+    if (wait == looper_wait_sleep || num_fds == 1) {
+        if (!timeout) return 0;
+        l->sleeps++;
+        looper_sleep(l);
+        return 1;
+    }
+    if (timeout) l->sleeps++;   /* only a wait that can block counts, not a look at the fds */
+    rc = poll(fds, num_fds, timeout);
+    if (rc < 0) {
+        if (timeout) looper_sleep(l);
+        return 1;
+    }
+    if (fds[0].revents & POLLIN) {
+        if (read(l->wake_fd, &count, sizeof(count)) < 0) { /* already cleared */ }
+        rc--;
+    }
+    if (rc > 0 && timeout) l->wakeups++;
+    return (rc > 0 || timeout);
+}
+
+// in between runs: doesn't wait at all while there is work, keeps polling while within the latency budget, then blocks or sleeps
+// returns whether the function should run next
+static int looper_idle(struct looper_t * l, int work) {
+    if (work) return 1;     /* there may well be more, so go straight back around */
+    if (l->latency_budget && l->function_to_poll) {
+        if (looper_usec_since(&(l->last_work)) < (long) l->latency_budget) {
+            l->spins++;
+            looper_cpu_relax();
+            if (l->num_wait_fds || l->function_before_wait) return looper_wait(l, true);
+            return 1;
+        }
+    }
+    if (l->num_wait_fds || l->function_before_wait) return looper_wait(l, false);
+    l->sleeps++;
+    looper_sleep(l);
+    return 1;
+}
+
+int looper_run(struct looper_t * l) {
+    if (l->function_to_poll) return l->function_to_poll(l->data);
+    l->function_to_repeat(l->data);
+    return 0;
+}
+
 void * looper_function(void * looper) {
     struct looper_t * l;
     enum looper_state_t desired_state, actual_state;
+    int run, work;
     l = (struct looper_t *) looper;
     desired_state = running;
     actual_state = not_running;
+    run = 1;
+    work = 0;
+    pthread_mutex_lock(&(l->lock));
+    l->tid = (pid_t) syscall(SYS_gettid);
+    l->start_cpu = sched_getcpu();
+    pthread_mutex_unlock(&(l->lock));
+    if (l->attr.name[0]) pthread_setname_np(pthread_self(), l->attr.name);
+    clock_gettime(CLOCK_MONOTONIC, &(l->last_work));
     while (desired_state != stopped) {
         if (desired_state != paused) {
             actual_state = running;
-            pthread_mutex_lock(&(l->lock));
-            l->function_to_repeat(l->data);
-            pthread_mutex_unlock(&(l->lock));
+            work = 0;
+            if (run) {
+                pthread_mutex_lock(&(l->lock));
+                work = looper_run(l);
+                pthread_mutex_unlock(&(l->lock));
+                if (work) clock_gettime(CLOCK_MONOTONIC, &(l->last_work));
+            }
         }
         else actual_state = paused;
         looper_update_state(l, &desired_state, actual_state);
-        #ifdef USE_YIELDS
-        pthread_yield();
-        #else
-        usleep(l->usleep_time);
-        #endif
+        if (desired_state == running) run = looper_idle(l, work);
+        else if (desired_state != stopped) looper_sleep(l);
     }
     actual_state = stopped;
     looper_update_state(l, &desired_state, actual_state);
@@ -41,13 +142,31 @@ void * looper_function(void * looper) {
 
 void looper_init(struct looper_t * l) {
     l->function_to_repeat = NULL;
+    l->function_to_poll = NULL;
     l->function_to_run_first = NULL;
+    l->function_before_wait = NULL;
     l->data = NULL;
     l->usleep_time = LOOPER_SLEEP_TIME_DEFAULT;
+    l->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (l->wake_fd < 0) printf("error creating looper wake fd\n");
+    l->wait_fds[0].fd = l->wake_fd;
+    l->wait_fds[0].events = POLLIN;
+    l->num_wait_fds = 0;
+    l->wait_timeout = -1;
+    l->spinning = false;
+    l->latency_budget = 0;
+    l->spins = l->sleeps = l->wakeups = 0;
+    CPU_ZERO(&(l->attr.cpus));
+    l->attr.policy = SCHED_OTHER;
+    l->attr.priority = 0;
+    l->attr.name[0] = '\0';
+    l->tid = 0;
+    l->start_cpu = -1;
     pthread_mutex_init(&(l->lock), NULL);
     l->desired_state = not_running;
     l->actual_state = not_running;
     l->nowait = 0;
+    l->has_thread = false;
 }
 
 void looper_nowait(struct looper_t * l) {
@@ -59,6 +178,8 @@ void looper_set_desired_state(struct looper_t * l, enum looper_state_t state) {
      pthread_mutex_lock(&(l->lock));
      l->desired_state = state;
      pthread_mutex_unlock(&(l->lock));
+     // in case the looper is blocked in looper_wait
+     looper_wake(l);
 }
 
 enum looper_state_t looper_get_actual_state(struct looper_t * l) {
@@ -91,16 +212,66 @@ void looper_change_usleep_time(struct looper_t * l, useconds_t ms) {
      pthread_mutex_unlock(&(l->lock));
 }
 
+void looper_change_latency_budget(struct looper_t * l, useconds_t us) {
+     pthread_mutex_lock(&(l->lock));
+    l->latency_budget = us;
+     pthread_mutex_unlock(&(l->lock));
+}
+
+// creates the thread with the cpus and scheduling in attr (the name is set by the thread itself), returns false if it
+// couldn't
+static bool looper_create_thread(struct looper_t * l) {
+    pthread_attr_t attr;
+    struct sched_param param;
+    int rc;
+    pthread_attr_init(&attr);
+    if (CPU_COUNT(&(l->attr.cpus)) && pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &(l->attr.cpus)))
+        printf("error setting cpus for looper %s\n", l->attr.name);
+    if (l->attr.policy != SCHED_OTHER) {
+        param.sched_priority = l->attr.priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        if (pthread_attr_setschedpolicy(&attr, l->attr.policy) || pthread_attr_setschedparam(&attr, &param))
+            printf("error setting scheduling for looper %s\n", l->attr.name);
+    }
+    rc = pthread_create(&(l->thread), &attr, looper_function, (void *) l);
+    if (rc == EPERM && l->attr.policy != SCHED_OTHER) {
+        printf("not permitted to use real-time scheduling for looper %s, using the default\n", l->attr.name);
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        rc = pthread_create(&(l->thread), &attr, looper_function, (void *) l);
+    }
+    if (rc) printf("error creating thread for looper %s: %s\n", l->attr.name, strerror(rc));
+    pthread_attr_destroy(&attr);
+    return rc == 0;
+}
+
+// waits for the thread to say who it is, which even a looper that doesn't wait to be running does, so that its tid can
+// be printed as soon as it has started
+static void looper_wait_for_tid(struct looper_t * l) {
+    pid_t tid;
+    do {
+        pthread_mutex_lock(&(l->lock));
+        tid = l->tid;
+        pthread_mutex_unlock(&(l->lock));
+        if (!tid) usleep(l->usleep_time);
+    } while (!tid);
+}
+
 void looper_start(struct looper_t * l) {
     l->desired_state = running;
+    l->tid = 0;
     if (l->function_to_run_first) l->function_to_run_first(l->data);
-    if (l->function_to_repeat) pthread_create(&(l->thread), NULL, looper_function, (void *) l);
+    if (l->function_to_repeat || l->function_to_poll) {
+        l->has_thread = looper_create_thread(l);
+        if (!l->has_thread) return;
+        looper_wait_for_tid(l);
+    }
     if (!(l->nowait)) looper_wait_for_actual_state(l, running);
 }
 
 void looper_stop(struct looper_t * l) {
      looper_set_desired_state(l, stopped);
-     pthread_join(l->thread, NULL);
+     if (l->has_thread) pthread_join(l->thread, NULL);
+     l->has_thread = false;
      if (l->function_to_run_last) l->function_to_run_last(l->data);
 }
 
@@ -120,4 +291,148 @@ void looper_update_data(struct looper_t * l, void * data) {
      pthread_mutex_unlock(&(l->lock));
 }
 
+void looper_clear_wait_fds(struct looper_t * l) {
+     pthread_mutex_lock(&(l->lock));
+     l->num_wait_fds = 0;
+     pthread_mutex_unlock(&(l->lock));
+}
+
+void looper_add_wait_fd(struct looper_t * l, int fd, short events) {
+     pthread_mutex_lock(&(l->lock));
+     if (l->num_wait_fds < LOOPER_MAX_WAIT_FDS) {
+         l->num_wait_fds++;
+         l->wait_fds[l->num_wait_fds].fd = fd;
+         l->wait_fds[l->num_wait_fds].events = events;
+     }
+     else printf("error: too many looper wait fds\n");
+     pthread_mutex_unlock(&(l->lock));
+}
+
+// makes a looper that is blocked in looper_wait go around again
+void looper_wake(struct looper_t * l) {
+     uint64_t one = 1;
+     if (l->wake_fd >= 0 && write(l->wake_fd, &one, sizeof(one)) < 0) printf("error waking looper\n");
+}
+
+static bool looper_parse_cpus(cpu_set_t * cpus, const char * list) {
+    char * end;
+    long first, last;
+    CPU_ZERO(cpus);
+    while (*list) {
+        first = strtol(list, &end, 10);
+        if (end == list) return false;
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) return false;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return false;
+        for (long cpu=first; cpu<=last; cpu++) CPU_SET(cpu, cpus);
+        if (*end == ',') end++;
+        else if (*end) return false;
+        list = end;
+    }
+    return true;
+}
+
+bool looper_parse_attr(struct looper_attr_t * attr, const char * spec) {
+    char setting[128];
+    char * value;
+    int n;
+    while (*spec) {
+        while (isspace((unsigned char) *spec)) spec++;
+        for (n=0; spec[n] && !isspace((unsigned char) spec[n]); n++);
+        if (!n) break;
+        if (n >= (int) sizeof(setting)) {
+            printf("looper setting too long: %.*s\n", n, spec);
+            return false;
+        }
+        memcpy(setting, spec, n);
+        setting[n] = '\0';
+        spec += n;
+        value = strchr(setting, '=');
+        if (!value) {
+            printf("looper setting should be name=value: %s\n", setting);
+            return false;
+        }
+        *value++ = '\0';
+        if (!strcmp(setting, "cpus")) {
+            if (!looper_parse_cpus(&(attr->cpus), value)) {
+                printf("looper cpus not understood: %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(setting, "policy")) {
+            if (!strcmp(value, "other")) attr->policy = SCHED_OTHER;
+            else if (!strcmp(value, "fifo")) attr->policy = SCHED_FIFO;
+            else if (!strcmp(value, "rr")) attr->policy = SCHED_RR;
+            else {
+                printf("looper policy should be other, fifo, or rr: %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(setting, "priority")) attr->priority = atoi(value);
+        else if (!strcmp(setting, "name")) snprintf(attr->name, LOOPER_NAME_LEN, "%s", value);
+        else {
+            printf("unknown looper setting: %s\n", setting);
+            return false;
+        }
+    }
+    if (attr->policy != SCHED_OTHER && (attr->priority < sched_get_priority_min(attr->policy) || attr->priority > sched_get_priority_max(attr->policy))) {
+        printf("looper priority %d is out of range for the policy\n", attr->priority);
+        return false;
+    }
+    return true;
+}
+
+bool looper_read_config(const char * path, bool (*apply_line)(const char * line)) {
+    char line[256];
+    char * start;
+    bool ok;
+    FILE * f;
+    f = fopen(path, "r");
+    if (!f) {
+        printf("error opening looper config %s\n", path);
+        return false;
+    }
+    ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        for (start=line; isspace((unsigned char) *start); start++);
+        if (*start && !apply_line(start)) ok = false;
+    }
+    fclose(f);
+    return ok;
+}
+
+static const char * looper_policy_name(int policy) {
+    switch (policy) {
+        case SCHED_OTHER: return "other";
+        case SCHED_FIFO:  return "fifo";
+        case SCHED_RR:    return "rr";
+        default:          return "?";
+    }
+}
 
+void looper_print_attr(const char * name, struct looper_t * l) {
+    char thread_name[LOOPER_NAME_LEN];
+    char cpus[128];
+    cpu_set_t set;
+    struct sched_param param;
+    int policy, n;
+    if (!l->tid) {
+        printf("%-12s not running on a thread of its own\n", name);
+        return;
+    }
+    if (pthread_getname_np(l->thread, thread_name, sizeof(thread_name))) thread_name[0] = '\0';
+    n = 0;
+    cpus[0] = '\0';
+    if (!pthread_getaffinity_np(l->thread, sizeof(set), &set)) {
+        for (int cpu=0; cpu<CPU_SETSIZE && n<(int) sizeof(cpus)-8; cpu++)
+            if (CPU_ISSET(cpu, &set)) n += snprintf(cpus + n, sizeof(cpus) - n, "%s%d", n ? "," : "", cpu);
+    }
+    if (pthread_getschedparam(l->thread, &policy, &param)) policy = -1;
+    printf("%-12s thread %-15s tid %d cpus %s (started on %d) policy %s priority %d\n", name, thread_name, (int) l->tid,
+           cpus, l->start_cpu, looper_policy_name(policy), (policy < 0) ? 0 : param.sched_priority);
+}
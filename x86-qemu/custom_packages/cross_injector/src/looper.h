@@ -7,6 +7,23 @@
  * usleep time in between the times that the looping function is run.
  * Note that this can be compiled so that yields are used (nonstandard pthread extension) or a small delay in between
  * function executions to yield to other threads.
+ * Instead of sleeping, a looper can block in between function executions until one of its wait fds is ready (e.g., a
+ * socket has data or a doorbell eventfd has been rung, /ref src/doorbell.h). To do this, add the wait fds and optionally
+ * a function_before_wait, which runs just before blocking and decides whether to block, not wait at all (there is
+ * already more work to do), or fall back to sleeping usleep_time (e.g., the output queue is full). State changes wake
+ * a blocked looper so that it can still be paused and stopped right away.
+ * A looper can be given function_to_poll instead of function_to_repeat, which is the same except that it returns how
+ * much work it did (e.g., frames moved). Then the looper goes straight back around as long as there is work, and only
+ * waits once the function did nothing. Also a latency budget can be set: after the last time the function did any
+ * work, the looper keeps polling (with cpu pause instructions in between) for up to that many microseconds before it
+ * backs off to blocking on its wait fds or sleeping usleep_time. So a budget of zero (the default) never spins and a
+ * larger budget trades cpu for latency. The counters show how it has been going: spins are idle polls while within the
+ * budget, sleeps are times it blocked or slept, and wakeups are times a wait fd woke it from blocking.
+ * Finally, attr says how the thread is created: which cpus it may run on, its scheduling policy and priority (e.g.,
+ * SCHED_FIFO so that it is not preempted by other busy threads on the same box), and its name (shown by top -H, ps -L,
+ * etc.). It can be set from a spec such as "cpus=2,4-5 policy=fifo priority=10 name=ci_send" (see looper_parse_attr)
+ * and looper_print_attr reports where the thread actually landed. If the process isn't allowed real-time scheduling, the
+ * thread is still started, just with the default policy.
  *
  * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
  */
@@ -17,20 +34,52 @@
 #define _GNU_SOURCE
 #include <pthread.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <stdbool.h>
 
 //#define USE_YIELDS
 
 #define LOOPER_SLEEP_TIME_DEFAULT 10 * 1000
+#define LOOPER_MAX_WAIT_FDS 12
+#define LOOPER_NAME_LEN 16      /* thread names are limited to 15 characters */
 
 enum looper_state_t { not_running, running, paused, stopped};
 
+enum looper_wait_t { looper_wait_block, looper_wait_none, looper_wait_sleep };
+
+struct looper_attr_t {
+    cpu_set_t cpus;                   /* none set = any cpu */
+    int policy;                       /* SCHED_OTHER (the default), SCHED_FIFO, or SCHED_RR */
+    int priority;                     /* 1 (lowest) to 99 for SCHED_FIFO and SCHED_RR */
+    char name[LOOPER_NAME_LEN];       /* empty = keep the process name */
+};
+
 struct looper_t {
     void (*function_to_repeat)(void * d);
+    int  (*function_to_poll)(void * d);                /* used instead of function_to_repeat if set, returns work done */
     void (*function_to_run_first)(void * d);
     void (*function_to_run_last)(void * d);
+    enum looper_wait_t (*function_before_wait)(void * d);
     useconds_t usleep_time;
+    struct pollfd wait_fds[LOOPER_MAX_WAIT_FDS + 1];   /* the first one is wake_fd */
+    int num_wait_fds;
+    int wait_timeout;                                  /* ms to block on the wait fds, -1 = until one is ready */
+    bool spinning;                                     /* this wait only looks at the wait fds (see latency_budget), so
+                                                          function_before_wait needn't arm a doorbell */
+    int wake_fd;                                       /* eventfd written by state changes */
+    useconds_t latency_budget;                         /* how long to keep polling after the last work, 0 = don't */
+    struct timespec last_work;
+    unsigned long spins;
+    unsigned long sleeps;
+    unsigned long wakeups;
+    struct looper_attr_t attr;                         /* applied when the thread is created */
+    pid_t tid;                                         /* set by the thread when it starts */
+    int start_cpu;                                     /* the cpu it was on when it started */
     pthread_mutex_t lock;
     pthread_t thread;
+    bool has_thread;                                   /* the thread was created, so there is one to join */
     enum looper_state_t desired_state;
     enum looper_state_t actual_state;
     int nowait;
@@ -44,6 +93,20 @@ void looper_stop(struct looper_t * l);
 void looper_pause(struct looper_t * l);
 void looper_resume(struct looper_t * l);
 void looper_change_usleep_time(struct looper_t * l, useconds_t ms);
+void looper_change_latency_budget(struct looper_t * l, useconds_t us);
+int looper_run(struct looper_t * l);   /* runs the function once (without the lock), returns work done (0 if it doesn't say) */
 void looper_update_data(struct looper_t * l, void * data);
+void looper_clear_wait_fds(struct looper_t * l);
+void looper_add_wait_fd(struct looper_t * l, int fd, short events);
+void looper_wake(struct looper_t * l);
+
+// sets attr from space separated settings: cpus=<list, e.g. 1,3-4> policy=<other|fifo|rr> priority=<n> name=<name>
+// settings not given are left as they are, returns false (and says why) if a setting is not understood
+bool looper_parse_attr(struct looper_attr_t * attr, const char * spec);
+// calls apply_line for each line of a config file that isn't blank or a # comment, returns false if the file can't be read
+// or apply_line returns false for any line
+bool looper_read_config(const char * path, bool (*apply_line)(const char * line));
+// prints where the (running) thread is: its name, tid, cpus it may run on, the cpu it started on, policy and priority
+void looper_print_attr(const char * name, struct looper_t * l);
 
 #endif // PTHREAD_WORKER_H
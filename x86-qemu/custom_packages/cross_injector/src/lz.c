@@ -0,0 +1,233 @@
+/*!
+ * @file src/lz.c
+ * @brief A small LZ compressor for frames on the wire, whose dictionary is the frames sent just before.
+ * @details
+ * The compressor is greedy: at each byte it looks up the last place the next 4 bytes were seen (by a hash of them) and
+ * if they match there it takes the longest match it can, otherwise it moves on. That finds the long runs that repeat
+ * from frame to frame, which is most of what there is to find, for far less time than a search for the best match.
+ * Once the history has more than 2 * LZ_KEEP bytes, both sides drop all but the last LZ_KEEP before the next frame.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#include "lz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HISTORY_SIZE (2 * LZ_KEEP + LZ_MAX_FRAME)
+#define HASH_BITS 12
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xFFFF
+
+static unsigned long nsec_since(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) ((now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec));
+}
+
+static uint32_t hash4(const uint8_t * p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+bool lz_init(struct lz_t * z, bool compressor) {
+    memset(z, 0, sizeof(*z));
+    z->history = malloc(HISTORY_SIZE);
+    if (compressor) z->table = malloc(sizeof(int32_t) << HASH_BITS);
+    if (!z->history || (compressor && !z->table)) {
+        lz_free(z);
+        return false;
+    }
+    if (z->table) memset(z->table, 0xFF, sizeof(int32_t) << HASH_BITS);
+    return true;
+}
+
+void lz_free(struct lz_t * z) {
+    free(z->history);
+    free(z->table);
+    z->history = NULL;
+    z->table = NULL;
+}
+
+void lz_reset(struct lz_t * z) {
+    z->used = 0;
+    z->stats.keys++;
+    if (z->table) memset(z->table, 0xFF, sizeof(int32_t) << HASH_BITS);
+}
+
+// drops all but the last LZ_KEEP bytes of history once there are more than 2 * LZ_KEEP, so that there is always room
+// for another frame (both sides do this at the same frames, since it only depends on what was in the history)
+static void make_room(struct lz_t * z) {
+    uint32_t drop;
+    if (z->used <= 2 * LZ_KEEP) return;
+    drop = z->used - LZ_KEEP;
+    memmove(z->history, z->history + drop, LZ_KEEP);
+    z->used = LZ_KEEP;
+    if (!z->table) return;
+    for (int i=0; i<(1 << HASH_BITS); i++) z->table[i] = (z->table[i] >= (int32_t) drop) ? z->table[i] - (int32_t) drop : -1;
+}
+
+static uint8_t * put_count(uint8_t * out, uint32_t count) {
+    for (; count >= 255; count -= 255) *out++ = 255;
+    *out++ = (uint8_t) count;
+    return out;
+}
+
+static uint8_t * put_token(uint8_t * out, const uint8_t * literals, uint32_t n_literals, uint32_t offset, uint32_t match) {
+    uint8_t * token = out++;
+    *token = (uint8_t) (((n_literals < 15) ? n_literals : 15) << 4);
+    if (n_literals >= 15) out = put_count(out, n_literals - 15);
+    memcpy(out, literals, n_literals);
+    out += n_literals;
+    if (!match) return out;
+    *out++ = (uint8_t) (offset & 0xFF);
+    *out++ = (uint8_t) (offset >> 8);
+    match -= MIN_MATCH;
+    *token |= (uint8_t) ((match < 15) ? match : 15);
+    if (match >= 15) out = put_count(out, match - 15);
+    return out;
+}
+
+uint32_t lz_compress(struct lz_t * z, const uint8_t * frame, uint32_t len, uint8_t * out) {
+    struct timespec start;
+    uint8_t * h = z->history;
+    uint8_t * o = out;
+    uint32_t p, end, anchor, match, misses = 0;
+    int32_t candidate;
+    uint32_t slot;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    make_room(z);
+    p = anchor = z->used;
+    end = z->used + len;
+    memcpy(h + p, frame, len);
+    while (p + MIN_MATCH <= end) {
+        slot = hash4(h + p);
+        candidate = z->table[slot];
+        z->table[slot] = (int32_t) p;
+        if (candidate < 0 || p - candidate > MAX_OFFSET || memcmp(h + candidate, h + p, MIN_MATCH)) {
+            p += 1 + (misses++ >> 5);    /* step faster through bytes that don't compress */
+            continue;
+        }
+        for (match = MIN_MATCH; p + match < end && h[candidate + match] == h[p + match]; match++);
+        o = put_token(o, h + anchor, p - anchor, p - candidate, match);
+        p += match;
+        anchor = p;
+        misses = 0;
+        if (p + MIN_MATCH <= end) z->table[hash4(h + p - 2)] = (int32_t) (p - 2);
+    }
+    if (anchor < end || o == out) o = put_token(o, h + anchor, end - anchor, 0, 0);
+    z->used = end;
+    z->stats.frames++;
+    z->stats.raw_bytes += len;
+    z->stats.packed_bytes += o - out;
+    z->stats.nsec += nsec_since(&start);
+    return (uint32_t) (o - out);
+}
+
+// reads a count that was more than 15 (see put_count), returns false if it runs past the end
+static bool get_count(const uint8_t ** in, const uint8_t * end, uint32_t * count) {
+    uint8_t b;
+    do {
+        if (*in == end) return false;
+        b = *(*in)++;
+        *count += b;
+    } while (b == 255);
+    return true;
+}
+
+int lz_expand(struct lz_t * z, const uint8_t * in, uint32_t len, const uint8_t ** frame) {
+    struct timespec start;
+    const uint8_t * end = in + len;
+    uint8_t * h = z->history;
+    uint32_t p, limit, n, offset;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    make_room(z);
+    p = z->used;
+    limit = z->used + LZ_MAX_FRAME;
+    while (in < end) {
+        uint8_t token = *in++;
+        n = token >> 4;
+        if (n == 15 && !get_count(&in, end, &n)) return -1;
+        if (n > (uint32_t) (end - in) || n > limit - p) return -1;
+        memcpy(h + p, in, n);
+        p += n;
+        in += n;
+        if (in == end) break;          /* the last literals */
+        if (end - in < 2) return -1;
+        offset = in[0] | (in[1] << 8);
+        in += 2;
+        n = token & 0x0F;
+        if (n == 15 && !get_count(&in, end, &n)) return -1;
+        n += MIN_MATCH;
+        if (!offset || offset > p || n > limit - p) return -1;
+        for (uint32_t i=0; i<n; i++, p++) h[p] = h[p - offset];   /* a byte at a time, since a match can overlap itself */
+    }
+    *frame = h + z->used;
+    n = p - z->used;
+    z->used = p;
+    z->stats.frames++;
+    z->stats.raw_bytes += n;
+    z->stats.packed_bytes += len;
+    z->stats.nsec += nsec_since(&start);
+    return (int) n;
+}
+
+int lz_expand_from(struct lz_sources_t * s, uint16_t source, uint16_t sequence, bool key, const uint8_t * in,
+                   uint32_t len, const uint8_t ** frame) {
+    struct lz_source_t * src;
+    int i, n;
+    for (i=0; i<s->n && s->sources[i].source != source; i++);
+    if (i == s->n) {
+        if (s->n == LZ_MAX_SOURCES) {
+            s->others++;
+            return -1;
+        }
+        src = &(s->sources[i]);
+        memset(src, 0, sizeof(*src));
+        if (!lz_init(&(src->z), false)) {
+            printf("error allocating history to expand frames from source %u\n", source);
+            s->others++;
+            return -1;
+        }
+        src->source = source;
+        s->n++;
+    }
+    else src = &(s->sources[i]);
+    if (key) {
+        lz_reset(&(src->z));
+        src->synced = true;
+    }
+    else if (sequence != src->next_sequence) src->synced = false;    /* one was missed, so the histories differ */
+    if (!src->synced) {
+        src->skipped++;
+        return -1;
+    }
+    n = lz_expand(&(src->z), in, len, frame);
+    if (n < 0) {
+        src->synced = false;
+        src->skipped++;
+        return -1;
+    }
+    src->next_sequence = sequence + 1;
+    return n;
+}
+
+void lz_print_stats(const char * name, const struct lz_stats_t * stats) {
+    printf("  %-12s frames: %lu (%lu keys) %lu bytes as %lu (%.1f%%) in %lu ns a frame\n", name, stats->frames,
+           stats->keys, stats->raw_bytes, stats->packed_bytes,
+           stats->raw_bytes ? 100.0 * stats->packed_bytes / stats->raw_bytes : 0.0,
+           stats->frames ? stats->nsec / stats->frames : 0);
+}
+
+void lz_print_sources(const struct lz_sources_t * s) {
+    char name[20];
+    for (int i=0; i<s->n; i++) {
+        snprintf(name, sizeof(name), "source %u", s->sources[i].source);
+        lz_print_stats(name, &(s->sources[i].z.stats));
+        if (s->sources[i].skipped) printf("  %-12s frames that couldn't be expanded: %lu\n", "", s->sources[i].skipped);
+    }
+    if (s->others) printf("  other sources frames that couldn't be expanded: %lu\n", s->others);
+}
@@ -0,0 +1,219 @@
+/*!
+ * @file src/reactor.c
+ * @brief A reactor runs several loopers on a single thread instead of a thread each.
+ * @details
+ * The reactor is itself a looper. Its function_before_wait asks each added looper what it wants, keeps the epoll set
+ * in step with that (only changes cost a system call), and then has the reactor's looper block on the epoll fd, with a
+ * timeout if some looper wants to sleep. Its function_to_poll collects the ready fds and runs the loopers, and returns
+ * the work they did all together, so a latency budget on the reactor's looper applies to all of them.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#include "reactor.h"
+#include <sys/epoll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+static long usec_since(struct timespec * then) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) * 1000000L + (now.tv_nsec - then->tv_nsec) / 1000L;
+}
+
+// whether a slot waits on fd for any of the events that happened on it (errors and hangups count for any)
+static bool slot_is_ready(struct reactor_slot_t * slot, int fd, uint32_t happened) {
+    for (int i=0; i<slot->num_wanted; i++) {
+        if (slot->wanted[i].fd == fd && (((uint16_t) slot->wanted[i].events & happened) || (happened & (EPOLLERR | EPOLLHUP)))) return true;
+    }
+    return false;
+}
+
+// takes note of what the looper in a slot wants to wait on now (nothing unless it is running and blocks)
+static void update_slot_fds(struct reactor_slot_t * slot) {
+    slot->num_wanted = 0;
+    if (!slot->l || slot->l->desired_state != running || slot->wait != looper_wait_block) return;
+    pthread_mutex_lock(&(slot->l->lock));
+    for (int i=0; i<slot->l->num_wait_fds; i++) slot->wanted[slot->num_wanted++] = slot->l->wait_fds[i+1];
+    pthread_mutex_unlock(&(slot->l->lock));
+}
+
+// brings the epoll set in line with what all the slots want to wait on now, each fd once with all the events any
+// slot wants on it (poll and epoll events have the same values on linux)
+static void sync_fds(struct reactor_t * r) {
+    struct reactor_fd_t wanted[REACTOR_MAX_FDS];
+    struct epoll_event event;
+    int num_wanted, i, j, n;
+    num_wanted = 0;
+    for (i=0; i<REACTOR_MAX_LOOPERS; i++) {
+        for (j=0; j<r->slots[i].num_wanted; j++) {
+            for (n=0; n<num_wanted && wanted[n].fd != r->slots[i].wanted[j].fd; n++);
+            if (n == num_wanted) {
+                wanted[num_wanted].fd = r->slots[i].wanted[j].fd;
+                wanted[num_wanted++].events = 0;
+            }
+            wanted[n].events |= (uint16_t) r->slots[i].wanted[j].events;
+        }
+    }
+    for (i=0, n=0; i<r->num_registered; i++) {
+        for (j=0; j<num_wanted && wanted[j].fd != r->registered[i].fd; j++);
+        if (j < num_wanted) r->registered[n++] = r->registered[i];
+        else epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, r->registered[i].fd, NULL);   /* may already be gone if it was closed */
+    }
+    r->num_registered = n;
+    for (i=0; i<num_wanted; i++) {
+        for (j=0; j<r->num_registered && r->registered[j].fd != wanted[i].fd; j++);
+        if (j < r->num_registered && r->registered[j].events == wanted[i].events) continue;
+        event.events = wanted[i].events;
+        event.data.fd = wanted[i].fd;
+        if (j < r->num_registered) {
+            if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, wanted[i].fd, &event) < 0) printf("error changing fd %d in reactor\n", wanted[i].fd);
+            r->registered[j].events = wanted[i].events;
+        }
+        else if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, wanted[i].fd, &event) < 0) printf("error adding fd %d to reactor\n", wanted[i].fd);
+        else r->registered[r->num_registered++] = wanted[i];
+    }
+}
+
+static enum looper_wait_t reactor_before_wait(void * d) {
+    struct reactor_t * r = (struct reactor_t *) d;
+    struct reactor_slot_t * slot;
+    enum looper_wait_t wait;
+    long timeout, left;
+    wait = looper_wait_block;
+    timeout = -1;
+    pthread_mutex_lock(&(r->looper.lock));
+    for (int i=0; i<REACTOR_MAX_LOOPERS; i++) {
+        slot = &(r->slots[i]);
+        if (!slot->l || slot->l->desired_state != running) {
+            update_slot_fds(slot);
+            continue;
+        }
+        slot->l->spinning = r->looper.spinning;
+        if (slot->l->function_before_wait) slot->wait = slot->l->function_before_wait(slot->l->data);
+        else slot->wait = (slot->l->num_wait_fds) ? looper_wait_block : looper_wait_sleep;
+        update_slot_fds(slot);
+        if (slot->wait == looper_wait_none) wait = looper_wait_none;
+        if (slot->wait == looper_wait_sleep) {
+            left = (long) slot->l->usleep_time - usec_since(&(slot->last_run));
+            left = (left > 0) ? (left + 999) / 1000 : 0;
+            if (timeout < 0 || left < timeout) timeout = left;
+        }
+    }
+    sync_fds(r);
+    r->looper.wait_timeout = (int) timeout;
+    pthread_mutex_unlock(&(r->looper.lock));
+    return wait;
+}
+
+static int reactor_run(void * d) {
+    struct reactor_t * r = (struct reactor_t *) d;
+    struct reactor_slot_t * slot;
+    struct epoll_event events[REACTOR_MAX_FDS];
+    int n, run, work;
+    work = 0;
+    // the reactor's looper already waited on the epoll fd, so this just collects what is ready (for every slot waiting
+    // on each fd that is)
+    n = epoll_wait(r->epoll_fd, events, REACTOR_MAX_FDS, 0);
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<REACTOR_MAX_LOOPERS; j++) {
+            if (slot_is_ready(&(r->slots[j]), events[i].data.fd, events[i].events)) r->slots[j].ready = true;
+        }
+    }
+    for (int i=0; i<REACTOR_MAX_LOOPERS; i++) {
+        slot = &(r->slots[i]);
+        if (!slot->l || slot->l->desired_state != running) continue;
+        switch (slot->wait) {
+            case looper_wait_none:  run = 1; break;
+            case looper_wait_block: run = slot->ready; break;
+            case looper_wait_sleep: run = (usec_since(&(slot->last_run)) >= (long) slot->l->usleep_time); break;
+            default: run = 1;
+        }
+        slot->ready = false;
+        if (run) {
+            clock_gettime(CLOCK_MONOTONIC, &(slot->last_run));
+            work += looper_run(slot->l);
+        }
+    }
+    return work;
+}
+
+bool reactor_init(struct reactor_t * r) {
+    looper_init(&(r->looper));
+    r->looper.function_to_poll = reactor_run;
+    r->looper.function_before_wait = reactor_before_wait;
+    r->looper.data = (void *) r;
+    for (int i=0; i<REACTOR_MAX_LOOPERS; i++) {
+        r->slots[i].l = NULL;
+        r->slots[i].num_wanted = 0;
+        r->slots[i].ready = false;
+    }
+    r->num_loopers = 0;
+    r->num_registered = 0;
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd < 0) {
+        printf("error creating reactor epoll fd\n");
+        return false;
+    }
+    looper_add_wait_fd(&(r->looper), r->epoll_fd, POLLIN);
+    return true;
+}
+
+void reactor_add(struct reactor_t * r, struct looper_t * l) {
+    int i;
+    l->desired_state = running;
+    l->actual_state = running;
+    if (l->function_to_run_first) l->function_to_run_first(l->data);
+    pthread_mutex_lock(&(r->looper.lock));
+    for (i=0; i<REACTOR_MAX_LOOPERS && r->slots[i].l; i++);
+    if (i == REACTOR_MAX_LOOPERS) {
+        pthread_mutex_unlock(&(r->looper.lock));
+        printf("error: too many loopers for reactor\n");
+        return;
+    }
+    r->slots[i].l = l;
+    r->slots[i].wait = looper_wait_none;
+    r->slots[i].ready = false;
+    clock_gettime(CLOCK_MONOTONIC, &(r->slots[i].last_run));
+    r->num_loopers++;
+    pthread_mutex_unlock(&(r->looper.lock));
+    if (r->num_loopers == 1) looper_start(&(r->looper));
+    else looper_wake(&(r->looper));
+}
+
+void reactor_remove(struct reactor_t * r, struct looper_t * l) {
+    int i, num_left;
+    pthread_mutex_lock(&(r->looper.lock));
+    for (i=0; i<REACTOR_MAX_LOOPERS && r->slots[i].l != l; i++);
+    if (i == REACTOR_MAX_LOOPERS) {
+        pthread_mutex_unlock(&(r->looper.lock));
+        return;
+    }
+    r->slots[i].l = NULL;
+    update_slot_fds(&(r->slots[i]));
+    sync_fds(r);
+    num_left = --(r->num_loopers);
+    pthread_mutex_unlock(&(r->looper.lock));
+    if (!num_left) looper_stop(&(r->looper));
+    else looper_wake(&(r->looper));
+    l->desired_state = stopped;
+    l->actual_state = stopped;
+    if (l->function_to_run_last) l->function_to_run_last(l->data);
+}
+
+void reactor_pause(struct reactor_t * r, struct looper_t * l) {
+    pthread_mutex_lock(&(r->looper.lock));
+    l->desired_state = paused;
+    l->actual_state = paused;
+    pthread_mutex_unlock(&(r->looper.lock));
+    looper_wake(&(r->looper));
+}
+
+void reactor_resume(struct reactor_t * r, struct looper_t * l) {
+    pthread_mutex_lock(&(r->looper.lock));
+    l->desired_state = running;
+    l->actual_state = running;
+    pthread_mutex_unlock(&(r->looper.lock));
+    looper_wake(&(r->looper));
+}
@@ -0,0 +1,71 @@
+/*!
+ * @file src/reactor.h
+ * @brief A reactor runs several loopers on a single thread instead of a thread each.
+ * @details
+ * The loopers added to a reactor are not started as threads of their own. Instead, the reactor's one thread uses each
+ * looper's function_before_wait and wait fds (see /ref src/looper.h) to decide which of them have something to do,
+ * waits on all of their fds together with one epoll fd, and then calls the function_to_repeat (or function_to_poll)
+ * of each looper that is ready. So the same looper definitions can run either way, and nothing else needs to know
+ * which way they are run.
+ * In particular, a looper that hands items to another looper through a queue just lets it run later on the same thread.
+ *
+ * For each added looper, on each time around:
+ *     function_before_wait says no wait  -> it runs right away
+ *     function_before_wait says block    -> its wait fds are in the epoll set (for the events it asked for) and it
+ *                                           runs once one of them is ready
+ *     function_before_wait says sleep    -> it runs again once its usleep_time has passed
+ *     (no function_before_wait means block if it has wait fds, otherwise sleep)
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "looper.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+
+#define REACTOR_MAX_LOOPERS 8
+#define REACTOR_MAX_FDS (REACTOR_MAX_LOOPERS * LOOPER_MAX_WAIT_FDS)
+
+struct reactor_slot_t {
+    struct looper_t * l;                      /* NULL if the slot is free */
+    enum looper_wait_t wait;                  /* what function_before_wait said this time around */
+    struct pollfd wanted[LOOPER_MAX_WAIT_FDS];  /* fds and events this looper is waiting on this time around */
+    int num_wanted;
+    bool ready;                               /* one of its fds was ready */
+    struct timespec last_run;
+};
+
+// an fd in the epoll set, which may be there for more than one looper (e.g., send waiting for room in a socket that
+// receive is waiting for data on), with the events of all of them
+struct reactor_fd_t {
+    int fd;
+    uint32_t events;
+};
+
+struct reactor_t {
+    struct looper_t looper;                   /* the one thread; its lock also guards the slots */
+    struct reactor_slot_t slots[REACTOR_MAX_LOOPERS];
+    int num_loopers;
+    int epoll_fd;
+    struct reactor_fd_t registered[REACTOR_MAX_FDS];  /* what is currently in the epoll set */
+    int num_registered;
+};
+
+// call once before adding loopers
+bool reactor_init(struct reactor_t * r);
+
+// runs the looper's function_to_run_first and then runs it on the reactor (starting the reactor thread if needed)
+void reactor_add(struct reactor_t * r, struct looper_t * l);
+
+// stops running the looper and then runs its function_to_run_last (stopping the reactor thread if it was the last one)
+void reactor_remove(struct reactor_t * r, struct looper_t * l);
+
+void reactor_pause(struct reactor_t * r, struct looper_t * l);
+void reactor_resume(struct reactor_t * r, struct looper_t * l);
+
+#endif // REACTOR_H
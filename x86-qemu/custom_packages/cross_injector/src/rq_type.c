@@ -0,0 +1,216 @@
+
+#include "rq_type.h"
+#include <stdlib.h>
+
+/*
+ * initially, head==tail and q is empty
+ * committing a record advances tail past it (and past the end of the ring, if it was skipped to make the record fit)
+ * using a record advances head past it the same way
+ * tail - head is how many bytes are in use, which wraps around correctly since the counters are unsigned
+ * the consumer knows the end of the ring was skipped either from a wrap record or from there not being room for a header
+ */
+
+#define RQ_HEADER_SIZE sizeof(rq_record_t)
+#define RQ_LENGTH(n) ((RQ_HEADER_SIZE + (n) + RQ_ALIGN - 1) & ~((uint32_t) RQ_ALIGN - 1))
+
+static uint32_t rq_ring_size(uint32_t size) {
+    uint32_t ring_size;
+    for (ring_size = RQ_MIN_SIZE; ring_size < size; ring_size <<= 1);
+    return ring_size;
+}
+
+// so that a record of any size up to this can always be reserved once the q has (partly) emptied
+uint32_t rq_max_record_for(uint32_t size) {
+    return rq_ring_size(size) / 4 - RQ_HEADER_SIZE;
+}
+
+// allocates and initializes q struct/data
+bool rq_new(rq_type ** q, uint32_t size) {
+    void *mem;
+    uint32_t ring_size;
+    if (size > RQ_MAX_SIZE) {
+        *q = NULL;
+        return false;
+    }
+    ring_size = rq_ring_size(size);
+    if (posix_memalign(&mem, RQ_CACHE_LINE_SIZE, sizeof(rq_type))) {
+        *q = NULL;
+        return false;
+    }
+    *q = mem;
+    if (posix_memalign(&mem, RQ_CACHE_LINE_SIZE, ring_size)) {
+        free(*q);
+        *q = NULL;
+        return false;
+    }
+    (*q)->data = mem;
+    atomic_init(&((*q)->head), 0);
+    atomic_init(&((*q)->tail), 0);
+    (*q)->next_tail = 0;
+    (*q)->tail_cache = 0;
+    (*q)->head_cache = 0;
+    (*q)->reserved_at = 0;
+    atomic_init(&((*q)->room_wanted), 0);
+    (*q)->size = ring_size;
+    (*q)->max_record = rq_max_record_for(ring_size);
+    (*q)->doorbell = NULL;
+    (*q)->room_doorbell = NULL;
+    return true;
+}
+
+static inline uint32_t rq_offset(rq_type * q, uint32_t counter) {
+    return counter & (q->size - 1);
+}
+
+static inline rq_record_t * rq_record(rq_type * q, uint32_t counter) {
+    return (rq_record_t *) (q->data + rq_offset(q, counter));
+}
+
+uint32_t rq_max_record(rq_type * q) {
+    return q->max_record;
+}
+
+// how many bytes a record of max bytes will take at tail, including skipping the end of the ring if needed
+static inline uint32_t rq_needed(rq_type * q, uint32_t tail, uint32_t max) {
+    uint32_t needed, to_end;
+    needed = RQ_LENGTH(max);
+    to_end = q->size - rq_offset(q, tail);
+    return (to_end < needed) ? to_end + needed : needed;
+}
+
+// gets pointer to a record with room for max bytes unless q doesn't have that much room
+rq_record_t * rq_reserve(rq_type * q, uint32_t max) {
+    uint32_t tail, needed;
+    if (max > q->max_record) return NULL;
+    tail = q->next_tail;
+    needed = rq_needed(q, tail, max);
+    if (q->size - (tail - q->head_cache) < needed) {
+        q->head_cache = atomic_load_explicit(&(q->head), memory_order_acquire);
+        if (q->size - (tail - q->head_cache) < needed) return NULL;
+    }
+    q->reserved_at = tail + needed - RQ_LENGTH(max);
+    return rq_record(q, q->reserved_at);
+}
+
+// puts the reserved record with size bytes in the q
+void rq_commit(rq_type * q, uint32_t size) {
+    rq_add(q, size);
+    rq_publish(q);
+}
+
+// finishes the reserved record with size bytes, after the records added before it, but only the producer knows yet
+void rq_add(rq_type * q, uint32_t size) {
+    uint32_t tail = q->next_tail;
+    rq_record_t * record;
+    if (q->reserved_at != tail && q->reserved_at - tail >= RQ_HEADER_SIZE) rq_record(q, tail)->flags = RQ_WRAP;
+    record = rq_record(q, q->reserved_at);
+    record->size = size;
+    record->flags = 0;
+    q->next_tail = q->reserved_at + RQ_LENGTH(size);
+}
+
+// lets the consumer have all the records added so far
+void rq_publish(rq_type * q) {
+    if (atomic_load_explicit(&(q->tail), memory_order_relaxed) == q->next_tail) return;
+    atomic_store_explicit(&(q->tail), q->next_tail, memory_order_release);
+    if (q->doorbell) doorbell_ring(q->doorbell);
+}
+
+// finds the record at counter, if it is in the q, moving counter past the end of the ring if that was skipped
+static rq_record_t * rq_find(rq_type * q, uint32_t * counter) {
+    uint32_t to_end;
+    if (*counter == q->tail_cache) {
+        q->tail_cache = atomic_load_explicit(&(q->tail), memory_order_acquire);
+        if (*counter == q->tail_cache) return NULL;
+    }
+    to_end = q->size - rq_offset(q, *counter);
+    // the skip and the record after it were committed together, so the record is there too
+    if (to_end < RQ_HEADER_SIZE || (rq_record(q, *counter)->flags & RQ_WRAP)) *counter += to_end;
+    return rq_record(q, *counter);
+}
+
+// gets pointer to head record unless q is empty
+rq_record_t * rq_get_head(rq_type * q) {
+    uint32_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    return rq_find(q, &head);
+}
+
+// indicates that memory associated with the head record has been consumed and can be reused
+void rq_used_head(rq_type * q) {
+    rq_used_head_n(q, 1);
+}
+
+// gets up to max records starting at head
+uint16_t rq_get_head_n(rq_type * q, rq_record_t ** records, uint16_t max) {
+    uint32_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    uint16_t n;
+    for (n=0; n<max; n++) {
+        records[n] = rq_find(q, &head);
+        if (!records[n]) break;
+        head += RQ_LENGTH(records[n]->size);
+    }
+    return n;
+}
+
+// indicates that memory associated with the n records at head has been consumed and can be reused
+void rq_used_head_n(rq_type * q, uint16_t n) {
+    uint32_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    rq_record_t * record;
+    for (uint16_t i=0; i<n; i++) {
+        record = rq_find(q, &head);
+        if (!record) break;
+        head += RQ_LENGTH(record->size);
+    }
+    atomic_store_explicit(&(q->head), head, memory_order_release);
+    if (q->room_doorbell) doorbell_ring(q->room_doorbell);
+}
+
+uint32_t rq_bytes_used(rq_type * q) {
+    return atomic_load_explicit(&(q->tail), memory_order_acquire) - atomic_load_explicit(&(q->head), memory_order_acquire);
+}
+
+void rq_set_doorbell(rq_type * q, struct doorbell_t * doorbell) {
+    q->doorbell = doorbell;
+}
+
+void rq_set_room_doorbell(rq_type * q, struct doorbell_t * doorbell) {
+    q->room_doorbell = doorbell;
+}
+
+void rq_want_room(rq_type * q, uint32_t max) {
+    if (atomic_load_explicit(&(q->room_wanted), memory_order_relaxed) == max) return;
+    atomic_store_explicit(&(q->room_wanted), max, memory_order_release);
+    // the consumer may be blocked waiting for more records rather than busy with the ones it has
+    if (max && q->doorbell) doorbell_ring(q->doorbell);
+}
+
+uint32_t rq_room_wanted(rq_type * q) {
+    return atomic_load_explicit(&(q->room_wanted), memory_order_acquire);
+}
+
+uint16_t rq_drop_head_for_room(rq_type * q) {
+    uint32_t wanted, head;
+    rq_record_t * record;
+    uint16_t n;
+    wanted = rq_room_wanted(q);
+    if (!wanted) return 0;
+    head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    q->tail_cache = atomic_load_explicit(&(q->tail), memory_order_acquire);
+    // the producer can't move tail until it has room, so it stays put while dropping
+    for (n=0; q->size - (q->tail_cache - head) < rq_needed(q, q->tail_cache, wanted); n++) {
+        record = rq_find(q, &head);
+        if (!record) break;
+        head += RQ_LENGTH(record->size);
+    }
+    if (n) {
+        atomic_store_explicit(&(q->head), head, memory_order_release);
+        if (q->room_doorbell) doorbell_ring(q->room_doorbell);
+    }
+    return n;
+}
+
+void rq_free(rq_type *q) {
+    free(q->data);
+    free(q);
+}
+
@@ -0,0 +1,118 @@
+/*
+ queue of variable length records packed one after another in a ring of bytes, for one producer and one consumer thread
+ intended use: like aq_type (/ref src/aq_type.h) but for frames, which are mostly small (acks, beacons, probes) and only
+ sometimes large (up to an A-MSDU), so that a fixed size slot for the largest frame would mostly be wasted
+
+ each record is a header (size and timestamp) followed by the data, rounded up to RQ_ALIGN bytes
+ the producer reserves room for a record of up to some size, writes the header and data in place, and then commits the
+ size it actually used, e.g., thread A: r = reserve(max), fill in r, commit(size), reserve(max), ...
+ or, to hand over several records at once, reserve(max), fill in, add(size), reserve(max), ..., publish()
+ the consumer gets records at the head, finishes with them, and then releases them, one at a time or as a burst,
+ e.g., thread B: get_head(), used_head(), ... or get_head_n(..., max), used_head_n(n), ...
+ a record is always contiguous: if it would not fit before the end of the ring, the rest of the ring is skipped (marked
+ with a wrap record when there is room for a header) and the record starts back at the beginning
+
+ this is lock free in the same way as aq_type: head and tail are byte counters that only the consumer and producer
+ (respectively) write, published with release and read with acquire semantics, on separate cache lines, and each side
+ keeps a cached copy of the other side's counter
+ the ring size is a power of two so the counters can simply run on and wrap around
+
+ when there isn't room for a record, the producer can either drop it or wait, optionally asking the consumer to drop the
+ oldest records to make room (rq_want_room and rq_drop_head_for_room), since only the consumer can move head
+ a second doorbell can be attached that the consumer rings as it makes room, so that a waiting producer can block on it
+*/
+#ifndef RQ_TYPE_H
+#define RQ_TYPE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "doorbell.h"
+#include "bignum_sec_profiling.h"
+
+#define RQ_CACHE_LINE_SIZE 64
+#define RQ_ALIGN 8
+#define RQ_MIN_SIZE 4096
+#define RQ_MAX_SIZE (1u << 30)
+#define RQ_WRAP 0x1     /* record flag: skip to the beginning of the ring */
+
+typedef struct rq_record_s {
+    uint32_t size;                    /* bytes of buffer */
+    uint32_t flags;
+    bignum_sec_t bignum_timestamp;
+    uint8_t  buffer[];
+} rq_record_t;
+
+typedef struct rq_struct {
+    /* consumer side */
+    _Alignas(RQ_CACHE_LINE_SIZE) _Atomic uint32_t head;
+    uint32_t tail_cache;
+    /* producer side */
+    _Alignas(RQ_CACHE_LINE_SIZE) _Atomic uint32_t tail;
+    uint32_t head_cache;
+    uint32_t next_tail;               /* tail once the records added since the last publish are published */
+    uint32_t reserved_at;             /* where the reserved record starts, which is past tail if it wrapped around */
+    _Atomic uint32_t room_wanted;     /* set by the producer for the consumer to make room for a record this big */
+    /* set once by rq_new */
+    _Alignas(RQ_CACHE_LINE_SIZE) uint32_t size;
+    uint32_t max_record;              /* largest buffer that can be reserved */
+    uint8_t *data;
+    struct doorbell_t *doorbell;
+    struct doorbell_t *room_doorbell;
+}rq_type;
+
+// allocates and initializes q struct/data with a ring of at least size bytes (rounded up to a power of two),
+// returns false if size is more than RQ_MAX_SIZE
+bool rq_new(rq_type ** q, uint32_t size);
+
+// largest buffer a record can have in a q made with rq_new(size)
+uint32_t rq_max_record_for(uint32_t size);
+
+// gets pointer to a record with room for up to max bytes of buffer, unless there is not that much room (or max is too
+// big for the q, see rq_max_record), the record is not in the q until committed
+rq_record_t * rq_reserve(rq_type * q, uint32_t max);
+
+// puts the reserved record in the q with size bytes of buffer (size may be less than what was reserved)
+void rq_commit(rq_type * q, uint32_t size);
+
+// like rq_commit, but the consumer doesn't get the record until rq_publish, so that a batch of records can be reserved
+// and added one after another and then handed over with one store (and at most one doorbell ring)
+void rq_add(rq_type * q, uint32_t size);
+void rq_publish(rq_type * q);
+
+// largest buffer a record can have in this q
+uint32_t rq_max_record(rq_type * q);
+
+// gets pointer to the head record, if any
+rq_record_t * rq_get_head(rq_type * q);
+
+// must call this when done using the head record for its memory to be able to be reused
+void rq_used_head(rq_type * q);
+
+// gets up to max records starting at head into records and returns how many (0 if q is empty)
+uint16_t rq_get_head_n(rq_type * q, rq_record_t ** records, uint16_t max);
+
+// must call this when done using n records acquired with get_head_n (n may be less than what get_head_n returned)
+void rq_used_head_n(rq_type * q, uint16_t n);
+
+// bytes of the ring in use, including headers and padding
+uint32_t rq_bytes_used(rq_type * q);
+
+// rings doorbell (if not NULL) each time a record is committed, so the consumer can block on it when the q is empty
+void rq_set_doorbell(rq_type * q, struct doorbell_t * doorbell);
+
+// rings doorbell (if not NULL) each time records are used, so the producer can block on it when the q is full
+void rq_set_room_doorbell(rq_type * q, struct doorbell_t * doorbell);
+
+// producer: asks the consumer to make room for a record of up to max bytes (0 = no longer needed)
+void rq_want_room(rq_type * q, uint32_t max);
+
+// consumer: how big a record the producer wants room for (0 if it doesn't)
+uint32_t rq_room_wanted(rq_type * q);
+
+// consumer: drops the oldest records (if any) until there is the room the producer wants, returns how many were dropped
+uint16_t rq_drop_head_for_room(rq_type * q);
+
+void rq_free(rq_type *q);
+
+#endif
@@ -0,0 +1,274 @@
+/*!
+ * @file src/shm_ring.c
+ * @brief A byte stream each way between two processes on one host, through rings in shared memory.
+ * @details
+ * Each ring has one writer and one reader, so head and tail need no locks: the writer copies bytes in and then
+ * publishes them by moving head on (with release order), and the reader copies them out and then gives the room back by
+ * moving tail on. They are on different cache lines so that the two sides aren't always taking the same line from
+ * each other. The doorbells work as in /ref src/doorbell.c, with the armed flags in the region rather than in either
+ * process: a side sets its flag and then looks at the ring once more before it waits, and the other side moves head
+ * or tail and then rings if the flag is set; the seq_cst fences between make sure that one of them sees the other.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#define _GNU_SOURCE   /* for memfd_create */
+
+#include "shm_ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#define SHM_MAGIC 0x4C53484DU   /* "LSHM" */
+#define SHM_FDS 5               /* sent from client to server: the memfd, then data and room for each ring */
+
+static void close_fds(int * fds, int n) {
+    for (int i=0; i<n; i++) if (fds[i] >= 0) close(fds[i]);
+}
+
+// side 0 is the client, which writes rings[0]; efds are data and room for rings[0] and then for rings[1]
+static void attach(struct shm_link_t * k, struct shm_region_t * region, const int * efds, int side, int sock) {
+    k->region = region;
+    k->tx = &(region->rings[side]);
+    k->rx = &(region->rings[1 - side]);
+    k->tx_data_fd = efds[2 * side];
+    k->tx_room_fd = efds[2 * side + 1];
+    k->rx_data_fd = efds[2 * (1 - side)];
+    k->rx_room_fd = efds[2 * (1 - side) + 1];
+    k->sock = sock;
+}
+
+static bool send_fds(int sock, const int * fds, int n) {
+    char byte = 0;
+    char control[CMSG_SPACE(SHM_FDS * sizeof(int))];
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg;
+    struct cmsghdr * cm;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(n * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, n * sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+// returns how many fds came (into fds), or -1
+static int recv_fds(int sock, int * fds, int n, int wait_ms) {
+    char byte;
+    char control[CMSG_SPACE(SHM_FDS * sizeof(int))];
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg;
+    struct cmsghdr * cm;
+    struct pollfd pfd = {sock, POLLIN, 0};
+    int got;
+    if (poll(&pfd, 1, wait_ms) <= 0) return -1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC) != 1) return -1;
+    cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) return -1;
+    got = (int) ((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    memcpy(fds, CMSG_DATA(cm), (got < n ? got : n) * sizeof(int));
+    if (got != n) {
+        close_fds(fds, got < n ? got : n);
+        return -1;
+    }
+    return got;
+}
+
+bool shm_link_create(struct shm_link_t * k, int sock) {
+    struct shm_region_t * region;
+    int fds[SHM_FDS];
+    memset(k, 0, sizeof(*k));
+    for (int i=0; i<SHM_FDS; i++) fds[i] = -1;
+    fds[0] = memfd_create("lisa-shm", MFD_CLOEXEC);
+    if (fds[0] < 0 || ftruncate(fds[0], sizeof(struct shm_region_t)) < 0) {
+        printf("error making shared memory for a link: %s\n", strerror(errno));
+        close_fds(fds, SHM_FDS);
+        return false;
+    }
+    for (int i=1; i<SHM_FDS; i++) {
+        fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fds[i] < 0) {
+            printf("error making eventfds for a link: %s\n", strerror(errno));
+            close_fds(fds, SHM_FDS);
+            return false;
+        }
+    }
+    region = mmap(NULL, sizeof(struct shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (region == MAP_FAILED) {
+        printf("error mapping shared memory for a link: %s\n", strerror(errno));
+        close_fds(fds, SHM_FDS);
+        return false;
+    }
+    region->ring_size = SHM_RING_SIZE;
+    for (int i=0; i<2; i++) {
+        atomic_init(&(region->rings[i].head), 0);
+        atomic_init(&(region->rings[i].tail), 0);
+        // a reader might wait (e.g., in epoll) before it ever reads, so the first write has to ring
+        atomic_init(&(region->rings[i].reader_waiting), 1);
+        atomic_init(&(region->rings[i].writer_waiting), 0);
+        atomic_init(&(region->rings[i].closed), 0);
+    }
+    region->magic = SHM_MAGIC;
+    if (!send_fds(sock, fds, SHM_FDS)) {
+        printf("error sending a link to the server: %s\n", strerror(errno));
+        munmap(region, sizeof(struct shm_region_t));
+        close_fds(fds, SHM_FDS);
+        return false;
+    }
+    close(fds[0]);    /* the mapping keeps the memory */
+    attach(k, region, fds + 1, 0, sock);
+    return true;
+}
+
+bool shm_link_accept(struct shm_link_t * k, int sock, int wait_ms) {
+    struct shm_region_t * region;
+    struct stat st;
+    int fds[SHM_FDS];
+    memset(k, 0, sizeof(*k));
+    if (recv_fds(sock, fds, SHM_FDS, wait_ms) < 0) {
+        printf("no link came from the client\n");
+        return false;
+    }
+    region = MAP_FAILED;
+    if (fstat(fds[0], &st) == 0 && st.st_size >= (off_t) sizeof(struct shm_region_t)) {
+        region = mmap(NULL, sizeof(struct shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    }
+    close(fds[0]);
+    if (region == MAP_FAILED || region->magic != SHM_MAGIC || region->ring_size != SHM_RING_SIZE) {
+        printf("the link from the client isn't one this knows\n");
+        if (region != MAP_FAILED) munmap(region, sizeof(struct shm_region_t));
+        close_fds(fds + 1, SHM_FDS - 1);
+        return false;
+    }
+    attach(k, region, fds + 1, 1, sock);
+    return true;
+}
+
+// called just before waiting on fd for the other side to ring (see doorbell_arm)
+static void arm(_Atomic int * waiting, int fd) {
+    uint64_t count;
+    if (!atomic_load_explicit(waiting, memory_order_relaxed)) {
+        if (read(fd, &count, sizeof(count)) < 0) { /* nothing was written, which is fine */ }
+        atomic_store_explicit(waiting, 1, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+// called after moving head or tail on, only makes a system call if the other side is (about to be) waiting
+static void ring(_Atomic int * waiting, int fd) {
+    uint64_t one = 1;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(waiting, memory_order_relaxed)) return;
+    if (atomic_exchange_explicit(waiting, 0, memory_order_relaxed)) {
+        if (write(fd, &one, sizeof(one)) < 0) printf("error ringing a link doorbell\n");
+    }
+}
+
+// true if the other process closed its end of the socket (e.g., because it exited without closing the link)
+static bool peer_gone(struct shm_link_t * k) {
+    char byte;
+    return recv(k->sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+ssize_t shm_link_write(struct shm_link_t * k, const struct iovec * iov, int iovcnt) {
+    struct shm_ring_t * r = k->tx;
+    uint64_t head, room, offset;
+    size_t n, first, done;
+    if (atomic_load_explicit(&(r->closed), memory_order_acquire)) {
+        errno = EPIPE;
+        return -1;
+    }
+    head = atomic_load_explicit(&(r->head), memory_order_relaxed);
+    room = SHM_RING_SIZE - (head - atomic_load_explicit(&(r->tail), memory_order_acquire));
+    if (!room) {
+        arm(&(r->writer_waiting), k->tx_room_fd);
+        room = SHM_RING_SIZE - (head - atomic_load_explicit(&(r->tail), memory_order_acquire));
+        if (!room) {
+            if (!peer_gone(k)) return 0;
+            errno = EPIPE;
+            return -1;
+        }
+    }
+    done = 0;
+    for (int i=0; i<iovcnt && done < room; i++) {
+        n = (iov[i].iov_len < room - done) ? iov[i].iov_len : room - done;
+        offset = (head + done) & (SHM_RING_SIZE - 1);
+        first = (n < SHM_RING_SIZE - offset) ? n : SHM_RING_SIZE - offset;
+        memcpy(r->data + offset, iov[i].iov_base, first);
+        memcpy(r->data, (const uint8_t *) iov[i].iov_base + first, n - first);
+        done += n;
+    }
+    atomic_store_explicit(&(r->head), head + done, memory_order_release);
+    ring(&(r->reader_waiting), k->tx_data_fd);
+    return (ssize_t) done;
+}
+
+ssize_t shm_link_read(struct shm_link_t * k, void * buf, size_t len) {
+    struct shm_ring_t * r = k->rx;
+    uint64_t tail, avail, offset;
+    size_t n, first;
+    tail = atomic_load_explicit(&(r->tail), memory_order_relaxed);
+    avail = atomic_load_explicit(&(r->head), memory_order_acquire) - tail;
+    if (!avail) {
+        arm(&(r->reader_waiting), k->rx_data_fd);
+        avail = atomic_load_explicit(&(r->head), memory_order_acquire) - tail;
+        if (!avail) {
+            // the other side sets closed after its last write, so look at head once more after seeing it
+            if (!atomic_load_explicit(&(r->closed), memory_order_acquire) && !peer_gone(k)) {
+                errno = EAGAIN;
+                return -1;
+            }
+            avail = atomic_load_explicit(&(r->head), memory_order_acquire) - tail;
+            if (!avail) return 0;
+        }
+    }
+    n = (len < avail) ? len : avail;
+    offset = tail & (SHM_RING_SIZE - 1);
+    first = (n < SHM_RING_SIZE - offset) ? n : SHM_RING_SIZE - offset;
+    memcpy(buf, r->data + offset, first);
+    memcpy((uint8_t *) buf + first, r->data, n - first);
+    atomic_store_explicit(&(r->tail), tail + n, memory_order_release);
+    ring(&(r->writer_waiting), k->rx_room_fd);
+    return (ssize_t) n;
+}
+
+int shm_link_data_fd(struct shm_link_t * k) {
+    return k->rx_data_fd;
+}
+
+int shm_link_room_fd(struct shm_link_t * k) {
+    return k->tx_room_fd;
+}
+
+void shm_link_close(struct shm_link_t * k) {
+    uint64_t one = 1;
+    if (!k->region) return;
+    atomic_store(&(k->tx->closed), 1);
+    atomic_store(&(k->rx->closed), 1);
+    // wakes the other side whether or not it is waiting, to see that the link is closed
+    if (write(k->tx_data_fd, &one, sizeof(one)) < 0) { /* the other side already closed its end */ }
+    if (write(k->rx_room_fd, &one, sizeof(one)) < 0) { /* likewise */ }
+    munmap(k->region, sizeof(struct shm_region_t));
+    close(k->tx_data_fd);
+    close(k->tx_room_fd);
+    close(k->rx_data_fd);
+    close(k->rx_room_fd);
+    k->region = NULL;
+}
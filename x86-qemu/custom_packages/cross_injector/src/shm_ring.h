@@ -0,0 +1,82 @@
+/*!
+ * @file src/shm_ring.h
+ * @brief A byte stream each way between two processes on one host, through rings in shared memory.
+ * @details
+ * A link is one shared memory region (a memfd) holding two single-producer single-consumer rings, one for each
+ * direction, and four eventfds as doorbells: data for each ring (rung by its writer) and room for each ring (rung by
+ * its reader). Like /ref src/doorbell.h, a side only rings when the other side said it is about to wait, so a busy link
+ * makes no system calls at all: the bytes are copied into the ring by one side and out of it by the other.
+ *       client: shm_link_create on a connected unix socket (sends the memfd and eventfds over it)
+ *       server: shm_link_accept on the socket it accepted (receives them)
+ * The unix socket stays open, since it is what says that the other process went away (it hangs up).
+ * The region holds no pointers or fds, only offsets counted in bytes, so it works mapped at any address, e.g., in the
+ * BAR of an ivshmem device, which would let a VM and its host share a link the same way.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SHM_RING_SIZE (1 << 20)          /* bytes of each ring (a power of 2) */
+#define SHM_CACHE_LINE 64
+
+// one direction, in the shared region; head and tail only ever go up (the offset in data is them mod SHM_RING_SIZE)
+struct shm_ring_t {
+    _Alignas(SHM_CACHE_LINE) _Atomic uint64_t head;   /* bytes ever written, only the writer changes it */
+    _Atomic int reader_waiting;                        /* the reader is about to wait for the data doorbell */
+    _Atomic int closed;                                /* either side closed the link */
+    _Alignas(SHM_CACHE_LINE) _Atomic uint64_t tail;   /* bytes ever read, only the reader changes it */
+    _Atomic int writer_waiting;                        /* the writer is about to wait for the room doorbell */
+    _Alignas(SHM_CACHE_LINE) uint8_t data[SHM_RING_SIZE];
+};
+
+struct shm_region_t {
+    uint32_t magic;
+    uint32_t ring_size;
+    struct shm_ring_t rings[2];    /* client to server, server to client */
+};
+
+// one side's view of a link, in its own process
+struct shm_link_t {
+    struct shm_region_t * region;
+    struct shm_ring_t * tx;        /* the ring this side writes */
+    struct shm_ring_t * rx;        /* the ring this side reads */
+    int tx_data_fd;                /* rung by this side when it writes to a waiting reader */
+    int tx_room_fd;                /* rung by the other side when it reads from tx and this side is waiting */
+    int rx_data_fd;
+    int rx_room_fd;
+    int sock;                      /* the unix socket the link was set up over, which hangs up with the other side */
+};
+
+// makes the region and eventfds and sends them over the connected unix socket sock, returns false on error
+bool shm_link_create(struct shm_link_t * k, int sock);
+
+// receives the region and eventfds from the client on sock (waiting up to wait_ms for them), returns false on error
+bool shm_link_accept(struct shm_link_t * k, int sock, int wait_ms);
+
+// writes what there is room for of iovcnt buffers, returns the bytes written (which may end partway through a buffer),
+// 0 if the ring is full (wait on shm_link_room_fd for POLLIN), or -1 if the link is closed
+ssize_t shm_link_write(struct shm_link_t * k, const struct iovec * iov, int iovcnt);
+
+// reads up to len bytes, returns how many, 0 if the other side closed (or went away) and there is nothing left, or -1
+// with errno EAGAIN if there is nothing to read yet (wait on shm_link_data_fd for POLLIN)
+ssize_t shm_link_read(struct shm_link_t * k, void * buf, size_t len);
+
+// the eventfd that becomes readable when there is something to read, after shm_link_read said there wasn't
+int shm_link_data_fd(struct shm_link_t * k);
+
+// the eventfd that becomes readable when there is room to write, after shm_link_write said there wasn't
+int shm_link_room_fd(struct shm_link_t * k);
+
+// marks the link closed (which the other side reads as the end of the stream), and unmaps and closes this side of it,
+// but not sock
+void shm_link_close(struct shm_link_t * k);
+
+#endif // SHM_RING_H
@@ -0,0 +1,180 @@
+/*!
+ * @file src/uring.c
+ * @brief Just enough of io_uring, through its system calls, for lisa's receives and for injecting bursts of frames.
+ * @details
+ * Each ring has one writer: this side moves the submission tail and the completion head, the kernel the other two.
+ * As with the other rings here, a side fills in entries and then publishes them by moving its counter on with release
+ * order, and reads the other side's counter with acquire order before it looks at the entries up to it.
+ * The submission ring is an array of indexes into the sqes, which are always used in order here, so index i is sqe i.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#include "uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int io_uring_setup(unsigned entries, struct io_uring_params * p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void * map(int fd, size_t size, off_t offset) {
+    void * p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+bool uring_init(struct uring_t * u, unsigned entries) {
+    struct io_uring_params p;
+    uint8_t * sq, * cq;
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = io_uring_setup(entries, &p);
+    if (u->fd < 0) return false;
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    // newer kernels (5.4) map both rings at once
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_size > u->sq_ring_size) u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+    u->sq_ring = map(u->fd, u->sq_ring_size, IORING_OFF_SQ_RING);
+    if (u->sq_ring && (p.features & IORING_FEAT_SINGLE_MMAP)) u->cq_ring = u->sq_ring;
+    else if (u->sq_ring) u->cq_ring = map(u->fd, u->cq_ring_size, IORING_OFF_CQ_RING);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (u->cq_ring) u->sqes = map(u->fd, u->sqes_size, IORING_OFF_SQES);
+    if (!u->sqes) {
+        uring_exit(u);
+        return false;
+    }
+    sq = u->sq_ring;
+    cq = u->cq_ring;
+    u->sq_head = (unsigned *) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    u->sq_array = (unsigned *) (sq + p.sq_off.array);
+    u->sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_next = *(u->sq_tail);
+    u->cq_head = (unsigned *) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned *) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return true;
+}
+
+struct io_uring_sqe * uring_get_sqe(struct uring_t * u) {
+    struct io_uring_sqe * sqe;
+    unsigned index;
+    if (u->sq_next - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) return NULL;
+    index = u->sq_next & u->sq_mask;
+    u->sq_array[index] = index;
+    sqe = &(u->sqes[index]);
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_next++;
+    return sqe;
+}
+
+int uring_submit(struct uring_t * u, unsigned wait_nr) {
+    unsigned to_submit;
+    int rc;
+    __atomic_store_n(u->sq_tail, u->sq_next, __ATOMIC_RELEASE);
+    to_submit = u->sq_next - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (!to_submit && !wait_nr) return 0;
+    do {
+        rc = io_uring_enter(u->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        u->enters++;
+    } while (rc < 0 && errno == EINTR);
+    return rc;
+}
+
+unsigned uring_unsubmit(struct uring_t * u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned taken_back = u->sq_next - head;
+    u->sq_next = head;
+    __atomic_store_n(u->sq_tail, head, __ATOMIC_RELEASE);
+    return taken_back;
+}
+
+struct io_uring_cqe * uring_peek(struct uring_t * u) {
+    unsigned head = *(u->cq_head);
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &(u->cqes[head & u->cq_mask]);
+}
+
+void uring_seen(struct uring_t * u) {
+    __atomic_store_n(u->cq_head, *(u->cq_head) + 1, __ATOMIC_RELEASE);
+}
+
+bool uring_provide_buffers(struct uring_t * u, uint16_t group, uint16_t count, uint32_t size) {
+    struct io_uring_buf_reg reg;
+    u->buf_ring_size = count * sizeof(struct io_uring_buf);
+    u->buf_ring = mmap(NULL, u->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->buf_ring == MAP_FAILED) {
+        u->buf_ring = NULL;
+        return false;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) u->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    u->buffers = malloc((size_t) count * size);
+    if (!u->buffers || io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(u->buffers);
+        u->buffers = NULL;
+        munmap(u->buf_ring, u->buf_ring_size);
+        u->buf_ring = NULL;
+        return false;
+    }
+    u->buffer_size = size;
+    u->buffer_count = count;
+    u->buffer_group = group;
+    u->buffer_tail = 0;
+    for (uint16_t bid = 0; bid < count; bid++) uring_recycle(u, (uint32_t) bid << IORING_CQE_BUFFER_SHIFT);
+    return true;
+}
+
+uint8_t * uring_buffer(struct uring_t * u, uint32_t cqe_flags) {
+    return u->buffers + (size_t) (cqe_flags >> IORING_CQE_BUFFER_SHIFT) * u->buffer_size;
+}
+
+void uring_recycle(struct uring_t * u, uint32_t cqe_flags) {
+    struct io_uring_buf * buf;
+    uint16_t bid = (uint16_t) (cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+    buf = &(u->buf_ring->bufs[u->buffer_tail & (u->buffer_count - 1)]);
+    buf->addr = (uint64_t) (uintptr_t) (u->buffers + (size_t) bid * u->buffer_size);
+    buf->len = u->buffer_size;
+    buf->bid = bid;
+    u->buffer_tail++;
+    __atomic_store_n(&(u->buf_ring->tail), u->buffer_tail, __ATOMIC_RELEASE);
+}
+
+bool uring_register_buffers(struct uring_t * u, const struct iovec * iov, unsigned n) {
+    return io_uring_register(u->fd, IORING_REGISTER_BUFFERS, (void *) iov, n) == 0;
+}
+
+int uring_fd(struct uring_t * u) {
+    return u->fd;
+}
+
+void uring_exit(struct uring_t * u) {
+    if (u->sqes) munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring) munmap(u->sq_ring, u->sq_ring_size);
+    if (u->fd >= 0) close(u->fd);
+    if (u->buf_ring) munmap(u->buf_ring, u->buf_ring_size);
+    free(u->buffers);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
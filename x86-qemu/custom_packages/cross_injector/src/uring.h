@@ -0,0 +1,99 @@
+/*!
+ * @file src/uring.h
+ * @brief Just enough of io_uring, through its system calls, for lisa's receives and for injecting bursts of frames.
+ * @details
+ * An io_uring is a pair of rings shared with the kernel: work is put in the submission ring and its results come back
+ * in the completion ring. Putting work in costs no system call, and one uring_submit hands the kernel all of it (and
+ * can wait for results in the same call). Results are read straight from memory, with no system call at all.
+ *       uring_get_sqe(), fill it in, ..., uring_submit()           uring_peek(), use the result, uring_seen(), ...
+ * The fd of the ring polls readable while there are results to read, so a looper can wait on it like any other fd.
+ * Provided buffers (uring_provide_buffers) let a receive pick its own buffer out of a ring of them when data arrives,
+ * so one multishot receive keeps receiving into a fresh buffer each time, for as long as it is given buffers back.
+ * Registered buffers (uring_register_buffers) are memory the kernel maps once rather than on every send or write.
+ * All of this needs a kernel that has it (multishot receives since 6.0), and may be turned off (io_uring_disabled), so
+ * a caller tries uring_init first and carries on without it if that fails.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+struct uring_t {
+    int fd;
+    /* submission ring, of which this side only writes the tail */
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_next;                   /* tail once the sqes got since the last submit are submitted */
+    struct io_uring_sqe * sqes;
+    /* completion ring, of which this side only writes the head */
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe * cqes;
+    /* the mappings, to unmap */
+    void * sq_ring;
+    size_t sq_ring_size;
+    void * cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    /* provided buffers (see uring_provide_buffers) */
+    struct io_uring_buf_ring * buf_ring;
+    size_t buf_ring_size;
+    uint8_t * buffers;
+    uint32_t buffer_size;
+    uint16_t buffer_count;
+    uint16_t buffer_tail;
+    uint16_t buffer_group;
+    unsigned long enters;               /* system calls made to submit or wait */
+};
+
+// sets up a ring with room for (at least) entries submissions, returns false if io_uring isn't there or isn't allowed
+bool uring_init(struct uring_t * u, unsigned entries);
+
+// the next submission to fill in (zeroed), or NULL if the submission ring is full (submit first)
+struct io_uring_sqe * uring_get_sqe(struct uring_t * u);
+
+// hands the kernel the submissions filled in since the last submit, and waits until there are at least wait_nr results
+// (0 = doesn't wait), returns how many it took or -1 (with errno) on error
+int uring_submit(struct uring_t * u, unsigned wait_nr);
+
+// takes back the submissions the kernel hasn't taken yet (after uring_submit failed), so that they are never done,
+// returns how many (they were the last ones got)
+unsigned uring_unsubmit(struct uring_t * u);
+
+// the oldest result not yet seen, or NULL if there is none yet
+struct io_uring_cqe * uring_peek(struct uring_t * u);
+
+// done with the result uring_peek returned, which frees its place in the completion ring
+void uring_seen(struct uring_t * u);
+
+// gives the kernel count buffers (a power of 2) of size bytes each, as buffer group group, for receives that select a
+// buffer (IOSQE_BUFFER_SELECT), returns false if it can't (e.g., the kernel is older than 5.19)
+bool uring_provide_buffers(struct uring_t * u, uint16_t group, uint16_t count, uint32_t size);
+
+// the provided buffer a result says was used (its flags have IORING_CQE_F_BUFFER)
+uint8_t * uring_buffer(struct uring_t * u, uint32_t cqe_flags);
+
+// gives that buffer back, for another receive to use
+void uring_recycle(struct uring_t * u, uint32_t cqe_flags);
+
+// registers n buffers for the fixed operations (e.g., IORING_OP_WRITE_FIXED with buf_index), returns false on error
+bool uring_register_buffers(struct uring_t * u, const struct iovec * iov, unsigned n);
+
+// the fd to poll for POLLIN, which is readable while there are results to read
+int uring_fd(struct uring_t * u);
+
+// tears the ring down, which cancels anything still in it
+void uring_exit(struct uring_t * u);
+
+#endif // URING_H
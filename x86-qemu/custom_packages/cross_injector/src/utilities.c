@@ -10,6 +10,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <assert.h>
 #include "debug.h"
@@ -55,6 +56,37 @@ bool is_beacon(uint8_t *data, int size) {
   return (fc.type_subtype == BEACON);
 }
 
+// like get_frame_control but only the type and subtype, checking that the frame is big enough and without printing
+uint8_t get_type_subtype(uint8_t *wfpkt, uint32_t size) {
+    unsigned int radiotap_len;
+    uint8_t fc_field;
+    if (size < 4) return UNKNOWN_TS;
+    radiotap_len = wfpkt[2] + (wfpkt[3] << 8);
+    if (radiotap_len + 2 > size) return UNKNOWN_TS;
+    fc_field = wfpkt[radiotap_len];
+    return (uint8_t) ((((fc_field >> 2) & 0x03) << 4) | (fc_field >> 4));
+}
+
+static const uint8_t eapol_llc_snap[8] = {0xAA, 0xAA, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8E};
+
+bool is_eapol(uint8_t *wfpkt, uint32_t size) {
+    unsigned int radiotap_len, header_len;
+    uint8_t ts, flags;
+    ts = get_type_subtype(wfpkt, size);
+    if (ts != DATA && ts != QOS_DATA) return false;
+    radiotap_len = wfpkt[2] + (wfpkt[3] << 8);
+    flags = wfpkt[radiotap_len+1];
+    if (getb(flags,6)) return false;                        /* protected, so the LLC header can't be seen */
+    header_len = 24;
+    if (getb(flags,0) && getb(flags,1)) header_len += 6;    /* toDS and FromDS: 4th address */
+    if (ts == QOS_DATA) {
+        header_len += 2;                                    /* QoS control */
+        if (getb(flags,7)) header_len += 4;                 /* order: HT control */
+    }
+    if (radiotap_len + header_len + sizeof(eapol_llc_snap) > size) return false;
+    return !memcmp(wfpkt + radiotap_len + header_len, eapol_llc_snap, sizeof(eapol_llc_snap));
+}
+
 
 
 #ifndef DEBUG
@@ -74,6 +74,11 @@ void get_frame_control(frame_control_t *fc, uint8_t *wfpkt, uint32_t size);
 bool is_ack(uint8_t *data, int size);
 bool is_beacon(uint8_t *data, int size);
 
+// type and subtype as in get_frame_control (e.g., BEACON), or UNKNOWN_TS if the frame is too short to have them
+uint8_t get_type_subtype(uint8_t *wfpkt, uint32_t size);
+// whether the frame is a data frame carrying EAPOL (e.g., the 4-way handshake), which can only be seen if it isn't protected
+bool is_eapol(uint8_t *wfpkt, uint32_t size);
+
 #define ASSOCIATION_REQUEST     0x00
 #define ASSOCIATION_RESPONSE    0x01
 #define REASSOCIATION_REQUEST   0x02
@@ -115,5 +120,6 @@ bool is_beacon(uint8_t *data, int size);
 #define QOS_CF_ACK_NO_DATA      0x2F
 #define RESERVED3               0x30 ... 0x3F
 #define UNKNOWN_TYPE_SUBTYPE    0x40 ... 0xFF
+#define UNKNOWN_TS              0xFF
 
 #endif // UTILITIES_H
@@ -0,0 +1,163 @@
+/*!
+ * @file src/wire.c
+ * @brief The header sent before each frame between cross injectors (and through bcaster), in either version.
+ * @details
+ * Everything is marshalled a byte at a time so that it doesn't matter what byte order or alignment the host has.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#include "wire.h"
+#include <stdio.h>
+#include <string.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+#define V2_MARK      0xA0        /* high 4 bits of the first byte of a v2 header */
+#define V2_FLAGS     0x0F        /* low 4 bits */
+#define V2_MIN_SIZE  13
+
+static const uint8_t hello_magic[6] = {'C', 'I', 'W', 'I', 'R', 'E'};
+
+static int put_varint(uint8_t * buf, uint32_t value) {
+    int n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (uint8_t) value;
+    return n;
+}
+
+// returns the bytes read, 0 if they aren't all there yet, or -1 if it is longer than max_bytes
+static int get_varint(const uint8_t * buf, uint32_t avail, int max_bytes, uint32_t * value) {
+    *value = 0;
+    for (int n=0; n<max_bytes; n++) {
+        if ((uint32_t) n >= avail) return 0;
+        *value |= (uint32_t) (buf[n] & 0x7F) << (7 * n);
+        if (!(buf[n] & 0x80)) return n + 1;
+    }
+    return -1;
+}
+
+static void put_be(uint8_t * buf, uint64_t value, int bytes) {
+    for (int i=bytes-1; i>=0; i--) {
+        buf[i] = (uint8_t) (value & 0xFF);
+        value >>= 8;
+    }
+}
+
+static uint64_t get_be(const uint8_t * buf, int bytes) {
+    uint64_t value = 0;
+    for (int i=0; i<bytes; i++) value = (value << 8) | buf[i];
+    return value;
+}
+
+int wire_put_header(uint8_t buf[WIRE_MAX_HEADER_SIZE], const struct wire_header_t * h) {
+    int n;
+    if (h->version == WIRE_V1) {
+        put_be(buf, h->length, 4);
+        put_be(buf + 4, h->timestamp / NSEC_PER_SEC, 8);
+        put_be(buf + 12, h->timestamp % NSEC_PER_SEC, 8);
+        return WIRE_MAX_HEADER_SIZE;
+    }
+    buf[0] = V2_MARK | (h->flags & V2_FLAGS);
+    n = 1 + put_varint(buf + 1, h->length);
+    put_be(buf + n, h->timestamp, 8);
+    n += 8;
+    put_be(buf + n, h->sequence, 2);
+    n += 2;
+    return n + put_varint(buf + n, h->source);
+}
+
+int wire_get_header(const uint8_t * buf, uint32_t avail, struct wire_header_t * h) {
+    uint32_t value;
+    int n, rc;
+    if (!avail) return 0;
+    if (buf[0] == 0) {
+        if (avail < WIRE_MAX_HEADER_SIZE) return 0;
+        h->version = WIRE_V1;
+        h->size = WIRE_MAX_HEADER_SIZE;
+        h->length = (uint32_t) get_be(buf, 4);
+        h->sequence = 0;
+        h->source = 0;
+        if (h->length == 0 && !memcmp(buf + 4, hello_magic, sizeof(hello_magic))) {
+            h->flags = WIRE_FLAG_HELLO;
+            h->version = buf[10];
+            h->source = (uint16_t) get_be(buf + 12, 2);
+            h->timestamp = 0;
+            return h->size;
+        }
+        h->flags = 0;
+        h->timestamp = get_be(buf + 4, 8) * NSEC_PER_SEC + get_be(buf + 12, 8);
+        return h->size;
+    }
+    if ((buf[0] & ~V2_FLAGS) != V2_MARK) return -1;
+    h->version = WIRE_V2;
+    h->flags = buf[0] & V2_FLAGS;
+    rc = get_varint(buf + 1, avail - 1, 3, &value);
+    if (rc <= 0) return rc;
+    h->length = value;
+    n = 1 + rc;
+    if (avail < (uint32_t) n + 10) return 0;
+    h->timestamp = get_be(buf + n, 8);
+    n += 8;
+    h->sequence = (uint16_t) get_be(buf + n, 2);
+    n += 2;
+    rc = get_varint(buf + n, avail - n, 3, &value);
+    if (rc <= 0) return rc;
+    if (value > UINT16_MAX) return -1;
+    h->source = (uint16_t) value;
+    h->size = (uint8_t) (n + rc);
+    return h->size;
+}
+
+int wire_put_hello(uint8_t buf[WIRE_MAX_HEADER_SIZE], uint8_t version, uint16_t source) {
+    memset(buf, 0, WIRE_MAX_HEADER_SIZE);
+    memcpy(buf + 4, hello_magic, sizeof(hello_magic));
+    buf[10] = version;
+    put_be(buf + 12, source, 2);
+    return WIRE_MAX_HEADER_SIZE;
+}
+
+uint16_t wire_count(struct wire_sources_t * s, const struct wire_header_t * h) {
+    struct wire_source_t * src;
+    uint16_t gap;
+    int i;
+    if (h->version < WIRE_V2 || !h->source) {
+        s->unnamed++;
+        return 0;
+    }
+    for (i=0; i<s->n && s->sources[i].source != h->source; i++);
+    if (i == s->n) {
+        if (s->n == WIRE_MAX_SOURCES) {
+            s->others++;
+            return 0;
+        }
+        src = &(s->sources[s->n++]);
+        memset(src, 0, sizeof(*src));
+        src->source = h->source;
+        src->next_sequence = h->sequence;
+    }
+    else src = &(s->sources[i]);
+    src->frames++;
+    src->bytes += h->length;
+    gap = (uint16_t) (h->sequence - src->next_sequence);
+    // more than half way round the sequence numbers is taken to be behind rather than ahead
+    if (gap >= 0x8000) {
+        src->late++;
+        return 0;
+    }
+    src->lost += gap;
+    src->next_sequence = h->sequence + 1;
+    return gap;
+}
+
+void wire_print_sources(const struct wire_sources_t * s) {
+    for (int i=0; i<s->n; i++) {
+        printf("  source %-5u frames: %lu (%lu bytes) lost: %lu late: %lu\n", s->sources[i].source, s->sources[i].frames,
+               s->sources[i].bytes, s->sources[i].lost, s->sources[i].late);
+    }
+    if (s->others) printf("  other sources frames: %lu\n", s->others);
+    if (s->unnamed) printf("  frames with no source: %lu\n", s->unnamed);
+}
@@ -0,0 +1,87 @@
+/*!
+ * @file src/wire.h
+ * @brief The header sent before each frame between cross injectors (and through bcaster), in either version.
+ * @details
+ * v1 is 20 bytes: a 4 byte big endian length and a 16 byte timestamp (big endian seconds and then nanoseconds).
+ * v2 is 13 to 17 bytes (13 or 14 for most frames), all big endian except for the varints (7 bits a byte, lowest first):
+ *       1 byte      1010 and then 4 bits of flags
+ *       1-3 bytes   length of the frame, varint
+ *       8 bytes     timestamp, nanoseconds since the epoch
+ *       2 bytes     sequence number, counting the frames of each source
+ *       1-3 bytes   source, the radio/VM that captured the frame (0 = not set), varint
+ * The first byte of a v1 header is always 0 (frames are far smaller than 16MB), so each header says which version it
+ * is and a receiver can take both. A sender only switches to v2 once the other side has said it takes it, with a hello:
+ *       client: connects, says hello (offering v2)      server: answers a hello with its own hello
+ * and each side then sends the highest version both offered. A hello is a v1 header for a frame of no bytes, with a
+ * magic number, the version offered, and the source in place of the timestamp, so a receiver that only knows v1 reads
+ * it as an empty frame and never answers (and so never gets v2).
+ * The sequence numbers let a receiver count the frames lost from each source (see wire_count), and the source lets it
+ * drop frames that it sent itself and a relay sent back to it.
+ * A v2 frame can be compressed against the frames its source sent before (see /ref src/lz.h), which the flags say, so
+ * a receiver keeps a history for each source and expands them; a relay passes them on as they are.
+ *
+ * fine-print: Copyright (c) 2020-2021, David Hamilton <david@davidohamilton.com>. This software may be freely copied and used under GPLv2 (see LICENSE.txt in root directory).
+ */
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WIRE_V1 1
+#define WIRE_V2 2
+
+#define WIRE_MAX_HEADER_SIZE 20          /* v1 is always this big, v2 at most 17 bytes */
+#define WIRE_MAX_LENGTH ((1 << 21) - 1)  /* longest frame v2 can carry (its length is at most 3 bytes of varint) */
+
+#define WIRE_FLAG_RELAYED    0x01        /* a relay (bcaster) passed the frame on */
+#define WIRE_FLAG_COMPRESSED 0x02        /* the frame is compressed against the earlier frames of its source (see lz.h) */
+#define WIRE_FLAG_KEY        0x04        /* the source started its history over with this (compressed) frame */
+#define WIRE_FLAG_HELLO      0x80        /* not sent as a flag: set by wire_get_header when the header is a hello */
+
+#define WIRE_MAX_SOURCES 16              /* sources counted separately, the rest are counted together */
+
+struct wire_header_t {
+    uint8_t  version;
+    uint8_t  flags;
+    uint8_t  size;        /* bytes of header, the frame follows */
+    uint32_t length;      /* bytes of frame */
+    uint64_t timestamp;   /* nanoseconds since the epoch */
+    uint16_t sequence;    /* v2 */
+    uint16_t source;      /* v2, or for a hello, who said it */
+};
+
+// writes the header for h->version (v2 sends only the flags below 0x10) and returns its size
+int wire_put_header(uint8_t buf[WIRE_MAX_HEADER_SIZE], const struct wire_header_t * h);
+
+// reads the header at the start of the avail bytes of buf, returns its size, 0 if it isn't all there yet, or -1 if
+// buf doesn't start with a header (of a version this knows)
+int wire_get_header(const uint8_t * buf, uint32_t avail, struct wire_header_t * h);
+
+// writes a hello offering version and returns its size (which is always WIRE_MAX_HEADER_SIZE)
+int wire_put_hello(uint8_t buf[WIRE_MAX_HEADER_SIZE], uint8_t version, uint16_t source);
+
+// frames received from each source, with the gaps in their sequence numbers counted as lost
+struct wire_source_t {
+    uint16_t source;
+    uint16_t next_sequence;   /* expected next */
+    unsigned long frames;
+    unsigned long bytes;
+    unsigned long lost;       /* skipped over by the sequence numbers */
+    unsigned long late;       /* came after a later one (reordered or repeated), so earlier counted as lost */
+};
+
+struct wire_sources_t {
+    int n;
+    struct wire_source_t sources[WIRE_MAX_SOURCES];
+    unsigned long others;     /* v2 frames from sources beyond the first WIRE_MAX_SOURCES */
+    unsigned long unnamed;    /* v1 frames (or v2 with no source), which have no sequence to check */
+};
+
+// counts a frame received, returns how many frames of its source were lost just before it
+uint16_t wire_count(struct wire_sources_t * s, const struct wire_header_t * h);
+
+void wire_print_sources(const struct wire_sources_t * s);
+
+#endif // WIRE_H
@@ -0,0 +1,272 @@
+#include "capture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t capture_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* the class of a frame from the type and subtype in its frame control field (just after the radiotap header) */
+static unsigned int capture_class(const uint8_t * frame, uint32_t len) {
+    unsigned int radiotap_len, type, subtype;
+    if (len < 4) return CAPTURE_ALL;
+    radiotap_len = frame[2] + (frame[3] << 8);
+    if (radiotap_len >= len) return CAPTURE_ALL;
+    type = (frame[radiotap_len] >> 2) & 0x03;
+    subtype = frame[radiotap_len] >> 4;
+    switch (type) {
+        case 0:  return (subtype == 0x08) ? CAPTURE_BEACON : CAPTURE_MGMT;
+        case 1:  return CAPTURE_CTRL;
+        case 2:  return CAPTURE_DATA;
+        default: return CAPTURE_ALL;
+    }
+}
+
+bool capture_init(struct capture_t * cap, const char * file_name, uint32_t frame_size) {
+    uint32_t slot_size;
+    memset(cap, 0, sizeof(*cap));
+    cap->file_name = file_name;
+    cap->frame_size = frame_size;
+    cap->classes = CAPTURE_ALL;
+    slot_size = (sizeof(struct capture_slot_t) + frame_size + 7) & ~7u;
+    if (slot_size > UINT16_MAX || !aq_new(&(cap->ring), slot_size, CAPTURE_RING_SIZE)) return false;
+    looper_init(&(cap->writer));
+    strcpy(cap->writer.attr.name, "bc_capture");
+    return true;
+}
+
+bool capture_set_classes(struct capture_t * cap, const char * list) {
+    unsigned int classes = 0;
+    int n;
+    if (!strcmp(list, "all")) classes = CAPTURE_ALL;
+    else if (strcmp(list, "none")) {
+        while (*list) {
+            for (n = 0; list[n] && list[n] != ','; n++);
+            if (n == 4 && !strncmp(list, "mgmt", n)) classes |= CAPTURE_MGMT;
+            else if (n == 6 && !strncmp(list, "beacon", n)) classes |= CAPTURE_BEACON;
+            else if (n == 4 && !strncmp(list, "ctrl", n)) classes |= CAPTURE_CTRL;
+            else if (n == 4 && !strncmp(list, "data", n)) classes |= CAPTURE_DATA;
+            else return false;
+            list += list[n] ? n + 1 : n;
+        }
+    }
+    cap->classes = classes;
+    return true;
+}
+
+#define PCAPNG_SHB 0x0A0D0D0A                /* section header block, which starts each file */
+#define PCAPNG_IDB 0x00000001                /* interface description block */
+#define PCAPNG_EPB 0x00000006                /* enhanced packet block */
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_RADIOTAP 127
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_TSRESOL_NSEC 9                /* timestamps in 10^-9 seconds */
+
+static uint32_t capture_pad(uint32_t n) {
+    return (n + 3) & ~3u;
+}
+
+/* puts an option (its value padded to 4 bytes) at buf, returns the bytes it took */
+static uint32_t capture_put_option(uint8_t * buf, uint16_t code, const void * value, uint16_t len) {
+    memcpy(buf, &code, 2);
+    memcpy(buf + 2, &len, 2);
+    memcpy(buf + 4, value, len);
+    memset(buf + 4 + len, 0, capture_pad(len) - len);
+    return 4 + capture_pad(len);
+}
+
+/* writes a block of fixed fields (a multiple of 4 bytes), then data (padded), then options (ended here) */
+static void capture_write_block(struct capture_t * cap, uint32_t type, const void * fixed, uint32_t fixed_len,
+                                const uint8_t * data, uint32_t data_len, const uint8_t * options, uint32_t options_len) {
+    static const uint8_t zeros[4] = { 0 };
+    uint32_t total = 4 + 4 + fixed_len + capture_pad(data_len) + options_len + 4 + 4;
+    fwrite(&type, 4, 1, cap->file);
+    fwrite(&total, 4, 1, cap->file);
+    fwrite(fixed, 1, fixed_len, cap->file);
+    if (data_len) fwrite(data, 1, data_len, cap->file);
+    fwrite(zeros, 1, capture_pad(data_len) - data_len, cap->file);
+    if (options_len) fwrite(options, 1, options_len, cap->file);
+    fwrite(zeros, 1, 4, cap->file);   /* end of options */
+    fwrite(&total, 4, 1, cap->file);
+    cap->file_bytes += total;
+}
+
+static void capture_write_section(struct capture_t * cap) {
+    struct { uint32_t byte_order; uint16_t major, minor; int64_t length; } shb = { PCAPNG_BYTE_ORDER, 1, 0, -1 };
+    uint8_t options[16];
+    capture_write_block(cap, PCAPNG_SHB, &shb, sizeof(shb), NULL, 0,
+                        options, capture_put_option(options, PCAPNG_OPT_SHB_USERAPPL, "bcaster", 7));
+    cap->interfaces_written = 0;
+}
+
+/* writes the interfaces up to and including the last, which have to come before the frames on them */
+static void capture_write_interfaces(struct capture_t * cap, uint32_t last) {
+    struct { uint16_t linktype, reserved; uint32_t snaplen; } idb = { PCAPNG_LINKTYPE_RADIOTAP, 0, cap->frame_size };
+    uint8_t options[CAPTURE_NAME_LEN + 16];
+    char name[CAPTURE_NAME_LEN];
+    uint8_t tsresol = PCAPNG_TSRESOL_NSEC;
+    uint32_t n;
+    for (; cap->interfaces_written <= last; cap->interfaces_written++) {
+        if (cap->interfaces[cap->interfaces_written][0]) strcpy(name, cap->interfaces[cap->interfaces_written]);
+        else if (cap->interfaces_written == CAPTURE_SHARED) strcpy(name, "other clients");
+        else snprintf(name, sizeof(name), "client %u", cap->interfaces_written);
+        n = capture_put_option(options, PCAPNG_OPT_IF_NAME, name, strlen(name));
+        n += capture_put_option(options + n, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+        capture_write_block(cap, PCAPNG_IDB, &idb, sizeof(idb), NULL, 0, options, n);
+    }
+}
+
+/* keeps the name for the interface of each file, and writes the interface now unless it was already (named by
+ * default, for a client whose name didn't fit on the ring) */
+static void capture_write_name(struct capture_t * cap, struct capture_slot_t * slot) {
+    snprintf(cap->interfaces[slot->interface], CAPTURE_NAME_LEN, "%.*s", (int) slot->caplen, (const char *) slot->data);
+    if (slot->interface >= cap->interfaces_written) capture_write_interfaces(cap, slot->interface);
+}
+
+/* stamped with when the sender captured it, with when bcaster received it as a comment */
+static void capture_write_frame(struct capture_t * cap, struct capture_slot_t * slot) {
+    struct { uint32_t interface, ts_high, ts_low, caplen, len; } epb;
+    uint8_t options[96];
+    char comment[80];
+    uint64_t ts = slot->sent_ns ? slot->sent_ns : slot->received_ns;
+    int n;
+    if (slot->interface >= cap->interfaces_written) capture_write_interfaces(cap, slot->interface);
+    epb.interface = slot->interface;
+    epb.ts_high = ts >> 32;
+    epb.ts_low = ts & 0xFFFFFFFF;
+    epb.caplen = slot->caplen;
+    epb.len = slot->len;
+    if (slot->sent_ns)
+        n = snprintf(comment, sizeof(comment), "received %lu.%09lu, %.3f ms after it was sent",
+                     (unsigned long) (slot->received_ns / 1000000000ULL), (unsigned long) (slot->received_ns % 1000000000ULL),
+                     ((int64_t) (slot->received_ns - slot->sent_ns)) / 1000000.0);
+    else n = snprintf(comment, sizeof(comment), "received (sent time not known)");
+    if (n >= (int) sizeof(comment)) n = sizeof(comment) - 1;
+    capture_write_block(cap, PCAPNG_EPB, &epb, sizeof(epb), slot->data, slot->caplen,
+                        options, capture_put_option(options, PCAPNG_OPT_COMMENT, comment, n));
+}
+
+static bool capture_open_file(struct capture_t * cap) {
+    cap->file = fopen(cap->file_name, "wb");
+    if (!cap->file) return false;
+    setvbuf(cap->file, cap->buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+    cap->file_bytes = 0;
+    capture_write_section(cap);
+    cap->file_started_ns = capture_now_ns();
+    cap->flushed_ns = cap->file_started_ns;
+    return true;
+}
+
+/* closes the full file under a name of its own and opens a new one in its place (unless it couldn't be renamed, since
+ * opening the new one would then empty it) */
+static void capture_next_file(struct capture_t * cap) {
+    char name[256];
+    fclose(cap->file);
+    cap->file = NULL;
+    snprintf(name, sizeof(name), "%s.%u", cap->file_name, cap->files + 1);
+    if (rename(cap->file_name, name)) {
+        printf("error renaming capture file %s to %s, capturing no more\n", cap->file_name, name);
+        return;
+    }
+    cap->files++;
+    if (!capture_open_file(cap)) printf("error opening capture file %s, capturing no more\n", cap->file_name);
+}
+
+/* writer: writes what is on the ring (or flushes the file if it has waited long enough), returns frames written */
+static int capture_write(void * d) {
+    struct capture_t * cap = d;
+    struct capture_slot_t * slot;
+    uint8_t * slots;
+    uint16_t n;
+    uint64_t now;
+    slots = aq_get_head_n(cap->ring, CAPTURE_BURST, &n);
+    if (!n) {
+        if (!cap->file) return 0;
+        now = capture_now_ns();
+        if (now - cap->flushed_ns > CAPTURE_FLUSH_S * 1000000000ULL) {
+            fflush(cap->file);
+            cap->flushed_ns = now;
+        }
+        return 0;
+    }
+    for (uint16_t i = 0; i < n && cap->file; i++) {
+        slot = (struct capture_slot_t *) (slots + (size_t) i * cap->ring->item_size);
+        if (slot->kind == CAPTURE_SLOT_NAME) capture_write_name(cap, slot);
+        else {
+            capture_write_frame(cap, slot);
+            cap->written++;
+        }
+    }
+    aq_used_head_n(cap->ring, n);
+    if (!cap->file) return n;
+    if ((cap->max_bytes && cap->file_bytes >= cap->max_bytes) ||
+        (cap->max_seconds && capture_now_ns() - cap->file_started_ns >= cap->max_seconds * 1000000000ULL)) capture_next_file(cap);
+    return n;
+}
+
+bool capture_start(struct capture_t * cap) {
+    if (!cap->classes) return true;
+    cap->buffer = malloc(CAPTURE_BUFFER_SIZE);
+    if (!cap->buffer || !capture_open_file(cap)) return false;
+    cap->writer.function_to_poll = capture_write;
+    cap->writer.data = cap;
+    cap->running = true;
+    looper_start(&(cap->writer));
+    return true;
+}
+
+void capture_set_interface(struct capture_t * cap, int interface, const char * name) {
+    struct capture_slot_t * slot;
+    uint32_t len = strnlen(name, CAPTURE_NAME_LEN - 1);
+    if (!cap->running || interface < 0 || interface >= CAPTURE_SHARED) return;
+    slot = aq_get_tail(cap->ring);
+    if (!slot) return;      /* the writer names it by its number */
+    slot->kind = CAPTURE_SLOT_NAME;
+    slot->interface = interface;
+    slot->caplen = (len < cap->frame_size) ? len : cap->frame_size;
+    memcpy(slot->data, name, slot->caplen);
+    aq_put_tail(cap->ring);
+}
+
+void capture_frame(struct capture_t * cap, const uint8_t * frame, uint32_t len, int interface, uint64_t sent_ns) {
+    struct capture_slot_t * slot;
+    if (!cap->running) return;
+    if (cap->classes != CAPTURE_ALL && !(capture_class(frame, len) & cap->classes)) {
+        cap->filtered++;
+        return;
+    }
+    slot = aq_get_tail(cap->ring);
+    if (!slot) {
+        cap->dropped++;
+        return;
+    }
+    slot->kind = CAPTURE_SLOT_FRAME;
+    slot->sent_ns = sent_ns;
+    slot->received_ns = capture_now_ns();
+    slot->interface = (interface >= 0 && interface < CAPTURE_SHARED) ? interface : CAPTURE_SHARED;
+    slot->len = len;
+    slot->caplen = (len < cap->frame_size) ? len : cap->frame_size;
+    memcpy(slot->data, frame, slot->caplen);
+    aq_put_tail(cap->ring);
+    cap->captured++;
+}
+
+void capture_stop(struct capture_t * cap) {
+    if (!cap->running) return;
+    cap->running = false;
+    looper_stop(&(cap->writer));
+    while (capture_write(cap) > 0);
+    if (cap->file) fclose(cap->file);
+    cap->file = NULL;
+}
+
+void capture_print_stats(struct capture_t * cap) {
+    printf("captured %lu, written %lu, not of the classes captured %lu, dropped from the capture %lu, full files %u\n",
+           cap->captured, cap->written, cap->filtered, cap->dropped, cap->files);
+}
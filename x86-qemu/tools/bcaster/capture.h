@@ -0,0 +1,104 @@
+/*
+ * Captures the frames bcaster relays into a pcapng file without holding up the relaying: the receiver copies each frame
+ * (with when it was received) onto a ring, and a writer thread of its own takes them off and writes them out through
+ * a big buffer, so the disk only ever slows down the writer.
+ *       receiver: capture_frame(frame) -> copied onto the ring, or dropped from the capture if the ring is full
+ *       writer: takes what is on the ring, writes it to the file, and starts a new file when the file is too big or
+ *               too old (the full one is renamed to <file>.<n>, so the one being written always has the same name)
+ * Only the classes of frames set in classes are captured (e.g., all but beacons, which are most of the frames).
+ * Each client is an interface of its own in the file, with timestamps in nanoseconds, named by capture_set_interface
+ * when it connects: the name goes onto the ring ahead of the client's frames, and the writer writes the interface then.
+ * The writer keeps the names, so each new file has the same interfaces.
+ * Each frame is stamped with when its sender captured it (from the wire header), and its comment says when bcaster
+ * received it and how long after that was, so the one-way latency of each frame can be seen in Wireshark.
+ * The ring has one producer (the receiver or the listener, under buffers.lock) and one consumer (the writer).
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "looper.h"
+#include "queue.h"
+
+#define CAPTURE_RING_SIZE 2048          /* frames waiting for the writer before frames are dropped from the capture */
+#define CAPTURE_BURST 64                /* most frames the writer takes off the ring at once */
+#define CAPTURE_BUFFER_SIZE (1 << 20)   /* bytes written to the file at once */
+#define CAPTURE_FLUSH_S 1               /* longest a frame waits in the buffer while there is nothing else to write */
+#define CAPTURE_INTERFACES 16           /* clients with an interface of their own, the rest share the last one */
+#define CAPTURE_SHARED (CAPTURE_INTERFACES - 1)
+#define CAPTURE_NAME_LEN 32
+
+/* classes of frames, for capture_set_classes */
+#define CAPTURE_MGMT    0x01            /* management frames other than beacons */
+#define CAPTURE_BEACON  0x02
+#define CAPTURE_CTRL    0x04
+#define CAPTURE_DATA    0x08
+#define CAPTURE_ALL     0x0F            /* and frames too short to tell */
+
+/* kinds of slot */
+#define CAPTURE_SLOT_FRAME 0
+#define CAPTURE_SLOT_NAME  1            /* the name of interface, in data */
+
+struct capture_slot_t {
+    uint32_t kind;                      /* CAPTURE_SLOT_* */
+    uint64_t sent_ns;                   /* when the sender captured the frame, since the epoch (0 = not known) */
+    uint64_t received_ns;               /* since the epoch */
+    uint32_t interface;                 /* the client it came from */
+    uint32_t len;                       /* of the frame */
+    uint32_t caplen;                    /* of it kept, at most frame_size */
+    uint8_t data[];
+};
+
+struct capture_t {
+    const char * file_name;
+    uint32_t frame_size;                /* longest frame kept whole, longer ones are cut short */
+    aq_type * ring;                     /* of struct capture_slot_t */
+    struct looper_t writer;
+    bool running;
+    FILE * file;
+    char * buffer;                      /* of the file, CAPTURE_BUFFER_SIZE bytes */
+    char interfaces[CAPTURE_INTERFACES][CAPTURE_NAME_LEN];  /* names, as the writer took them off the ring */
+    /* settings, before capture_start */
+    unsigned int classes;               /* CAPTURE_* captured, 0 = capture nothing */
+    uint64_t max_bytes;                 /* start a new file once the file is this big, 0 = never */
+    unsigned int max_seconds;           /* start a new file once the file is this old, 0 = never */
+    /* counted by the receiver */
+    unsigned long captured;
+    unsigned long filtered;             /* frames of classes not captured */
+    unsigned long dropped;              /* frames the ring was full for */
+    /* counted by the writer */
+    unsigned long written;
+    uint64_t file_bytes;
+    uint64_t file_started_ns;
+    uint64_t flushed_ns;
+    unsigned int files;                 /* full files renamed so far */
+    uint32_t interfaces_written;        /* to the file being written */
+};
+
+// sets up the ring for frames of up to frame_size bytes (with every class captured and no new files until started)
+bool capture_init(struct capture_t * cap, const char * file_name, uint32_t frame_size);
+
+// sets classes from a list such as "mgmt,ctrl,data", or "all" or "none", returns false if it can't
+bool capture_set_classes(struct capture_t * cap, const char * list);
+
+// opens the file and starts the writer (unless no classes are captured), returns false if it can't
+bool capture_start(struct capture_t * cap);
+
+// puts the name of the interface of client number interface (e.g., by its fd) onto the ring, for the writer to write
+// the interface with before any of the client's frames (the clients from CAPTURE_SHARED on share one, not named by them)
+void capture_set_interface(struct capture_t * cap, int interface, const char * name);
+
+// copies the frame that client number interface sent (captured at sent_ns) onto the ring for the writer
+// (if its class is captured and there is room)
+void capture_frame(struct capture_t * cap, const uint8_t * frame, uint32_t len, int interface, uint64_t sent_ns);
+
+// stops the writer, writes out what is still on the ring, and closes the file
+void capture_stop(struct capture_t * cap);
+
+// prints the frames captured, dropped and written
+void capture_print_stats(struct capture_t * cap);
+
+#endif // CAPTURE_H
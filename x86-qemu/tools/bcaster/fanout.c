@@ -0,0 +1,319 @@
+#define _GNU_SOURCE   /* for struct mmsghdr */
+#include "fanout.h"
+#include "wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#define FANOUT_IDLE_MS 100          /* longest a writer waits on its bell before looking at its ring again */
+#define FANOUT_ROOM_MS 100          /* longest a writer waits for room in its client before looking again */
+
+static uint64_t fanout_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static struct fanout_frame_t * fanout_frame(struct fanout_t * fo, uint32_t i) {
+    return (struct fanout_frame_t *) (fo->pool + (size_t) i * fo->frame_stride);
+}
+
+static void fanout_release(struct fanout_frame_t * f) {
+    atomic_fetch_sub_explicit(&(f->refs), 1, memory_order_release);
+}
+
+/* frames are let go of in about the order they were cast, so the one after the last one taken is almost always free */
+static struct fanout_frame_t * fanout_get_frame(struct fanout_t * fo) {
+    struct fanout_frame_t * f;
+    for (uint32_t n = 0; n < fo->num_frames; n++) {
+        f = fanout_frame(fo, fo->next_frame);
+        if (++(fo->next_frame) == fo->num_frames) fo->next_frame = 0;
+        if (atomic_load_explicit(&(f->refs), memory_order_acquire) == 0) return f;
+    }
+    fo->no_frames++;
+    return NULL;
+}
+
+bool fanout_init(struct fanout_t * fo, lisa * l, uint32_t frame_size) {
+    memset(fo, 0, sizeof(*fo));
+    fo->l = l;
+    fo->frame_stride = (sizeof(struct fanout_frame_t) + frame_size + 7) & ~7u;
+    fo->num_frames = MAX_CLIENTS * FANOUT_RING_SIZE + 1;
+    fo->pool = calloc(fo->num_frames, fo->frame_stride);
+    if (!fo->pool) return false;
+    for (uint32_t i = 0; i < fo->num_frames; i++) atomic_init(&(fanout_frame(fo, i)->refs), 0);
+    CPU_ZERO(&(fo->writer_attr.cpus));
+    fo->writer_attr.policy = SCHED_OTHER;
+    return true;
+}
+
+/* puts f on c's ring (and rings the writer's bell if it is waiting), returns false if the ring is full */
+static bool fanout_queue(struct fanout_client_t * c, struct fanout_frame_t * f) {
+    struct fanout_frame_t ** slot;
+    unsigned int depth;
+    slot = aq_get_tail(c->ring);
+    if (!slot) {
+        c->dropped++;
+        return false;
+    }
+    atomic_fetch_add_explicit(&(f->refs), 1, memory_order_relaxed);
+    *slot = f;
+    aq_put_tail(c->ring);
+    c->queued++;
+    depth = c->queued - c->sent - c->errors;
+    if (depth > c->max_depth) c->max_depth = depth;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&(c->waiting), false)) {
+        if (eventfd_write(c->bell, 1) < 0) printf("error ringing the writer of client %d\n", c->fd);
+    }
+    return true;
+}
+
+/* whether c is on channel freq (as of now), which it is if it is on no channel at all */
+static bool fanout_on_channel(struct fanout_client_t * c, uint16_t freq, uint64_t now) {
+    bool on_any = false;
+    for (int i = 0; i < FANOUT_CHANNELS; i++) {
+        if (!c->channels[i].freq) continue;
+        if (!c->pinned && now - c->channels[i].heard_ns > FANOUT_CHANNEL_TIMEOUT_S * 1000000000ULL) {
+            c->channels[i].freq = 0;
+            continue;
+        }
+        if (c->channels[i].freq == freq) return true;
+        on_any = true;
+    }
+    return !on_any;
+}
+
+/* finds the clients that match, then takes a frame from the pool, copies data into it, and puts it on their rings,
+ * holding the frame meanwhile so that a writer quick to send it doesn't give it back before it is on every ring */
+static int fanout_put(struct fanout_t * fo, const uint8_t * data, uint32_t len, SOCKET fd, bool only_fd, uint16_t freq,
+                      uint8_t version) {
+    struct fanout_client_t * to[MAX_CLIENTS];
+    struct fanout_frame_t * f;
+    uint64_t now;
+    int num_to = 0, n = 0;
+    bool off_channel = false;
+    if (len > fo->frame_stride - sizeof(struct fanout_frame_t)) return 0;
+    now = fanout_now_ns();
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        struct fanout_client_t * c = &(fo->clients[i]);
+        if (!c->in_use || (only_fd ? c->fd != fd : (c->fd == fd && !fo->loopback))) continue;
+        if (version && c->version != version) continue;
+        if (freq && fo->by_channel && !fanout_on_channel(c, freq, now)) {
+            c->off_channel++;
+            off_channel = true;
+            continue;
+        }
+        to[num_to++] = c;
+    }
+    if (!num_to) {
+        if (off_channel) fo->off_channel++;
+        return 0;
+    }
+    f = fanout_get_frame(fo);
+    if (!f) return 0;
+    memcpy(f->data, data, len);
+    f->len = len;
+    f->queued_ns = now;
+    atomic_store_explicit(&(f->refs), 1, memory_order_relaxed);
+    for (int i = 0; i < num_to; i++) if (fanout_queue(to[i], f)) n++;
+    fanout_release(f);
+    return n;
+}
+
+int fanout_cast(struct fanout_t * fo, const uint8_t * data, uint32_t len, SOCKET from, uint16_t freq, uint8_t version) {
+    return fanout_put(fo, data, len, from, false, freq, version);
+}
+
+bool fanout_send(struct fanout_t * fo, const uint8_t * data, uint32_t len, SOCKET fd) {
+    return fanout_put(fo, data, len, fd, true, 0, 0) > 0;
+}
+
+static struct fanout_client_t * fanout_client(struct fanout_t * fo, SOCKET fd) {
+    for (int i = 0; i < MAX_CLIENTS; i++) if (fo->clients[i].in_use && fo->clients[i].fd == fd) return &(fo->clients[i]);
+    return NULL;
+}
+
+/* refreshes the channel if the client is on it already, or else takes the place of the one it left longest ago */
+void fanout_heard(struct fanout_t * fo, SOCKET fd, uint16_t freq) {
+    struct fanout_client_t * c = fanout_client(fo, fd);
+    struct fanout_channel_t * ch, * oldest = NULL;
+    if (!c || c->pinned || !freq) return;
+    for (int i = 0; i < FANOUT_CHANNELS; i++) {
+        ch = &(c->channels[i]);
+        if (ch->freq == freq) {
+            ch->heard_ns = fanout_now_ns();
+            return;
+        }
+        if (!oldest || (oldest->freq && (!ch->freq || ch->heard_ns < oldest->heard_ns))) oldest = ch;
+    }
+    oldest->freq = freq;
+    oldest->heard_ns = fanout_now_ns();
+}
+
+void fanout_set_version(struct fanout_t * fo, SOCKET fd, uint8_t version) {
+    struct fanout_client_t * c = fanout_client(fo, fd);
+    if (c) c->version = version;
+}
+
+bool fanout_takes(struct fanout_t * fo, uint8_t version) {
+    for (int i = 0; i < MAX_CLIENTS; i++) if (fo->clients[i].in_use && fo->clients[i].version == version) return true;
+    return false;
+}
+
+bool fanout_set_channels(struct fanout_t * fo, SOCKET fd, const uint16_t * freqs, int n) {
+    struct fanout_client_t * c = fanout_client(fo, fd);
+    if (!c) return false;
+    memset(c->channels, 0, sizeof(c->channels));
+    for (int i = 0; i < n && i < FANOUT_CHANNELS; i++) c->channels[i].freq = freqs[i];
+    c->pinned = true;
+    return true;
+}
+
+/* done with the first n frames on the ring: sent is whether the client took them */
+static void fanout_done(struct fanout_client_t * c, struct fanout_frame_t ** frames, uint16_t n, bool sent) {
+    uint64_t now, lag;
+    if (!n) return;
+    now = sent ? fanout_now_ns() : 0;
+    for (uint16_t i = 0; i < n; i++) {
+        if (sent) {
+            lag = now - frames[i]->queued_ns;
+            c->lag_total_ns += lag;
+            if (lag > c->lag_max_ns) c->lag_max_ns = lag;
+        }
+        fanout_release(frames[i]);
+    }
+    aq_used_head_n(c->ring, n);
+    if (sent) c->sent += n;
+    else c->errors += n;
+}
+
+/* sends what it can of n frames, the first of them from c->offset, returns how many it sent all of (or -1 on error) */
+static int fanout_write_frames(struct fanout_client_t * c, struct fanout_frame_t ** frames, uint16_t n) {
+    struct iovec iov[FANOUT_BURST];
+    struct mmsghdr msgs[FANOUT_BURST];
+    uint32_t left;
+    int rc, done;
+    for (uint16_t i = 0; i < n; i++) {
+        iov[i].iov_base = frames[i]->data;
+        iov[i].iov_len = frames[i]->len;
+    }
+    if (c->fo->messages) {
+        memset(msgs, 0, n * sizeof(struct mmsghdr));
+        for (uint16_t i = 0; i < n; i++) {
+            msgs[i].msg_hdr.msg_iov = &(iov[i]);
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        return lisa_sendmv_client(c->fo->l, c->fd, msgs, n);
+    }
+    iov[0].iov_base = frames[0]->data + c->offset;
+    iov[0].iov_len = frames[0]->len - c->offset;
+    rc = lisa_sendv_client(c->fo->l, c->fd, iov, n);
+    if (rc < 0) return rc;
+    left = (uint32_t) rc;
+    for (done = 0; done < n && left >= iov[done].iov_len; done++) left -= iov[done].iov_len;
+    c->offset = (done == 0) ? c->offset + left : left;   /* what was sent of the first frame not sent all of */
+    return done;
+}
+
+/* writer: sends what is on the ring, or waits on its bell if there is nothing, returns whether it got anywhere */
+static int fanout_write(void * d) {
+    struct fanout_client_t * c = d;
+    struct fanout_frame_t ** frames;
+    uint16_t n;
+    uint64_t count;
+    struct pollfd pfd;
+    int rc;
+    if (atomic_load(&(c->closing))) return 0;
+    frames = aq_get_head_n(c->ring, FANOUT_BURST, &n);
+    if (!n) {
+        pfd.revents = 0;
+        atomic_store(&(c->waiting), true);
+        atomic_thread_fence(memory_order_seq_cst);
+        frames = aq_get_head_n(c->ring, FANOUT_BURST, &n);
+        if (!n && !atomic_load(&(c->closing))) {
+            pfd.fd = c->bell;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, FANOUT_IDLE_MS);
+        }
+        atomic_store(&(c->waiting), false);
+        eventfd_read(c->bell, &count);
+        return n ? 1 : (pfd.revents & POLLIN) != 0;
+    }
+    rc = fanout_write_frames(c, frames, n);
+    if (rc < 0) {
+        c->offset = 0;
+        fanout_done(c, frames, n, false);   /* the client is going, and its frames go with it */
+        return 1;
+    }
+    fanout_done(c, frames, (uint16_t) rc, true);
+    if (rc == 0) lisa_wait_client(c->fo->l, c->fd, FANOUT_ROOM_MS);  /* it took no more than part of a frame */
+    return 1;
+}
+
+bool fanout_add(struct fanout_t * fo, SOCKET fd) {
+    struct fanout_client_t * c = NULL;
+    for (int i = 0; i < MAX_CLIENTS && !c; i++) if (!fo->clients[i].in_use) c = &(fo->clients[i]);
+    if (!c) return false;
+    memset(c, 0, sizeof(*c));
+    if (!aq_new(&(c->ring), sizeof(struct fanout_frame_t *), FANOUT_RING_SIZE)) return false;
+    c->bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->bell < 0) {
+        aq_free(c->ring);
+        return false;
+    }
+    c->fd = fd;
+    c->fo = fo;
+    c->version = WIRE_V1;
+    atomic_init(&(c->waiting), false);
+    atomic_init(&(c->closing), false);
+    fo->messages = (fo->l->type == LISA_SEQPACKET);
+    looper_init(&(c->writer));
+    c->writer.attr = fo->writer_attr;
+    snprintf(c->writer.attr.name, LOOPER_NAME_LEN, "bc_writer%d", fd);
+    c->writer.function_to_poll = fanout_write;
+    c->writer.data = c;
+    c->in_use = true;
+    looper_start(&(c->writer));
+    return true;
+}
+
+void fanout_remove(struct fanout_t * fo, SOCKET fd) {
+    struct fanout_client_t * c = fanout_client(fo, fd);
+    struct fanout_frame_t ** f;
+    if (!c) return;
+    atomic_store(&(c->closing), true);
+    eventfd_write(c->bell, 1);
+    looper_stop(&(c->writer));
+    while ((f = aq_get_head(c->ring))) {
+        fanout_release(*f);
+        aq_used_head(c->ring);
+        c->errors++;
+    }
+    close(c->bell);
+    aq_free(c->ring);
+    c->in_use = false;
+}
+
+void fanout_print_stats(struct fanout_t * fo) {
+    struct fanout_client_t * c;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        c = &(fo->clients[i]);
+        if (!c->in_use) continue;
+        printf("client fd %d (v%u): queued %lu, sent %lu, dropped %lu, errors %lu, most waiting %u, lag avg %.1f us max %.1f us\n",
+               c->fd, c->version, c->queued, c->sent, c->dropped, c->errors, c->max_depth,
+               c->sent ? (double) c->lag_total_ns / c->sent / 1000.0 : 0.0, (double) c->lag_max_ns / 1000.0);
+        if (!fo->by_channel) continue;
+        printf("    off channel %lu, %s channels:", c->off_channel, c->pinned ? "set" : "learned");
+        for (int j = 0; j < FANOUT_CHANNELS; j++) if (c->channels[j].freq) printf(" %u", c->channels[j].freq);
+        printf("\n");
+    }
+    if (fo->no_frames) printf("frames not cast for want of a free frame: %lu\n", fo->no_frames);
+    if (fo->off_channel) printf("frames dropped for no client being on their channel: %lu\n", fo->off_channel);
+}
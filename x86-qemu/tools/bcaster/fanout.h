@@ -0,0 +1,125 @@
+/*
+ * Fans frames out to the clients, each through an egress ring of its own that a writer thread of its own empties,
+ * so that a client that is slow to take its frames only holds up itself (and loses frames once its ring is full),
+ * rather than the receiver and every other client as well.
+ *       receiver: fanout_cast(frame) -> copied once into a frame of the pool -> a reference to it on each client's ring
+ *       writer of each client: takes what is on its ring, sends as much of it as the client takes in one call, and
+ *                              lets go of the frames it sent (the last to let go of one gives it back to the pool)
+ * A ring holds at most FANOUT_RING_SIZE references, and the pool has more frames than all the rings together can
+ * hold, so there is always a frame free for the next cast.
+ * Each ring has one producer (whoever casts) and one consumer (its writer), so the caller makes sure that adding,
+ * removing, casting and sending aren't done at the same time (bcaster does all of them under buffers.lock).
+ * A writer waits on an eventfd while its ring is empty, which the producer only rings if the writer is waiting.
+ * With by_channel set, a frame cast on a channel (the frequency in its radiotap header) only goes to the clients on that
+ * channel, since no radio on another channel could hear it; one that no client is on is dropped before it is copied.
+ * A client is on the channels it was set to (see fanout_set_channels), or else on the channels it sent frames on in the
+ * last FANOUT_CHANNEL_TIMEOUT_S seconds (up to FANOUT_CHANNELS of them), and one on no channel hears everything.
+ * What a client sends only says where its radio was, not where it listens now (a station that scans, or a monitor that
+ * never sends, would miss the beacons of other channels), so by_channel is off unless asked for, and is best used with
+ * the channels of each client set.
+ * A frame is never cast back to the client it came from (which would inject its own frame again), unless loopback is
+ * set for debugging.
+ * Each client takes the wire version it offered in its hello (see wire.h and fanout_set_version), v1 until it says one,
+ * so a frame with a v2 header is only cast to the clients that take v2, and the caller casts it again with a v1 header
+ * for the rest.
+ */
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "lisa.h"
+#include "looper.h"
+#include "queue.h"
+
+#define FANOUT_RING_SIZE 256        /* frames queued for a client before the client loses frames */
+#define FANOUT_BURST 32             /* most frames a writer sends in one call */
+#define FANOUT_CHANNELS 4           /* channels a client can be on at once */
+#define FANOUT_CHANNEL_TIMEOUT_S 10 /* a client leaves a channel it hasn't sent a frame on for this long */
+
+struct fanout_frame_t {
+    atomic_int refs;                /* rings (and the caster, while it casts) holding it, 0 = free */
+    uint32_t len;
+    uint64_t queued_ns;             /* when it was cast, for the lag of each client */
+    uint8_t data[];
+};
+
+struct fanout_channel_t {
+    uint16_t freq;                  /* MHz, 0 = none */
+    uint64_t heard_ns;              /* when the client last sent a frame on it */
+};
+
+struct fanout_client_t {
+    bool in_use;
+    SOCKET fd;
+    struct fanout_channel_t channels[FANOUT_CHANNELS];
+    bool pinned;                    /* the channels were set, rather than learned */
+    uint8_t version;                /* the wire version it takes */
+    aq_type * ring;                 /* of struct fanout_frame_t * */
+    uint32_t offset;                /* bytes of the frame at the head of the ring already sent (streams only) */
+    int bell;                       /* eventfd the writer waits on while the ring is empty */
+    atomic_bool waiting;
+    atomic_bool closing;
+    struct looper_t writer;
+    struct fanout_t * fo;
+    /* counted by the caster */
+    unsigned long queued;
+    unsigned long dropped;          /* frames the ring was full for */
+    unsigned int max_depth;         /* most frames waiting on the ring */
+    unsigned long off_channel;      /* frames not sent for being on a channel the client wasn't on */
+    /* counted by the writer */
+    unsigned long sent;
+    unsigned long errors;           /* frames lost because sending failed */
+    unsigned long long lag_total_ns;  /* from cast until the client took all of a frame */
+    unsigned long long lag_max_ns;
+};
+
+struct fanout_t {
+    lisa * l;
+    bool messages;                  /* seqpacket: each frame sent as a message of its own */
+    uint8_t * pool;
+    uint32_t frame_stride;
+    uint32_t num_frames;
+    uint32_t next_frame;            /* where to look for a free frame first */
+    unsigned long no_frames;        /* casts with no frame free (which can't happen while the pool is big enough) */
+    bool by_channel;                /* route frames to the clients on their channel only (false unless set) */
+    unsigned long off_channel;      /* frames dropped for no client being on their channel */
+    bool loopback;                  /* cast frames back to the client they came from as well */
+    struct looper_attr_t writer_attr;   /* applied to each writer when it starts (see looper_parse_attr) */
+    struct fanout_client_t clients[MAX_CLIENTS];
+};
+
+// sets up the pool for frames of up to frame_size bytes sent to the clients of l, returns false if out of memory
+bool fanout_init(struct fanout_t * fo, lisa * l, uint32_t frame_size);
+
+// starts a ring and a writer for client fd (just accepted), returns false if it can't
+bool fanout_add(struct fanout_t * fo, SOCKET fd);
+
+// stops the writer of client fd and drops what is still on its ring, before the client is closed
+void fanout_remove(struct fanout_t * fo, SOCKET fd);
+
+// queues len bytes of data, which came from client from, for every other client (that is on channel freq, if not 0
+// and by_channel is set) that takes wire version version (0 = every client), returns how many clients it was queued for
+int fanout_cast(struct fanout_t * fo, const uint8_t * data, uint32_t len, SOCKET from, uint16_t freq, uint8_t version);
+
+// queues len bytes of data for client fd only, returns false if its ring is full (or there is no such client)
+bool fanout_send(struct fanout_t * fo, const uint8_t * data, uint32_t len, SOCKET fd);
+
+// client fd sent a frame on channel freq (0 = not known), so is on that channel for a while, unless it was set
+void fanout_heard(struct fanout_t * fo, SOCKET fd, uint16_t freq);
+
+// puts client fd on the n channels of freqs for good rather than learning them, returns false if there is no such client
+bool fanout_set_channels(struct fanout_t * fo, SOCKET fd, const uint16_t * freqs, int n);
+
+// client fd said hello offering version, so takes that version from now on
+void fanout_set_version(struct fanout_t * fo, SOCKET fd, uint8_t version);
+
+// whether any client takes wire version version
+bool fanout_takes(struct fanout_t * fo, uint8_t version);
+
+// prints what each client was sent, lost, and how far behind it fell
+void fanout_print_stats(struct fanout_t * fo);
+
+#endif // FANOUT_H
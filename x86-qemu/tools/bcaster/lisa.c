@@ -6,8 +6,10 @@
 
 #define ERRORS 1
 #define TIMEOUTS 1
+#define _GNU_SOURCE   /* for sendmmsg and recvmmsg */
 
 #include "lisa.h"
+#include "shm_ring.h"
 #include <strings.h>
 #include <memory.h>
 #include <unistd.h>
@@ -21,6 +23,10 @@
 #else
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <stddef.h>
 #endif
 
 static int lisa_initialized = 0;
@@ -109,6 +115,100 @@ static int isnumber (char *c, int max) {
     return 1;
 }
 
+/* LLLLLLLLLLLLLLLLLLLLLLLL
+ * WAITING
+ * LLLLLLLLLLLLLLLLLLLLLLLL
+ */
+
+/* how long poll or epoll_wait should wait for tp (NULL = forever) */
+static int lisa_wait_ms(struct timeval * tp) {
+  if (!tp) return -1;
+  return (int) (tp->tv_sec * 1000 + tp->tv_usec / 1000);
+}
+
+/* waits for events on one fd, returns 1 if it is ready, 0 on timeout, or -1 on error */
+static int lisa_poll(SOCKET fd, short events, struct timeval * tp) {
+  struct pollfd pfd;
+  int rc;
+  pfd.fd = fd;
+  pfd.events = events;
+  pfd.revents = 0;
+  do rc = poll(&pfd, 1, lisa_wait_ms(tp));
+  while (rc < 0 && errno == EINTR);
+  return rc;
+}
+
+/* the shm link of fd (the socket of a client, or one of the clients of a server), or NULL if it isn't shm */
+static struct shm_link_t * lisa_link(lisa *l, SOCKET fd) {
+  if (l->type != LISA_SHM) return NULL;
+  if (l->clsvr == LISA_CLIENT) return l->shm_links[0];
+  for (int i=0; i<l->num_clients; i++) if (l->client_fds[i] == fd) return l->shm_links[i];
+  return NULL;
+}
+
+/* a server keeps its clients in an epoll set, rather than putting all of them in an fd_set for every receive
+ * (for shm, the link's eventfd is what says there is something to receive, but the event names the client's socket) */
+static void lisa_watch_client(lisa *l, SOCKET fd) {
+  struct epoll_event ev;
+  struct shm_link_t * link;
+  if (l->epfd < 0) l->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (l->epfd < 0) return;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev);
+  link = lisa_link(l, fd);
+  if (link) epoll_ctl(l->epfd, EPOLL_CTL_ADD, shm_link_data_fd(link), &ev);
+}
+
+static void lisa_unwatch_client(lisa *l, SOCKET fd) {
+  struct shm_link_t * link;
+  int i, j;
+  link = lisa_link(l, fd);
+  if (l->epfd >= 0) epoll_ctl(l->epfd, EPOLL_CTL_DEL, fd, NULL);
+  if (l->epfd >= 0 && link) epoll_ctl(l->epfd, EPOLL_CTL_DEL, shm_link_data_fd(link), NULL);
+  for (i=l->next_ready, j=l->next_ready; i<l->num_ready; i++) {
+    if (l->ready_fds[i] != fd) l->ready_fds[j++] = l->ready_fds[i];
+  }
+  l->num_ready = j;
+}
+
+/* waits for clients with something to receive and puts (up to MAX_CLIENTS of) them in fds
+ * returns how many, 0 on timeout, or -1 on error
+ * called without the lock, so that clients can still be accepted meanwhile */
+static int lisa_wait_clients(SOCKET epfd, SOCKET * fds, struct timeval * tp) {
+  struct epoll_event events[MAX_CLIENTS];
+  int n;
+  if (epfd < 0) return 0;  /* no client yet */
+  do n = epoll_wait(epfd, events, MAX_CLIENTS, lisa_wait_ms(tp));
+  while (n < 0 && errno == EINTR);
+  for (int i=0; i<n; i++) fds[i] = events[i].data.fd;
+  return n;
+}
+
+/* closes the shm link of client i (for a client, 0), if it has one */
+static void lisa_drop_link(lisa *l, int i) {
+  if (!l->shm_links[i]) return;
+  shm_link_close(l->shm_links[i]);
+  free(l->shm_links[i]);
+  l->shm_links[i] = NULL;
+}
+
+/* shm is set up over a unix socket named for the port (in the abstract namespace, so there is no file to clean up) */
+static socklen_t lisa_shm_address(struct sockaddr_un * addr, unsigned short port) {
+  int n;
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "lisa-shm-%u", port);
+  return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+/* the next client the last wait found ready, or 0 if it has received from all of them (and should wait again) */
+static SOCKET lisa_next_ready(lisa *l) {
+  if (l->next_ready >= l->num_ready) return 0;
+  return l->ready_fds[l->next_ready++];
+}
+
 /**
  * start
  *
@@ -162,6 +262,10 @@ void lisa_open(lisa* l) {
   l->wait_time.tv_sec = 30;
   l->wait_time.tv_usec = 0;
   l->num_clients=0;
+  l->epfd = -1;
+  l->num_ready = 0;
+  l->next_ready = 0;
+  for (int i=0; i<MAX_CLIENTS; i++) l->shm_links[i] = NULL;
   l->clsvr = LISA_UNKNOWN;
   l->vsock = 0;
   COPY_MSG("lisa_open", "OK");
@@ -246,6 +350,59 @@ void lisa_setup_udp(lisa *l) {
   COPY_MSG("lisa_setup_udp", "OK");
 }
 
+#ifndef WIN32
+/**
+ * Setup the lisa for SEQPACKET, which connects like TCP but keeps each message apart like UDP (vsock only).
+ */
+#ifdef DEBUG
+void LISA_SETUP_SEQPACKET(lisa *l, char * file, char * line) {
+#else
+void lisa_setup_seqpacket(lisa *l) {
+#endif
+  CHECK_ERROR();
+  if (!lisa_initialized) lisa_start();
+  if (!l->vsock) {
+      COPY_MSG("lisa_setup_seqpacket", "seqpacket is only for vsock");
+      l->state = LISA_ERROR;
+      return;
+  }
+  l->fd  = socket(AF_VSOCK, SOCK_SEQPACKET, 0);
+  CHECK_FD_ERROR("lisa_setup_seqpacket", )
+  memset(&(l->local_vaddr),  0, sizeof(l->local_vaddr));
+  memset(&(l->remote_vaddr), 0, sizeof(l->remote_vaddr));
+  l->local_vaddr.svm_family  = AF_VSOCK;
+  l->remote_vaddr.svm_family = AF_VSOCK;
+  l->type = LISA_SEQPACKET;
+  l->flags = 0;
+  l->state = LISA_CREATED;
+  l->client_state = LISA_UNINITIALIZED;
+  lisa_set_nonblocking(l);
+  COPY_MSG("lisa_setup_seqpacket", "OK");
+}
+
+/**
+ * Setup the lisa for SHM, a stream through shared memory with another process on this host, which is set up over a
+ * unix socket (see lisa_connect and lisa_accept).
+ */
+#ifdef DEBUG
+void LISA_SETUP_SHM(lisa *l, char * file, char * line) {
+#else
+void lisa_setup_shm(lisa *l) {
+#endif
+  CHECK_ERROR();
+  if (!lisa_initialized) lisa_start();
+  l->fd  = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_FD_ERROR("lisa_setup_shm", )
+  l->vsock = 0;  /* shm is only ever on this host */
+  l->type = LISA_SHM;
+  l->flags = 0;
+  l->state = LISA_CREATED;
+  l->client_state = LISA_UNINITIALIZED;
+  lisa_set_nonblocking(l);
+  COPY_MSG("lisa_setup_shm", "OK");
+}
+#endif
+
 /**
  * Set the remote address to the destination addr and port, connect,
  * and then get the local address of the connection.
@@ -260,15 +417,16 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
   int rc;
   struct timeval timeout;
   struct timeval * tp;
+  int err;
   SOCKET         this_fd;
-  fd_set         this_fdset;
 #ifdef WIN32
   int size;
 #else
   unsigned int size;
+  struct sockaddr_un uaddr;
 #endif
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -282,7 +440,11 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
 #ifdef WIN32
   if (addr) l->remote_addr.sin_addr.s_addr = inet_addr(addr);
 #else
-  if (l->vsock) {
+  if (l->type == LISA_SHM) {  /* the server is on this host, so only the port matters */
+    size = lisa_shm_address(&uaddr, port);
+    rc = connect(l->fd, (struct sockaddr *) &uaddr, size);
+  }
+  else if (l->vsock) {
     /* convert addr from text number to binary */
     if (!isnumber(addr, 10)) {SET_ERROR("lisa connect failed"); l->state = LISA_ERROR; return;}
     l->remote_vaddr.svm_cid = atol(addr);
@@ -316,13 +478,10 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
   }
   pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  FD_ZERO(&this_fdset);
-  FD_SET(this_fd, &this_fdset);
-  rc = select(this_fd+1, NULL, &this_fdset, NULL, tp);
-  if (select(this_fd+1, NULL, &this_fdset, NULL, tp) <= 0) {
+  if (lisa_poll(this_fd, POLLOUT, tp) <= 0) {
     COPY_MSG("lisa_connect", "timeout waiting for connect");
     pthread_mutex_lock(&(l->lock));
 	l->state = LISA_ERROR;
@@ -330,12 +489,31 @@ void lisa_connect(lisa *l, char * addr, unsigned short port) {
     return;
   }
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
-  if (!FD_ISSET(this_fd, &this_fdset)) COPY_MSG("lisa_connect", "fd not set");
-  if (l->vsock) {
+  /* the socket is writable whether or not the connection worked, so see which it was */
+  size = sizeof(err);
+  if (getsockopt(this_fd, SOL_SOCKET, SO_ERROR, &err, &size) < 0 || err) {
+    COPY_MSG("lisa_connect", err ? strerror(err) : "error getting connect result");
+    l->state = LISA_ERROR;
+    pthread_mutex_unlock(&(l->lock));
+    return;
+  }
+  if (l->type == LISA_SHM) {  /* the connection is only used to hand the server the link */
+    l->shm_links[0] = malloc(sizeof(struct shm_link_t));
+    if (!l->shm_links[0] || !shm_link_create(l->shm_links[0], this_fd)) {
+      free(l->shm_links[0]);
+      l->shm_links[0] = NULL;
+      COPY_MSG("lisa_connect", "error setting up shared memory");
+      l->state = LISA_ERROR;
+      pthread_mutex_unlock(&(l->lock));
+      return;
+    }
+    rc = 0;
+  }
+  else if (l->vsock) {
     size = sizeof(l->local_vaddr);
     rc = getsockname(this_fd, (struct sockaddr *) &(l->local_vaddr), &size);
   }
@@ -400,6 +578,7 @@ void LISA_LISTEN(lisa *l, unsigned short port, char * file, char * line) {
 void lisa_listen(lisa *l, unsigned short port) {
 #endif
   int rc;
+  struct sockaddr_un uaddr;
   CHECK_ERROR();
   l->clsvr = LISA_SERVER;
   if (l->state < LISA_CREATED) {
@@ -408,7 +587,11 @@ void lisa_listen(lisa *l, unsigned short port) {
   }
   CHECK_ERROR();
   if (l->state < LISA_BOUND) {
-    if (l->vsock) {
+    if (l->type == LISA_SHM) {
+        rc = bind(l->fd, (struct sockaddr *) &uaddr, lisa_shm_address(&uaddr, port));
+        CHECK_RC_ERROR("lisa_listen", );
+    }
+    else if (l->vsock) {
         l->local_vaddr.svm_cid = VMADDR_CID_ANY;
         l->local_vaddr.svm_port = port;  /* vsock always in host byte order */
         //printf("port: %d\n", l->local_vaddr.svm_port);
@@ -430,9 +613,27 @@ void lisa_listen(lisa *l, unsigned short port) {
   COPY_MSG("lisa_listen", "OK");
 }
 
+/* accepts a client's connection and then the link it sends over it (waiting up to tp for that), which it keeps in
+ * shm_links for the client about to be added; returns the client's socket or -1 */
+static SOCKET lisa_accept_shm(lisa *l, struct timeval * tp) {
+  struct shm_link_t * link;
+  SOCKET client;
+  client = accept(l->fd, NULL, NULL);
+  if (client < 0) return -1;
+  link = malloc(sizeof(struct shm_link_t));
+  if (!link || !shm_link_accept(link, client, lisa_wait_ms(tp))) {
+    free(link);
+    close(client);
+    return -1;
+  }
+  l->shm_links[l->num_clients] = link;
+  return client;
+}
+
 /**
  * In addition to calling the regular accept function, this also calls
  * listen automatically if needed.
+ * For shm, the client's connection is accepted and then the link it sends over it.
  */
 #ifdef DEBUG
 int LISA_ACCEPT(lisa *l, unsigned short port, char * file, char * line) {
@@ -440,7 +641,6 @@ int LISA_ACCEPT(lisa *l, unsigned short port, char * file, char * line) {
 int lisa_accept(lisa *l, unsigned short port) {
 #endif
   SOCKET  this_fd;
-  fd_set  this_fdset;
   int rc;
 #ifdef WIN32
   int size;
@@ -450,7 +650,7 @@ int lisa_accept(lisa *l, unsigned short port) {
   struct timeval timeout;
   struct timeval * tp;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -486,15 +686,13 @@ int lisa_accept(lisa *l, unsigned short port) {
       }
       pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-      FD_ZERO(&this_fdset);
-      FD_SET(this_fd, &this_fdset);
-      rc = select(this_fd+1, &this_fdset, NULL, NULL, tp);
+      rc = lisa_poll(this_fd, POLLIN, tp);
 
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
       pthread_mutex_lock(&(l->lock));
@@ -509,13 +707,18 @@ int lisa_accept(lisa *l, unsigned short port) {
                  rc = 0;
                  break;
         default: l->state = LISA_ACCEPTED;
-                 if (!FD_ISSET(this_fd, &this_fdset)) {
-                   COPY_MSG("lisa_accept", "accepted but fd not set");
-                   l->client_state = LISA_ERROR;
-                   pthread_mutex_unlock(&(l->lock));
-                   return 0;
+                 if (l->type == LISA_SHM) {
+                     l->client_fd = lisa_accept_shm(l, tp);
+                     if (l->client_fd < 0) COPY_MSG("lisa_accept", "Error accepting shared memory");
+                     else {
+                       l->client_state = LISA_CONNECTED;
+                       l->client_fds[l->num_clients] = l->client_fd;
+                       l->num_clients++;
+                       lisa_watch_client(l, l->client_fd);
+                     }
+                     rc = 1;
                  }
-                 if (l->vsock) {
+                 else if (l->vsock) {
                      size = sizeof(l->remote_vaddr);
                      rc = accept(l->fd, (struct sockaddr *) &(l->remote_vaddr), &size);
                      if (rc <= 0) {
@@ -528,6 +731,7 @@ int lisa_accept(lisa *l, unsigned short port) {
                        l->client_state = LISA_CONNECTED;
                        l->client_fds[l->num_clients] = l->client_fd;
                        l->num_clients++;
+                       lisa_watch_client(l, l->client_fd);
                        //printf("added client: %d (%d)\n", l->client_fd, l->num_clients);
                      }
                  }
@@ -538,6 +742,7 @@ int lisa_accept(lisa *l, unsigned short port) {
                      l->client_state = LISA_CONNECTED;
                      l->client_fds[l->num_clients] = l->client_fd;
                      l->num_clients++;
+                     if (l->client_fd > 0) lisa_watch_client(l, l->client_fd);
                      rc = 1;
                  }
       }
@@ -567,12 +772,15 @@ int lisa_send(lisa *l, char *msg, unsigned int msglength) {
   struct timeval * tp;
   SOCKET this_fd;
   SOCKET this_socket;
-  fd_set this_fdset;
+  SOCKET wait_fd;
+  short  wait_events;
   char   this_type;
   int    this_flags;
   int    this_state;
+  struct shm_link_t * this_link;
+  struct iovec iov;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-SEND
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -588,6 +796,10 @@ int lisa_send(lisa *l, char *msg, unsigned int msglength) {
   if (l->clsvr == LISA_CLIENT) this_socket = this_fd;
   else this_socket = l->client_fd;  //note that this defaults to the most recently set fd from recv (but could be overwritten as in cast)
   this_type = l->type;
+  this_link = lisa_link(l, this_socket);
+  /* shm has room again when the other side rings the link's eventfd */
+  wait_fd = this_link ? shm_link_room_fd(this_link) : this_socket;
+  wait_events = this_link ? POLLIN : POLLOUT;
   if (l->wait_time.tv_sec == 0) tp = NULL;
   else {
      timeout.tv_sec = l->wait_time.tv_sec;
@@ -596,38 +808,44 @@ int lisa_send(lisa *l, char *msg, unsigned int msglength) {
   }
   pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * SEND (waiting only while the socket is full)
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  if (this_type == LISA_TCP) {
+  if (this_type != LISA_UDP) {  /* a seqpacket send is whole or not at all, so this loop sends it once */
 	bytes_sent = 0;
-    FD_ZERO(&this_fdset);
-    FD_SET(this_socket, &this_fdset);
 	  while (bytes_sent < msglength && this_state != LISA_ERROR) {
-	    rc = select(this_socket+1, NULL, &this_fdset, NULL, tp);
-	    if (rc <= 0) {
+	    if (this_link) {
+            iov.iov_base = &(msg[bytes_sent]);
+            iov.iov_len = msglength-bytes_sent;
+            rc = shm_link_write(this_link, &iov, 1);
+            if (rc == 0) {  /* the ring is full */
+                rc = -1;
+                errno = EAGAIN;
+            }
+	    }
+	    else rc = send(this_socket, &(msg[bytes_sent]), msglength-bytes_sent, this_flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+	    if (rc >= 0) {
+            bytes_sent += rc;
+            this_state = LISA_SENT_DATA;
+	    }
+	    else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          if (lisa_poll(wait_fd, wait_events, tp) <= 0) {
             pthread_mutex_lock(&(l->lock));
             COPY_MSG("lisa_send", "timeout sending");
 		    this_state = LISA_TIMEOUT;
             pthread_mutex_unlock(&(l->lock));
+          }
 	    }
-	    else {
-          if (!FD_ISSET(this_socket, &this_fdset)) {
+	    else if (errno != EINTR) {
             pthread_mutex_lock(&(l->lock));
-	        COPY_MSG("lisa_send", "unexpected fd not set");
+	        COPY_MSG("lisa_send", "send failed");
 		    this_state = LISA_ERROR;
             pthread_mutex_unlock(&(l->lock));
-  	      }
-		  else { /* all ok */
-            bytes_sent += send(this_socket, &(msg[bytes_sent]), msglength-bytes_sent, this_flags);
-            this_state = LISA_SENT_DATA;
-          }
 	    }
     } //while
     rc = bytes_sent;
-    //printf("rc: %d\n", rc);
   }
-  else {  //not TCP
+  else {  //UDP
     pthread_mutex_lock(&(l->lock));
     if (l->vsock) {
         rc = sendto(this_socket, msg, msglength, this_flags,
@@ -642,7 +860,7 @@ int lisa_send(lisa *l, char *msg, unsigned int msglength) {
   }
   if (rc < 0) this_state = LISA_ERROR;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-SEND
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -686,6 +904,110 @@ int lisa_cast(lisa *l, char *msg, unsigned int msglength) {
   }
 }
 
+#ifndef WIN32
+/* sends all vlen messages on fd, waiting up to tp each time the socket is full, returns how many were sent */
+static unsigned int lisa_sendmv_all(SOCKET fd, int flags, struct mmsghdr *msgs, unsigned int vlen, struct timeval * tp) {
+  unsigned int sent;
+  int rc;
+  for (sent = 0; sent < vlen; ) {
+    rc = sendmmsg(fd, msgs + sent, vlen - sent, flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (rc > 0) sent += rc;
+    else if (rc < 0 && errno == EINTR) continue;
+    else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (lisa_poll(fd, POLLOUT, tp) <= 0) break;
+    }
+    else break;
+  }
+  return sent;
+}
+
+/**
+ * Sends all vlen messages to all clients (other than the one last received from, as for lisa_cast), each whole, in
+ * one sendmmsg per client unless its socket fills up. A client just sends them to the server.
+ */
+#ifdef DEBUG
+int LISA_CASTMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line) {
+#else
+int lisa_castmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen) {
+#endif
+  SOCKET fds[MAX_CLIENTS];
+  struct timeval timeout;
+  struct timeval * tp;
+  int this_flags;
+  int n;
+  pthread_mutex_lock(&(l->lock));
+  CHECK_ERROR_UNLOCK(LISA_ERROR);
+  if (l->state < LISA_CONNECTED || l->type == LISA_TCP || l->type == LISA_SHM) {
+    pthread_mutex_unlock(&(l->lock));
+    return LISA_ERROR;
+  }
+  n = 0;
+  if (l->clsvr == LISA_CLIENT) fds[n++] = l->fd;
+  else {
+    for (int i=0; i<l->num_clients; i++) if (l->client_fds[i] != l->client_fd) fds[n++] = l->client_fds[i];
+  }
+  this_flags = l->flags;
+  if (l->wait_time.tv_sec == 0) tp = NULL;
+  else {
+    timeout.tv_sec = l->wait_time.tv_sec;
+    timeout.tv_usec = l->wait_time.tv_usec;
+    tp = &(timeout);
+  }
+  pthread_mutex_unlock(&(l->lock));
+  for (int i=0; i<n; i++) {
+    if (lisa_sendmv_all(fds[i], this_flags, msgs, vlen, tp) < vlen) {
+      pthread_mutex_lock(&(l->lock));
+      COPY_MSG("lisa_castmv", "timeout or error sending to a client");
+      pthread_mutex_unlock(&(l->lock));
+    }
+  }
+  return vlen;
+}
+
+/* the link of client fd is looked up under the lock but used without it, as in lisa_send */
+int lisa_sendv_client(lisa *l, SOCKET fd, struct iovec *iov, int iovcnt) {
+  struct shm_link_t * link;
+  struct msghdr msg;
+  int this_flags;
+  ssize_t rc;
+  pthread_mutex_lock(&(l->lock));
+  link = lisa_link(l, fd);
+  this_flags = l->flags;
+  pthread_mutex_unlock(&(l->lock));
+  if (link) rc = shm_link_write(link, iov, iovcnt);
+  else {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    rc = sendmsg(fd, &msg, this_flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+  if (rc >= 0) return (int) rc;
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+  return LISA_ERROR;
+}
+
+int lisa_sendmv_client(lisa *l, SOCKET fd, struct mmsghdr *msgs, unsigned int vlen) {
+  int rc;
+  rc = sendmmsg(fd, msgs, vlen, l->flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (rc >= 0) return rc;
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+  return LISA_ERROR;
+}
+
+/* shm has room again when the other side rings the link's eventfd, a socket when it is writable */
+int lisa_wait_client(lisa *l, SOCKET fd, int ms) {
+  struct shm_link_t * link;
+  struct timeval timeout;
+  pthread_mutex_lock(&(l->lock));
+  link = lisa_link(l, fd);
+  pthread_mutex_unlock(&(l->lock));
+  timeout.tv_sec = ms / 1000;
+  timeout.tv_usec = (ms % 1000) * 1000;
+  if (link) return lisa_poll(shm_link_room_fd(link), POLLIN, &timeout) > 0;
+  return lisa_poll(fd, POLLOUT, &timeout) > 0;
+}
+#endif
+
 
 /**
  * Basically the same as bind for UDP sockets, except that it automatically
@@ -784,16 +1106,18 @@ int lisa_recv_part2(lisa *l, char *msg, unsigned int msglength) {
   return lisa_recv_with_part(l, msg, msglength, 2);
 }
 
+/* receives into msg or, if msgs is not NULL, up to vlen whole messages into msgs (seqpacket) */
 #ifdef DEBUG
-int LISA_RECV_WITH_PART(lisa *l, char *msg, unsigned int msglength, int part, char * file, char * line) {
+static int lisa_recv_parts(lisa *l, char *msg, unsigned int msglength, struct mmsghdr *msgs, unsigned int vlen, int part, char * file, char * line) {
 #else
-int lisa_recv_with_part(lisa *l, char *msg, unsigned int msglength, int part) {
+static int lisa_recv_parts(lisa *l, char *msg, unsigned int msglength, struct mmsghdr *msgs, unsigned int vlen, int part) {
 #endif
-  int rc, this_state;
+  int rc, this_state, ready, n;
   struct timeval timeout;
   struct timeval * tp;
-  SOCKET max_fd, this_fd;
-  fd_set this_fdset;
+  SOCKET this_fd, epfd;
+  SOCKET ready_fds[MAX_CLIENTS];
+  struct shm_link_t * this_link;
   this_state = LISA_ERROR;
   rc = -1;
 #ifdef WIN32
@@ -802,93 +1126,93 @@ int lisa_recv_with_part(lisa *l, char *msg, unsigned int msglength, int part) {
   unsigned int size;
 #endif
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   if (part == 2) goto part2;
   pthread_mutex_lock(&(l->lock));
   CHECK_ERROR_UNLOCK(-1);
-  this_fd = l->fd;
   this_state = l->state;
   if (l->state < LISA_CONNECTED || l->clsvr == LISA_UNKNOWN) {
     COPY_MSG("lisa_recv", "not connected");
     pthread_mutex_unlock(&(l->lock));
     return 0;
   }
-  this_fd = 0;
   if (l->wait_time.tv_sec == 0) tp = NULL;
   else {
     timeout.tv_sec = l->wait_time.tv_sec;
     timeout.tv_usec = l->wait_time.tv_usec;
 	tp = &(timeout);
   }
-  FD_ZERO(&this_fdset);
-  if (l->clsvr == LISA_CLIENT) {
-    FD_SET(this_fd, &this_fdset);
-    max_fd=this_fd+1;
-  }
-  else {
-    max_fd=0;
-    for (int i=0; i<l->num_clients; i++) {
-        this_fd=l->client_fds[i];
-        //printf("selecting on: %d\n", this_fd);
-        FD_SET(this_fd, &this_fdset);
-        if (max_fd<this_fd) max_fd=this_fd;
-    }
-    max_fd++;
-  }
+  /* a server goes through the clients the last wait found ready before it waits again */
+  if (l->clsvr == LISA_CLIENT) this_fd = l->fd;
+  else this_fd = lisa_next_ready(l);
+  epfd = l->epfd;
+  this_link = lisa_link(l, this_fd);
   pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  rc = select(max_fd, &this_fdset, NULL, NULL, tp);
+  ready = 1;
+  if (l->clsvr == LISA_CLIENT) ready = lisa_poll(this_link ? shm_link_data_fd(this_link) : this_fd, POLLIN, tp);
+  else if (!this_fd) ready = lisa_wait_clients(epfd, ready_fds, tp);
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
-  if (rc <= 0) {
+  if (ready <= 0) {
     COPY_MSG("lisa_recv", "timeout receiving");
     this_state = LISA_TIMEOUT;
 	rc = -1;
   }
   else {
     /* this_fd := fd for sending data, depending on if we are a client or a server */
-    if (l->clsvr == LISA_CLIENT) {
-        this_fd=l->fd;
-    }
-    else { //we must be a server
-        l->client_fd=0;
-        for (int i=0; i<l->num_clients; i++) {
-            if (FD_ISSET(l->client_fds[i], &this_fdset)) {
-                l->client_fd = l->client_fds[i];
-                break;
-            }
-        }
-        if (!l->client_fd) {
-            COPY_MSG("lisa_recv", "Unexpected FD not set receiving");
-        }
-        else {
-            this_fd=l->client_fd;
+    if (l->clsvr != LISA_CLIENT) {
+        if (!this_fd) {
+            memcpy(l->ready_fds, ready_fds, ready * sizeof(SOCKET));
+            l->num_ready = ready;
+            l->next_ready = 0;
+            this_fd = lisa_next_ready(l);
         }
+        l->client_fd = this_fd;
     }
     l->this_fd = this_fd;
     if (part ==1) return  this_fd;
     part2:
     this_fd = l->this_fd;
+    this_link = lisa_link(l, this_fd);
     /* now that we have the socket for receiving data, do the receive and set the current state, depending on if tcp or udp */
     if (this_fd) {
-        if (l->type == LISA_TCP)  {
-            rc = recv(this_fd, msg, msglength, 0);
+        if (l->type != LISA_UDP)  {
+#ifndef WIN32
+            if (this_link) rc = (int) shm_link_read(this_link, msg, msglength);
+            else if (msgs) {
+                rc = recvmmsg(this_fd, msgs, vlen, MSG_DONTWAIT, NULL);
+                /* a message of no bytes is the end of the connection, so stop before it (it comes first next time) */
+                if (rc > 0) {
+                    for (n = 0; n < rc && msgs[n].msg_len; n++);
+                    rc = n;
+                }
+            }
+            else
+#endif
+            rc = recv(this_fd, msg, msglength, MSG_DONTWAIT);
             //printf("rc: %d, this_fd: %d\n", rc, this_fd);
             if (rc <= 0) {
-                if (rc < 0) {
+                if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    /* the wait said there was something, but it had already been received */
+                    COPY_MSG("lisa_recv", "timeout receiving");
+                    this_state = LISA_TIMEOUT;
+                    rc = 0;
+                }
+                else if (rc < 0) {
                     printf("%s\n", strerror(errno));
                     COPY_MSG("lisa_recv", "receive failed");
                     this_state = LISA_ERROR;
                 }
-                else this_state = LISA_CLOSED;  /* if select passes but no data then socket is at EOF */
+                else this_state = LISA_CLOSED;  /* if the socket is ready but has no data then it is at EOF */
             }
             else {
                 this_state = LISA_GOT_DATA;
@@ -910,6 +1234,28 @@ int lisa_recv_with_part(lisa *l, char *msg, unsigned int msglength, int part) {
   return rc;
 }
 
+#ifndef WIN32
+#ifdef DEBUG
+int LISA_RECVMV_PART2(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line) {
+  return lisa_recv_parts(l, NULL, 0, msgs, vlen, 2, file, line);
+}
+#else
+int lisa_recvmv_part2(lisa *l, struct mmsghdr *msgs, unsigned int vlen) {
+  return lisa_recv_parts(l, NULL, 0, msgs, vlen, 2);
+}
+#endif
+#endif
+
+#ifdef DEBUG
+int LISA_RECV_WITH_PART(lisa *l, char *msg, unsigned int msglength, int part, char * file, char * line) {
+  return lisa_recv_parts(l, msg, msglength, NULL, 0, part, file, line);
+}
+#else
+int lisa_recv_with_part(lisa *l, char *msg, unsigned int msglength, int part) {
+  return lisa_recv_parts(l, msg, msglength, NULL, 0, part);
+}
+#endif
+
 /**
  * Basically the same as recv_from except that it automatically binds
  * if needed, sets up the local address and handles errors. The remote
@@ -929,9 +1275,8 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
   struct timeval * tp;
   int this_fd;
   int rc;
-  fd_set this_fdset;
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * PRE-SELECT
+   * PRE-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -953,7 +1298,6 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
     CHECK_RC_ERROR_UNLOCK("lisa_recv_from", rc)
     l->state = LISA_BOUND;
   }
-  FD_SET(this_fd, &this_fdset);
   if (l->wait_time.tv_sec == 0) tp = NULL;
   else {
     timeout.tv_sec = l->wait_time.tv_sec;
@@ -962,12 +1306,12 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
   }
   pthread_mutex_unlock(&(l->lock));
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * SELECT
+   * WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
-  rc = select(this_fd+1, &this_fdset, NULL, NULL, tp);
+  rc = lisa_poll(this_fd, POLLIN, tp);
   /* LLLLLLLLLLLLLLLLLLLLLLLL
-   * POST-SELECT
+   * POST-WAIT
    * LLLLLLLLLLLLLLLLLLLLLLLL
    */
   pthread_mutex_lock(&(l->lock));
@@ -976,7 +1320,6 @@ int lisa_recv_from(lisa *l, char *msg, unsigned int msglength, unsigned short po
     pthread_mutex_unlock(&(l->lock));
     return 0;
   }
-  if (!FD_ISSET(this_fd, &this_fdset)) COPY_MSG("lisa_recv_from", "fd not set");
   if (l->vsock) {
     size = sizeof(l->local_vaddr);
     rc = recvfrom(this_fd, msg, msglength, l->flags,
@@ -1007,18 +1350,26 @@ void lisa_close(lisa *l) {
 #endif
   CHECK_ERROR();
   if (l->state < LISA_CONNECTED) return;
+  pthread_mutex_lock(&(l->lock));
 #ifdef WIN32
   /* setsockopt(l->fd, SOL_SOCKET, SO_LINGER, (char *) &linger, sizeof(linger)); */
   closesocket(l->fd);
 #else
   setsockopt(l->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
   for (int i=0; i<l->num_clients; i++) {
+    lisa_drop_link(l, i);
     close(l->client_fds[i]);
   }
+  if (l->clsvr == LISA_CLIENT) lisa_drop_link(l, 0);
   close(l->fd);
+  if (l->epfd >= 0) close(l->epfd);
+  l->epfd = -1;
+  l->num_ready = 0;
+  l->next_ready = 0;
 #endif
   l->state = LISA_UNINITIALIZED;
   COPY_MSG("lisa_close", "OK");
+  pthread_mutex_unlock(&(l->lock));
 }
 
 /**
@@ -1029,24 +1380,34 @@ void LISA_CLOSE_CLIENT(lisa *l, char * file, char * line) {
 #else
 void lisa_close_client(lisa *l) {
 #endif
-  int i, j, found;
+  int i, j;
   struct linger linger = {1,5};
   CHECK_ERROR();
   if (l->client_state < LISA_CONNECTED) return;
+  /* the fanout writers look up the links of their clients under the lock (see lisa_sendv_client) */
+  pthread_mutex_lock(&(l->lock));
+  for (i=0; i<l->num_clients && l->client_fds[i] != l->client_fd; i++);
 #ifdef WIN32
   setsockopt(l->client_fd, SOL_SOCKET, SO_LINGER, (char *) &linger, sizeof(linger));
   closesocket(l->client_fd);
 #else
+  lisa_unwatch_client(l, l->client_fd);
+  if (i < l->num_clients) lisa_drop_link(l, i);
   setsockopt(l->client_fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
   close(l->client_fd);
 #endif
-  found = 0;
-  for (i=0; i<l->num_clients && !found; i++) found = (l->client_fds[i] == l->client_fd);
-  for (j=i+1; j<l->num_clients; j++) l->client_fds[j-1] = l->client_fds[j];
-  l->num_clients--;
+  if (i < l->num_clients) {
+    for (j=i+1; j<l->num_clients; j++) {
+      l->client_fds[j-1] = l->client_fds[j];
+      l->shm_links[j-1] = l->shm_links[j];
+    }
+    l->shm_links[l->num_clients - 1] = NULL;
+    l->num_clients--;
+  }
   l->client_state = LISA_UNINITIALIZED;
   l->state = LISA_LISTENING;
   COPY_MSG("lisa_close_client", "OK");
+  pthread_mutex_unlock(&(l->lock));
 }
 
 
@@ -51,13 +51,19 @@
  *  2) The non-blocking server does call setup_udp because the subsequent call to make it nonblocking can work
  *     for either tcp or udp sockets so it doesn't know which one to initialize it for, and therefore we need to
  *     explicitly set it to udp.
- *  3) reads are guarded with a select statment with a default timeout of one second. If you want to chang the
- *     timeout, set tube->wait_time.tv_sec to the number of seconds you wan to wait (or tube->wait_time_tv_usec);
+ *  3) reads are guarded with a poll (for a server, an epoll set of its clients, which it only waits on again after
+ *     it has received from all of the clients the last wait found ready), by default for up to 30 seconds. If you
+ *     want to change the timeout, set tube->wait_time.tv_sec to the number of seconds you wan to wait (or tube->wait_time_tv_usec);
  *  4) by default, sockets are nonblocking ("by default" means if you call connect without calling setup_tcp).
  *  5) Servers can have up to MAX_CLIENTS connected at a time. Sends will go to whichever client the last recv
  *     came from. The expectation is that servers will be in a loop receiving and then optionally responding to
  *     the client that most recently sent something. So, for example, trying to receive from three different clients
  *     and then responding to all 3 will result in all 3 responses going to the last client who sent something.
+ *  6) Over vsock, a server can instead be set up with setup_seqpacket, which connects like tcp but receives each
+ *     message whole, on its own; recvmv_part2 and castmv then receive and send a batch of messages in one call.
+ *  7) A server can also be set up with setup_shm, for clients (cross injectors) that are processes on the same host: a
+ *     stream like tcp that goes through rings in shared memory (see shm_ring.h), set up over a unix socket named for
+ *     the port.
  *
  */
 
@@ -85,6 +91,8 @@
 #include <linux/vm_sockets.h>
 #endif
 
+struct shm_link_t;
+
 /** \brief
  * This will use either strerror or WSAGetLastError depending on the platform.
  * (for Windows, there are hard coded strings for errors that pertain to sockets)
@@ -108,23 +116,28 @@ struct lisa_def {
   struct sockaddr_in   remote_addr;  /* remote protocol, address, port */
   struct sockaddr_vm   local_vaddr;  /* local protocol, address, port */
   struct sockaddr_vm   remote_vaddr; /* remote protocol, address, port */
-  stdtimeval           wait_time;    /* how long to wait on reads (using select) */
+  stdtimeval           wait_time;    /* how long to wait on reads (using poll) */
   SOCKET               fd;           /* the socket, or for a server the listening socket */
   SOCKET               client_fd;    /* for a server this is the most recent accept */
   SOCKET               client_fds[MAX_CLIENTS];   /* for a server this is what accept returns for each client connecting */
-  SOCKET               this_fd;      /* fd from most recent select */
+  SOCKET               this_fd;      /* fd from most recent wait */
   int                  num_clients;  /* number of clients with a connection */
+  SOCKET               epfd;         /* for a server, epoll set of the clients (created by the first accept) */
+  SOCKET               ready_fds[MAX_CLIENTS];    /* for a server, the clients the last wait found ready */
+  int                  num_ready;    /* number of ready_fds */
+  int                  next_ready;   /* next of ready_fds to receive from; the server only waits again after the last */
   int                  state;        /* used to short circuit if tube is in a bad state */
   int                  client_state; /* for a server, the state of the connection with a client */
   int                  flags;        /* used to customize tube behavior */
   int                  timeout;      /* for things like opening a connection */
   int                  port;         /* port to use */
-  char                 type;         /* tcp, udp */
+  char                 type;         /* tcp, udp, seqpacket, shm */
   char                 clsvr;        /* client or server */
   char                 vsock;        /* inet or vsock connection type: default inet (i.e., vsock=0) */
   char                 blocking;     /* 0 = nonblocking */
   //fd_set               fdset;        /* for select on reads */
   char                 debugmsg[DEBUGMSGLEN]; /* the last error or last status */
+  struct shm_link_t *  shm_links[MAX_CLIENTS];  /* for shm, the link of each of client_fds (a client's is shm_links[0]) */
   pthread_mutex_t      lock;
 
 };
@@ -199,6 +212,31 @@ void LISA_SETUP_UDP(lisa *l, char * file, char * line);
 void lisa_setup_udp(lisa *l);
 #endif
 
+#ifndef WIN32
+/** \brief
+ * initialize a tube to be a seqpacket socket (vsock only), which connects like tcp but keeps messages apart like udp
+ * Unlike tcp and udp, you do have to call this, before connect or listen.
+ */
+#ifdef DEBUG
+#define lisa_setup_seqpacket(l) LISA_SETUP_SEQPACKET(l, BREADCRUMB)
+void LISA_SETUP_SEQPACKET(lisa *l, char * file, char * line);
+#else
+void lisa_setup_seqpacket(lisa *l);
+#endif
+
+/** \brief
+ * initialize a tube to be a stream through shared memory with another process on this host (see note 7), which takes
+ * the same calls as tcp; as with seqpacket, you have to call this before connect or listen.
+ * The address to connect to is ignored, only the port says which server.
+ */
+#ifdef DEBUG
+#define lisa_setup_shm(l) LISA_SETUP_SHM(l, BREADCRUMB)
+void LISA_SETUP_SHM(lisa *l, char * file, char * line);
+#else
+void lisa_setup_shm(lisa *l);
+#endif
+#endif
+
 /** \brief
  * called in a client to connect to a host
  */
@@ -297,8 +335,8 @@ int  lisa_send_to(lisa *l, char *msg, unsigned int msglength, char *addr, unsign
  * depends on if set_nonblocking has been called.
  * note: part argument is intended for servers who use different receive buffers for
  * different clients; it allows the server to first get the client fd and then do the receive
- * part argument == 1 means do the select part and stop
- * part argument == 2 means skip to the receive because the select has already been done
+ * part argument == 1 means do the wait part and stop
+ * part argument == 2 means skip to the receive because the wait has already been done
  * part argument == 12 (or anything other than 1 or 2) means do both parts 1 and 2
  * lisa_recv calls lisa_recv_with_part 12 (so the "default" is to do both)
  * note that you must do part 2 after part 1 without doing any other recv in between (on the same socket)
@@ -325,6 +363,44 @@ int  LISA_RECV_part2(lisa *l, char *msg, unsigned int msglength, char * file, ch
 int  lisa_recv_part2(lisa *l, char *msg, unsigned int msglength);
 #endif
 
+#ifndef WIN32
+struct mmsghdr;
+
+/** \brief
+ * seqpacket: like lisa_recv_part2, but receives up to vlen whole messages at once (like recvmmsg), each in its own
+ * buffer with msg_len set to its size (a message too big for its buffer has MSG_TRUNC in msg_flags); returns how many
+ */
+#ifdef DEBUG
+#define lisa_recvmv_part2(l, msgs, vlen) LISA_RECVMV_PART2(l, msgs, vlen, BREADCRUMB)
+int  LISA_RECVMV_PART2(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line);
+#else
+int  lisa_recvmv_part2(lisa *l, struct mmsghdr *msgs, unsigned int vlen);
+#endif
+
+/** \brief
+ * seqpacket: sends all vlen messages to all clients like lisa_cast (for a client, to the server), each whole
+ */
+#ifdef DEBUG
+#define lisa_castmv(l, msgs, vlen) LISA_CASTMV(l, msgs, vlen, BREADCRUMB)
+int  LISA_CASTMV(lisa *l, struct mmsghdr *msgs, unsigned int vlen, char * file, char * line);
+#else
+int  lisa_castmv(lisa *l, struct mmsghdr *msgs, unsigned int vlen);
+#endif
+
+struct iovec;
+
+/** \brief
+ * server: sends to the one client fd (one of client_fds) without going through client_fd, so that a thread for each
+ * client can send to it while the others send to theirs; the caller makes sure the client isn't closed meanwhile
+ * none of these wait: sendv gathers iov into one write on a stream (tcp or shm) and returns how many bytes it took,
+ * sendmv sends each of msgs whole (seqpacket) and returns how many it took, both 0 if there is no room and LISA_ERROR
+ * on error; wait_client waits up to ms for room to send to the client again (returns 0 if there still is none)
+ */
+int  lisa_sendv_client(lisa *l, SOCKET fd, struct iovec *iov, int iovcnt);
+int  lisa_sendmv_client(lisa *l, SOCKET fd, struct mmsghdr *msgs, unsigned int vlen);
+int  lisa_wait_client(lisa *l, SOCKET fd, int ms);
+#endif
+
 #ifdef DEBUG
 #define lisa_recv_with_part(l, msg, msglength) LISA_RECV_WITH_PART(l, msg, msglength, int part, BREADCRUMB)
 int  LISA_RECV_WITH_PART(lisa *l, char *msg, unsigned int msglength, int part, char * file, char * line);
@@ -425,6 +501,8 @@ void lisa_set_to_vsock(lisa *l);
 /* Socket Type */
 #define LISA_TCP 1
 #define LISA_UDP 2
+#define LISA_SEQPACKET 3
+#define LISA_SHM 4
 
 /* State */
 #define LISA_ERROR         -1
@@ -1,25 +1,41 @@
 #include "looper.h"
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/syscall.h>
 
 void looper_update_state(struct looper_t * l, enum looper_state_t *desired_state, enum looper_state_t actual_state);
 
 void * looper_function(void * looper) {
     struct looper_t * l;
     enum looper_state_t desired_state, actual_state;
+    int work;
     l = (struct looper_t *) looper;
     desired_state = running;
     actual_state = not_running;
+    l->tid = (pid_t) syscall(SYS_gettid);
+    l->start_cpu = sched_getcpu();
+    if (l->attr.name[0]) pthread_setname_np(pthread_self(), l->attr.name);
     while (desired_state != stopped) {
         if (desired_state != paused) {
             actual_state = running;
             pthread_mutex_lock(&(l->lock));
-            l->function_to_repeat(l->data);
+            if (l->function_to_poll) work = l->function_to_poll(l->data);
+            else {
+                l->function_to_repeat(l->data);
+                work = 0;
+            }
             pthread_mutex_unlock(&(l->lock));
         }
-        else actual_state = paused;
+        else {
+            actual_state = paused;
+            work = 0;
+        }
         looper_update_state(l, &desired_state, actual_state);
-        usleep(l->usleep_time);
+        if (!work) usleep(l->usleep_time);    /* while there is work there may well be more, so go straight back around */
     }
     actual_state = stopped;
     looper_update_state(l, &desired_state, actual_state);
@@ -28,13 +44,21 @@ void * looper_function(void * looper) {
 
 void looper_init(struct looper_t * l) {
     l->function_to_repeat = NULL;
+    l->function_to_poll = NULL;
     l->function_to_run_first = NULL;
     l->data = NULL;
     l->usleep_time = LOOPER_SLEEP_TIME_DEFAULT;
+    CPU_ZERO(&(l->attr.cpus));
+    l->attr.policy = SCHED_OTHER;
+    l->attr.priority = 0;
+    l->attr.name[0] = '\0';
+    l->tid = 0;
+    l->start_cpu = -1;
     pthread_mutex_init(&(l->lock), NULL);
     l->desired_state = not_running;
     l->actual_state = not_running;
     l->nowait = 0;
+    l->has_thread = false;
 }
 
 void looper_nowait(struct looper_t * l) {
@@ -78,16 +102,46 @@ void looper_change_usleep_time(struct looper_t * l, useconds_t ms) {
      pthread_mutex_unlock(&(l->lock));
 }
 
+// creates the thread with the cpus and scheduling in attr (the name is set by the thread itself), returns false if it
+// couldn't
+static bool looper_create_thread(struct looper_t * l) {
+    pthread_attr_t attr;
+    struct sched_param param;
+    int rc;
+    pthread_attr_init(&attr);
+    if (CPU_COUNT(&(l->attr.cpus)) && pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &(l->attr.cpus)))
+        printf("error setting cpus for looper %s\n", l->attr.name);
+    if (l->attr.policy != SCHED_OTHER) {
+        param.sched_priority = l->attr.priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        if (pthread_attr_setschedpolicy(&attr, l->attr.policy) || pthread_attr_setschedparam(&attr, &param))
+            printf("error setting scheduling for looper %s\n", l->attr.name);
+    }
+    rc = pthread_create(&(l->thread), &attr, looper_function, (void *) l);
+    if (rc == EPERM && l->attr.policy != SCHED_OTHER) {
+        printf("not permitted to use real-time scheduling for looper %s, using the default\n", l->attr.name);
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        rc = pthread_create(&(l->thread), &attr, looper_function, (void *) l);
+    }
+    if (rc) printf("error creating thread for looper %s: %s\n", l->attr.name, strerror(rc));
+    pthread_attr_destroy(&attr);
+    return rc == 0;
+}
+
 void looper_start(struct looper_t * l) {
     l->desired_state = running;
     if (l->function_to_run_first) l->function_to_run_first(l->data);
-    if (l->function_to_repeat) pthread_create(&(l->thread), NULL, looper_function, (void *) l);
+    if (l->function_to_repeat || l->function_to_poll) {
+        l->has_thread = looper_create_thread(l);
+        if (!l->has_thread) return;
+    }
     if (!(l->nowait)) looper_wait_for_actual_state(l, running);
 }
 
 void looper_stop(struct looper_t * l) {
      looper_set_desired_state(l, stopped);
-     pthread_join(l->thread, NULL);
+     if (l->has_thread) pthread_join(l->thread, NULL);
+     l->has_thread = false;
      if (l->function_to_run_last) l->function_to_run_last(l->data);
 }
 
@@ -107,6 +161,125 @@ void looper_update_data(struct looper_t * l, void * data) {
      pthread_mutex_unlock(&(l->lock));
 }
 
+static bool looper_parse_cpus(cpu_set_t * cpus, const char * list) {
+    char * end;
+    long first, last;
+    CPU_ZERO(cpus);
+    while (*list) {
+        first = strtol(list, &end, 10);
+        if (end == list) return false;
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) return false;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return false;
+        for (long cpu=first; cpu<=last; cpu++) CPU_SET(cpu, cpus);
+        if (*end == ',') end++;
+        else if (*end) return false;
+        list = end;
+    }
+    return true;
+}
 
+bool looper_parse_attr(struct looper_attr_t * attr, const char * spec) {
+    char setting[128];
+    char * value;
+    int n;
+    while (*spec) {
+        while (isspace((unsigned char) *spec)) spec++;
+        for (n=0; spec[n] && !isspace((unsigned char) spec[n]); n++);
+        if (!n) break;
+        if (n >= (int) sizeof(setting)) {
+            printf("looper setting too long: %.*s\n", n, spec);
+            return false;
+        }
+        memcpy(setting, spec, n);
+        setting[n] = '\0';
+        spec += n;
+        value = strchr(setting, '=');
+        if (!value) {
+            printf("looper setting should be name=value: %s\n", setting);
+            return false;
+        }
+        *value++ = '\0';
+        if (!strcmp(setting, "cpus")) {
+            if (!looper_parse_cpus(&(attr->cpus), value)) {
+                printf("looper cpus not understood: %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(setting, "policy")) {
+            if (!strcmp(value, "other")) attr->policy = SCHED_OTHER;
+            else if (!strcmp(value, "fifo")) attr->policy = SCHED_FIFO;
+            else if (!strcmp(value, "rr")) attr->policy = SCHED_RR;
+            else {
+                printf("looper policy should be other, fifo, or rr: %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(setting, "priority")) attr->priority = atoi(value);
+        else if (!strcmp(setting, "name")) snprintf(attr->name, LOOPER_NAME_LEN, "%s", value);
+        else {
+            printf("unknown looper setting: %s\n", setting);
+            return false;
+        }
+    }
+    if (attr->policy != SCHED_OTHER && (attr->priority < sched_get_priority_min(attr->policy) || attr->priority > sched_get_priority_max(attr->policy))) {
+        printf("looper priority %d is out of range for the policy\n", attr->priority);
+        return false;
+    }
+    return true;
+}
 
+bool looper_read_config(const char * path, bool (*apply_line)(const char * line)) {
+    char line[256];
+    char * start;
+    bool ok;
+    FILE * f;
+    f = fopen(path, "r");
+    if (!f) {
+        printf("error opening looper config %s\n", path);
+        return false;
+    }
+    ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        for (start=line; isspace((unsigned char) *start); start++);
+        if (*start && !apply_line(start)) ok = false;
+    }
+    fclose(f);
+    return ok;
+}
 
+static const char * looper_policy_name(int policy) {
+    switch (policy) {
+        case SCHED_OTHER: return "other";
+        case SCHED_FIFO:  return "fifo";
+        case SCHED_RR:    return "rr";
+        default:          return "?";
+    }
+}
+
+void looper_print_attr(const char * name, struct looper_t * l) {
+    char thread_name[LOOPER_NAME_LEN];
+    char cpus[128];
+    cpu_set_t set;
+    struct sched_param param;
+    int policy, n;
+    if (!l->tid) {
+        printf("%-12s not running on a thread of its own\n", name);
+        return;
+    }
+    if (pthread_getname_np(l->thread, thread_name, sizeof(thread_name))) thread_name[0] = '\0';
+    n = 0;
+    cpus[0] = '\0';
+    if (!pthread_getaffinity_np(l->thread, sizeof(set), &set)) {
+        for (int cpu=0; cpu<CPU_SETSIZE && n<(int) sizeof(cpus)-8; cpu++)
+            if (CPU_ISSET(cpu, &set)) n += snprintf(cpus + n, sizeof(cpus) - n, "%s%d", n ? "," : "", cpu);
+    }
+    if (pthread_getschedparam(l->thread, &policy, &param)) policy = -1;
+    printf("%-12s thread %-15s tid %d cpus %s (started on %d) policy %s priority %d\n", name, thread_name, (int) l->tid,
+           cpus, l->start_cpu, looper_policy_name(policy), (policy < 0) ? 0 : param.sched_priority);
+}
@@ -3,25 +3,45 @@
  * Its behavior might be altered by that looping function processing data shared with other threads, but
  * otherwise it can only be started, stopped, paused, and resumed, and slowed or sped up by changing the
  * usleep time in between the times that the looping function is run.
+ * If function_to_poll is used instead of function_to_repeat, it returns how much work it did, and the looper only
+ * sleeps once it did none.
+ * attr says which cpus the thread may run on, its scheduling policy and priority, and its name, e.g., from a spec such as
+ * "cpus=2 policy=fifo priority=10 name=bc_receiver" (see looper_parse_attr).
  */
 
 #ifndef PTHREAD_WORKER_H
 #define PTHREAD_WORKER_H
 
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <unistd.h>
+#include <sched.h>
+#include <stdbool.h>
 
 #define LOOPER_SLEEP_TIME_DEFAULT 500
+#define LOOPER_NAME_LEN 16      /* thread names are limited to 15 characters */
 
 enum looper_state_t { not_running, running, paused, stopped};
 
+struct looper_attr_t {
+    cpu_set_t cpus;                   /* none set = any cpu */
+    int policy;                       /* SCHED_OTHER (the default), SCHED_FIFO, or SCHED_RR */
+    int priority;                     /* 1 (lowest) to 99 for SCHED_FIFO and SCHED_RR */
+    char name[LOOPER_NAME_LEN];       /* empty = keep the process name */
+};
+
 struct looper_t {
     void (*function_to_repeat)(void * d);
+    int  (*function_to_poll)(void * d);       /* used instead of function_to_repeat if set, returns work done */
     void (*function_to_run_first)(void * d);
     void (*function_to_run_last)(void * d);
     useconds_t usleep_time;
+    struct looper_attr_t attr;                /* applied when the thread is created */
+    pid_t tid;                                /* set by the thread when it starts */
+    int start_cpu;                            /* the cpu it was on when it started */
     pthread_mutex_t lock;
     pthread_t thread;
+    bool has_thread;                          /* the thread was created, so there is one to join */
     enum looper_state_t desired_state;
     enum looper_state_t actual_state;
     int nowait;
@@ -37,5 +57,12 @@ void looper_resume(struct looper_t * l);
 void looper_change_usleep_time(struct looper_t * l, useconds_t ms);
 void looper_update_data(struct looper_t * l, void * data);
 
+// sets attr from space separated settings: cpus=<list, e.g. 1,3-4> policy=<other|fifo|rr> priority=<n> name=<name>
+bool looper_parse_attr(struct looper_attr_t * attr, const char * spec);
+// calls apply_line for each line of a config file that isn't blank or a # comment
+bool looper_read_config(const char * path, bool (*apply_line)(const char * line));
+// prints the (running) thread's name, tid, cpus, the cpu it started on, policy and priority
+void looper_print_attr(const char * name, struct looper_t * l);
+
 #endif // PTHREAD_WORKER_H
 
@@ -0,0 +1,83 @@
+/*
+ * A small LZ compressor for frames on the wire, whose dictionary is the frames sent just before.
+ * Beacons and probe responses of a BSS hardly change from one to the next, and the same MAC addresses are in most
+ * headers, so most of a frame can be found in the last few frames from the same sender. Each side keeps a history of
+ * the last LZ_KEEP or more bytes of frames (each frame is added as it is compressed or expanded) and a frame is sent as
+ * tokens of literal bytes and matches (copies of earlier bytes of the history or of the frame itself):
+ *       1 byte      4 bits count of literals (15: more follow), then 4 bits match length less 4 (15: more follow)
+ *       0+ bytes    more of the count of literals, each byte added to it, until one isn't 255
+ *       0+ bytes    the literals
+ *       2 bytes     how far back the match starts, little endian (not there after the last literals of the frame)
+ *       0+ bytes    more of the match length, as for the literals
+ * The history of the receiver has to be the same as that of the sender, so a receiver can only expand a frame if it
+ * expanded every frame from that sender since the sender last started over (a key frame, see wire.h); the
+ * sender starts over every so often so that a receiver that joins late or misses a frame catches up.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LZ_MAX_FRAME 12288                     /* longest frame that is compressed, longer ones are sent as they are */
+#define LZ_KEEP (16 * 1024)                    /* bytes of earlier frames matched against, at least */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)     /* most bytes n bytes can take compressed */
+#define LZ_MAX_SOURCES 16                      /* senders whose frames can be expanded, as for wire_sources_t */
+
+struct lz_stats_t {
+    unsigned long frames;
+    unsigned long raw_bytes;      /* before compressing (or after expanding) */
+    unsigned long packed_bytes;   /* on the wire */
+    unsigned long nsec;           /* spent compressing or expanding */
+    unsigned long keys;           /* frames that started over */
+};
+
+struct lz_t {
+    uint8_t * history;            /* the earlier frames, with room for one more */
+    uint32_t used;
+    int32_t * table;              /* compressor only, where in history each hash of 4 bytes was last seen (-1 for never) */
+    struct lz_stats_t stats;
+};
+
+// allocates the history (and for a compressor the hash table), returns false if it couldn't
+bool lz_init(struct lz_t * z, bool compressor);
+
+void lz_free(struct lz_t * z);
+
+// forgets the history, which the other side has to do at the same frame (a key frame)
+void lz_reset(struct lz_t * z);
+
+// compresses the len (at most LZ_MAX_FRAME) bytes of frame into out, which has room for LZ_BOUND(len) bytes, and adds
+// the frame to the history, returns the size compressed
+uint32_t lz_compress(struct lz_t * z, const uint8_t * frame, uint32_t len, uint8_t * out);
+
+// expands the len bytes of in and adds the frame to the history, returns its size with *frame pointing at it (in the
+// history, so only good until the next call), or -1 if in isn't a frame compressed against this history
+int lz_expand(struct lz_t * z, const uint8_t * in, uint32_t len, const uint8_t ** frame);
+
+// a history for each sender whose frames are expanded
+struct lz_source_t {
+    uint16_t source;
+    bool synced;                  /* history is the same as the sender's, up to (not including) next_sequence */
+    uint16_t next_sequence;
+    unsigned long skipped;        /* frames that couldn't be expanded (the history wasn't the same) */
+    struct lz_t z;
+};
+
+struct lz_sources_t {
+    int n;
+    struct lz_source_t sources[LZ_MAX_SOURCES];
+    unsigned long others;         /* frames from senders beyond the first LZ_MAX_SOURCES, which are dropped */
+};
+
+// expands a frame of source (which has to be set) with its sequence number, starting over first if it is a key frame,
+// returns its size with *frame pointing at it, or -1 if it can't be expanded (then it should be dropped)
+int lz_expand_from(struct lz_sources_t * s, uint16_t source, uint16_t sequence, bool key, const uint8_t * in,
+                   uint32_t len, const uint8_t ** frame);
+
+// prints the ratio and time for each sender
+void lz_print_stats(const char * name, const struct lz_stats_t * stats);
+void lz_print_sources(const struct lz_sources_t * s);
+
+#endif // LZ_H
@@ -1,13 +1,19 @@
+#define _GNU_SOURCE   /* for struct mmsghdr */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <assert.h>
 #include "lisa.h"
 #include "looper.h"
 #include "print_data.h"
 #include "pkt.h"
+#include "wire.h"
+#include "lz.h"
+#include "fanout.h"
+#include "capture.h"
 
 #define PORT 9991
 #define MAX_SIZE 3000
@@ -15,22 +21,33 @@
 #define STOP_MSG "***STOP***NOW***"
 #define STOP_MSG_LEN sizeof(STOP_MSG)
 
+#define RECEIVE_MESSAGES 16     /* most messages received (and then cast) at once with transport=messages */
+
 int packets_received = 0;
 int packets_sent = 0;
 
+static struct wire_sources_t sources;   /* packets received from each source (see wire.h) */
+static struct lz_sources_t expanders;   /* the packets of each source, to expand compressed ones against (see lz.h) */
+static struct fanout_t fanout;          /* a ring and a writer for each client, which packets are cast through */
+static struct capture_t capture;        /* the packets relayed, written to a pcapng file by a thread of its own */
+
 static lisa l_server;
 static lisa *lp=&l_server;
 
+static bool use_messages = false;  /* a seqpacket message per packet instead of a stream */
+static bool use_shm = false;       /* a stream through shared memory, for cross injectors on this host */
+static uint16_t client_channels[MAX_CLIENTS][FANOUT_CHANNELS];  /* set for each client number, rather than learned */
+static int num_client_channels[MAX_CLIENTS];
+
 /*******************************************************
  * receive buffers (ADO)
  ******************************************************/
 
-uint8_t temp_buffer[MAX_SIZE];
+uint8_t temp_buffer[MAX_SIZE];   /* what is received from a client that isn't in buffers, which is dropped */
 
 typedef struct client_data_s {
     int client_fd;
     int color;
-    uint32_t bytes_expected;
     uint32_t bytes_received;  /* also think of this as "bytes remaining to be processed" */
     uint8_t  buffer[MAX_SIZE];
     uint8_t *next_pkt;
@@ -47,32 +64,50 @@ typedef struct client_data_s {
     buffers.num_clients = 0;
  }
 
+ // newest first, since a closed client's fd can be reused for a new one (closing clears it, but just in case)
  int client_for_fd(int client_fd) {
-    for (int i=0; i < buffers.num_clients; i++) {
+    for (int i=buffers.num_clients-1; i >= 0; i--) {
         if (buffers.client[i].client_fd == client_fd) return i;
     }
     return -1;
  }
 
+ // stops sending to the client and closes it, and forgets its fd, since that can be reused for another client
+ void close_client(int clnum, int client_fd) {
+    fanout_remove(&fanout, client_fd);
+    lisa_close_client(lp);
+    if (clnum >= 0) buffers.client[clnum].client_fd = -1;
+ }
+
 /*******************************************************
  * utilities
  ******************************************************/
 #include <stdio.h>
 #include <signal.h>
 
+static volatile sig_atomic_t interrupted = 0;
+
 /*
- * catch control-c
+ * catch control-c, which main then stops on (printing and closing the capture aren't safe in a signal handler)
  */
 void sig_handler(int signo)
 {
-  if (signo == SIGINT) {
-        change_color(DEFAULT_COLOR);
-        printf("\n");
-        printf("packets received: %d\n", packets_received);
-        printf("packets sent: %d\n",     packets_sent);
-        pkt_close_file();
-        exit(0);
-  }
+  if (signo == SIGINT) interrupted = 1;
+}
+
+static void print_stats() {
+    change_color(DEFAULT_COLOR);
+    printf("\n");
+    printf("packets received: %d\n", packets_received);
+    printf("packets sent: %d\n",     packets_sent);
+    printf("packets by source:\n");
+    wire_print_sources(&sources);
+    if (expanders.n || expanders.others) {
+        printf("packets expanded by source:\n");
+        lz_print_sources(&expanders);
+    }
+    printf("packets by client:\n");
+    fanout_print_stats(&fanout);
 }
 
 
@@ -84,7 +119,24 @@ static int next_color;
 
 static void init_listener(void *d) {
     lisa_open(lp);
-    lisa_set_to_vsock(lp);
+    if (use_shm) {
+        lisa_setup_shm(lp);
+        if (lp->state != LISA_CREATED) {
+            printf("no shm (%s), using a stream\n", lp->debugmsg);
+            lisa_open(lp);
+            use_shm = false;
+        }
+    }
+    if (!use_shm) lisa_set_to_vsock(lp);
+    if (use_messages && !use_shm) {
+        lisa_setup_seqpacket(lp);
+        if (lp->state != LISA_CREATED) {
+            printf("no seqpacket (%s), using a stream\n", lp->debugmsg);
+            lisa_open(lp);
+            lisa_set_to_vsock(lp);
+            use_messages = false;
+        }
+    }
     lisa_set_wait_time(lp, 2);
     buffers_init();
     next_color = FIRST_COLOR;
@@ -93,23 +145,41 @@ static void init_listener(void *d) {
 
 #define NEXT_CLIENT buffers.client[buffers.num_clients]
 
-static void repeat_listening_function(void *d) {
-    int num_clients;
+// returns 1 if a client connected
+// the client number (clnum) is its place in buffers.client, which only grows, so it names the client's capture
+// interface and its channels setting, in the order the clients connected
+static int repeat_listening_function(void *d) {
+    int num_clients, clnum;
+    char name[CAPTURE_NAME_LEN];
     num_clients = lp->num_clients;
+    if (num_clients >= MAX_CLIENTS) return 0;    /* lisa has no room for another until one closes */
     lisa_accept(lp, PORT);
-    if (lp->num_clients > num_clients) {
+    if (lp->num_clients <= num_clients) return 0;
+    else {
         change_color(next_color);
-        printf("Received connection, fd=%d as client number %d\n", lp->client_fd, num_clients);
         pthread_mutex_lock(&(buffers.lock));
+        clnum = buffers.num_clients;
+        if (clnum >= MAX_CLIENTS) {
+            printf("Received connection, fd=%d, but there are no client numbers left, closing it\n", lp->client_fd);
+            lisa_close_client(lp);
+            pthread_mutex_unlock(&(buffers.lock));
+            return 0;
+        }
+        printf("Received connection, fd=%d as client number %d\n", lp->client_fd, clnum);
         NEXT_CLIENT.client_fd = lp->client_fd;
-        NEXT_CLIENT.bytes_expected = 0;
         NEXT_CLIENT.bytes_received = 0;
         NEXT_CLIENT.next_pkt = NEXT_CLIENT.buffer;
         NEXT_CLIENT.color = next_color;
+        snprintf(name, sizeof(name), "client %d (fd %d)", clnum, lp->client_fd);
+        capture_set_interface(&capture, clnum, name);
+        if (!fanout_add(&fanout, lp->client_fd)) printf("no writer for client %d, it won't be sent anything\n", clnum);
+        else if (num_client_channels[clnum])
+            fanout_set_channels(&fanout, lp->client_fd, client_channels[clnum], num_client_channels[clnum]);
         if (next_color == LAST_COLOR) next_color = FIRST_COLOR;
         else next_color++;
         buffers.num_clients++;
         pthread_mutex_unlock(&(buffers.lock));
+        return 1;
     }
 }
 
@@ -130,73 +200,318 @@ static int match_end(char * s) {
     return !strncmp(s, STOP_MSG, STOP_MSG_LEN);
 }
 
-static void process_pkt(uint8_t * pkt, uint32_t pkt_len, int clnum) {
+// answers a client's hello (see wire.h) with one offering v2, to that client only since it is the one connecting
+// (through its ring like everything else sent to it, so that it isn't sent in the middle of a packet), and from then
+// on casts it the highest version both offered
+static void answer_hello(const struct wire_header_t * h, int clnum) {
+    uint8_t hello[WIRE_MAX_HEADER_SIZE];
+    int fd = buffers.client[clnum].client_fd;
+    printf("hello from client %d (source %u) offering v%u\n", clnum, h->source, h->version);
+    fanout_send(&fanout, hello, wire_put_hello(hello, WIRE_V2, 0), fd);
+    fanout_set_version(&fanout, fd, (h->version < WIRE_V2) ? WIRE_V1 : WIRE_V2);
+}
+
+static uint8_t v1_pkt[MAX_SIZE];
+
+// the packet with a v1 header in place of its v2 one (and expanded, if it was compressed) in v1_pkt, for the clients
+// that never offered v2, returns its length, or 0 if there are no such clients or it doesn't fit
+static uint32_t repack_v1(const struct wire_header_t * h, const uint8_t * frame, int len) {
+    struct wire_header_t v1 = *h;
+    int header_size;
+    if (len < 0 || WIRE_MAX_HEADER_SIZE + (uint32_t) len > MAX_SIZE || !fanout_takes(&fanout, WIRE_V1)) return 0;
+    v1.version = WIRE_V1;
+    v1.flags = 0;
+    v1.length = len;
+    header_size = wire_put_header(v1_pkt, &v1);
+    memcpy(v1_pkt + header_size, frame, len);
+    return header_size + len;
+}
+
+// counts a packet (with the header h at the start of pkt) and marks it as relayed, returns false if it is a hello
+// a compressed packet is relayed as it is, and only expanded here to print and capture it (and for v1 clients)
+// freq is the channel to cast it on, learned as one its client is on (see fanout.h), or 0 to cast it to every client:
+// a client that missed a compressed packet couldn't expand the packets of its source after it until the next key
+// *v1_len is the length of the packet repacked in v1_pkt for the v1 clients (0 if it isn't, see repack_v1)
+static bool relay_pkt(uint8_t * pkt, const struct wire_header_t * h, int clnum, uint16_t * freq, uint32_t * v1_len) {
+    const uint8_t * frame = pkt + h->size;
+    int len = h->length;
+    *freq = 0;
+    *v1_len = 0;
     packets_received++;
-    if (match_end( (char *) pkt)) {
-        lisa_close_client(lp);
+    if (h->flags & WIRE_FLAG_HELLO) {
+        answer_hello(h, clnum);
+        return false;
+    }
+    wire_count(&sources, h);
+    if (h->version >= WIRE_V2) pkt[0] |= WIRE_FLAG_RELAYED;
+    if (h->flags & WIRE_FLAG_COMPRESSED) {
+        len = lz_expand_from(&expanders, h->source, h->sequence, h->flags & WIRE_FLAG_KEY, pkt + h->size, h->length, &frame);
+        if (len < 0) return true;   /* this missed a packet of its source since its last key, the receivers may not have */
     }
+    if (h->version >= WIRE_V2) *v1_len = repack_v1(h, frame, len);
+    *freq = pkt_get_frequency((uint8_t *) frame, len);
+    fanout_heard(&fanout, buffers.client[clnum].client_fd, *freq);
+    if (h->flags & WIRE_FLAG_COMPRESSED) *freq = 0;
+    print_data_add_pkt(clnum, (uint8_t *) frame, len, buffers.client[clnum].color);
+    capture_frame(&capture, frame, len, clnum, h->timestamp);  /* don't include the header in packet capture */
+    return true;
+}
+
+// casts the packet to the other clients on its channel, never back to its own (each writer sends it to its client,
+// see fanout.h): a v1 packet to all of them, a v2 one as it is to the clients that take v2 and repacked to the rest
+static void cast_pkt(uint8_t * pkt, uint32_t pkt_len, const struct wire_header_t * h, int clfd, uint16_t freq, uint32_t v1_len) {
+    if (h->version < WIRE_V2) fanout_cast(&fanout, pkt, pkt_len, clfd, freq, 0);
     else {
-        lisa_cast(lp, (char *) pkt, pkt_len);
-        packets_sent++;
-        print_data_add_pkt(clnum, pkt, pkt_len, buffers.client[clnum].color);
-        pkt_write_file(pkt+20, pkt_len-20);  /* don't include the len bytes or timestamp in packet capture */
+        fanout_cast(&fanout, pkt, pkt_len, clfd, freq, WIRE_V2);
+        if (v1_len) fanout_cast(&fanout, v1_pkt, v1_len, clfd, freq, WIRE_V1);
     }
+    packets_sent++;
+}
+
+static void process_pkt(uint8_t * pkt, const struct wire_header_t * h, int clnum) {
+    uint16_t freq;
+    uint32_t v1_len;
+    if (!relay_pkt(pkt, h, clnum, &freq, &v1_len)) return;
+    cast_pkt(pkt, h->size + h->length, h, buffers.client[clnum].client_fd, freq, v1_len);
+}
+
+/* with transport=messages each packet is a message of its own, so there is nothing to reassemble: receive a batch of
+ * them straight into message_buffer and cast each that is a packet (each writer sends a batch of them in one call)
+ */
+static uint8_t message_buffer[RECEIVE_MESSAGES][MAX_SIZE];
+static struct iovec message_iov[RECEIVE_MESSAGES];
+static struct mmsghdr messages[RECEIVE_MESSAGES];
+
+static void init_receiver(void *d) {
+    for (int i=0; i<RECEIVE_MESSAGES; i++) {
+        message_iov[i].iov_base = message_buffer[i];
+        message_iov[i].iov_len = MAX_SIZE;
+        messages[i].msg_hdr.msg_iov = &(message_iov[i]);
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+// returns how many messages were received
+static int receive_messages() {
+    int n, stop, header_size;
+    uint32_t pkt_len;
+    uint16_t freq;
+    uint32_t v1_len;
+    struct wire_header_t h;
+    int clfd = lisa_recv_part1(lp);
+    if (clfd < 0) return 0;
+    pthread_mutex_lock(&(buffers.lock));
+    int clnum = client_for_fd(clfd);
+    n = lisa_recvmv_part2(lp, messages, RECEIVE_MESSAGES);
+    if (clnum < 0) {
+        if (n > 0) printf("dropping %d messages from fd %d, which isn't a client\n", n, clfd);
+        pthread_mutex_unlock(&(buffers.lock));
+        return (n > 0) ? n : 0;
+    }
+    stop = 0;
+    for (int i=0; i<n; i++) {
+        uint8_t * pkt = message_buffer[i];
+        pkt_len = messages[i].msg_len;
+        if (match_end( (char *) pkt)) {
+            packets_received++;
+            stop = 1;
+            break;
+        }
+        header_size = wire_get_header(pkt, pkt_len, &h);
+        if ((messages[i].msg_hdr.msg_flags & MSG_TRUNC) || header_size <= 0 || header_size + h.length != pkt_len) {
+            printf("dropping a malformed message of %u bytes from client %d\n", pkt_len, clnum);
+            continue;
+        }
+        if (!relay_pkt(pkt, &h, clnum, &freq, &v1_len)) continue;
+        cast_pkt(pkt, pkt_len, &h, clfd, freq, v1_len);
+    }
+    if (stop) close_client(clnum, clfd);
+    pthread_mutex_unlock(&(buffers.lock));
+    return (n > 0) ? n : 0;
 }
 
 #define CLIENT buffers.client[clnum]
 /* receive into the client buffer from the select (part 1),
  * if received length and received entire packet then process
+ * returns how many bytes were received
  */
-static void repeat_receiving_function(void *d) {
+static int repeat_receiving_function(void *d) {
     int num_clients;
+    int rc, header_size;
+    struct wire_header_t h;
     pthread_mutex_lock(&(buffers.lock));
     num_clients = buffers.num_clients;
     pthread_mutex_unlock(&(buffers.lock));
-    if (num_clients == 0) return;
+    if (num_clients == 0) return 0;
+    if (lp->type == LISA_SEQPACKET) return receive_messages();
     int clfd = lisa_recv_part1(lp);
-    if (clfd < 0) return;
+    if (clfd < 0) return 0;
     pthread_mutex_lock(&(buffers.lock));
     int clnum = client_for_fd(clfd);
+    if (clnum < 0) {
+        rc = lisa_recv_part2(lp, (char *) temp_buffer, MAX_SIZE);
+        if (rc > 0) printf("dropping %d bytes from fd %d, which isn't a client\n", rc, clfd);
+        pthread_mutex_unlock(&(buffers.lock));
+        return (rc > 0) ? rc : 0;
+    }
     uint8_t * buffer_start = CLIENT.buffer + CLIENT.bytes_received;
     uint32_t buffer_remaining = MAX_SIZE - CLIENT.bytes_received;
-    CLIENT.bytes_received += lisa_recv_part2(lp, (char *) buffer_start, buffer_remaining);
-    while ((CLIENT.bytes_received >= 4) && (CLIENT.bytes_expected <= CLIENT.bytes_received)) {
-        if ( (CLIENT.bytes_expected == 0) && (CLIENT.bytes_received >= 4) ) {
-            CLIENT.bytes_expected = pkt_get_length(CLIENT.buffer) +20;  /* include len bytes and timestamp */
-        }
-        if (CLIENT.bytes_expected && (CLIENT.bytes_expected <= CLIENT.bytes_received )) {
-            process_pkt(CLIENT.next_pkt, CLIENT.bytes_expected, clnum);
-            CLIENT.bytes_received -= CLIENT.bytes_expected;
-            CLIENT.next_pkt += CLIENT.bytes_expected;
-            CLIENT.bytes_expected = 0;
+    rc = lisa_recv_part2(lp, (char *) buffer_start, buffer_remaining);
+    if (rc > 0) CLIENT.bytes_received += rc;   /* not the -1 of an error (which would wrap around) */
+    while (CLIENT.bytes_received > 0) {
+        header_size = wire_get_header(CLIENT.next_pkt, CLIENT.bytes_received, &h);
+        if (header_size == 0) break;   /* the rest of the header hasn't arrived yet */
+        if (header_size < 0 || header_size + h.length > MAX_SIZE) {
+            packets_received++;
+            if (match_end( (char *) CLIENT.next_pkt)) close_client(clnum, clfd);
+            else printf("dropping %u bytes from client %d that aren't a packet that fits\n", CLIENT.bytes_received, clnum);
+            CLIENT.bytes_received = 0;
+            break;
         }
+        if (header_size + h.length > CLIENT.bytes_received) break;
+        process_pkt(CLIENT.next_pkt, &h, clnum);
+        CLIENT.bytes_received -= header_size + h.length;
+        CLIENT.next_pkt += header_size + h.length;
     }
     if (CLIENT.bytes_received > 0) { /* relocate remaining bytes from next_pkt to front; assume this is rarely needed */
         for (int i=0; i<CLIENT.bytes_received; i++) CLIENT.buffer[i] = CLIENT.next_pkt[i];
     }
     CLIENT.next_pkt = CLIENT.buffer;
     pthread_mutex_unlock(&(buffers.lock));
+    return (rc > 0) ? rc : 0;
+}
+
+/*******************************************************
+ * thread settings
+ ******************************************************/
+
+// e.g., "receiver cpus=2 policy=fifo priority=10" (see looper_parse_attr), "writer" for the writer of each client,
+// "capture" for the capture writer
+static bool set_thread_attr(const char * line) {
+    int n;
+    for (n=0; line[n] && line[n] != ' ' && line[n] != '\t'; n++);
+    if (n == 8 && !strncmp(line, "listener", n)) return looper_parse_attr(&(listener.attr), line + n);
+    if (n == 8 && !strncmp(line, "receiver", n)) return looper_parse_attr(&(receiver.attr), line + n);
+    if (n == 6 && !strncmp(line, "writer", n)) return looper_parse_attr(&(fanout.writer_attr), line + n);
+    if (n == 7 && !strncmp(line, "capture", n)) return looper_parse_attr(&(capture.writer.attr), line + n);
+    printf("unknown looper in thread settings: %.*s\n", n, line);
+    return false;
+}
+
+// e.g., "channels=2:2412,5180" puts client number 2 (in the order they connect) on those two channels for good
+static bool set_client_channels(const char * list) {
+    char * end;
+    long clnum, freq;
+    int n = 0;
+    clnum = strtol(list, &end, 10);
+    if (end == list || *end != ':' || clnum < 0 || clnum >= MAX_CLIENTS) return false;
+    do {
+        list = end + 1;
+        freq = strtol(list, &end, 10);
+        if (end == list || freq <= 0 || freq > 0xFFFF || n == FANOUT_CHANNELS) return false;
+        client_channels[clnum][n++] = (uint16_t) freq;
+    } while (*end == ',');
+    if (*end) return false;
+    num_client_channels[clnum] = n;
+    return true;
+}
+
+// the whole number value of a setting, which has to be from 0 to max
+static bool setting_number(const char * value, unsigned long long max, unsigned long long * number) {
+    char * end;
+    if (*value < '0' || *value > '9') return false;    /* strtoull would take a sign or spaces */
+    *number = strtoull(value, &end, 10);
+    return !*end && *number <= max;
+}
+
+// applies one setting: "transport=messages" (a seqpacket message per packet), "transport=shm" (a stream through shared
+// memory, for cross injectors on this host rather than in VMs), "transport=stream", "routing=channel" (each packet to
+// the clients on its channel only, see fanout.h), "routing=all" (the default, each packet to every client),
+// "channels=<client number>:<MHz>,..." (the channels routing=channel takes a client to be on), "loopback=on"
+// (each packet back to the client it came from too, for debugging), "loopback=off", "capture=<classes>" (see
+// capture_set_classes), "capture_size=<MB>" and "capture_time=<seconds>" (when to start a new capture file, 0 = never),
+// or thread settings
+static bool configure(const char * line) {
+    unsigned long long number;
+    if (!strcmp(line, "transport=messages")) use_messages = true, use_shm = false;
+    else if (!strcmp(line, "transport=shm")) use_shm = true, use_messages = false;
+    else if (!strcmp(line, "transport=stream")) use_messages = false, use_shm = false;
+    else if (!strcmp(line, "routing=channel")) fanout.by_channel = true;
+    else if (!strcmp(line, "routing=all")) fanout.by_channel = false;
+    else if (!strcmp(line, "loopback=on")) fanout.loopback = true;
+    else if (!strcmp(line, "loopback=off")) fanout.loopback = false;
+    else if (!strncmp(line, "capture=", 8)) {
+        if (!capture_set_classes(&capture, line + 8)) {
+            printf("bad capture setting: %s\n", line);
+            return false;
+        }
+    }
+    else if (!strncmp(line, "capture_size=", 13)) {
+        if (!setting_number(line + 13, UINT64_MAX >> 20, &number)) {
+            printf("bad capture_size setting: %s\n", line);
+            return false;
+        }
+        capture.max_bytes = number << 20;
+    }
+    else if (!strncmp(line, "capture_time=", 13)) {
+        if (!setting_number(line + 13, UINT_MAX, &number)) {
+            printf("bad capture_time setting: %s\n", line);
+            return false;
+        }
+        capture.max_seconds = (unsigned int) number;
+    }
+    else if (!strncmp(line, "channels=", 9)) {
+        if (!set_client_channels(line + 9)) {
+            printf("bad channels setting: %s\n", line);
+            return false;
+        }
+    }
+    else return set_thread_attr(line);
+    return true;
 }
 
 /*******************************************************
  * main
+ * each parameter is a file of settings or one quoted setting line (see configure)
  ******************************************************/
-int main() {
+int main(int argc, char **argv) {
     printf("initializing\n");
+    if (!fanout_init(&fanout, lp, MAX_SIZE)) {
+        printf("out of memory for the packets cast to clients\n");
+        return 1;
+    }
+    if (!capture_init(&capture, "bcaster.pcapng", MAX_SIZE)) {
+        printf("out of memory for the packets captured\n");
+        return 1;
+    }
     looper_init(&listener);
     looper_init(&receiver);
+    strcpy(listener.attr.name, "bc_listener");
+    strcpy(receiver.attr.name, "bc_receiver");
+    for (int i=1; i<argc; i++) {
+        if (strchr(argv[i], '=')) configure(argv[i]);
+        else looper_read_config(argv[i], configure);
+    }
+    if (fanout.loopback) printf("loopback on: packets are sent back to the clients they came from as well\n");
     listener.function_to_run_first = init_listener;
-    listener.function_to_repeat = repeat_listening_function;
+    listener.function_to_poll = repeat_listening_function;
     listener.function_to_run_last = final_listener;
-    receiver.function_to_run_first = NULL;
-    receiver.function_to_repeat = repeat_receiving_function;
+    receiver.function_to_run_first = init_receiver;
+    receiver.function_to_poll = repeat_receiving_function;
     receiver.function_to_run_last = NULL;
-    if (!pkt_open_file()) printf("error opening pcap dump file\n");
-    else printf("pcap dump file opened\n");
+    if (!capture_start(&capture)) printf("error opening pcapng capture file\n");
+    else if (capture.classes) printf("pcapng capture file opened\n");
     printf("starting threads\n");
     print_data_init(true, false);
     looper_start(&listener);
     looper_start(&receiver);
+    printf("threads:\n");
+    looper_print_attr("listener", &listener);
+    looper_print_attr("receiver", &receiver);
     signal (SIGINT,sig_handler);
-    while (1) { sleep(1); }
+    while (!interrupted) sleep(1);
+    print_stats();
+    capture_stop(&capture);
+    capture_print_stats(&capture);
+    return 0;
 }
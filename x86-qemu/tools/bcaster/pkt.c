@@ -2,20 +2,6 @@
 #include "pkt.h"
 #include "bit_things.h"
 #include <stdio.h>
-#include <sys/time.h>
-#include <pcap.h>
-
-uint32_t pkt_get_length(uint8_t len[4]) {
-    uint32_t size;
-    size = (uint32_t) len[0];
-    size <<= 8;
-    size += (uint32_t) len[1];
-    size <<= 8;
-    size += (uint32_t) len[2];
-    size <<= 8;
-    size += (uint32_t) len[3];
-    return size;
-}
 
 // Note about bit order of things in the frame control field:
 // field order: version, type, subtype followed by toDS, FromDS, morefrag, retry, PS, moredata, protected, order
@@ -77,6 +63,34 @@ bool pkt_is_data(uint8_t *pkt, int size, uint8_t ** data_ptr_h, int * data_len_h
     return ret;
 }
 
+// the fields of the radiotap header up to the channel, in the order they come (with the alignment of each)
+#define RT_TSFT    0
+#define RT_FLAGS   1
+#define RT_RATE    2
+#define RT_CHANNEL 3
+
+uint16_t pkt_get_frequency(uint8_t *pkt, uint32_t size) {
+    unsigned int radiotap_len, offset;
+    uint32_t present, more;
+    if (size < 8) return 0;
+    radiotap_len = pkt[2] + (pkt[3] << 8);
+    if (radiotap_len > size) return 0;
+    present = pkt[4] + (pkt[5] << 8) + (pkt[6] << 16) + ((uint32_t) pkt[7] << 24);
+    if (!getb(present, RT_CHANNEL)) return 0;
+    /* the fields start after the last word of presence flags (each with bit 31 set if another follows) */
+    offset = 8;
+    for (more = present; more & 0x80000000; offset += 4) {
+        if (offset + 4 > radiotap_len) return 0;
+        more = (uint32_t) pkt[offset+3] << 24;   /* only bit 31 matters */
+    }
+    if (getb(present, RT_TSFT)) offset = ((offset + 7) & ~7u) + 8;
+    if (getb(present, RT_FLAGS)) offset += 1;
+    if (getb(present, RT_RATE)) offset += 1;
+    offset = (offset + 1) & ~1u;
+    if (offset + 2 > radiotap_len) return 0;
+    return pkt[offset] + (pkt[offset+1] << 8);
+}
+
 void pkt_get_type_string(uint8_t *pkt, uint32_t size, char * type_string, int len) {
     frame_control_t fc;
     pkt_get_frame_control(&fc, pkt, size);
@@ -167,32 +181,3 @@ void pkt_get_llc_type_string(uint8_t *data_start, uint32_t data_size, char * typ
         default:                  snprintf(type_string, len, "TYPE?");    break;
     };
  }
-
-#define MAX_SIZE 3000
-pcap_dumper_t *outputFile;
-pcap_t *fileHandle;
-char *outputFileName = "bcaster.cap";
-
-int pkt_open_file() {
-	fileHandle = pcap_open_dead(DLT_IEEE802_11_RADIO, MAX_SIZE);
-	outputFile = pcap_dump_open(fileHandle,outputFileName);
-	if (!outputFile) return 0;
-	else return 1;
-}
-
-void pkt_write_file(uint8_t *pkt, uint32_t pkt_len) {
-    struct pcap_pkthdr header;
-    struct timeval timestamp;
-    gettimeofday(&timestamp, NULL);
-    header.ts = timestamp;
-    header.caplen = pkt_len;
-    header.len = pkt_len;
-	pcap_dump((u_char *) outputFile, &header, pkt);
-}
-
-void pkt_close_file() {
-    pcap_close(fileHandle);
-}
-
-
-
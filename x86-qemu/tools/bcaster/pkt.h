@@ -24,8 +24,6 @@ struct frame_control_s {
 
 typedef struct frame_control_s frame_control_t;
 
-uint32_t pkt_get_length(uint8_t len[4]);
-
 void pkt_get_frame_control(frame_control_t *fc, uint8_t *pkt, uint32_t size);
 
 bool pkt_is_ack(uint8_t *pkt, int size);
@@ -34,11 +32,10 @@ bool pkt_is_beacon(uint8_t *pkt, int size);
 
 bool pkt_is_data(uint8_t *pkt, int size, uint8_t ** data_ptr_h, int * data_len_h);
 
-void pkt_get_llc_type_string(uint8_t *data_start, uint32_t data_size, char * type_string, int len);
+// the frequency (MHz) in the radiotap channel field, or 0 if the header has none
+uint16_t pkt_get_frequency(uint8_t *pkt, uint32_t size);
 
-int  pkt_open_file();
-void pkt_write_file(uint8_t *pkt, uint32_t pkt_len);
-void pkt_close_file();
+void pkt_get_llc_type_string(uint8_t *data_start, uint32_t data_size, char * type_string, int len);
 
 #define ASSOCIATION_REQUEST     0x00
 #define ASSOCIATION_RESPONSE    0x01
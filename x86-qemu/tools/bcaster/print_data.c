@@ -63,49 +63,46 @@ void print_data_add_pkt(int client, uint8_t *pkt, uint32_t len, int color) {
     }
 }
 
-void * print_data_worker (void * d) {
+static void print_one(print_data_t * pd) {
     frame_control_t fc;
     char str[25];
     uint8_t * data_start;
     uint8_t * pkt_start;
     int data_len;
     int pkt_len;
-    print_data_t * pd;
-   while (true) {
-        while ((pd = (print_data_t *) aq_get_head(print_q)) != NULL) {
-            change_color(pd->color);
-            if (pd->len < 4) {
-                printf("error: pkt too short to even get length from!\n");
-            }
-            else {
-                pkt_len = pkt_get_length(pd->data);
-                pkt_start = pd->data+20;
-                if (pkt_len != (pd->len - 20)) {
-                    printf("\n partial or multiple packet received: expected %d but got %d\n", pkt_len, pd->len);
-                }
-                if (!ignore_beacons || !pkt_is_beacon(pkt_start, pkt_len)) {
-                    printf("%10ld.%-6ld  ", pd->timestamp.tv_sec, pd->timestamp.tv_usec);
-                    printf("%d ", pd->client);
-                    pkt_get_type_string(pkt_start, pkt_len, str, 25);
-                    printf("%s ", str);
-                    if (pkt_is_data(pkt_start, pkt_len, &data_start, &data_len)) {
-                        pkt_get_llc_type_string(data_start, data_len, str, 25);
-                        printf("%-5s ", str);
-                        pkt_get_ether_type_string(data_start, data_len, str, 25);
-                        printf("%-7s ", str);
-                        // skip over LLC frame
-                        if (print_data_bytes) {
-                            for (int i=0; i<(data_len-6); i++) {
-                                printf("%02X:", data_start[i+6]);
-                            }
-                        }
-                    }
-                    printf("\n");
-                    pkt_get_frame_control(&fc, pkt_start, pkt_len);
-                    if (fc.PS) printf("POWER SAVE SET\n");
+    change_color(pd->color);
+    pkt_len = pd->len;
+    pkt_start = pd->data;
+    if (!ignore_beacons || !pkt_is_beacon(pkt_start, pkt_len)) {
+        printf("%10ld.%-6ld  ", pd->timestamp.tv_sec, pd->timestamp.tv_usec);
+        printf("%d ", pd->client);
+        pkt_get_type_string(pkt_start, pkt_len, str, 25);
+        printf("%s ", str);
+        if (pkt_is_data(pkt_start, pkt_len, &data_start, &data_len)) {
+            pkt_get_llc_type_string(data_start, data_len, str, 25);
+            printf("%-5s ", str);
+            pkt_get_ether_type_string(data_start, data_len, str, 25);
+            printf("%-7s ", str);
+            // skip over LLC frame
+            if (print_data_bytes) {
+                for (int i=0; i<(data_len-6); i++) {
+                    printf("%02X:", data_start[i+6]);
                 }
             }
-            aq_used_head(print_q);
+        }
+        printf("\n");
+        pkt_get_frame_control(&fc, pkt_start, pkt_len);
+        if (fc.PS) printf("POWER SAVE SET\n");
+    }
+}
+
+void * print_data_worker (void * d) {
+    print_data_t * pds;
+    uint16_t n;
+   while (true) {
+        while ((pds = (print_data_t *) aq_get_head_n(print_q, NUM_DATA, &n)) != NULL) {
+            for (int i=0; i<n; i++) print_one(&(pds[i]));
+            aq_used_head_n(print_q, n);
         }
         usleep(SLEEP_TIME);
     }
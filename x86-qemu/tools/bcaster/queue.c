@@ -1,83 +1,139 @@
 
 #include "queue.h"
 #include <stdlib.h>
+
 /*
  * initially, head==tail and q is empty
  * when using an item from the q, head increments and wraps around
  * when putting an item to the q, tail increments and wraps around
  * if using an item from the q, head meets tail then q is empty and can get no more items
- * if putting an item to the q, tail meets head then q is full and can put no more items
+ * if putting an item to the q, tail gets num_items ahead of head then q is full and can put no more items
+ * head and tail wrap around at 2*num_items (not at num_items) so that full and empty can be told apart without flags
  */
 
 // allocates and initializes q struct/data
 bool aq_new(aq_type ** q, uint16_t item_size, uint16_t num_items) {
-    *q = malloc(sizeof(aq_type));
-    if (!*q) return false;
+    void *mem;
+    if (posix_memalign(&mem, AQ_CACHE_LINE_SIZE, sizeof(aq_type))) {
+        *q = NULL;
+        return false;
+    }
+    *q = mem;
     (*q)->data = malloc(item_size * num_items);
     if (!(*q)->data) {
-        free(q);
+        free(*q);
         *q = NULL;
         return false;
     }
-    (*q)->head = (*q)->tail = 0;
+    atomic_init(&((*q)->head), 0);
+    atomic_init(&((*q)->tail), 0);
+    (*q)->tail_cache = 0;
+    (*q)->head_cache = 0;
     (*q)->item_size = item_size;
     (*q)->num_items = num_items;
-    (*q)->full = false;
-    (*q)->empty = true;
-    pthread_mutex_init(&((*q)->lock), NULL);
     return true;
 }
 
-void * aq_head(aq_type * q) {
-    return q->data + (q->item_size * q->head);
+static inline void * aq_slot(aq_type * q, uint32_t counter) {
+    if (counter >= q->num_items) counter -= q->num_items;
+    return q->data + (q->item_size * counter);
+}
+
+static inline uint32_t aq_next_n(aq_type * q, uint32_t counter, uint16_t n) {
+    counter += n;
+    if (counter >= 2 * (uint32_t) q->num_items) counter -= 2 * (uint32_t) q->num_items;
+    return counter;
+}
+
+static inline uint32_t aq_next(aq_type * q, uint32_t counter) {
+    return aq_next_n(q, counter, 1);
+}
+
+// number of items from counter to the end of the array
+static inline uint32_t aq_to_end(aq_type * q, uint32_t counter) {
+    if (counter >= q->num_items) counter -= q->num_items;
+    return q->num_items - counter;
+}
+
+static inline uint16_t aq_min3(uint32_t a, uint32_t b, uint32_t c) {
+    if (b < a) a = b;
+    if (c < a) a = c;
+    return (uint16_t) a;
 }
 
-void * aq_tail(aq_type * q) {
-    return q->data + (q->item_size * q->tail);
+static inline uint32_t aq_count(aq_type * q, uint32_t head, uint32_t tail) {
+    if (tail >= head) return tail - head;
+    return tail + 2 * (uint32_t) q->num_items - head;
 }
 
 // gets pointer to head data unless q is empty
 void * aq_get_head(aq_type * q) {
-    void *ret = NULL;
-    pthread_mutex_lock(&(q->lock));
-    if (!q->empty) {
-        ret = aq_head(q);
+    uint32_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    if (head == q->tail_cache) {
+        q->tail_cache = atomic_load_explicit(&(q->tail), memory_order_acquire);
+        if (head == q->tail_cache) return NULL;
     }
-    pthread_mutex_unlock(&(q->lock));
-    return ret;
+    return aq_slot(q, head);
 }
 
 // gets pointer to tail unless q is full
 void * aq_get_tail(aq_type * q) {
-    void *ret = NULL;
-    pthread_mutex_lock(&(q->lock));
-    if (!q->full) {
-        ret = aq_tail(q);
+    uint32_t tail = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    if (aq_count(q, q->head_cache, tail) == q->num_items) {
+        q->head_cache = atomic_load_explicit(&(q->head), memory_order_acquire);
+        if (aq_count(q, q->head_cache, tail) == q->num_items) return NULL;
     }
-    pthread_mutex_unlock(&(q->lock));
-    return ret;
+    return aq_slot(q, tail);
 }
 
 // indicates that memory associated with head has been consumed and can be reused
 void aq_used_head(aq_type * q) {
-    pthread_mutex_lock(&(q->lock));
-    if (++(q->head) == q->num_items) q->head = 0;
-    if (q->head == q->tail) {
-        q->empty = true;
-    }
-    q->full = false;
-    pthread_mutex_unlock(&(q->lock));
+    uint32_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    atomic_store_explicit(&(q->head), aq_next(q, head), memory_order_release);
 }
 
 // indicates that memory associated with tail has been fully produced
 void aq_put_tail(aq_type * q) {
-    pthread_mutex_lock(&(q->lock));
-    if (++(q->tail) == q->num_items) q->tail = 0;
-    if (q->tail == q->head) {
-        q->full = true;
+    uint32_t tail = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    atomic_store_explicit(&(q->tail), aq_next(q, tail), memory_order_release);
+}
+
+// gets up to max contiguous items starting at head unless q is empty
+void * aq_get_head_n(aq_type * q, uint16_t max, uint16_t * n) {
+    uint32_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    uint32_t ready = aq_count(q, head, q->tail_cache);
+    if (ready < max) {
+        q->tail_cache = atomic_load_explicit(&(q->tail), memory_order_acquire);
+        ready = aq_count(q, head, q->tail_cache);
     }
-    q->empty = false;
-    pthread_mutex_unlock(&(q->lock));
+    *n = aq_min3(ready, aq_to_end(q, head), max);
+    if (!*n) return NULL;
+    return aq_slot(q, head);
+}
+
+// gets up to max contiguous items starting at tail unless q is full
+void * aq_get_tail_n(aq_type * q, uint16_t max, uint16_t * n) {
+    uint32_t tail = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    uint32_t space = q->num_items - aq_count(q, q->head_cache, tail);
+    if (space < max) {
+        q->head_cache = atomic_load_explicit(&(q->head), memory_order_acquire);
+        space = q->num_items - aq_count(q, q->head_cache, tail);
+    }
+    *n = aq_min3(space, aq_to_end(q, tail), max);
+    if (!*n) return NULL;
+    return aq_slot(q, tail);
+}
+
+// indicates that memory associated with the n items at head has been consumed and can be reused
+void aq_used_head_n(aq_type * q, uint16_t n) {
+    uint32_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    atomic_store_explicit(&(q->head), aq_next_n(q, head, n), memory_order_release);
+}
+
+// indicates that memory associated with the n items at tail has been fully produced
+void aq_put_tail_n(aq_type * q, uint16_t n) {
+    uint32_t tail = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    atomic_store_explicit(&(q->tail), aq_next_n(q, tail, n), memory_order_release);
 }
 
 void aq_free(aq_type *q) {
@@ -5,24 +5,36 @@
  i.e., head_used and tail_done are what actually advance the head and tail pointers, get_head and get_tail do not
  e.g., thread A: get_head(), head_used(), get_head(), head_used(), ...
        thread B: get_tail(), tail_done(), get_tail(), tail_done(), ...
+ the _n versions do the same for a burst of items at a time, e.g., get_head_n(..., &n), head_used_n(n), ...
+ a burst is always a contiguous span of the array, so when the ready items wrap around the end of the array,
+ the first call returns the span up to the end and the next call returns the span starting back at the beginning
 
+ this is lock free for exactly one producer thread and one consumer thread:
+ head and tail are counters that wrap around at 2*num_items, the consumer is the only one to write head and the
+ producer is the only one to write tail, and each is published with release and read with acquire semantics
+ the consumer and producer fields are on separate cache lines, and each side keeps a cached copy of the other side's counter
+ so that it only has to touch the other side's cache line when the queue looks empty (consumer) or full (producer)
 */
 #ifndef QUEUE_H
 #define QUEUE_H
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <pthread.h>
+#include <stdatomic.h>
+
+#define AQ_CACHE_LINE_SIZE 64
 
 typedef struct aq_struct {
-    uint16_t head;
-    uint16_t tail;
-    uint16_t item_size;
+    /* consumer side */
+    _Alignas(AQ_CACHE_LINE_SIZE) _Atomic uint32_t head;
+    uint32_t tail_cache;
+    /* producer side */
+    _Alignas(AQ_CACHE_LINE_SIZE) _Atomic uint32_t tail;
+    uint32_t head_cache;
+    /* set once by aq_new */
+    _Alignas(AQ_CACHE_LINE_SIZE) uint16_t item_size;
     uint16_t num_items;
-    pthread_mutex_t lock;
     void    *data;
-    bool    full;
-    bool    empty;
 }aq_type;
 
 // allocates and initializes q struct/data
@@ -40,6 +52,18 @@ void aq_used_head(aq_type * q);
 // must call this when finished filling in tail data before getting the next tail
 void aq_put_tail(aq_type * q);
 
+// gets pointer to the first of up to max contiguous head items that are ready and sets n to how many (NULL and 0 if q is empty)
+void * aq_get_head_n(aq_type * q, uint16_t max, uint16_t * n);
+
+// gets pointer to the first of up to max contiguous free tail items and sets n to how many (NULL and 0 if q is full)
+void * aq_get_tail_n(aq_type * q, uint16_t max, uint16_t * n);
+
+// must call this when done using n items acquired with get_head_n (n may be less than what get_head_n returned)
+void aq_used_head_n(aq_type * q, uint16_t n);
+
+// must call this when finished filling in n items acquired with get_tail_n (n may be less than what get_tail_n returned)
+void aq_put_tail_n(aq_type * q, uint16_t n);
+
 void aq_free(aq_type *q);
 
 